@@ -18,6 +18,7 @@
 #include "fv_smooth.h"
 #include "fv_hough.h"
 #include "fv_dft.h"
+#include "fv_integral.h"
 
 static fv_app_proc_file_t fv_app_proc[] = {
     {"image", 1, fv_cv_detect_img},
@@ -43,6 +44,16 @@ static fv_app_algorithm_t fv_app_algorithm[] = {
     {"canny", {fv_cv_canny, fv_cv_canny}},
     {"hough", {fv_cv_hough, fv_cv_hough}},
     {"dft", {fv_cv_dft, fv_cv_dft}},
+    {"gaussian", {fv_cv_gaussian, fv_cv_gaussian}},
+    {"median", {fv_cv_median, fv_cv_median}},
+    {"bilateral", {fv_cv_bilateral, fv_cv_bilateral}},
+    {"integral", {fv_cv_integral, fv_cv_integral}},
+    {"guided", {fv_cv_guided, fv_cv_guided}},
+    {"canny_threads", {fv_cv_canny_threads, fv_cv_canny_threads}},
+    {"sobel_8u16s", {fv_cv_sobel_8u16s, fv_cv_sobel_8u16s}},
+    {"laplacian", {fv_cv_laplacian, fv_cv_laplacian}},
+    {"cart_to_polar", {fv_cv_cart_to_polar, fv_cv_cart_to_polar}},
+    {"morphology_ex", {fv_cv_morphology_ex, fv_cv_morphology_ex}},
 };
 
 #define fv_app_alg_num (sizeof(fv_app_algorithm)/sizeof(fv_app_algorithm_t))
@@ -18,6 +18,12 @@
 #include "fv_dxt.h"
 #include "fv_dft.h"
 #include "fv_mem.h"
+#include "fv_filter.h"
+#include "fv_smooth.h"
+#include "fv_thread.h"
+#include "fv_thresh.h"
+#include "fv_integral.h"
+#include "fv_edge.h"
 
 static void
 _fv_dft_1D_real(float *r, float *i, float *src, float width,
@@ -126,6 +132,10 @@ static fv_test_proc_t fv_test_algorithm[] = {
 
 #define fv_test_alg_num (sizeof(fv_test_algorithm)/sizeof(fv_test_proc_t))
 
+static fv_bool fv_test_has_case(char *name);
+static fv_s32 fv_test_cases(char *name);
+static void fv_test_list_cases(void);
+
 static const char *
 fv_program_version = "1.0.0";//PACKAGE_STRING;
 
@@ -218,6 +228,7 @@ int main(int argc, char **argv)
         for (i = 0; i < fv_test_alg_num; i++) {
             fprintf(stdout, "%s\n", fv_test_algorithm[i].tp_name);
         }
+        fv_test_list_cases();
         return FV_OK;
     }
 
@@ -233,6 +244,10 @@ int main(int argc, char **argv)
         }
     }
 
+    if (alg == NULL && fv_test_has_case(name)) {
+        return fv_test_cases(name);
+    }
+
     if (alg == NULL) {
         fprintf(stderr, "Unknow algorithm name %s!\n", name);
         return FV_ERROR;
@@ -625,3 +640,2305 @@ fv_test_dft(IplImage *cv_img, fv_bool image)
 
     return FV_OK;
 }
+
+#define FV_TEST_ROWS        37
+#define FV_TEST_COLS        53
+
+struct _fv_test_case_t;
+
+/*
+ * A case fills src, runs the operation under test into dst and its
+ * reference into ref, a 64F matrix of the size and channels of dst.
+ * Both runs get the case for their parameters.
+ */
+typedef void (*fv_test_fill_func)(fv_mat_t *);
+typedef void (*fv_test_run_func)(fv_mat_t *dst, fv_mat_t *src, 
+            const struct _fv_test_case_t *tc);
+typedef fv_mat_t *(*fv_test_dst_func)(fv_mat_t *src, 
+            const struct _fv_test_case_t *tc);
+
+typedef struct _fv_test_case_t {
+    char                *tc_name;       /* fv_test -n */
+    fv_u32              tc_depth;
+    fv_s32              tc_cn;
+    fv_s32              tc_ksize;
+    double              tc_p1;
+    double              tc_p2;
+    fv_test_run_func    tc_run;
+    fv_test_run_func    tc_ref;
+    double              tc_tol;         /* largest difference allowed */
+    fv_size_t           tc_size;        /* 0x0 for the default */
+    fv_test_fill_func   tc_fill;        /* NULL for random */
+    double              tc_mean_tol;    /* mean difference, 0 for any */
+    fv_test_dst_func    tc_dst;         /* NULL for one like src */
+} fv_test_case_t;
+
+static const fv_u32 fv_test_depth_type[FV_DEPTH_NUM] = {
+    FV_DEPTH_8U, FV_DEPTH_8S, FV_DEPTH_16U, FV_DEPTH_16S,
+    FV_DEPTH_32S, FV_DEPTH_32F, FV_DEPTH_64F,
+};
+
+/* fv_create_mat() makes 16s depths 16u and 32s 32f: set it here */
+static fv_mat_t *
+fv_test_create_mat(fv_s32 rows, fv_s32 cols, fv_u32 depth, fv_s32 cn)
+{
+    fv_mat_t    *mat;
+
+    mat = fv_create_mat(rows, cols, 
+            FV_MAKETYPE(fv_test_depth_type[depth], cn));
+    FV_ASSERT(mat != NULL);
+    mat->mt_depth = depth;
+
+    return mat;
+}
+
+static double
+fv_test_get(fv_mat_t *mat, fv_s32 y, fv_s32 x, fv_s32 c)
+{
+    void        *row;
+    fv_s32      i;
+
+    row = mat->mt_data.dt_ptr + y*mat->mt_step;
+    i = x*mat->mt_nchannel + c;
+    switch (mat->mt_depth) {
+        case FV_8U:
+            return ((fv_u8 *)row)[i];
+        case FV_16U:
+            return ((fv_u16 *)row)[i];
+        case FV_16S:
+            return ((fv_s16 *)row)[i];
+        case FV_32S:
+            return ((fv_s32 *)row)[i];
+        case FV_32F:
+            return ((float *)row)[i];
+        default:
+            return ((double *)row)[i];
+    }
+}
+
+static void
+fv_test_set(fv_mat_t *mat, fv_s32 y, fv_s32 x, fv_s32 c, double v)
+{
+    void        *row;
+    fv_s32      i;
+
+    row = mat->mt_data.dt_ptr + y*mat->mt_step;
+    i = x*mat->mt_nchannel + c;
+    switch (mat->mt_depth) {
+        case FV_8U:
+            ((fv_u8 *)row)[i] = v;
+            break;
+        case FV_16U:
+            ((fv_u16 *)row)[i] = v;
+            break;
+        case FV_16S:
+            ((fv_s16 *)row)[i] = v;
+            break;
+        case FV_32S:
+            ((fv_s32 *)row)[i] = v;
+            break;
+        case FV_32F:
+            ((float *)row)[i] = v;
+            break;
+        default:
+            ((double *)row)[i] = v;
+            break;
+    }
+}
+
+/* Quarters of 0 to 10000: many times the range of sigma_color */
+static void
+fv_test_fill_wide(fv_mat_t *mat)
+{
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            for (c = 0; c < mat->mt_nchannel; c++) {
+                fv_test_set(mat, y, x, c, (random() % 40001)/4.0);
+            }
+        }
+    }
+}
+
+/* Squares of 0 and 255 a side of 4: both derivatives saturate */
+static void
+fv_test_fill_checker(fv_mat_t *mat)
+{
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            for (c = 0; c < mat->mt_nchannel; c++) {
+                fv_test_set(mat, y, x, c, 
+                        (x/4 + y/4) % 2 ? 252 + random() % 4 : random() % 4);
+            }
+        }
+    }
+}
+
+/* 0 to 255, -256 to 255 for 16s, quarters for the floats */
+static void
+fv_test_fill_random(fv_mat_t *mat)
+{
+    double      v;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            for (c = 0; c < mat->mt_nchannel; c++) {
+                if (mat->mt_depth == FV_16S) {
+                    v = random() % 512 - 256;
+                } else if (mat->mt_depth >= FV_32F) {
+                    v = (random() % 1024)/4.0;
+                } else {
+                    v = random() % 256;
+                }
+                fv_test_set(mat, y, x, c, v);
+            }
+        }
+    }
+}
+
+/* Replicated border */
+static double
+fv_test_get_replicate(fv_mat_t *mat, fv_s32 y, fv_s32 x, fv_s32 c)
+{
+    y = fv_min(fv_max(y, 0), mat->mt_rows - 1);
+    x = fv_min(fv_max(x, 0), mat->mt_cols - 1);
+
+    return fv_test_get(mat, y, x, c);
+}
+
+/* Blocks of 60 and 180 with some noise: edges and flat areas */
+static void
+fv_test_fill_blocks(fv_mat_t *mat)
+{
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            for (c = 0; c < mat->mt_nchannel; c++) {
+                fv_test_set(mat, y, x, c, ((x/9 + y/7) % 2 ? 180 : 60) + 
+                        c*10 + random() % 31 - 15);
+            }
+        }
+    }
+}
+
+/* mat into ref, a 64F matrix of its size */
+static void
+fv_test_store(fv_mat_t *ref, fv_mat_t *mat)
+{
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            for (c = 0; c < mat->mt_nchannel; c++) {
+                fv_test_set(ref, y, x, c, fv_test_get(mat, y, x, c));
+            }
+        }
+    }
+}
+
+/* The largest difference of dst from ref, and the mean one */
+static double
+fv_test_diff(fv_mat_t *dst, fv_mat_t *ref, double *mean)
+{
+    double      diff;
+    double      max_diff = 0;
+    double      sum = 0;
+    fv_s32      cn = dst->mt_nchannel;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (y = 0; y < dst->mt_rows; y++) {
+        for (x = 0; x < dst->mt_cols; x++) {
+            for (c = 0; c < cn; c++) {
+                diff = fabs(fv_test_get(dst, y, x, c) - 
+                        fv_test_get(ref, y, x, c));
+                max_diff = fv_max(max_diff, diff);
+                sum += diff;
+            }
+        }
+    }
+
+    *mean = sum/(dst->mt_rows*dst->mt_cols*cn);
+
+    return max_diff;
+}
+
+/* Weights 1 to 5 over and over, summing to 1 */
+static fv_mat_t *
+fv_test_kernel(fv_s32 rows, fv_s32 cols)
+{
+    fv_mat_t    *kernel;
+    double      sum = 0;
+    fv_s32      n = rows*cols;
+    fv_s32      i;
+
+    kernel = fv_test_create_mat(rows, cols, FV_32F, 1);
+    for (i = 0; i < n; i++) {
+        sum += i % 5 + 1;
+    }
+    for (i = 0; i < n; i++) {
+        kernel->mt_data.dt_fl[i] = (i % 5 + 1)/sum;
+    }
+
+    return kernel;
+}
+
+/*
+ * Filters of tc_ksize taps through the engine, tc_p1 selects the
+ * kind: 0 separable, 1 2D, 2 normalized box.
+ */
+static void
+fv_test_filter(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel;
+    fv_s32      ksize = tc->tc_ksize;
+
+    switch ((fv_s32)tc->tc_p1) {
+        case 0:
+            kernel = fv_test_kernel(ksize, 1);
+            fv_sep_filter2D(dst, src, kernel, kernel, fv_point(-1, -1), 
+                    0, FV_BORDER_REFLECT_101);
+            fv_release_mat(&kernel);
+            break;
+        case 1:
+            kernel = fv_test_kernel(ksize, ksize);
+            fv_filter2D(dst, src, dst->mt_depth, kernel, fv_point(-1, -1),
+                    0, FV_BORDER_REFLECT_101);
+            fv_release_mat(&kernel);
+            break;
+        default:
+            fv_box_filter(dst, src, dst->mt_depth, fv_size(ksize, ksize),
+                    fv_point(-1, -1), 1, FV_BORDER_REFLECT_101);
+            break;
+    }
+}
+
+/* The filter on tc_p2 threads, the reference on one */
+static void
+fv_test_filter_threads(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(tc->tc_p2);
+    fv_test_filter(dst, src, tc);
+    fv_set_num_threads(num_threads);
+}
+
+/* The reference is run into a matrix of the depth of src */
+static void
+fv_test_store_run(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc,
+        fv_test_run_func run)
+{
+    fv_mat_t    *dst;
+
+    dst = fv_test_create_mat(ref->mt_rows, ref->mt_cols, src->mt_depth,
+            ref->mt_nchannel);
+    run(dst, src, tc);
+    fv_test_store(ref, dst);
+    fv_release_mat(&dst);
+}
+
+static void
+fv_test_filter_one_band(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(1);
+    fv_test_store_run(ref, src, tc, fv_test_filter);
+    fv_set_num_threads(num_threads);
+}
+
+/* fv_test_filter_threads() over dst in place */
+static void
+fv_test_filter_in_place(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_copy_mat(dst, src);
+    fv_test_filter_threads(dst, dst, tc);
+}
+
+static void
+fv_test_filter_out_of_place(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_store_run(ref, src, tc, fv_test_filter_threads);
+}
+
+/*
+ * The filter of fv_test_filter() from an engine, tc_p1 0 separable or
+ * 1 2D, in strips of strip_width columns, 0 for the planned width.
+ * Narrower strips fit the scratch planned for whole rows.
+ */
+static void
+fv_test_filter_engine(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc,
+        fv_s32 strip_width)
+{
+    fv_filter_engine_t  *engine;
+    fv_mat_t            *kernel;
+    fv_s32              ksize = tc->tc_ksize;
+
+    if (tc->tc_p1 == 0) {
+        kernel = fv_test_kernel(ksize, 1);
+        engine = fv_create_sep_filter_engine(dst, src, kernel, kernel, 
+                fv_point(-1, -1), 0, FV_BORDER_REFLECT_101);
+    } else {
+        kernel = fv_test_kernel(ksize, ksize);
+        engine = fv_create_linear_filter_engine(dst, src, kernel, 
+                fv_point(-1, -1), 0, FV_BORDER_REFLECT_101);
+    }
+    if (strip_width > 0) {
+        engine->fe_strip_width = strip_width;
+    }
+    fv_filter_engine_apply(engine, dst, src);
+    fv_release_filter_engine(&engine);
+    fv_release_mat(&kernel);
+}
+
+/* Strips of tc_p2 columns, the reference filters whole rows */
+static void
+fv_test_filter_strips(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_filter_engine(dst, src, tc, tc->tc_p2);
+}
+
+static void
+fv_test_filter_rows(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_test_filter_engine(dst, src, tc, 0);
+}
+
+static void
+fv_test_filter_whole_rows(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_store_run(ref, src, tc, fv_test_filter_rows);
+}
+
+/* Taps -ksize/2 to ksize/2, a derivative of sorts */
+static fv_mat_t *
+fv_test_kernel_deriv(fv_s32 ksize)
+{
+    fv_mat_t    *kernel;
+    fv_s32      i;
+
+    kernel = fv_test_create_mat(ksize, 1, FV_32F, 1);
+    for (i = 0; i < ksize; i++) {
+        kernel->mt_data.dt_fl[i] = i - ksize/2;
+    }
+
+    return kernel;
+}
+
+/*
+ * The x and y derivatives of fv_sep_filter2D_dual() with delta tc_p1,
+ * dst gets the first when tc_p2 is 0 and the second otherwise.
+ */
+static void
+fv_test_filter_dual(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *other;
+    fv_mat_t    *smooth;
+    fv_mat_t    *deriv;
+
+    smooth = fv_test_kernel(tc->tc_ksize, 1);
+    deriv = fv_test_kernel_deriv(tc->tc_ksize);
+    other = fv_test_create_mat(dst->mt_rows, dst->mt_cols, dst->mt_depth,
+            dst->mt_nchannel);
+    if (tc->tc_p2 == 0) {
+        fv_sep_filter2D_dual(dst, other, src, deriv, smooth, smooth, deriv,
+                fv_point(-1, -1), tc->tc_p1, FV_BORDER_REFLECT_101);
+    } else {
+        fv_sep_filter2D_dual(other, dst, src, deriv, smooth, smooth, deriv,
+                fv_point(-1, -1), tc->tc_p1, FV_BORDER_REFLECT_101);
+    }
+    fv_release_mat(&other);
+    fv_release_mat(&deriv);
+    fv_release_mat(&smooth);
+}
+
+/* The same derivative from a pass of its own */
+static void
+fv_test_filter_single(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *smooth;
+    fv_mat_t    *deriv;
+
+    smooth = fv_test_kernel(tc->tc_ksize, 1);
+    deriv = fv_test_kernel_deriv(tc->tc_ksize);
+    if (tc->tc_p2 == 0) {
+        fv_sep_filter2D(dst, src, deriv, smooth, fv_point(-1, -1), 
+                tc->tc_p1, FV_BORDER_REFLECT_101);
+    } else {
+        fv_sep_filter2D(dst, src, smooth, deriv, fv_point(-1, -1), 
+                tc->tc_p1, FV_BORDER_REFLECT_101);
+    }
+    fv_release_mat(&deriv);
+    fv_release_mat(&smooth);
+}
+
+static void
+fv_test_filter_two_passes(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_store_run(ref, src, tc, fv_test_filter_single);
+}
+
+/* 
+ * The 7x7 kernel of fv_test_kernel() with zero columns up to cols:
+ * 7x8 and wider go through the DFT.
+ */
+static fv_mat_t *
+fv_test_kernel_pad(fv_s32 cols)
+{
+    fv_mat_t    *kernel;
+    fv_mat_t    *k;
+    fv_s32      x;
+    fv_s32      y;
+
+    k = fv_test_kernel(7, 7);
+    kernel = fv_test_create_mat(7, cols, FV_32F, 1);
+    for (y = 0; y < 7; y++) {
+        for (x = 0; x < cols; x++) {
+            kernel->mt_data.dt_fl[y*cols + x] = x < 7 ? 
+                k->mt_data.dt_fl[y*7 + x] : 0;
+        }
+    }
+    fv_release_mat(&k);
+
+    return kernel;
+}
+
+/* fv_filter2D() with the kernel tc_ksize wide, delta tc_p1, border tc_p2 */
+static void
+fv_test_filter2D(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel;
+
+    kernel = fv_test_kernel_pad(tc->tc_ksize);
+    fv_filter2D(dst, src, dst->mt_depth, kernel, fv_point(3, 3), 
+            tc->tc_p1, tc->tc_p2);
+    fv_release_mat(&kernel);
+}
+
+/* The same through the DFT */
+static void
+fv_test_filter2D_dft(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_test_case_t      dft = *tc;
+
+    dft.tc_ksize = 8;
+    fv_test_store_run(ref, src, &dft, fv_test_filter2D);
+}
+
+static void
+fv_test_filter2D_in_place(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_copy_mat(dst, src);
+    fv_test_filter2D(dst, dst, tc);
+}
+
+typedef void (*fv_test_view_func)(fv_mat_t *, fv_mat_t *, fv_rect_t);
+
+/* 
+ * The rect of mat filtered through views, margin columns and rows in
+ * from the top left and a few from the bottom right
+ */
+static fv_rect_t
+fv_test_roi_rect(fv_mat_t *mat, fv_s32 margin)
+{
+    return fv_rect(margin, margin, mat->mt_cols - margin - 3, 
+            mat->mt_rows - margin - 2);
+}
+
+/* src with rect replaced by part, into ref */
+static void
+fv_test_store_pasted(fv_mat_t *ref, fv_mat_t *src, fv_mat_t *part, 
+        fv_rect_t rect)
+{
+    fv_mat_t    *dst;
+    fv_mat_t    view;
+
+    dst = fv_test_create_mat(src->mt_rows, src->mt_cols, src->mt_depth,
+            src->mt_nchannel);
+    fv_copy_mat(dst, src);
+    fv_get_sub_rect(&view, dst, rect);
+    fv_copy_mat(&view, part);
+    fv_test_store(ref, dst);
+    fv_release_mat(&dst);
+}
+
+/*
+ * run from a view of src, tc_p2 in from its top left, into the same
+ * view of dst. The rest of dst is src.
+ */
+static void
+fv_test_run_view(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc,
+        fv_test_view_func get_view, fv_test_run_func run)
+{
+    fv_mat_t    dst_view;
+    fv_mat_t    src_view;
+    fv_rect_t   rect = fv_test_roi_rect(src, tc->tc_p2);
+
+    fv_copy_mat(dst, src);
+    get_view(&src_view, src, rect);
+    get_view(&dst_view, dst, rect);
+    run(&dst_view, &src_view, tc);
+}
+
+/* The view run as part of all of src, with its real neighbours */
+static void
+fv_test_run_roi_whole(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc, fv_test_run_func run)
+{
+    fv_mat_t    *dst;
+    fv_mat_t    part;
+    fv_rect_t   rect = fv_test_roi_rect(src, tc->tc_p2);
+
+    dst = fv_test_create_mat(src->mt_rows, src->mt_cols, src->mt_depth,
+            src->mt_nchannel);
+    run(dst, src, tc);
+    fv_get_sub_rect(&part, dst, rect);
+    fv_test_store_pasted(ref, src, &part, rect);
+    fv_release_mat(&dst);
+}
+
+static void
+fv_test_filter_roi(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_test_run_view(dst, src, tc, fv_mat_get_roi_view, fv_test_filter);
+}
+
+static void
+fv_test_filter_sub_rect(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_view(dst, src, tc, fv_get_sub_rect, fv_test_filter);
+}
+
+static void
+fv_test_filter_roi_whole(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_roi_whole(ref, src, tc, fv_test_filter);
+}
+
+/* Binary threshold at tc_p1 */
+static void
+fv_test_threshold(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    _fv_threshold(dst, src, tc->tc_p1, 200, FV_THRESH_BINARY);
+}
+
+/* Views are thresholded row by row */
+static void
+fv_test_threshold_roi(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_view(dst, src, tc, fv_mat_get_roi_view, fv_test_threshold);
+}
+
+static void
+fv_test_threshold_roi_whole(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_roi_whole(ref, src, tc, fv_test_threshold);
+}
+
+/* A sub-rect filtered on its own, as a copy */
+static void
+fv_test_filter_rect_alone(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *copy;
+    fv_mat_t    *dst;
+    fv_mat_t    view;
+    fv_rect_t   rect = fv_test_roi_rect(src, tc->tc_p2);
+
+    copy = fv_test_create_mat(rect.rt_height, rect.rt_width, src->mt_depth,
+            src->mt_nchannel);
+    dst = fv_test_create_mat(rect.rt_height, rect.rt_width, src->mt_depth,
+            src->mt_nchannel);
+    fv_get_sub_rect(&view, src, rect);
+    fv_copy_mat(copy, &view);
+    fv_test_filter(dst, copy, tc);
+    fv_test_store_pasted(ref, src, dst, rect);
+    fv_release_mat(&dst);
+    fv_release_mat(&copy);
+}
+
+/* fv_test_filter2D() in place over an ROI view 5 pixels in */
+static void
+fv_test_filter2D_roi_in_place(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    view;
+
+    fv_copy_mat(dst, src);
+    fv_mat_get_roi_view(&view, dst, fv_test_roi_rect(dst, 5));
+    fv_test_filter2D(&view, &view, tc);
+}
+
+/* The same out of place */
+static void
+fv_test_filter2D_roi(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *dst;
+    fv_mat_t    dst_view;
+    fv_mat_t    src_view;
+    fv_rect_t   rect = fv_test_roi_rect(src, 5);
+
+    dst = fv_test_create_mat(src->mt_rows, src->mt_cols, src->mt_depth,
+            src->mt_nchannel);
+    fv_copy_mat(dst, src);
+    fv_mat_get_roi_view(&src_view, src, rect);
+    fv_mat_get_roi_view(&dst_view, dst, rect);
+    fv_test_filter2D(&dst_view, &src_view, tc);
+    fv_test_store(ref, dst);
+    fv_release_mat(&dst);
+}
+
+/* Separable convolution in double with a replicated border */
+static void
+_fv_test_gaussian_ref(fv_mat_t *ref, fv_mat_t *src, fv_s32 nx, fv_s32 ny,
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *kx;
+    fv_mat_t    *ky;
+    fv_mat_t    *tmp;
+    double      v;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+
+    kx = fv_get_gaussian_kernel(nx, tc->tc_p1);
+    ky = fv_get_gaussian_kernel(ny, tc->tc_p2 > 0 ? tc->tc_p2 : tc->tc_p1);
+    tmp = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_64F, 
+            src->mt_nchannel);
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                v = 0;
+                for (i = 0; i < nx; i++) {
+                    v += kx->mt_data.dt_fl[i]*fv_test_get_replicate(src, y, 
+                            x + i - nx/2, c);
+                }
+                fv_test_set(tmp, y, x, c, v);
+            }
+        }
+    }
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                v = 0;
+                for (i = 0; i < ny; i++) {
+                    v += ky->mt_data.dt_fl[i]*fv_test_get_replicate(tmp, 
+                            y + i - ny/2, x, c);
+                }
+                fv_test_set(ref, y, x, c, v);
+            }
+        }
+    }
+
+    fv_release_mat(&tmp);
+    fv_release_mat(&ky);
+    fv_release_mat(&kx);
+}
+
+/* 
+ * Square kernels of tc_ksize, or sized from the sigmas tc_p1 and tc_p2
+ * as fv_gaussian_blur() does: 3 sigma each side for 8u, 4 for others
+ */
+static void
+fv_test_gaussian_sized(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    double      nsigma = src->mt_depth == FV_8U ? 3 : 4;
+    double      sigma_y = tc->tc_p2 > 0 ? tc->tc_p2 : tc->tc_p1;
+    fv_s32      nx = tc->tc_ksize;
+    fv_s32      ny = tc->tc_ksize;
+
+    if (tc->tc_ksize == 0) {
+        nx = fv_round(tc->tc_p1*nsigma*2 + 1) | 1;
+        ny = fv_round(sigma_y*nsigma*2 + 1) | 1;
+    }
+    _fv_test_gaussian_ref(ref, src, nx, ny, tc);
+}
+
+/* The sampled Gaussian of 4 sigma each side */
+static void
+fv_test_gaussian_sampled(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    double      sigma_y = tc->tc_p2 > 0 ? tc->tc_p2 : tc->tc_p1;
+
+    _fv_test_gaussian_ref(ref, src, fv_round(tc->tc_p1*8 + 1) | 1, 
+            fv_round(sigma_y*8 + 1) | 1, tc);
+}
+
+static void
+fv_test_gaussian(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_gaussian_blur(dst, src, fv_size(tc->tc_ksize, tc->tc_ksize), 
+            tc->tc_p1, tc->tc_p2, FV_BORDER_REPLICATE);
+}
+
+static void
+fv_test_gaussian_iir(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_gaussian_blur_iir(dst, src, tc->tc_p1, tc->tc_p2, 
+            FV_BORDER_REPLICATE);
+}
+
+static int
+fv_test_cmp_double(const void *a, const void *b)
+{
+    double      v1 = *(const double *)a;
+    double      v2 = *(const double *)b;
+
+    return v1 < v2 ? -1 : v1 > v2;
+}
+
+/* Median of each sorted aperture, replicated border */
+static void
+fv_test_median_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    double      win[15*15];
+    fv_s32      r = tc->tc_ksize/2;
+    fv_s32      n;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    FV_ASSERT(tc->tc_ksize <= 15);
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                n = 0;
+                for (i = -r; i <= r; i++) {
+                    for (j = -r; j <= r; j++) {
+                        win[n++] = fv_test_get_replicate(src, y + i, 
+                                x + j, c);
+                    }
+                }
+                qsort(win, n, sizeof(win[0]), fv_test_cmp_double);
+                fv_test_set(ref, y, x, c, win[n/2]);
+            }
+        }
+    }
+}
+
+static void
+fv_test_median(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_median_blur(dst, src, tc->tc_ksize);
+}
+
+/* In place on a view of dst, tc_p2 in from its top left */
+static void
+fv_test_median_roi_in_place(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    view;
+
+    fv_copy_mat(dst, src);
+    fv_mat_get_roi_view(&view, dst, fv_test_roi_rect(dst, tc->tc_p2));
+    fv_median_blur(&view, &view, tc->tc_ksize);
+}
+
+static void
+fv_test_median_roi_whole(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_roi_whole(ref, src, tc, fv_test_median);
+}
+
+/* 
+ * Bilateral filter in double, replicated border. The direct filter
+ * takes the disc of radius r and the sum of the channel differences;
+ * full is the whole square window cut at the edges and the difference
+ * of the channel means, what the grid approximates.
+ */
+static void
+_fv_test_bilateral_ref(fv_mat_t *ref, fv_mat_t *src, fv_s32 r, 
+        double sigma_color, double sigma_space, fv_bool full)
+{
+    double      sum[4];
+    double      q[4];
+    double      p[4];
+    double      diff;
+    double      pm;
+    double      qm;
+    double      w;
+    double      wsum;
+    fv_s32      cn = src->mt_nchannel;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            pm = 0;
+            for (c = 0; c < cn; c++) {
+                p[c] = fv_test_get(src, y, x, c);
+                pm += p[c]/cn;
+                sum[c] = 0;
+            }
+            wsum = 0;
+            for (i = -r; i <= r; i++) {
+                for (j = -r; j <= r; j++) {
+                    if (full) {
+                        if (y + i < 0 || y + i >= src->mt_rows || 
+                                x + j < 0 || x + j >= src->mt_cols) {
+                            continue;
+                        }
+                    } else if (i*i + j*j > r*r) {
+                        continue;
+                    }
+                    diff = qm = 0;
+                    for (c = 0; c < cn; c++) {
+                        q[c] = fv_test_get_replicate(src, y + i, x + j, c);
+                        diff += fabs(q[c] - p[c]);
+                        qm += q[c]/cn;
+                    }
+                    if (full) {
+                        diff = fabs(qm - pm);
+                    }
+                    w = exp(-(i*i + j*j)/(2*sigma_space*sigma_space) - 
+                            diff*diff/(2*sigma_color*sigma_color));
+                    for (c = 0; c < cn; c++) {
+                        sum[c] += w*q[c];
+                    }
+                    wsum += w;
+                }
+            }
+            for (c = 0; c < cn; c++) {
+                fv_test_set(ref, y, x, c, sum[c]/wsum);
+            }
+        }
+    }
+}
+
+/* Diameter tc_ksize, or 3 sigma_space for 0; tc_p1 and tc_p2 sigmas */
+static void
+fv_test_bilateral_direct(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_s32      r = tc->tc_ksize/2;
+
+    if (tc->tc_ksize == 0) {
+        r = fv_round(tc->tc_p2*1.5);
+    }
+    _fv_test_bilateral_ref(ref, src, r, tc->tc_p1, tc->tc_p2, 0);
+}
+
+static void
+fv_test_bilateral_full(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    _fv_test_bilateral_ref(ref, src, 3*tc->tc_p2, tc->tc_p1, tc->tc_p2, 1);
+}
+
+static void
+fv_test_bilateral(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_bilateral_filter(dst, src, tc->tc_ksize, tc->tc_p1, tc->tc_p2, 
+            FV_BORDER_REPLICATE);
+}
+
+/* 
+ * Summed-area tables of tc_p2 depth, tc_p1 picks the one checked: 0
+ * sum, 1 squared sums, 2 tilted sums
+ */
+static fv_mat_t *
+fv_test_integral_dst(fv_mat_t *src, const fv_test_case_t *tc)
+{
+    return fv_test_create_mat(src->mt_rows + 1, src->mt_cols + 1, 
+            tc->tc_p1 == 1 ? FV_64F : tc->tc_p2, src->mt_nchannel);
+}
+
+static void
+fv_test_integral(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *table[3];
+    fv_s32      i;
+
+    for (i = 0; i < 3; i++) {
+        table[i] = fv_test_create_mat(dst->mt_rows, dst->mt_cols, 
+                i == 1 ? FV_64F : tc->tc_p2, dst->mt_nchannel);
+    }
+    fv_integral(table[0], table[1], table[2], src);
+    fv_copy_mat(dst, table[(fv_s32)tc->tc_p1]);
+    for (i = 0; i < 3; i++) {
+        fv_release_mat(&table[i]);
+    }
+}
+
+/* Each sum over the pixels it covers, exact in double for quarters */
+static void
+fv_test_integral_ref(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    double      s;
+    double      v;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    for (y = 0; y < ref->mt_rows; y++) {
+        for (x = 0; x < ref->mt_cols; x++) {
+            for (c = 0; c < ref->mt_nchannel; c++) {
+                s = 0;
+                for (i = 0; i < y; i++) {
+                    for (j = 0; j < src->mt_cols; j++) {
+                        v = fv_test_get(src, i, j, c);
+                        if (tc->tc_p1 == 2) {
+                            s += abs(j - x + 1) <= y - i - 1 ? v : 0;
+                        } else if (j < x) {
+                            s += tc->tc_p1 == 1 ? v*v : v;
+                        }
+                    }
+                }
+                fv_test_set(ref, y, x, c, s);
+            }
+        }
+    }
+}
+
+/* 
+ * Box filter of tc_ksize from a table of tc_p1 depth, normalized when
+ * tc_p2 is, on up to four threads
+ */
+static void
+fv_test_box_integral(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *sum;
+    fv_s32      num_threads = fv_get_num_threads();
+
+    sum = fv_test_create_mat(src->mt_rows + 1, src->mt_cols + 1, tc->tc_p1,
+            src->mt_nchannel);
+    fv_integral(sum, NULL, NULL, src);
+    fv_set_num_threads(4);
+    fv_box_filter_integral(dst, sum, fv_size(tc->tc_ksize, tc->tc_ksize),
+            fv_point(-1, -1), tc->tc_p2);
+    fv_set_num_threads(num_threads);
+    fv_release_mat(&sum);
+}
+
+/* The same windows one by one from the corners of the table */
+static void
+fv_test_box_rect_sum(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *sum;
+    fv_rect_t   rect;
+    double      v;
+    fv_s32      r = tc->tc_ksize/2;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    sum = fv_test_create_mat(src->mt_rows + 1, src->mt_cols + 1, tc->tc_p1,
+            src->mt_nchannel);
+    fv_integral(sum, NULL, NULL, src);
+    for (y = 0; y < dst->mt_rows; y++) {
+        for (x = 0; x < dst->mt_cols; x++) {
+            rect.rt_x = fv_max(x - r, 0);
+            rect.rt_y = fv_max(y - r, 0);
+            rect.rt_width = fv_min(x + r + 1, dst->mt_cols) - rect.rt_x;
+            rect.rt_height = fv_min(y + r + 1, dst->mt_rows) - rect.rt_y;
+            for (c = 0; c < dst->mt_nchannel; c++) {
+                v = fv_integral_rect_sum(sum, rect, c);
+                if (tc->tc_p2) {
+                    v /= rect.rt_width*rect.rt_height;
+                }
+                fv_test_set(dst, y, x, c, v);
+            }
+        }
+    }
+    fv_release_mat(&sum);
+}
+
+/* Windows cut at the edges, averaged over the pixels left */
+static void
+fv_test_box_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    double      s;
+    fv_s32      r = tc->tc_ksize/2;
+    fv_s32      n;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                s = 0;
+                n = 0;
+                for (i = fv_max(y - r, 0); 
+                        i <= fv_min(y + r, src->mt_rows - 1); i++) {
+                    for (j = fv_max(x - r, 0); 
+                            j <= fv_min(x + r, src->mt_cols - 1); j++) {
+                        s += fv_test_get(src, i, j, c);
+                        n++;
+                    }
+                }
+                fv_test_set(ref, y, x, c, tc->tc_p2 ? s/n : s);
+            }
+        }
+    }
+}
+
+/* Box means of the window of radius r, cut at the edges */
+static void
+fv_test_box_mean(double *dst, double *src, fv_s32 rows, fv_s32 cols, 
+        fv_s32 r)
+{
+    double      sum;
+    fv_s32      n;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      i;
+    fv_s32      j;
+
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < cols; x++) {
+            sum = 0;
+            n = 0;
+            for (i = fv_max(y - r, 0); i <= fv_min(y + r, rows - 1); i++) {
+                for (j = fv_max(x - r, 0); j <= fv_min(x + r, cols - 1); 
+                        j++) {
+                    sum += src[i*cols + j];
+                    n++;
+                }
+            }
+            dst[y*cols + x] = sum/n;
+        }
+    }
+}
+
+/* 
+ * The guide of the case: src itself, or for tc_p2 a gray one of the
+ * first channel of src over a ramp
+ */
+static fv_mat_t *
+fv_test_guide(fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *guide;
+    fv_s32      x;
+    fv_s32      y;
+
+    if (!tc->tc_p2) {
+        return NULL;
+    }
+
+    guide = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_8U, 1);
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            fv_test_set(guide, y, x, 0, 
+                    fmod(fv_test_get(src, y, x, 0) + 3*x + 5*y, 256));
+        }
+    }
+
+    return guide;
+}
+
+/* He et al. in double of radius tc_ksize and eps tc_p1 */
+static void
+fv_test_guided_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *guide;
+    double      *buf;
+    double      *p;
+    double      *g;
+    double      *t;
+    double      *mean_g;
+    double      *mean_p;
+    double      *mean_gg;
+    double      *mean_gp;
+    double      a;
+    fv_s32      rows = src->mt_rows;
+    fv_s32      cols = src->mt_cols;
+    fv_s32      r = tc->tc_ksize;
+    fv_s32      n = rows*cols;
+    fv_s32      c;
+    fv_s32      i;
+
+    guide = fv_test_guide(src, tc);
+    buf = fv_alloc(7*n*sizeof(*buf));
+    FV_ASSERT(buf != NULL);
+    p = buf;
+    g = p + n;
+    t = g + n;
+    mean_g = t + n;
+    mean_p = mean_g + n;
+    mean_gg = mean_p + n;
+    mean_gp = mean_gg + n;
+
+    for (c = 0; c < src->mt_nchannel; c++) {
+        for (i = 0; i < n; i++) {
+            p[i] = fv_test_get(src, i/cols, i%cols, c);
+            g[i] = guide != NULL ? fv_test_get(guide, i/cols, i%cols, 0) : 
+                p[i];
+        }
+        fv_test_box_mean(mean_g, g, rows, cols, r);
+        fv_test_box_mean(mean_p, p, rows, cols, r);
+        for (i = 0; i < n; i++) {
+            t[i] = g[i]*g[i];
+        }
+        fv_test_box_mean(mean_gg, t, rows, cols, r);
+        for (i = 0; i < n; i++) {
+            t[i] = g[i]*p[i];
+        }
+        fv_test_box_mean(mean_gp, t, rows, cols, r);
+        /* a in mean_gg, b in mean_gp */
+        for (i = 0; i < n; i++) {
+            a = (mean_gp[i] - mean_g[i]*mean_p[i])/
+                (mean_gg[i] - mean_g[i]*mean_g[i] + tc->tc_p1);
+            mean_gg[i] = a;
+            mean_gp[i] = mean_p[i] - a*mean_g[i];
+        }
+        fv_test_box_mean(mean_g, mean_gg, rows, cols, r);
+        fv_test_box_mean(mean_p, mean_gp, rows, cols, r);
+        for (i = 0; i < n; i++) {
+            fv_test_set(ref, i/cols, i%cols, c, mean_g[i]*g[i] + mean_p[i]);
+        }
+    }
+
+    fv_free(&buf);
+    fv_release_mat(&guide);
+}
+
+/* On up to four threads */
+static void
+fv_test_guided(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *guide;
+    fv_s32      num_threads = fv_get_num_threads();
+
+    guide = fv_test_guide(src, tc);
+    fv_set_num_threads(4);
+    fv_guided_filter(dst, src, guide, tc->tc_ksize, tc->tc_p1);
+    fv_set_num_threads(num_threads);
+    fv_release_mat(&guide);
+}
+
+/* 
+ * Canny of thresholds tc_p1 and tc_p2, tc_ksize the aperture with
+ * FV_CANNY_L2_GRADIENT if any
+ */
+static void
+fv_test_canny(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    _fv_canny(dst, src, tc->tc_p1, tc->tc_p2, tc->tc_ksize);
+}
+
+/* 
+ * The same derivatives, magnitudes in 64 bits, the sector of atan2
+ * and hysteresis flooding from each strong pixel
+ */
+static void
+fv_test_canny_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *dx;
+    fv_mat_t    *dy;
+    fv_mat_t    *mag;
+    fv_u8       *cand;
+    fv_s32      *stack;
+    fv_s32      width = src->mt_cols;
+    fv_s32      height = src->mt_rows;
+    fv_s32      aperture = tc->tc_ksize & ~FV_CANNY_L2_GRADIENT;
+    fv_bool     l2 = (tc->tc_ksize & FV_CANNY_L2_GRADIENT) != 0;
+    double      low = tc->tc_p1;
+    double      high = tc->tc_p2;
+    double      a;
+    double      b;
+    double      g;
+    double      angle;
+    fv_bool     is_max;
+    fv_s32      sp = 0;
+    fv_s32      s;
+    fv_s32      n;
+    fv_s32      p;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      i;
+    fv_s32      j;
+
+    dx = fv_test_create_mat(height, width, FV_16S, 1);
+    dy = fv_test_create_mat(height, width, FV_16S, 1);
+    _fv_sobel_dxdy(dx, dy, src, FV_16S, aperture, 1, 0, FV_BORDER_REPLICATE);
+    /* zero magnitudes around the image */
+    mag = fv_test_create_mat(height + 2, width + 2, FV_64F, 1);
+    cand = fv_alloc(width*height);
+    FV_ASSERT(cand != NULL);
+    stack = fv_alloc(width*height*sizeof(*stack));
+    FV_ASSERT(stack != NULL);
+    memset(cand, 0, width*height);
+
+    if (l2) {
+        low = fv_min(low, 32767);
+        high = fv_min(high, 32767);
+        low *= low;
+        high *= high;
+    }
+    for (y = 0; y < height + 2; y++) {
+        for (x = 0; x < width + 2; x++) {
+            g = 0;
+            if (y > 0 && y <= height && x > 0 && x <= width) {
+                a = fv_test_get(dx, y - 1, x - 1, 0);
+                b = fv_test_get(dy, y - 1, x - 1, 0);
+                g = l2 ? a*a + b*b : fabs(a) + fabs(b);
+            }
+            fv_test_set(mag, y, x, 0, g);
+        }
+    }
+
+#define fv_test_canny_mag(i, j) fv_test_get(mag, y + 1 + (i), x + 1 + (j), 0)
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            g = fv_test_canny_mag(0, 0);
+            if (g <= low) {
+                continue;
+            }
+            a = fv_test_get(dx, y, x, 0);
+            b = fv_test_get(dy, y, x, 0);
+            /* in 45 degrees */
+            angle = atan2(fabs(b), fabs(a))/atan(1);
+            if (angle < 0.5) {
+                is_max = g > fv_test_canny_mag(0, -1) && 
+                    g >= fv_test_canny_mag(0, 1);
+            } else if (angle > 1.5) {
+                is_max = g > fv_test_canny_mag(-1, 0) && 
+                    g >= fv_test_canny_mag(1, 0);
+            } else {
+                s = a*b < 0 ? -1 : 1;
+                is_max = g > fv_test_canny_mag(-1, -s) && 
+                    g > fv_test_canny_mag(1, s);
+            }
+            if (is_max) {
+                cand[y*width + x] = 1 + (g > high);
+            }
+        }
+    }
+#undef fv_test_canny_mag
+
+    for (p = 0; p < width*height; p++) {
+        fv_test_set(ref, p/width, p%width, 0, 0);
+    }
+    for (n = 0; n < width*height; n++) {
+        if (cand[n] != 2 || fv_test_get(ref, n/width, n%width, 0) != 0) {
+            continue;
+        }
+        fv_test_set(ref, n/width, n%width, 0, 255);
+        stack[sp++] = n;
+        while (sp > 0) {
+            p = stack[--sp];
+            for (i = -1; i <= 1; i++) {
+                for (j = -1; j <= 1; j++) {
+                    y = p/width + i;
+                    x = p%width + j;
+                    if (y < 0 || y >= height || x < 0 || x >= width ||
+                            !cand[y*width + x] || 
+                            fv_test_get(ref, y, x, 0) != 0) {
+                        continue;
+                    }
+                    fv_test_set(ref, y, x, 0, 255);
+                    stack[sp++] = y*width + x;
+                }
+            }
+        }
+    }
+
+    fv_free(&stack);
+    fv_free(&cand);
+    fv_release_mat(&mag);
+    fv_release_mat(&dy);
+    fv_release_mat(&dx);
+}
+
+/*
+ * Canny between tc_p1 and 3*tc_p1 on tc_p2 threads, the reference on
+ * one: the stripes meet on the same edges
+ */
+static void
+fv_test_canny_threads(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(tc->tc_p2);
+    _fv_canny(dst, src, tc->tc_p1, 3*tc->tc_p1, tc->tc_ksize);
+    fv_set_num_threads(num_threads);
+}
+
+static void
+fv_test_canny_one_band(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_case_t      one = *tc;
+
+    one.tc_p2 = 1;
+    fv_test_store_run(ref, src, &one, fv_test_canny_threads);
+}
+
+/* 
+ * Derivative tc_p1 (0 dx, 1 dy) of 8u into 16s, tc_ksize -1 for
+ * Scharr, tc_p2 the border; on 4 threads
+ */
+static fv_mat_t *
+fv_test_sobel_dst(fv_mat_t *src, const fv_test_case_t *tc)
+{
+    return fv_test_create_mat(src->mt_rows, src->mt_cols, FV_16S, 
+            src->mt_nchannel);
+}
+
+static void
+fv_test_sobel_run(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_s32      dx = tc->tc_p1 == 0;
+
+    if (tc->tc_ksize < 0) {
+        _fv_scharr(dst, src, dst->mt_depth, dx, !dx, 1, 0, tc->tc_p2);
+    } else {
+        _fv_sobel(dst, src, dst->mt_depth, dx, !dx, tc->tc_ksize, 1, 0, 
+                tc->tc_p2);
+    }
+}
+
+static void
+fv_test_sobel(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(4);
+    fv_test_sobel_run(dst, src, tc);
+    fv_set_num_threads(num_threads);
+}
+
+/* The float filter engine over src in 32f: the sums are exact */
+static void
+fv_test_sobel_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *fsrc;
+    fv_mat_t    *fdst;
+
+    fsrc = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_32F, 
+            src->mt_nchannel);
+    fdst = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_32F, 
+            src->mt_nchannel);
+    fv_test_store(fsrc, src);
+    fv_test_sobel_run(fdst, fsrc, tc);
+    fv_test_store(ref, fdst);
+    fv_release_mat(&fdst);
+    fv_release_mat(&fsrc);
+}
+
+/* 
+ * Laplacian of aperture tc_ksize scaled by tc_p1 with a replicated
+ * border, on 4 threads, into a dst of depth tc_p2
+ */
+static fv_mat_t *
+fv_test_laplacian_dst(fv_mat_t *src, const fv_test_case_t *tc)
+{
+    return fv_test_create_mat(src->mt_rows, src->mt_cols, tc->tc_p2, 
+            src->mt_nchannel);
+}
+
+static void
+fv_test_laplacian(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(4);
+    fv_laplacian(dst, src, dst->mt_depth, tc->tc_ksize, tc->tc_p1, 0, 
+            FV_BORDER_REPLICATE);
+    fv_set_num_threads(num_threads);
+}
+
+#define FV_TEST_LAPLACIAN_MAX_KSIZE     31
+
+/* The n binomial coefficients of (1 + x)^(n - 1) */
+static void
+fv_test_binomial(double *k, fv_s32 n)
+{
+    fv_s32      i;
+    fv_s32      j;
+
+    for (i = 0; i < n; i++) {
+        k[i] = 1;
+        for (j = i - 1; j > 0; j--) {
+            k[j] += k[j - 1];
+        }
+    }
+}
+
+/* 
+ * The 2D kernel ks*kd' + kd*ks' in double: ks binomial, kd the
+ * binomial of ksize - 2 convolved with [1 -2 1]. ksize 1 is the 4
+ * neighbour kernel.
+ */
+static void
+fv_test_laplacian_ref(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    double      ks[FV_TEST_LAPLACIAN_MAX_KSIZE];
+    double      kd[FV_TEST_LAPLACIAN_MAX_KSIZE];
+    double      b[FV_TEST_LAPLACIAN_MAX_KSIZE];
+    double      v;
+    fv_s32      n = fv_max(tc->tc_ksize, 3);
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    FV_ASSERT(n <= FV_TEST_LAPLACIAN_MAX_KSIZE);
+    fv_test_binomial(ks, n);
+    fv_test_binomial(b, n - 2);
+    for (i = 0; i < n; i++) {
+        kd[i] = (i < n - 2 ? b[i] : 0) - (i >= 1 && i < n - 1 ? 
+                2*b[i - 1] : 0) + (i >= 2 ? b[i - 2] : 0);
+    }
+    if (tc->tc_ksize == 1) {
+        ks[0] = 0, ks[1] = 1, ks[2] = 0;
+    }
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                v = 0;
+                for (i = 0; i < n; i++) {
+                    for (j = 0; j < n; j++) {
+                        v += (ks[i]*kd[j] + kd[i]*ks[j])*
+                            fv_test_get_replicate(src, y + i - n/2, 
+                                    x + j - n/2, c);
+                    }
+                }
+                fv_test_set(ref, y, x, c, v*tc->tc_p1);
+            }
+        }
+    }
+}
+
+/* A view of src into the same view of dst, tc_p2 in from the edges */
+static void
+fv_test_laplacian_roi(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_view(dst, src, tc, fv_mat_get_roi_view, fv_test_laplacian);
+}
+
+static void
+fv_test_laplacian_roi_whole(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_run_roi_whole(ref, src, tc, fv_test_laplacian);
+}
+
+#define FV_TEST_POLAR_MAG_TOL       5e-6
+#define FV_TEST_POLAR_ANGLE_TOL     0.01
+
+/* 
+ * x in channel 0 and y in channel 1, the axes both ways, the origin and
+ * tiny x among them
+ */
+static void
+fv_test_fill_polar(fv_mat_t *mat)
+{
+    double      v[2];
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      i;
+
+    for (y = 0; y < mat->mt_rows; y++) {
+        for (x = 0; x < mat->mt_cols; x++) {
+            i = y*mat->mt_cols + x;
+            v[0] = (random() % 20001 - 10000)/7.0;
+            v[1] = (random() % 20001 - 10000)/7.0;
+            if (i % 11 == 0) {
+                v[0] = 0;
+                if (i % 2 == 0) {
+                    v[1] = 0;
+                }
+            } else if (i % 13 == 0) {
+                v[1] = 0;
+            } else if (i % 17 == 0) {
+                v[0] *= 1e-20;
+            }
+            fv_test_set(mat, y, x, 0, v[0]);
+            fv_test_set(mat, y, x, 1, v[1]);
+        }
+    }
+}
+
+static fv_mat_t *
+fv_test_cart_to_polar_dst(fv_mat_t *src, const fv_test_case_t *tc)
+{
+    return fv_test_create_mat(src->mt_rows, src->mt_cols, FV_64F, 2);
+}
+
+/* 
+ * fv_cart_to_polar() on 4 threads, tc_p1 for degrees. dst gets the
+ * magnitude error relative to sqrt() and the angle error against
+ * atan2() in degrees, both in units of their documented bounds, so the
+ * reference is 0 and the tolerance 1.
+ */
+static void
+fv_test_cart_to_polar(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *xy[2];
+    fv_mat_t    *mag;
+    fv_mat_t    *angle;
+    double      v[2];
+    double      unit = tc->tc_p1 ? 1 : fv_pi/180;
+    double      m;
+    double      a;
+    fv_s32      num_threads = fv_get_num_threads();
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    for (c = 0; c < 2; c++) {
+        xy[c] = fv_test_create_mat(src->mt_rows, src->mt_cols, 
+                src->mt_depth, 1);
+    }
+    mag = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_32F, 1);
+    angle = fv_test_create_mat(src->mt_rows, src->mt_cols, FV_32F, 1);
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < 2; c++) {
+                fv_test_set(xy[c], y, x, 0, fv_test_get(src, y, x, c));
+            }
+        }
+    }
+
+    fv_set_num_threads(4);
+    fv_cart_to_polar(mag, angle, xy[0], xy[1], tc->tc_p1);
+    fv_set_num_threads(num_threads);
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            v[0] = fv_test_get(xy[0], y, x, 0);
+            v[1] = fv_test_get(xy[1], y, x, 0);
+            m = sqrt(v[0]*v[0] + v[1]*v[1]);
+            a = atan2(v[1], v[0])*180/fv_pi;
+            if (a < 0) {
+                a += 360;
+            }
+            fv_test_set(dst, y, x, 0, fabs(fv_test_get(mag, y, x, 0) - m)/
+                    fv_max(m, FLT_MIN)/FV_TEST_POLAR_MAG_TOL);
+            /* 0 and 360 are the same angle */
+            a = fabs(fv_test_get(angle, y, x, 0)/unit - a);
+            a = fv_min(a, 360 - a);
+            fv_test_set(dst, y, x, 1, a/FV_TEST_POLAR_ANGLE_TOL);
+        }
+    }
+
+    fv_release_mat(&angle);
+    fv_release_mat(&mag);
+    fv_release_mat(&xy[1]);
+    fv_release_mat(&xy[0]);
+}
+
+static void
+fv_test_zero_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    memset(ref->mt_data.dt_ptr, 0, ref->mt_rows*ref->mt_step);
+}
+
+/* 
+ * Erode (tc_p2 0) or dilate (tc_p2 1) by a tc_ksize x tc_p1 rect with
+ * a replicated border, on 4 threads
+ */
+static void
+fv_test_morph_rect(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel;
+    fv_s32      num_threads = fv_get_num_threads();
+    fv_s32      i;
+
+    kernel = fv_test_create_mat(tc->tc_p1, tc->tc_ksize, FV_32S, 1);
+    for (i = 0; i < kernel->mt_rows*kernel->mt_cols; i++) {
+        kernel->mt_data.dt_i[i] = 1;
+    }
+    fv_set_num_threads(4);
+    if (tc->tc_p2 == FV_MOP_ERODE) {
+        _fv_erode(dst, src, kernel, fv_point(-1, -1), 1, 
+                FV_BORDER_REPLICATE);
+    } else {
+        _fv_dilate(dst, src, kernel, fv_point(-1, -1), 1, 
+                FV_BORDER_REPLICATE);
+    }
+    fv_set_num_threads(num_threads);
+    fv_release_mat(&kernel);
+}
+
+/* The min or max over every window */
+static void
+fv_test_morph_rect_ref(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_s32      kw = tc->tc_ksize;
+    fv_s32      kh = tc->tc_p1;
+    double      v;
+    double      m;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+    fv_s32      i;
+    fv_s32      j;
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                m = fv_test_get_replicate(src, y - kh/2, x - kw/2, c);
+                for (i = 0; i < kh; i++) {
+                    for (j = 0; j < kw; j++) {
+                        v = fv_test_get_replicate(src, y + i - kh/2, 
+                                x + j - kw/2, c);
+                        m = tc->tc_p2 == FV_MOP_ERODE ? fv_min(m, v) : 
+                            fv_max(m, v);
+                    }
+                }
+                fv_test_set(ref, y, x, c, m);
+            }
+        }
+    }
+}
+
+/* 
+ * _fv_morphology_ex() of op tc_p1 and tc_p2 iterations on 4 threads, by
+ * a tc_ksize rect or, for 0, a 3x5 cross
+ */
+static fv_mat_t *
+fv_test_morph_kernel(const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel;
+    fv_s32      cross[] = {
+        0, 1, 0,
+        1, 1, 1,
+        1, 1, 1,
+        0, 1, 0,
+        0, 1, 0,
+    };
+    fv_s32      i;
+
+    if (tc->tc_ksize == 0) {
+        kernel = fv_test_create_mat(5, 3, FV_32S, 1);
+        memcpy(kernel->mt_data.dt_i, cross, sizeof(cross));
+        return kernel;
+    }
+
+    kernel = fv_test_create_mat(tc->tc_ksize, tc->tc_ksize, FV_32S, 1);
+    for (i = 0; i < tc->tc_ksize*tc->tc_ksize; i++) {
+        kernel->mt_data.dt_i[i] = 1;
+    }
+
+    return kernel;
+}
+
+static void
+fv_test_morph_ex(fv_mat_t *dst, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel = fv_test_morph_kernel(tc);
+    fv_s32      num_threads = fv_get_num_threads();
+
+    fv_set_num_threads(4);
+    _fv_morphology_ex(dst, src, tc->tc_p1, kernel, fv_point(-1, -1), 
+            tc->tc_p2, FV_BORDER_REPLICATE);
+    fv_set_num_threads(num_threads);
+    fv_release_mat(&kernel);
+}
+
+/* 
+ * Chained _fv_erode() and _fv_dilate(), the second on the first's
+ * result alone, and the differences clipped at 0 for 8u. src may be a
+ * view, ref is as large.
+ */
+static void
+_fv_test_morph_ex_ref(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    *kernel = fv_test_morph_kernel(tc);
+    fv_mat_t    *a;
+    fv_mat_t    *b;
+    fv_point_t  anchor = fv_point(-1, -1);
+    fv_s32      op = tc->tc_p1;
+    fv_s32      n = tc->tc_p2;
+    double      v;
+    fv_s32      x;
+    fv_s32      y;
+    fv_s32      c;
+
+    a = fv_test_create_mat(src->mt_rows, src->mt_cols, src->mt_depth, 
+            src->mt_nchannel);
+    b = fv_test_create_mat(src->mt_rows, src->mt_cols, src->mt_depth, 
+            src->mt_nchannel);
+    switch (op) {
+        case FV_MOP_OPEN:
+        case FV_MOP_TOPHAT:
+            _fv_erode(b, src, kernel, anchor, n, FV_BORDER_REPLICATE);
+            _fv_dilate(a, b, kernel, anchor, n, FV_BORDER_REPLICATE);
+            break;
+        case FV_MOP_CLOSE:
+        case FV_MOP_BLACKHAT:
+            _fv_dilate(b, src, kernel, anchor, n, FV_BORDER_REPLICATE);
+            _fv_erode(a, b, kernel, anchor, n, FV_BORDER_REPLICATE);
+            break;
+        default:
+            _fv_dilate(a, src, kernel, anchor, n, FV_BORDER_REPLICATE);
+            _fv_erode(b, src, kernel, anchor, n, FV_BORDER_REPLICATE);
+            break;
+    }
+
+    for (y = 0; y < src->mt_rows; y++) {
+        for (x = 0; x < src->mt_cols; x++) {
+            for (c = 0; c < src->mt_nchannel; c++) {
+                v = fv_test_get(a, y, x, c);
+                if (op == FV_MOP_GRADIENT) {
+                    v -= fv_test_get(b, y, x, c);
+                } else if (op == FV_MOP_TOPHAT) {
+                    v = fv_test_get(src, y, x, c) - v;
+                } else if (op == FV_MOP_BLACKHAT) {
+                    v -= fv_test_get(src, y, x, c);
+                }
+                if (src->mt_depth == FV_8U) {
+                    v = fv_max(v, 0);
+                }
+                fv_test_set(ref, y, x, c, v);
+            }
+        }
+    }
+
+    fv_release_mat(&b);
+    fv_release_mat(&a);
+    fv_release_mat(&kernel);
+}
+
+static void
+fv_test_morph_ex_ref(fv_mat_t *ref, fv_mat_t *src, const fv_test_case_t *tc)
+{
+    _fv_test_morph_ex_ref(ref, src, tc);
+}
+
+/* One iteration, tc_p2 being the margin of the views below */
+static void
+fv_test_morph_ex_once(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_case_t      once = *tc;
+
+    once.tc_p2 = 1;
+    fv_test_morph_ex(dst, src, &once);
+}
+
+/* In place on a view, through the copy of it and its neighbours */
+static void
+fv_test_morph_ex_roi_in_place(fv_mat_t *dst, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_mat_t    view;
+
+    fv_copy_mat(dst, src);
+    fv_mat_get_roi_view(&view, dst, fv_test_roi_rect(dst, tc->tc_p2));
+    fv_test_morph_ex_once(&view, &view, tc);
+}
+
+static void
+fv_test_morph_ex_roi_ref(fv_mat_t *ref, fv_mat_t *src, 
+        const fv_test_case_t *tc)
+{
+    fv_test_case_t      once = *tc;
+    fv_mat_t            *part;
+    fv_mat_t            view;
+    fv_rect_t           rect = fv_test_roi_rect(src, tc->tc_p2);
+
+    once.tc_p2 = 1;
+    fv_mat_get_roi_view(&view, src, rect);
+    part = fv_test_create_mat(view.mt_rows, view.mt_cols, src->mt_depth, 
+            src->mt_nchannel);
+    _fv_test_morph_ex_ref(part, &view, &once);
+    fv_test_store_pasted(ref, src, part, rect);
+    fv_release_mat(&part);
+}
+
+/*
+ * The table of cases, fv_test -n runs the ones of that name. The
+ * default size is FV_TEST_COLS x FV_TEST_ROWS, cases of several
+ * bands take more rows.
+ */
+static const fv_test_case_t fv_test_case[] = {
+    /* row bands give what one band does */
+    {"filter_threads", FV_8U, 1, 5, 0, 4, fv_test_filter_threads, 
+        fv_test_filter_one_band, 0, {67, 150}},
+    {"filter_threads", FV_32F, 3, 7, 0, 3, fv_test_filter_threads, 
+        fv_test_filter_one_band, 0, {67, 150}},
+    {"filter_threads", FV_8U, 3, 5, 1, 4, fv_test_filter_threads, 
+        fv_test_filter_one_band, 0, {67, 150}},
+    {"filter_threads", FV_8U, 1, 7, 2, 4, fv_test_filter_threads, 
+        fv_test_filter_one_band, 0, {67, 150}},
+    /* 
+     * In place, bands keep the rows their neighbours and the bottom
+     * border read before writing them
+     */
+    {"filter_in_place", FV_8U, 1, 5, 0, 4, fv_test_filter_in_place, 
+        fv_test_filter_out_of_place, 0, {67, 150}},
+    {"filter_in_place", FV_32F, 3, 7, 0, 3, fv_test_filter_in_place, 
+        fv_test_filter_out_of_place, 0, {67, 150}},
+    {"filter_in_place", FV_8U, 3, 5, 1, 4, fv_test_filter_in_place, 
+        fv_test_filter_out_of_place, 0, {67, 150}},
+    {"filter_in_place", FV_8U, 1, 7, 2, 1, fv_test_filter_in_place, 
+        fv_test_filter_out_of_place, 0, {67, 150}},
+    /* vertical strips give what whole rows do */
+    {"filter_strips", FV_8U, 1, 5, 0, 16, fv_test_filter_strips, 
+        fv_test_filter_whole_rows, 0, {97, 37}},
+    {"filter_strips", FV_32F, 3, 7, 0, 23, fv_test_filter_strips, 
+        fv_test_filter_whole_rows, 0, {97, 37}},
+    {"filter_strips", FV_16S, 1, 3, 0, 5, fv_test_filter_strips, 
+        fv_test_filter_whole_rows, 0, {97, 37}},
+    {"filter_strips", FV_8U, 3, 5, 1, 16, fv_test_filter_strips, 
+        fv_test_filter_whole_rows, 0, {97, 37}},
+    /* both outputs of a dual engine are the ones of two passes */
+    {"filter_dual", FV_8U, 1, 3, 0, 0, fv_test_filter_dual, 
+        fv_test_filter_two_passes, 0},
+    {"filter_dual", FV_8U, 3, 5, 128, 1, fv_test_filter_dual, 
+        fv_test_filter_two_passes, 0},
+    {"filter_dual", FV_16S, 1, 5, 0, 0, fv_test_filter_dual, 
+        fv_test_filter_two_passes, 0},
+    {"filter_dual", FV_32F, 1, 7, 0.5, 1, fv_test_filter_dual, 
+        fv_test_filter_two_passes, 0},
+    {"filter_dual", FV_32F, 3, 3, 0, 0, fv_test_filter_dual, 
+        fv_test_filter_two_passes, 0, {4000, 9}},
+    /* 
+     * ROI views read their real neighbours, the border extends the
+     * whole matrix only; sub-rects are matrices of their own
+     */
+    {"filter_roi", FV_8U, 1, 5, 0, 4, fv_test_filter_roi, 
+        fv_test_filter_roi_whole, 0},
+    {"filter_roi", FV_8U, 3, 7, 0, 1, fv_test_filter_roi, 
+        fv_test_filter_roi_whole, 0},
+    {"filter_roi", FV_32F, 1, 5, 1, 0, fv_test_filter_roi, 
+        fv_test_filter_roi_whole, 0},
+    {"filter_roi", FV_16S, 1, 5, 2, 3, fv_test_filter_roi, 
+        fv_test_filter_roi_whole, 0},
+    {"filter_roi", FV_8U, 1, 5, 0, 4, fv_test_filter_sub_rect, 
+        fv_test_filter_rect_alone, 0},
+    {"filter_roi", FV_32F, 3, 5, 1, 2, fv_test_filter_sub_rect, 
+        fv_test_filter_rect_alone, 0},
+    {"filter_roi", FV_8U, 3, 0, 100, 4, fv_test_threshold_roi, 
+        fv_test_threshold_roi_whole, 0},
+    {"filter_roi", FV_32F, 1, 0, 50.25, 0, fv_test_threshold_roi, 
+        fv_test_threshold_roi_whole, 0},
+    /* in place, the DFT copy of a view holds all a wrap reads */
+    {"filter_roi", FV_8U, 1, 8, 0, FV_BORDER_WRAP, 
+        fv_test_filter2D_roi_in_place, fv_test_filter2D_roi, 0, {97, 61}},
+    {"filter_roi", FV_32F, 3, 8, 0, FV_BORDER_REFLECT, 
+        fv_test_filter2D_roi_in_place, fv_test_filter2D_roi, 0, {97, 61}},
+    /* 
+     * Direct and DFT add delta and round alike, the DFT sums in float:
+     * ties may round either way
+     */
+    {"filter2D", FV_8U, 1, 7, 0, FV_BORDER_REPLICATE, fv_test_filter2D, 
+        fv_test_filter2D_dft, 1, {97, 61}, NULL, 0.01},
+    {"filter2D", FV_8U, 1, 7, 5, FV_BORDER_REPLICATE, fv_test_filter2D, 
+        fv_test_filter2D_dft, 1, {97, 61}, NULL, 0.01},
+    {"filter2D", FV_8U, 1, 7, -3.5, FV_BORDER_REPLICATE, fv_test_filter2D,
+        fv_test_filter2D_dft, 1, {97, 61}, NULL, 0.01},
+    /* 
+     * In place, DFT tiles of 128 or less would read what earlier tiles
+     * wrote
+     */
+    {"filter2D", FV_8U, 3, 8, 0, FV_BORDER_WRAP, fv_test_filter2D_in_place,
+        fv_test_filter2D_dft, 0, {301, 203}},
+    {"filter2D", FV_32F, 1, 8, 2, FV_BORDER_REFLECT, 
+        fv_test_filter2D_in_place, fv_test_filter2D_dft, 0, {301, 203}},
+    /* 
+     * Against a separable reference in double with the same kernels,
+     * 8u filters with 8 bit fixed point ones
+     */
+    {"gaussian", FV_8U, 1, 5, 1.1, 0, fv_test_gaussian, 
+        fv_test_gaussian_sized, 2},
+    {"gaussian", FV_8U, 3, 7, 0, 0, fv_test_gaussian, 
+        fv_test_gaussian_sized, 2},
+    {"gaussian", FV_8U, 1, 0, 1.5, 0.7, fv_test_gaussian, 
+        fv_test_gaussian_sized, 2},
+    {"gaussian", FV_32F, 1, 9, 2, 0, fv_test_gaussian, 
+        fv_test_gaussian_sized, 0.01},
+    {"gaussian", FV_32F, 3, 0, 2.5, 0, fv_test_gaussian, 
+        fv_test_gaussian_sized, 0.01},
+    /* 
+     * The recursive filter is within 1% of the signal range of the
+     * sampled Gaussian, 8u rounds on top; sized from sigmas of 3 and
+     * up fv_gaussian_blur() takes it
+     */
+    {"gaussian_iir", FV_32F, 1, 0, 3, 3, fv_test_gaussian, 
+        fv_test_gaussian_sampled, 2.55, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_32F, 1, 0, 5, 2.5, fv_test_gaussian_iir, 
+        fv_test_gaussian_sampled, 2.55, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_32F, 1, 0, 2, 2, fv_test_gaussian_iir, 
+        fv_test_gaussian_sampled, 2.55, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_32F, 1, 0, 8, 4, fv_test_gaussian, 
+        fv_test_gaussian_sampled, 2.55, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_8U, 3, 0, 3, 3, fv_test_gaussian, 
+        fv_test_gaussian_sampled, 3.05, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_8U, 3, 0, 5, 2.5, fv_test_gaussian_iir, 
+        fv_test_gaussian_sampled, 3.05, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_8U, 3, 0, 2, 2, fv_test_gaussian_iir, 
+        fv_test_gaussian_sampled, 3.05, {0, 0}, fv_test_fill_blocks},
+    {"gaussian_iir", FV_8U, 3, 0, 8, 4, fv_test_gaussian, 
+        fv_test_gaussian_sampled, 3.05, {0, 0}, fv_test_fill_blocks},
+    /* sorting networks, then histograms for 8u */
+    {"median", FV_8U, 1, 3, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 3, 3, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 1, 5, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 3, 5, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 1, 7, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 4, 9, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_8U, 1, 15, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_16U, 1, 3, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_16S, 1, 5, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_16S, 2, 3, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_32F, 1, 3, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    {"median", FV_32F, 3, 5, 0, 0, fv_test_median, fv_test_median_ref, 0},
+    /* in place, the copy of a view keeps its neighbours */
+    {"median", FV_8U, 1, 5, 0, 1, fv_test_median_roi_in_place, 
+        fv_test_median_roi_whole, 0},
+    {"median", FV_8U, 3, 9, 0, 3, fv_test_median_roi_in_place, 
+        fv_test_median_roi_whole, 0},
+    /* direct, 8u rounds and the 32f range weights are interpolated */
+    {"bilateral", FV_8U, 1, 5, 30, 3, fv_test_bilateral, 
+        fv_test_bilateral_direct, 1, {0, 0}, fv_test_fill_blocks},
+    {"bilateral", FV_8U, 3, 5, 30, 3, fv_test_bilateral, 
+        fv_test_bilateral_direct, 1, {0, 0}, fv_test_fill_blocks},
+    {"bilateral", FV_8U, 1, 11, 30, 3, fv_test_bilateral, 
+        fv_test_bilateral_direct, 1, {0, 0}, fv_test_fill_blocks},
+    {"bilateral", FV_32F, 1, 7, 30, 3, fv_test_bilateral, 
+        fv_test_bilateral_direct, 0.05, {0, 0}, fv_test_fill_blocks},
+    {"bilateral", FV_32F, 3, 5, 30, 3, fv_test_bilateral, 
+        fv_test_bilateral_direct, 0.05, {0, 0}, fv_test_fill_blocks},
+    /* both sigmas large enough for the grid, close on the mean */
+    {"bilateral", FV_8U, 1, 0, 30, 5, fv_test_bilateral, 
+        fv_test_bilateral_full, 255, {0, 0}, fv_test_fill_blocks, 2.5},
+    {"bilateral", FV_8U, 3, 0, 30, 5, fv_test_bilateral, 
+        fv_test_bilateral_full, 255, {0, 0}, fv_test_fill_blocks, 2.5},
+    {"bilateral", FV_32F, 1, 0, 30, 5, fv_test_bilateral, 
+        fv_test_bilateral_full, 255, {0, 0}, fv_test_fill_blocks, 2.5},
+    /* 
+     * A range 2500 times sigma_color: the small grid still fits, the
+     * large one falls back to the direct filter, whose range weights
+     * are interpolated over bins of 2.4
+     */
+    {"bilateral", FV_32F, 1, 0, 4, 4, fv_test_bilateral, 
+        fv_test_bilateral_full, 10000, {0, 0}, fv_test_fill_wide, 2.5},
+    {"bilateral", FV_32F, 1, 0, 4, 4, fv_test_bilateral, 
+        fv_test_bilateral_direct, 0.5, {400, 300}, fv_test_fill_wide},
+    /* the sums of quarters are exact */
+    {"integral", FV_8U, 1, 0, 0, FV_32S, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_8U, 3, 0, 1, FV_32S, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_8U, 3, 0, 2, FV_32S, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_8U, 1, 0, 2, FV_64F, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_32F, 1, 0, 0, FV_64F, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_32F, 2, 0, 1, FV_64F, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    {"integral", FV_32F, 2, 0, 2, FV_64F, fv_test_integral, 
+        fv_test_integral_ref, 0, {0, 0}, NULL, 0, fv_test_integral_dst},
+    /* box filters in bands, 8u rounds */
+    {"integral", FV_8U, 1, 5, FV_32S, 1, fv_test_box_integral, 
+        fv_test_box_ref, 0.5, {53, 150}},
+    {"integral", FV_8U, 3, 9, FV_64F, 1, fv_test_box_integral, 
+        fv_test_box_ref, 0.5, {53, 150}},
+    {"integral", FV_32F, 1, 7, FV_64F, 0, fv_test_box_integral, 
+        fv_test_box_ref, 0.01, {53, 150}},
+    {"integral", FV_32F, 2, 3, FV_64F, 1, fv_test_box_integral, 
+        fv_test_box_ref, 0.001, {53, 150}},
+    {"integral", FV_32F, 1, 7, FV_64F, 0, fv_test_box_rect_sum, 
+        fv_test_box_ref, 0.01},
+    /* 
+     * Against box means in double, src as guide or a gray one; 8u
+     * rounds. Radius 30 is wider than the image, the tall one runs
+     * in bands.
+     */
+    {"guided", FV_8U, 1, 2, 100, 0, fv_test_guided, fv_test_guided_ref, 
+        0.5001, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_8U, 3, 4, 100, 0, fv_test_guided, fv_test_guided_ref, 
+        0.5001, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_8U, 3, 1, 100, 1, fv_test_guided, fv_test_guided_ref, 
+        0.5001, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_32F, 1, 9, 100, 0, fv_test_guided, fv_test_guided_ref, 
+        1e-3, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_32F, 3, 2, 100, 1, fv_test_guided, fv_test_guided_ref, 
+        1e-3, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_8U, 1, 30, 100, 1, fv_test_guided, fv_test_guided_ref, 
+        0.5001, {0, 0}, fv_test_fill_blocks},
+    {"guided", FV_8U, 3, 5, 100, 1, fv_test_guided, fv_test_guided_ref, 
+        0.5001, {53, 150}, fv_test_fill_blocks},
+    /* 
+     * Against the sectors of atan2: the tangents in fixed point pick
+     * the same neighbours here. The squares of two saturated
+     * derivatives of the checkers pass 2^31.
+     */
+    {"canny", FV_8U, 1, 3, 50, 150, fv_test_canny, fv_test_canny_ref, 0},
+    {"canny", FV_8U, 1, 3 | FV_CANNY_L2_GRADIENT, 50, 150, fv_test_canny, 
+        fv_test_canny_ref, 0, {0, 0}, fv_test_fill_blocks},
+    {"canny", FV_8U, 1, 5, 200, 600, fv_test_canny, fv_test_canny_ref, 0,
+        {0, 0}, fv_test_fill_blocks},
+    {"canny", FV_8U, 1, 5 | FV_CANNY_L2_GRADIENT, 80, 240, fv_test_canny, 
+        fv_test_canny_ref, 0},
+    {"canny", FV_8U, 1, 7, 800, 2400, fv_test_canny, fv_test_canny_ref, 0,
+        {0, 0}, fv_test_fill_checker},
+    {"canny", FV_8U, 1, 7 | FV_CANNY_L2_GRADIENT, 800, 2400, fv_test_canny,
+        fv_test_canny_ref, 0, {0, 0}, fv_test_fill_checker},
+    {"canny", FV_8U, 1, 7 | FV_CANNY_L2_GRADIENT, 20000, 40000, 
+        fv_test_canny, fv_test_canny_ref, 0, {0, 0}, fv_test_fill_checker},
+    {"canny_threads", FV_8U, 1, 3, 50, 2, fv_test_canny_threads, 
+        fv_test_canny_one_band, 0, {97, 150}, fv_test_fill_blocks},
+    {"canny_threads", FV_8U, 1, 5, 200, 3, fv_test_canny_threads, 
+        fv_test_canny_one_band, 0, {97, 150}, fv_test_fill_blocks},
+    {"canny_threads", FV_8U, 1, 3 | FV_CANNY_L2_GRADIENT, 50, 4, 
+        fv_test_canny_threads, fv_test_canny_one_band, 0, {97, 150}, 
+        fv_test_fill_blocks},
+    {"canny_threads", FV_8U, 1, 3, 50, 8, fv_test_canny_threads, 
+        fv_test_canny_one_band, 0, {97, 150}},
+    /* the integer 8u path against the float engine */
+    {"sobel_8u16s", FV_8U, 1, 3, 0, FV_BORDER_REFLECT_101, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    {"sobel_8u16s", FV_8U, 3, 3, 1, FV_BORDER_REPLICATE, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    {"sobel_8u16s", FV_8U, 1, 5, 0, FV_BORDER_CONSTANT, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    {"sobel_8u16s", FV_8U, 4, 5, 1, FV_BORDER_REFLECT_101, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    {"sobel_8u16s", FV_8U, 1, -1, 0, FV_BORDER_REFLECT, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    {"sobel_8u16s", FV_8U, 3, -1, 1, FV_BORDER_CONSTANT, fv_test_sobel, 
+        fv_test_sobel_ref, 0, {67, 150}, NULL, 0, fv_test_sobel_dst},
+    /* 
+     * Against the 2D kernel; the integer depths round, the views read
+     * their real neighbours
+     */
+    {"laplacian", FV_8U, 1, 1, 1, FV_16S, fv_test_laplacian, 
+        fv_test_laplacian_ref, 0.5001, {0, 0}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_8U, 3, 3, 1, FV_16S, fv_test_laplacian, 
+        fv_test_laplacian_ref, 0.5001, {67, 150}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_8U, 1, 5, 0.5, FV_16S, fv_test_laplacian, 
+        fv_test_laplacian_ref, 0.5001, {67, 150}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_8U, 4, 7, 1, FV_32F, fv_test_laplacian, 
+        fv_test_laplacian_ref, 0.01, {67, 150}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_32F, 1, 9, 0.01, FV_32F, fv_test_laplacian, 
+        fv_test_laplacian_ref, 0.01, {0, 0}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_32F, 3, 5, 1, FV_64F, fv_test_laplacian, 
+        fv_test_laplacian_ref, 1e-6, {0, 0}, NULL, 0, 
+        fv_test_laplacian_dst},
+    {"laplacian", FV_32F, 1, 3, 1, 4, fv_test_laplacian_roi, 
+        fv_test_laplacian_roi_whole, 1e-3},
+    {"laplacian", FV_32F, 3, 7, 1, 4, fv_test_laplacian_roi, 
+        fv_test_laplacian_roi_whole, 1e-3},
+    /* within the bounds of fv_fast_rsqrt() and fv_fast_atan2() */
+    {"cart_to_polar", FV_32F, 2, 0, 0, 0, fv_test_cart_to_polar, 
+        fv_test_zero_ref, 1, {67, 150}, fv_test_fill_polar, 0, 
+        fv_test_cart_to_polar_dst},
+    {"cart_to_polar", FV_32F, 2, 0, 1, 0, fv_test_cart_to_polar, 
+        fv_test_zero_ref, 1, {67, 150}, fv_test_fill_polar, 0, 
+        fv_test_cart_to_polar_dst},
+    {"cart_to_polar", FV_16S, 2, 0, 1, 0, fv_test_cart_to_polar, 
+        fv_test_zero_ref, 1, {67, 150}, fv_test_fill_polar, 0, 
+        fv_test_cart_to_polar_dst},
+    /* the van Herk/Gil-Werman passes against the min and max */
+    {"morph_rect", FV_8U, 1, 15, 1, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_8U, 3, 1, 13, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_8U, 1, 31, 21, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_8U, 1, 5, 11, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_32F, 1, 11, 11, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_32F, 3, 7, 9, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    /* every depth, the direct passes up to their vHGW thresholds */
+    {"morph_rect", FV_8U, 4, 65, 3, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_8U, 1, 63, 9, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_16U, 1, 9, 13, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_16S, 3, 3, 3, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_16S, 1, 17, 5, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_32F, 1, 8, 3, FV_MOP_DILATE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    {"morph_rect", FV_64F, 2, 7, 15, FV_MOP_ERODE, fv_test_morph_rect, 
+        fv_test_morph_rect_ref, 0, {67, 150}},
+    /* the fused pass against chained erode and dilate */
+    {"morphology_ex", FV_8U, 1, 3, FV_MOP_OPEN, 1, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0, {67, 150}},
+    {"morphology_ex", FV_8U, 3, 5, FV_MOP_CLOSE, 2, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0, {67, 150}},
+    {"morphology_ex", FV_8U, 1, 0, FV_MOP_GRADIENT, 1, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0, {67, 150}},
+    {"morphology_ex", FV_8U, 1, 0, FV_MOP_TOPHAT, 2, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0, {67, 150}},
+    {"morphology_ex", FV_8U, 4, 7, FV_MOP_BLACKHAT, 1, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0, {67, 150}},
+    {"morphology_ex", FV_16S, 3, 0, FV_MOP_OPEN, 2, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0},
+    {"morphology_ex", FV_16S, 1, 3, FV_MOP_TOPHAT, 1, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0},
+    {"morphology_ex", FV_32F, 1, 5, FV_MOP_GRADIENT, 2, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0},
+    {"morphology_ex", FV_32F, 1, 0, FV_MOP_BLACKHAT, 1, fv_test_morph_ex, 
+        fv_test_morph_ex_ref, 0},
+    {"morphology_ex", FV_8U, 1, 5, FV_MOP_CLOSE, 4, 
+        fv_test_morph_ex_roi_in_place, fv_test_morph_ex_roi_ref, 0},
+    {"morphology_ex", FV_8U, 3, 0, FV_MOP_TOPHAT, 4, 
+        fv_test_morph_ex_roi_in_place, fv_test_morph_ex_roi_ref, 0},
+    {"morphology_ex", FV_32F, 1, 3, FV_MOP_GRADIENT, 6, 
+        fv_test_morph_ex_roi_in_place, fv_test_morph_ex_roi_ref, 0},
+};
+
+#define fv_test_case_num (sizeof(fv_test_case)/sizeof(fv_test_case_t))
+
+static fv_s32
+fv_test_run_case(const fv_test_case_t *tc)
+{
+    fv_mat_t    *src;
+    fv_mat_t    *dst;
+    fv_mat_t    *ref;
+    fv_size_t   size = tc->tc_size;
+    double      max_diff;
+    double      mean;
+
+    if (size.sz_width == 0) {
+        size = fv_size(FV_TEST_COLS, FV_TEST_ROWS);
+    }
+    src = fv_test_create_mat(size.sz_height, size.sz_width, tc->tc_depth,
+            tc->tc_cn);
+    (tc->tc_fill != NULL ? tc->tc_fill : fv_test_fill_random)(src);
+    if (tc->tc_dst != NULL) {
+        dst = tc->tc_dst(src, tc);
+    } else {
+        dst = fv_test_create_mat(size.sz_height, size.sz_width, 
+                tc->tc_depth, tc->tc_cn);
+    }
+    ref = fv_test_create_mat(dst->mt_rows, dst->mt_cols, FV_64F, 
+            dst->mt_nchannel);
+
+    tc->tc_ref(ref, src, tc);
+    tc->tc_run(dst, src, tc);
+    max_diff = fv_test_diff(dst, ref, &mean);
+
+    fv_release_mat(&ref);
+    fv_release_mat(&dst);
+    fv_release_mat(&src);
+
+    if (max_diff > tc->tc_tol || (tc->tc_mean_tol > 0 && 
+                mean > tc->tc_mean_tol)) {
+        fprintf(stderr, "%s depth %d cn %d ksize %d (%g, %g): "
+                "max diff %g, mean %g!\n", tc->tc_name, tc->tc_depth, 
+                tc->tc_cn, tc->tc_ksize, tc->tc_p1, tc->tc_p2, max_diff, 
+                mean);
+        return FV_ERROR;
+    }
+
+    return FV_OK;
+}
+
+static fv_bool
+fv_test_has_case(char *name)
+{
+    fv_u32      i;
+
+    for (i = 0; i < fv_test_case_num; i++) {
+        if (strcmp(name, fv_test_case[i].tc_name) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static fv_s32
+fv_test_cases(char *name)
+{
+    fv_s32      ret = FV_OK;
+    fv_u32      i;
+
+    for (i = 0; i < fv_test_case_num; i++) {
+        if (strcmp(name, fv_test_case[i].tc_name) == 0) {
+            ret |= fv_test_run_case(&fv_test_case[i]);
+        }
+    }
+
+    if (ret == FV_OK) {
+        fprintf(stdout, "OK!\n");
+    }
+
+    return ret;
+}
+
+/* Names of the cases, once each */
+static void
+fv_test_list_cases(void)
+{
+    fv_u32      i;
+    fv_u32      j;
+
+    for (i = 0; i < fv_test_case_num; i++) {
+        for (j = 0; j < i; j++) {
+            if (strcmp(fv_test_case[i].tc_name, 
+                        fv_test_case[j].tc_name) == 0) {
+                break;
+            }
+        }
+        if (j == i) {
+            fprintf(stdout, "%s\n", fv_test_case[i].tc_name);
+        }
+    }
+}
@@ -9,6 +9,7 @@
 #include "fv_debug.h"
 #include "fv_imgproc.h"
 #include "fv_border.h"
+#include "fv_core.h"
 
 static fv_s32 fv_image_create_data(fv_arr *arr);
 static void fv_image_release_data(fv_arr *arr);
@@ -323,7 +324,7 @@ fv_image_get_size(fv_arr *arr)
     img = arr;
     if (img->ig_roi) {
         size.sz_width = img->ig_roi->ri_width;
-        size.sz_height = img->ig_roi->ri_width;
+        size.sz_height = img->ig_roi->ri_height;
     } else {
         size.sz_width = img->ig_width;
         size.sz_height = img->ig_height;
@@ -444,14 +445,48 @@ fv_create_mat(fv_s32 height, fv_s32 width, fv_u32 atr)
     return arr;
 }
 
+/*
+ * Copy n pixels of one channel between interleaved rows, dst and src
+ * advancing dst_pix and src_pix bytes a pixel.
+ */
+#define fv_copy_channel_core(type, dst, dst_pix, src, src_pix, n) \
+    do { \
+        fv_s32  i; \
+        for (i = 0; i < n; i++) { \
+            *(type *)(dst + i*dst_pix) = *(type *)(src + i*src_pix); \
+        } \
+    } while (0)
+
+static void
+fv_copy_channel(fv_u8 *dst, fv_s32 dst_pix, fv_u8 *src, fv_s32 src_pix,
+            fv_s32 n, fv_u32 elem_size)
+{
+    switch (elem_size) {
+        case 1:
+            fv_copy_channel_core(fv_u8, dst, dst_pix, src, src_pix, n);
+            break;
+        case 2:
+            fv_copy_channel_core(fv_u16, dst, dst_pix, src, src_pix, n);
+            break;
+        case 4:
+            fv_copy_channel_core(fv_u32, dst, dst_pix, src, src_pix, n);
+            break;
+        case 8:
+            fv_copy_channel_core(fv_u64, dst, dst_pix, src, src_pix, n);
+            break;
+        default:
+            FV_ASSERT(0);
+    }
+}
+
 fv_mat_t *
 fv_mat_extract_image_coi(fv_image_t *image) 
 {
     fv_mat_t    *mat;
     fv_roi_t    *roi;
     fv_u32      i;
-    fv_u32      j;
     fv_u32      elem_size;
+    fv_u32      pix_size;
     fv_s32      offset;
     fv_s32      atr = FV_IMAGE_GET_TYPE(image);
 
@@ -466,8 +501,9 @@ fv_mat_extract_image_coi(fv_image_t *image)
     FV_ASSERT(mat != NULL);
 
     elem_size = FV_ELEM_SIZE(mat->mt_atr);
+    pix_size = FV_ELEM_SIZE(atr);
     offset = roi->ri_y_offset*image->ig_width_step + 
-        roi->ri_x_offset*elem_size*image->ig_channels;
+        roi->ri_x_offset*pix_size;
     if (roi->ri_coi < 0) {
         for (i = 0; i < roi->ri_height; i++) {
             memcpy(mat->mt_data.dt_ptr + i*mat->mt_step, 
@@ -476,20 +512,127 @@ fv_mat_extract_image_coi(fv_image_t *image)
         }
     } else {
         FV_ASSERT(roi->ri_coi < image->ig_channels);
+        offset += elem_size*roi->ri_coi;
         for (i = 0; i < roi->ri_height; i++) {
-            for (j = 0; j < roi->ri_width; j++) {
-                memcpy(mat->mt_data.dt_ptr + i*mat->mt_step + j*elem_size,
-                        image->ig_image_data + offset +
-                        i*image->ig_width_step +
-                        j*elem_size*image->ig_channels +
-                        elem_size*roi->ri_coi, elem_size);
-            }
+            fv_copy_channel(mat->mt_data.dt_ptr + i*mat->mt_step, 
+                    elem_size, (fv_u8 *)image->ig_image_data + offset + 
+                    i*image->ig_width_step, pix_size, 
+                    roi->ri_width, elem_size);
         }
     }
 
     return mat;
 }
 
+/*
+ * Header for the ROI of image (the whole image without one) sharing
+ * the image data. The COI is not applied. The header remembers where
+ * the ROI lies in the image, so filters take the real pixels around
+ * it as its border.
+ */
+fv_mat_t
+fv_image_roi_to_mat(fv_image_t *image) 
+{
+    fv_mat_t    mat;
+    fv_roi_t    *roi = image->ig_roi;
+    fv_s32      atr = FV_IMAGE_GET_TYPE(image);
+
+    mat = fv_mat(image->ig_height, image->ig_width, atr, 
+            image->ig_image_data);
+    mat.mt_step = image->ig_width_step;
+    if (roi != NULL) {
+        fv_mat_get_roi_view(&mat, &mat, fv_rect(roi->ri_x_offset, 
+                    roi->ri_y_offset, roi->ri_width, roi->ri_height));
+    }
+
+    return mat;
+}
+
+/*
+ * The matrix an image operation works on: the ROI view of image or,
+ * with a COI set, a view into a single channel copy of the ROI and of
+ * up to margin pixels around it, which stay its real neighbours
+ * (borders wrapping around the image only see those). Destinations
+ * pass a negative margin and the copy is left unfilled. *coi_buf is
+ * set to the copy, NULL without a COI, and is handed back to
+ * fv_image_put_roi_view().
+ */
+fv_mat_t
+fv_image_get_roi_view(fv_image_t *image, fv_s32 margin, fv_mat_t **coi_buf)
+{
+    fv_mat_t    view;
+    fv_mat_t    *buf;
+    fv_roi_t    *roi = image->ig_roi;
+    fv_u8       *src;
+    fv_u32      elem_size;
+    fv_s32      x0;
+    fv_s32      y0;
+    fv_s32      x1;
+    fv_s32      y1;
+    fv_s32      m;
+    fv_s32      i;
+
+    *coi_buf = NULL;
+    view = fv_image_roi_to_mat(image);
+    if (roi == NULL || roi->ri_coi < 0) {
+        return view;
+    }
+
+    FV_ASSERT(roi->ri_coi < image->ig_channels);
+    m = fv_max(margin, 0);
+    x0 = fv_max(roi->ri_x_offset - m, 0);
+    y0 = fv_max(roi->ri_y_offset - m, 0);
+    x1 = fv_min(roi->ri_x_offset + roi->ri_width + m, image->ig_width);
+    y1 = fv_min(roi->ri_y_offset + roi->ri_height + m, image->ig_height);
+    buf = fv_create_mat(y1 - y0, x1 - x0, FV_MAKETYPE(image->ig_depth, 1));
+    FV_ASSERT(buf != NULL);
+
+    if (margin >= 0) {
+        elem_size = FV_ELEM_SIZE(buf->mt_atr);
+        src = (fv_u8 *)image->ig_image_data + y0*image->ig_width_step + 
+            (x0*image->ig_channels + roi->ri_coi)*elem_size;
+        for (i = 0; i < buf->mt_rows; i++, src += image->ig_width_step) {
+            fv_copy_channel(buf->mt_data.dt_ptr + i*buf->mt_step, 
+                    elem_size, src, elem_size*image->ig_channels, 
+                    buf->mt_cols, elem_size);
+        }
+    }
+
+    fv_mat_get_roi_view(&view, buf, fv_rect(roi->ri_x_offset - x0, 
+                roi->ri_y_offset - y0, roi->ri_width, roi->ri_height));
+    *coi_buf = buf;
+
+    return view;
+}
+
+/*
+ * Write a view from fv_image_get_roi_view() back to the COI of image
+ * and release its copy. Views of the image data itself need nothing.
+ */
+void
+fv_image_put_roi_view(fv_image_t *image, fv_mat_t *view, fv_mat_t **coi_buf)
+{
+    fv_roi_t    *roi = image->ig_roi;
+    fv_u8       *dst;
+    fv_u32      elem_size;
+    fv_s32      i;
+
+    if (*coi_buf == NULL) {
+        return;
+    }
+
+    elem_size = FV_MAT_ELEM_SIZE(view);
+    dst = (fv_u8 *)image->ig_image_data + 
+        roi->ri_y_offset*image->ig_width_step + 
+        (roi->ri_x_offset*image->ig_channels + roi->ri_coi)*elem_size;
+    for (i = 0; i < view->mt_rows; i++, dst += image->ig_width_step) {
+        fv_copy_channel(dst, elem_size*image->ig_channels, 
+                view->mt_data.dt_ptr + i*view->mt_step, elem_size,
+                view->mt_cols, elem_size);
+    }
+    fv_release_mat(coi_buf);
+}
+
 static void  
 fv_mat_dec_ref_data(fv_arr *arr)
 {
@@ -604,7 +747,7 @@ fv_copy_mat(fv_mat_t *dst, fv_mat_t *src)
             dst->mt_rows == src->mt_rows &&
             dst->mt_cols == src->mt_cols);
 
-    step = dst->mt_cols*FV_MAT_ELEM_SIZE(dst);
+    step = dst->mt_cols*FV_ELEM_SIZE(dst->mt_atr);
     for (i = 0; i < dst->mt_rows; i++) {
         memcpy(dst->mt_data.dt_ptr + i*dst->mt_step, 
                 src->mt_data.dt_ptr + i*src->mt_step,
@@ -793,15 +936,62 @@ fv_convert_mat(fv_mat_t *dst, fv_mat_t *src)
     FV_LOG_ERR("Unknow convert format!\n");
 }
 
+/*
+ * Where mat lies in the whole matrix it is a view of: its offset
+ * there and the whole size, itself for a whole matrix.
+ */
+void
+fv_mat_locate_roi(fv_mat_t *mat, fv_size_t *whole, fv_point_t *ofs)
+{
+    if (mat->mt_whole.sz_width == 0) {
+        *whole = fv_size(mat->mt_cols, mat->mt_rows);
+        *ofs = fv_point(0, 0);
+        return;
+    }
+
+    *whole = mat->mt_whole;
+    *ofs = mat->mt_roi_ofs;
+}
+
+/*
+ * Header for rect of src sharing its data. submat is a matrix of its
+ * own: filters build its border from its pixels alone, as they always
+ * did. fv_mat_get_roi_view() makes a view that keeps its neighbours.
+ */
 void
 fv_get_sub_rect(fv_mat_t *submat, fv_mat_t *src, fv_rect_t rect)
 {
     submat->mt_data.dt_ptr = src->mt_data.dt_ptr + 
         rect.rt_point.pt_y*src->mt_step + 
-        rect.rt_point.pt_x*FV_MAT_ELEM_SIZE(src);
+        rect.rt_point.pt_x*FV_ELEM_SIZE(src->mt_atr);
     submat->mt_cols = rect.rt_size.sz_width;
     submat->mt_rows = rect.rt_size.sz_height;
+    submat->mt_total = submat->mt_rows*submat->mt_cols;
     submat->mt_step = src->mt_step;
     submat->mt_atr = src->mt_atr;
+    submat->mt_depth = src->mt_depth;
+    submat->mt_roi_ofs = fv_point(0, 0);
+    submat->mt_whole = fv_size(0, 0);
+}
+
+/*
+ * ROI view of rect of src, which must lie inside src. The view
+ * records where it lies in the whole matrix src belongs to, so
+ * filters read the pixels around it as its border.
+ */
+void
+fv_mat_get_roi_view(fv_mat_t *view, fv_mat_t *src, fv_rect_t rect)
+{
+    fv_size_t   whole;
+    fv_point_t  ofs;
+
+    FV_ASSERT(rect.rt_x >= 0 && rect.rt_y >= 0 && 
+            rect.rt_x + rect.rt_width <= src->mt_cols &&
+            rect.rt_y + rect.rt_height <= src->mt_rows);
+
+    fv_mat_locate_roi(src, &whole, &ofs);
+    fv_get_sub_rect(view, src, rect);
+    view->mt_roi_ofs = fv_point(ofs.pt_x + rect.rt_x, ofs.pt_y + rect.rt_y);
+    view->mt_whole = whole;
 }
 
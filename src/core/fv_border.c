@@ -1,6 +1,9 @@
 #include <string.h>
 
 #include "fv_types.h"
+#include "fv_core.h"
+#include "fv_math.h"
+#include "fv_mem.h"
 #include "fv_imgproc.h"
 #include "fv_debug.h"
 #include "fv_border.h"
@@ -225,3 +228,139 @@ fv_border_get_func(fv_u32 depth)
     return fv_border_make_tab[depth];
 }
 
+/*
+ * Where src lies in the matrix its border extends: the whole matrix
+ * of an ROI view, src itself for isolated maps.
+ */
+static void
+fv_border_map_locate(fv_border_map_t *bm, fv_mat_t *src)
+{
+    bm->bm_rows = src->mt_rows;
+    if (bm->bm_isolated) {
+        bm->bm_whole = fv_size(src->mt_cols, src->mt_rows);
+        bm->bm_ofs = fv_point(0, 0);
+        return;
+    }
+
+    fv_mat_locate_roi(src, &bm->bm_whole, &bm->bm_ofs);
+}
+
+void
+fv_border_map_init(fv_border_map_t *bm, fv_mat_t *src, fv_s32 left,
+            fv_s32 right, fv_s32 border_type)
+{
+    fv_s32      i;
+    fv_s32      c;
+
+    bm->bm_left = left;
+    bm->bm_right = right;
+    bm->bm_cols = src->mt_cols;
+    bm->bm_pix = FV_ELEM_SIZE(src->mt_atr);
+    bm->bm_border_type = border_type & ~FV_BORDER_ISOLATED;
+    bm->bm_isolated = (border_type & FV_BORDER_ISOLATED) != 0;
+    fv_border_map_locate(bm, src);
+
+    bm->bm_xmap = fv_alloc(fv_max(left + right, 1)*sizeof(*bm->bm_xmap));
+    FV_ASSERT(bm->bm_xmap != NULL);
+    for (i = 0; i < left + right; i++) {
+        c = (i < left ? i - left : src->mt_cols + i - left) +
+            bm->bm_ofs.pt_x;
+        if (c < 0 || c >= bm->bm_whole.sz_width) {
+            if (bm->bm_border_type == FV_BORDER_CONSTANT) {
+                bm->bm_xmap[i] = FV_BORDER_MAP_ZERO;
+                continue;
+            }
+            c = fv_border_get_value(bm->bm_border_type, c,
+                    bm->bm_whole.sz_width);
+        }
+        bm->bm_xmap[i] = c - bm->bm_ofs.pt_x;
+    }
+}
+
+/*
+ * Map src, a frame as wide as the one bm was made for, whose columns
+ * around it are read the same way; rows may differ.
+ */
+void
+fv_border_map_rebind(fv_border_map_t *bm, fv_mat_t *src)
+{
+    fv_size_t   whole = bm->bm_whole;
+    fv_point_t  ofs = bm->bm_ofs;
+
+    FV_ASSERT(src->mt_cols == bm->bm_cols);
+    fv_border_map_locate(bm, src);
+    FV_ASSERT(bm->bm_whole.sz_width == whole.sz_width &&
+            bm->bm_ofs.pt_x == ofs.pt_x);
+}
+
+void
+fv_border_map_release(fv_border_map_t *bm)
+{
+    fv_free(&bm->bm_xmap);
+}
+
+/*
+ * The row of the view that row y of the filter reads (outside the
+ * view for its neighbours), FV_BORDER_MAP_ZERO for zeros.
+ */
+fv_s32
+fv_border_map_y(fv_border_map_t *bm, fv_s32 y)
+{
+    if (y >= 0 && y < bm->bm_rows) {
+        return y;
+    }
+
+    y += bm->bm_ofs.pt_y;
+    if (y < 0 || y >= bm->bm_whole.sz_height) {
+        if (bm->bm_border_type == FV_BORDER_CONSTANT) {
+            return FV_BORDER_MAP_ZERO;
+        }
+        y = fv_border_get_value(bm->bm_border_type, y,
+                bm->bm_whole.sz_height);
+    }
+
+    return y - bm->bm_ofs.pt_y;
+}
+
+/*
+ * The view row s (NULL for zeros) with its borders into d. s may
+ * already be in place in d.
+ */
+void
+fv_border_map_row(fv_border_map_t *bm, fv_u8 *d, fv_u8 *s)
+{
+    fv_u8       *p;
+    fv_s32      pix = bm->bm_pix;
+    fv_s32      left = bm->bm_left;
+    fv_s32      i;
+    fv_s32      c;
+
+    if (s == NULL) {
+        memset(d, 0, (bm->bm_cols + left + bm->bm_right)*pix);
+        return;
+    }
+
+    if (s != d + left*pix) {
+        memcpy(d + left*pix, s, bm->bm_cols*pix);
+    }
+    for (i = 0; i < left + bm->bm_right; i++) {
+        c = bm->bm_xmap[i];
+        p = d + (i < left ? i : bm->bm_cols + i)*pix;
+        if (c == FV_BORDER_MAP_ZERO) {
+            memset(p, 0, pix);
+        } else {
+            memcpy(p, s + c*pix, pix);
+        }
+    }
+}
+
+/*
+ * Row y of the filter over src with its borders into d.
+ */
+void
+fv_border_map_read(fv_border_map_t *bm, fv_mat_t *src, fv_u8 *d, fv_s32 y)
+{
+    y = fv_border_map_y(bm, y);
+    fv_border_map_row(bm, d, y == FV_BORDER_MAP_ZERO ? NULL :
+            src->mt_data.dt_ptr + y*src->mt_step);
+}
@@ -187,13 +187,10 @@ fv_corner_eigen_vals_vecs(fv_mat_t *dst, fv_mat_t *src,
 
     FV_LOG_PRINT("scale = %f\n", scale);
     if (aperture_size > 0) {
-        _fv_sobel(dx, src, FV_DEPTH_32F, 1, 0, aperture_size, 
-                scale, 0, border_type);
-        _fv_sobel(dy, src, FV_DEPTH_32F, 0, 1, aperture_size, 
+        _fv_sobel_dxdy(dx, dy, src, FV_DEPTH_32F, aperture_size, 
                 scale, 0, border_type);
     } else {
-        _fv_scharr(dx, src, FV_DEPTH_32F, 1, 0, scale, 0, border_type);
-        _fv_scharr(dy, src, FV_DEPTH_32F, 0, 1, scale, 0, border_type);
+        _fv_scharr_dxdy(dx, dy, src, FV_DEPTH_32F, scale, 0, border_type);
     }
 
     cov = fv_create_mat(src->mt_rows, src->mt_cols, FV_32FC3);
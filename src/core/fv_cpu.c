@@ -0,0 +1,56 @@
+#include <pthread.h>
+
+#include "fv_types.h"
+#include "fv_cpu.h"
+
+static fv_bool fv_optimized = 1;
+static fv_u32 fv_cpu_feature_bits;
+static pthread_once_t fv_cpu_once = PTHREAD_ONCE_INIT;
+
+static void
+fv_cpu_detect(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        fv_cpu_feature_bits |= FV_CPU_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        fv_cpu_feature_bits |= FV_CPU_AVX2;
+    }
+#endif
+}
+
+/* 
+ * Checked once at the first call; threads calling meanwhile wait for
+ * the result.
+ */
+fv_u32
+fv_cpu_features(void)
+{
+    pthread_once(&fv_cpu_once, fv_cpu_detect);
+
+    return fv_cpu_feature_bits;
+}
+
+/* 
+ * Always false while optimized code is switched off, so the scalar
+ * functions can be used as reference.
+ */
+fv_bool
+fv_cpu_has(fv_u32 feature)
+{
+    return fv_optimized && (fv_cpu_features() & feature) == feature;
+}
+
+void
+fv_set_use_optimized(fv_bool on)
+{
+    fv_optimized = on;
+}
+
+fv_bool
+fv_use_optimized(void)
+{
+    return fv_optimized;
+}
@@ -257,7 +257,6 @@ fv_dft(fv_mat_t *dst, fv_mat_t *src, fv_s32 flags, fv_s32 nonzero_rows)
     dst_data = dst->mt_data.dt_fl;
     src_data = src->mt_data.dt_fl;
     step = 2*width;
-    fv_time_meter_set(3);
     for (row = 0; row < height; row++, dst_data += step, src_data += width) {
         fv_fft_real(dst_data, src_data, width, m, pi2);
     }
@@ -271,7 +270,6 @@ fv_dft(fv_mat_t *dst, fv_mat_t *src, fv_s32 flags, fv_s32 nonzero_rows)
                     sizeof(*col_data)*2);
         }
     }
-    fv_time_meter_get(3, 0);
     fv_release_mat(&column);
 }
 
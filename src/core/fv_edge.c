@@ -5,8 +5,16 @@
 #include "fv_log.h"
 #include "fv_mem.h"
 #include "fv_filter.h"
+#include "fv_border.h"
+#include "fv_edge.h"
 #include "fv_debug.h"
 #include "fv_time.h"
+#include "fv_thread.h"
+
+#define FV_CANNY_SHIFT      15
+/* tan(22.5) << FV_CANNY_SHIFT */
+#define FV_CANNY_TG22 \
+    ((fv_s32)(0.4142135623730950488*(1 << FV_CANNY_SHIFT) + 0.5))
 
 static void 
 _fv_get_scharr_kernels(fv_mat_t **_kx, fv_mat_t **_ky,
@@ -157,6 +165,259 @@ fv_get_deriv_kernels(fv_mat_t **kx, fv_mat_t **ky, fv_s32 dx, fv_s32 dy,
     }
 }
 
+/*
+ * Sobel (ksize 3 and 5) and Scharr derivatives of 8u images into 16s
+ * in integers: the column pass gives the smoothed and differenced
+ * sums of 2r + 1 source rows in 16 bits, the row pass applies the
+ * other kernel to them. No sum gets past 16 bits (ksize 5 tops at
+ * 255*6*16), so the results need no saturation and are what the
+ * float engine gives.
+ */
+#define FV_SOBEL_BLOCK              16
+#define FV_SOBEL_BAND_MIN_ROWS      16
+
+typedef struct _fv_sobel_t {
+    fv_mat_t        *sb_src;
+    fv_mat_t        *sb_dx;
+    fv_mat_t        *sb_dy;
+    fv_s32          sb_ksize;
+    fv_border_map_t     sb_border;
+    fv_s32          sb_len;
+    fv_s32          sb_band_rows;
+} fv_sobel_t;
+
+static inline void
+fv_sobel_col3_block(fv_s16 *restrict d, const fv_u8 *restrict s0,
+            const fv_u8 *restrict s1, const fv_u8 *restrict s2,
+            fv_s32 k0, fv_s32 k1, fv_s32 k2)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_SOBEL_BLOCK; i++) {
+        d[i] = (fv_s16)(k0*s0[i] + k1*s1[i] + k2*s2[i]);
+    }
+}
+
+static inline void
+fv_sobel_col5_block(fv_s16 *restrict d, const fv_u8 *restrict s0,
+            const fv_u8 *restrict s1, const fv_u8 *restrict s2,
+            const fv_u8 *restrict s3, const fv_u8 *restrict s4,
+            fv_s32 k0, fv_s32 k1, fv_s32 k2, fv_s32 k3, fv_s32 k4)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_SOBEL_BLOCK; i++) {
+        d[i] = (fv_s16)(k0*s0[i] + k1*s1[i] + k2*s2[i] + k3*s3[i] +
+                k4*s4[i]);
+    }
+}
+
+static inline void
+fv_sobel_row3_block(fv_s16 *restrict d, const fv_s16 *restrict s,
+            fv_s32 cn, fv_s32 k0, fv_s32 k1, fv_s32 k2)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_SOBEL_BLOCK; i++) {
+        d[i] = (fv_s16)(k0*s[i] + k1*s[i + cn] + k2*s[i + 2*cn]);
+    }
+}
+
+static inline void
+fv_sobel_row5_block(fv_s16 *restrict d, const fv_s16 *restrict s,
+            fv_s32 cn, fv_s32 k0, fv_s32 k1, fv_s32 k2, fv_s32 k3,
+            fv_s32 k4)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_SOBEL_BLOCK; i++) {
+        d[i] = (fv_s16)(k0*s[i] + k1*s[i + cn] + k2*s[i + 2*cn] +
+                k3*s[i + 3*cn] + k4*s[i + 4*cn]);
+    }
+}
+
+static void
+fv_sobel_band(void *arg, fv_s32 index)
+{
+    fv_sobel_t      *sb = arg;
+    fv_mat_t        *dx = sb->sb_dx;
+    fv_mat_t        *dy = sb->sb_dy;
+    fv_u8           *rows[5];
+    fv_u8           *buf;
+    fv_u8           *t;
+    fv_s16          *vs;
+    fv_s16          *vd;
+    fv_s16          *ox;
+    fv_s16          *oy;
+    fv_s32          cn = sb->sb_src->mt_nchannel;
+    fv_s32          r = sb->sb_border.bm_left;
+    fv_s32          n = sb->sb_src->mt_cols*cn;
+    fv_s32          len = sb->sb_len;
+    fv_s32          y0 = index*sb->sb_band_rows;
+    fv_s32          y1;
+    fv_s32          y;
+    fv_s32          i;
+    fv_s32          k;
+
+    y1 = fv_min(y0 + sb->sb_band_rows, sb->sb_src->mt_rows);
+    if (y0 >= y1) {
+        return;
+    }
+
+    /* 2r + 1 source rows, then the column sums and the two outputs */
+    buf = fv_calloc((2*r + 1)*len + 4*len*sizeof(fv_s16));
+    FV_ASSERT(buf != NULL);
+    vs = (fv_s16 *)(buf + (2*r + 1)*len);
+    vd = vs + len;
+    ox = vd + len;
+    oy = ox + len;
+    for (k = 0; k < 2*r + 1; k++) {
+        rows[k] = buf + k*len;
+        if (k < 2*r) {
+            fv_border_map_read(&sb->sb_border, sb->sb_src, rows[k],
+                    y0 + k - r);
+        }
+    }
+
+    for (y = y0; y < y1; y++) {
+        /* rows[] holds source rows y - r .. y + r */
+        fv_border_map_read(&sb->sb_border, sb->sb_src, rows[2*r],
+                y + r);
+        for (i = 0; i < len; i += FV_SOBEL_BLOCK) {
+            switch (sb->sb_ksize) {
+            case 3:
+                if (dx != NULL) {
+                    fv_sobel_col3_block(vs + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, 1, 2, 1);
+                }
+                if (dy != NULL) {
+                    fv_sobel_col3_block(vd + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, -1, 0, 1);
+                }
+                break;
+            case 5:
+                if (dx != NULL) {
+                    fv_sobel_col5_block(vs + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, rows[3] + i, rows[4] + i,
+                            1, 4, 6, 4, 1);
+                }
+                if (dy != NULL) {
+                    fv_sobel_col5_block(vd + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, rows[3] + i, rows[4] + i,
+                            -1, -2, 0, 2, 1);
+                }
+                break;
+            default:
+                if (dx != NULL) {
+                    fv_sobel_col3_block(vs + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, 3, 10, 3);
+                }
+                if (dy != NULL) {
+                    fv_sobel_col3_block(vd + i, rows[0] + i, rows[1] + i,
+                            rows[2] + i, -1, 0, 1);
+                }
+                break;
+            }
+        }
+
+        for (i = 0; i < n; i += FV_SOBEL_BLOCK) {
+            switch (sb->sb_ksize) {
+            case 3:
+                if (dx != NULL) {
+                    fv_sobel_row3_block(ox + i, vs + i, cn, -1, 0, 1);
+                }
+                if (dy != NULL) {
+                    fv_sobel_row3_block(oy + i, vd + i, cn, 1, 2, 1);
+                }
+                break;
+            case 5:
+                if (dx != NULL) {
+                    fv_sobel_row5_block(ox + i, vs + i, cn, -1, -2, 0, 2, 1);
+                }
+                if (dy != NULL) {
+                    fv_sobel_row5_block(oy + i, vd + i, cn, 1, 4, 6, 4, 1);
+                }
+                break;
+            default:
+                if (dx != NULL) {
+                    fv_sobel_row3_block(ox + i, vs + i, cn, -1, 0, 1);
+                }
+                if (dy != NULL) {
+                    fv_sobel_row3_block(oy + i, vd + i, cn, 3, 10, 3);
+                }
+                break;
+            }
+        }
+
+        if (dx != NULL) {
+            memcpy(dx->mt_data.dt_ptr + y*dx->mt_step, ox, n*sizeof(*ox));
+        }
+        if (dy != NULL) {
+            memcpy(dy->mt_data.dt_ptr + y*dy->mt_step, oy, n*sizeof(*oy));
+        }
+
+        t = rows[0];
+        for (k = 0; k < 2*r; k++) {
+            rows[k] = rows[k + 1];
+        }
+        rows[2*r] = t;
+    }
+
+    fv_free(&buf);
+}
+
+/*
+ * dx and/or dy (either may be NULL) of an 8u src into 16s by the
+ * integer path. Returns false, computing nothing, for the sizes,
+ * depths, scales and deltas it does not cover.
+ */
+static fv_bool
+fv_sobel_8u16s(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, fv_s32 ksize,
+            double scale, double delta, fv_s32 border_type)
+{
+    fv_sobel_t      sb;
+    fv_mat_t        *d[2] = {dx, dy};
+    fv_s32          cn = src->mt_nchannel;
+    fv_s32          r;
+    fv_s32          i;
+
+    if (ksize <= 0) {
+        ksize = 0;
+    } else if (ksize != 3 && ksize != 5) {
+        return false;
+    }
+
+    if (src->mt_depth != FV_8U || scale != 1 || delta != 0) {
+        return false;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (d[i] != NULL && (d[i]->mt_depth != FV_16S ||
+                    d[i]->mt_nchannel != cn ||
+                    d[i]->mt_rows != src->mt_rows ||
+                    d[i]->mt_cols != src->mt_cols)) {
+            return false;
+        }
+    }
+
+    sb.sb_src = src;
+    sb.sb_dx = dx;
+    sb.sb_dy = dy;
+    sb.sb_ksize = ksize;
+    r = ksize == 5 ? 2 : 1;
+    fv_border_map_init(&sb.sb_border, src, r, r, border_type);
+
+    /* whole blocks of row, and room for the row pass to read past them */
+    sb.sb_len = fv_align(src->mt_cols*cn, FV_SOBEL_BLOCK) +
+        fv_align(2*r*cn, FV_SOBEL_BLOCK);
+    fv_parallel_bands(src->mt_rows, FV_SOBEL_BAND_MIN_ROWS, &sb.sb_band_rows,
+            fv_sobel_band, &sb);
+
+    fv_border_map_release(&sb.sb_border);
+
+    return true;
+}
+
 static void
 fv_edge_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx, 
                 fv_s32 dy, fv_s32 ksize, double scale, double delta, 
@@ -167,6 +428,12 @@ fv_edge_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx,
     fv_mat_t    *ky;
     fv_s32      ktype;// = std::max(CV_32F, std::max(ddepth, src.depth()));
 
+    if (dx + dy == 1 && fv_sobel_8u16s(dx ? dst : NULL, dy ? dst : NULL,
+                src, ksize, scale, delta, border_type)) {
+        fv_debug_save_img("Sobel", dst);
+        return;
+    }
+
     ktype = fv_max(ddepth, FV_MAT_DEPTH(src));
     get_kernels(&kx, &ky, dx, dy, ksize, false, ktype);
     if (scale != 1) {
@@ -179,9 +446,6 @@ fv_edge_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx,
         }
     }
 
-    printf("kx[%f %f %f], ky[%f %f %f]\n", 
-            kx->mt_data.dt_fl[0], kx->mt_data.dt_fl[1],kx->mt_data.dt_fl[2],
-            ky->mt_data.dt_fl[0], ky->mt_data.dt_fl[1],ky->mt_data.dt_fl[2]);
     fv_sep_filter2D(dst, src, kx, ky, fv_point(-1, -1), 
             delta, border_type);
     fv_release_mat(&ky);
@@ -190,6 +454,55 @@ fv_edge_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx,
     fv_debug_save_img("Sobel", dst);
 }
 
+/*
+ * dx and dy derivatives in one pass: the source is read, bordered
+ * and row filtered for both outputs together. Kernels of different
+ * sizes (ksize 1) are filtered one after the other.
+ */
+static void
+fv_edge_filter_dxdy(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, 
+                fv_s32 ddepth, fv_s32 ksize, double scale, double delta, 
+                fv_s32 border_type, void (*get_kernels)(fv_mat_t **, 
+                    fv_mat_t **, fv_s32, fv_s32, fv_s32, fv_bool, fv_s32))
+{
+    fv_mat_t    *kx[2];
+    fv_mat_t    *ky[2];
+    fv_s32      ktype;
+    fv_s32      k;
+
+    if (fv_sobel_8u16s(dx, dy, src, ksize, scale, delta, border_type)) {
+        return;
+    }
+
+    ktype = fv_max(ddepth, FV_MAT_DEPTH(src));
+    for (k = 0; k < 2; k++) {
+        get_kernels(&kx[k], &ky[k], k == 0, k == 1, ksize, false, ktype);
+        if (scale != 1) {
+            if (k == 1) {
+                fv_mset_scale((*kx[k]), scale, float);
+            } else {
+                fv_mset_scale((*ky[k]), scale, float);
+            }
+        }
+    }
+
+    if (kx[0]->mt_rows == kx[1]->mt_rows && 
+            ky[0]->mt_rows == ky[1]->mt_rows) {
+        fv_sep_filter2D_dual(dx, dy, src, kx[0], ky[0], kx[1], ky[1],
+                fv_point(-1, -1), delta, border_type);
+    } else {
+        fv_sep_filter2D(dx, src, kx[0], ky[0], fv_point(-1, -1), 
+                delta, border_type);
+        fv_sep_filter2D(dy, src, kx[1], ky[1], fv_point(-1, -1), 
+                delta, border_type);
+    }
+
+    for (k = 0; k < 2; k++) {
+        fv_release_mat(&ky[k]);
+        fv_release_mat(&kx[k]);
+    }
+}
+
 void 
 _fv_sobel(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx, 
                 fv_s32 dy, fv_s32 ksize, double scale, double delta, 
@@ -205,13 +518,17 @@ fv_sobel(fv_image_t *dst, fv_image_t *src, fv_s32 dx,
 {
     fv_mat_t    _dst;
     fv_mat_t    _src;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
 
     FV_ASSERT(src->ig_image_size == dst->ig_image_size && 
             src->ig_channels == dst->ig_channels);
 
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
+    _src = fv_image_get_roi_view(src, fv_max(aperture_size/2, 1), &src_coi);
+    _dst = fv_image_get_roi_view(dst, -1, &dst_coi);
     _fv_sobel(&_dst, &_src, src->ig_depth, dx, dy, aperture_size, 1, 0, 0);
+    fv_image_put_roi_view(dst, &_dst, &dst_coi);
+    fv_release_mat(&src_coi);
 }
 
 void
@@ -222,136 +539,379 @@ _fv_scharr(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_s32 dx,
             fv_get_scharr_kernels);
 }
 
-#define fv_grad_add_core(dst, src1, src2, total, castop) \
-    do { \
-        fv_s32      i; \
-        \
-        for (i = 0; i < total; i++, dst++, src1++, src2++) { \
-            *dst = castop((*src1 + *src2)); \
-        } \
-    } while(0)
-
-
-static void
-fv_grad_add_8u(fv_u8 *dst, double *src1, double *src2, fv_u32 total)
+/*
+ * First order Sobel derivatives in x (to dx) and y (to dy), computed
+ * together. Gives the same results as two _fv_sobel() calls.
+ */
+void 
+_fv_sobel_dxdy(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, fv_s32 ddepth, 
+                fv_s32 ksize, double scale, double delta, 
+                fv_s32 border_type)
 {
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
+    fv_edge_filter_dxdy(dx, dy, src, ddepth, ksize, scale, delta, 
+            border_type, fv_get_deriv_kernels);
 }
 
-static void
-fv_grad_add_8s(fv_s8 *dst, double *src1, double *src2, fv_u32 total)
+void
+_fv_scharr_dxdy(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, fv_s32 ddepth, 
+                double scale, double delta, fv_s32 border_type)
 {
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
+    fv_edge_filter_dxdy(dx, dy, src, ddepth, 0, scale, delta, border_type, 
+            fv_get_scharr_kernels);
 }
 
-static void
-fv_grad_add_16u(fv_u16 *dst, double *src1, double *src2, fv_u32 total)
-{
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
-}
+/*
+ * Laplacian: d2/dx2 + d2/dy2 with the Sobel kernels, a row of it at a
+ * time. Every source row is filtered once by the second derivative and
+ * once by the smoothing kernel along x; the last ksize of those rows
+ * are kept in rings and the column pass applies the other kernel to
+ * each and sums the two into dst. Rows are float, double when src or
+ * dst is 64f.
+ */
+#define FV_LAPLACIAN_BLOCK          16
+#define FV_LAPLACIAN_BAND_MIN_ROWS  16
+#define FV_LAPLACIAN_MAX_KSIZE      31
+
+typedef void (*fv_laplacian_load_func)(void *, void *, fv_s32);
+typedef void (*fv_laplacian_store_func)(void *, void *, fv_s32, double,
+            double);
+typedef void (*fv_laplacian_band_func)(void *, fv_s32);
+
+typedef struct _fv_laplacian_t {
+    fv_mat_t                *lp_dst;
+    fv_mat_t                *lp_src;
+    fv_mat_t                *lp_kd;
+    fv_mat_t                *lp_ks;
+    fv_s32                  lp_ksize;
+    double                  lp_scale;
+    double                  lp_delta;
+    fv_border_map_t         lp_border;
+    fv_laplacian_load_func  lp_load;
+    fv_laplacian_store_func lp_store;
+    fv_s32                  lp_len;
+    fv_s32                  lp_band_rows;
+} fv_laplacian_t;
+
+/* saturated, then rounded half up: v - lo is not negative */
+#define fv_laplacian_round(v, lo, hi) \
+    ({ \
+        typeof(v)   _v = (v); \
+        _v = _v < lo ? lo : _v; \
+        _v = _v > hi ? hi : _v; \
+        (fv_s32)(_v - lo + (typeof(v))0.5) + lo; \
+     })
+#define fv_laplacian_cast_8u(v) fv_laplacian_round(v, 0, 255)
+#define fv_laplacian_cast_8s(v) fv_laplacian_round(v, -128, 127)
+#define fv_laplacian_cast_16u(v) fv_laplacian_round(v, 0, 65535)
+#define fv_laplacian_cast_16s(v) \
+    fv_laplacian_round(v, fv_short_min, fv_short_max)
+#define fv_laplacian_cast_32s(v) \
+    ((fv_s32)lrint(fv_saturate_cast((double)(v), fv_int_max, fv_int_min)))
+#define fv_laplacian_cast_32f(v) (v)
+#define fv_laplacian_cast_64f(v) (v)
+
+/*
+ * Whole blocks first, the compiler only vectorizes loops of a known
+ * length.
+ */
+#define fv_laplacian_load_core(d, s, n) \
+    do { \
+        fv_s32      i; \
+        fv_s32      j; \
+        \
+        for (i = 0; i + FV_LAPLACIAN_BLOCK <= n; \
+                i += FV_LAPLACIAN_BLOCK) { \
+            for (j = i; j < i + FV_LAPLACIAN_BLOCK; j++) { \
+                d[j] = s[j]; \
+            } \
+        } \
+        for (; i < n; i++) { \
+            d[i] = s[i]; \
+        } \
+    } while (0)
 
-static void
-fv_grad_add_16s(fv_s16 *dst, double *src1, double *src2, fv_u32 total)
-{
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
-}
+#define fv_laplacian_store_core(d, s, n, scale, delta, castop) \
+    do { \
+        fv_s32      i; \
+        fv_s32      j; \
+        \
+        for (i = 0; i + FV_LAPLACIAN_BLOCK <= n; \
+                i += FV_LAPLACIAN_BLOCK) { \
+            for (j = i; j < i + FV_LAPLACIAN_BLOCK; j++) { \
+                d[j] = castop(s[j]*scale + delta); \
+            } \
+        } \
+        for (; i < n; i++) { \
+            d[i] = castop(s[i]*scale + delta); \
+        } \
+    } while (0)
+
+#define fv_laplacian_load_func(name, type, wname, wtype) \
+    static void \
+    fv_laplacian_load_##name##_##wname(void *_d, void *_s, fv_s32 n) \
+    { \
+        wtype       *restrict d = _d; \
+        type        *restrict s = _s; \
+        \
+        fv_laplacian_load_core(d, s, n); \
+    }
 
-static void
-fv_grad_add_32s(fv_s32 *dst, double *src1, double *src2, fv_u32 total)
-{
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
-}
+#define fv_laplacian_store_func(name, type, wname, wtype) \
+    static void \
+    fv_laplacian_store_##name##_##wname(void *_d, void *_s, fv_s32 n, \
+                double _scale, double _delta) \
+    { \
+        type        *restrict d = _d; \
+        wtype       *restrict s = _s; \
+        wtype       scale = _scale; \
+        wtype       delta = _delta; \
+        \
+        fv_laplacian_store_core(d, s, n, scale, delta, \
+                fv_laplacian_cast_##name); \
+    }
 
-static void
-fv_grad_add_32f(float *dst, double *src1, double *src2, fv_u32 total)
-{
-    fv_grad_add_core(dst, src1, src2, total, fv_saturate_cast_8u);
-}
+/*
+ * A block of hd and hs: s filtered by kd and ks along x, the taps
+ * read pixels cn apart.
+ */
+#define fv_laplacian_row_block_func(wname, wtype) \
+    static inline void \
+    fv_laplacian_row_block_##wname(wtype *restrict hd, wtype *restrict hs, \
+                const wtype *restrict s, const wtype *restrict kd, \
+                const wtype *restrict ks, fv_s32 ksize, fv_s32 cn) \
+    { \
+        fv_s32      i; \
+        fv_s32      k; \
+        \
+        for (i = 0; i < FV_LAPLACIAN_BLOCK; i++) { \
+            hd[i] = 0; \
+            hs[i] = 0; \
+        } \
+        for (k = 0; k < ksize; k++, s += cn) { \
+            for (i = 0; i < FV_LAPLACIAN_BLOCK; i++) { \
+                hd[i] += kd[k]*s[i]; \
+                hs[i] += ks[k]*s[i]; \
+            } \
+        } \
+    }
 
-static void
-fv_grad_add_64f(double *dst, double *src1, double *src2, fv_u32 total)
-{
-    fv_s32      i;
+/*
+ * A block of a dst row from block ofs of the rings: d2/dx2 smoothed
+ * along y, plus d2/dy2 of the rows smoothed along x.
+ */
+#define fv_laplacian_col_block_func(wname, wtype) \
+    static inline void \
+    fv_laplacian_col_block_##wname(wtype *restrict d, wtype **hd, \
+                wtype **hs, fv_s32 ofs, const wtype *restrict kd, \
+                const wtype *restrict ks, fv_s32 ksize) \
+    { \
+        const wtype *restrict   a; \
+        const wtype *restrict   b; \
+        fv_s32                  i; \
+        fv_s32                  k; \
+        \
+        for (i = 0; i < FV_LAPLACIAN_BLOCK; i++) { \
+            d[i] = 0; \
+        } \
+        for (k = 0; k < ksize; k++) { \
+            a = hd[k] + ofs; \
+            b = hs[k] + ofs; \
+            for (i = 0; i < FV_LAPLACIAN_BLOCK; i++) { \
+                d[i] += ks[k]*a[i] + kd[k]*b[i]; \
+            } \
+        } \
+    }
 
-    for (i = 0; i < total; i++, dst++, src1++, src2++) {
-        *dst = (*src1 + *src2);
+/*
+ * Rows index*lp_band_rows on of dst: the ksize - 1 rows above the
+ * band fill the rings, every row after gives a row of dst.
+ */
+#define fv_laplacian_band_core(lp, index, wname, wtype) \
+    do { \
+        fv_mat_t        *src = lp->lp_src; \
+        fv_mat_t        *dst = lp->lp_dst; \
+        wtype           **hd; \
+        wtype           **hs; \
+        wtype           *buf; \
+        wtype           *fs; \
+        wtype           *out; \
+        wtype           *t; \
+        wtype           kd[FV_LAPLACIAN_MAX_KSIZE]; \
+        wtype           ks[FV_LAPLACIAN_MAX_KSIZE]; \
+        fv_u8           *raw; \
+        fv_s32          cn = src->mt_nchannel; \
+        fv_s32          ksize = lp->lp_ksize; \
+        fv_s32          r = ksize/2; \
+        fv_s32          n = src->mt_cols*cn; \
+        fv_s32          nb = fv_align(n, FV_LAPLACIAN_BLOCK); \
+        fv_s32          y0 = index*lp->lp_band_rows; \
+        fv_s32          y1; \
+        fv_s32          y; \
+        fv_s32          i; \
+        fv_s32          k; \
+        \
+        y1 = fv_min(y0 + lp->lp_band_rows, src->mt_rows); \
+        if (y0 >= y1) { \
+            break; \
+        } \
+        \
+        for (k = 0; k < ksize; k++) { \
+            kd[k] = lp->lp_kd->mt_data.dt_fl[k]; \
+            ks[k] = lp->lp_ks->mt_data.dt_fl[k]; \
+        } \
+        \
+        /* the source row as read and converted, rings, the dst row */ \
+        raw = fv_alloc((src->mt_cols + 2*r)*FV_ELEM_SIZE(src->mt_atr)); \
+        FV_ASSERT(raw != NULL); \
+        buf = fv_calloc((lp->lp_len + (2*ksize + 1)*nb)*sizeof(*buf)); \
+        FV_ASSERT(buf != NULL); \
+        hd = fv_alloc(2*ksize*sizeof(*hd)); \
+        FV_ASSERT(hd != NULL); \
+        hs = hd + ksize; \
+        fs = buf; \
+        out = fs + lp->lp_len; \
+        for (k = 0; k < ksize; k++) { \
+            hd[k] = out + (2*k + 1)*nb; \
+            hs[k] = hd[k] + nb; \
+        } \
+        \
+        for (y = y0 - r; y < y1 + r; y++) { \
+            /* the rings move on, they hold rows y - ksize + 1 .. y */ \
+            t = hd[0]; \
+            memmove(hd, hd + 1, (ksize - 1)*sizeof(*hd)); \
+            hd[ksize - 1] = t; \
+            t = hs[0]; \
+            memmove(hs, hs + 1, (ksize - 1)*sizeof(*hs)); \
+            hs[ksize - 1] = t; \
+            \
+            fv_border_map_read(&lp->lp_border, src, raw, y); \
+            lp->lp_load(fs, raw, (src->mt_cols + 2*r)*cn); \
+            for (i = 0; i < nb; i += FV_LAPLACIAN_BLOCK) { \
+                fv_laplacian_row_block_##wname(hd[ksize - 1] + i, \
+                        hs[ksize - 1] + i, fs + i, kd, ks, ksize, cn); \
+            } \
+            \
+            if (y < y0 + r) { \
+                continue; \
+            } \
+            \
+            for (i = 0; i < nb; i += FV_LAPLACIAN_BLOCK) { \
+                fv_laplacian_col_block_##wname(out + i, hd, hs, i, kd, ks, \
+                        ksize); \
+            } \
+            lp->lp_store(dst->mt_data.dt_ptr + (y - r)*dst->mt_step, out, \
+                    n, lp->lp_scale, lp->lp_delta); \
+        } \
+        \
+        fv_free(&hd); \
+        fv_free(&buf); \
+        fv_free(&raw); \
+    } while (0)
+
+#define fv_laplacian_funcs(wname, wtype) \
+    fv_laplacian_load_func(8u, fv_u8, wname, wtype) \
+    fv_laplacian_load_func(8s, fv_s8, wname, wtype) \
+    fv_laplacian_load_func(16u, fv_u16, wname, wtype) \
+    fv_laplacian_load_func(16s, fv_s16, wname, wtype) \
+    fv_laplacian_load_func(32s, fv_s32, wname, wtype) \
+    fv_laplacian_load_func(32f, float, wname, wtype) \
+    fv_laplacian_load_func(64f, double, wname, wtype) \
+    fv_laplacian_store_func(8u, fv_u8, wname, wtype) \
+    fv_laplacian_store_func(8s, fv_s8, wname, wtype) \
+    fv_laplacian_store_func(16u, fv_u16, wname, wtype) \
+    fv_laplacian_store_func(16s, fv_s16, wname, wtype) \
+    fv_laplacian_store_func(32s, fv_s32, wname, wtype) \
+    fv_laplacian_store_func(32f, float, wname, wtype) \
+    fv_laplacian_store_func(64f, double, wname, wtype) \
+    fv_laplacian_row_block_func(wname, wtype) \
+    fv_laplacian_col_block_func(wname, wtype) \
+    static void \
+    fv_laplacian_band_##wname(void *arg, fv_s32 index) \
+    { \
+        fv_laplacian_t      *lp = arg; \
+        \
+        fv_laplacian_band_core(lp, index, wname, wtype); \
     }
-}
 
-typedef void (*fv_grad_add_func)(void *, void *, void *, fv_u32);
+fv_laplacian_funcs(32f, float)
+fv_laplacian_funcs(64f, double)
+
+#define fv_laplacian_tab(kind, wname) \
+    { \
+        fv_laplacian_##kind##_8u_##wname, \
+        fv_laplacian_##kind##_8s_##wname, \
+        fv_laplacian_##kind##_16u_##wname, \
+        fv_laplacian_##kind##_16s_##wname, \
+        fv_laplacian_##kind##_32s_##wname, \
+        fv_laplacian_##kind##_32f_##wname, \
+        fv_laplacian_##kind##_64f_##wname, \
+    }
 
-static fv_grad_add_func fv_grad_add_tab[] = {
-    (fv_grad_add_func)fv_grad_add_8u,
-    (fv_grad_add_func)fv_grad_add_8s,
-    (fv_grad_add_func)fv_grad_add_16u,
-    (fv_grad_add_func)fv_grad_add_16s,
-    (fv_grad_add_func)fv_grad_add_32s,
-    (fv_grad_add_func)fv_grad_add_32f,
-    (fv_grad_add_func)fv_grad_add_64f,
+static fv_laplacian_load_func fv_laplacian_load_tab[2][7] = {
+    fv_laplacian_tab(load, 32f),
+    fv_laplacian_tab(load, 64f),
 };
 
-#define fv_grad_add_tab_size \
-    (sizeof(fv_grad_add_tab)/sizeof(fv_grad_add_func))
-
-static fv_grad_add_func 
-fv_get_grad_add_tab(fv_u32 depth)
-{
-    FV_ASSERT(depth < fv_grad_add_tab_size);
+static fv_laplacian_store_func fv_laplacian_store_tab[2][7] = {
+    fv_laplacian_tab(store, 32f),
+    fv_laplacian_tab(store, 64f),
+};
 
-    return fv_grad_add_tab[depth];
-}
+static fv_laplacian_band_func fv_laplacian_band_tab[2] = {
+    fv_laplacian_band_32f,
+    fv_laplacian_band_64f,
+};
 
 void
 fv_laplacian(fv_mat_t *dst, fv_mat_t *src, fv_u16 ddepth, fv_s32 ksize, 
             double scale, double delta, fv_s32 border_type)
 {
-    fv_grad_add_func    func;
-    fv_mat_t            *dx;
-    fv_mat_t            *dy;
-    fv_mat_t            *kx;
-    fv_mat_t            *ky;
-    fv_mat_t            kernel = {};
-    float               k[2][9] = {{0, 1, 0, 1, -4, 1, 0, 1, 0},
-                {2, 0, 2, 0, -8, 0, 2, 0, 2}};
-    fv_u16              cn;
+    fv_laplacian_t      lp;
+    float               *ks;
+    fv_s32              cn;
+    fv_s32              w;
+
+    cn = src->mt_nchannel;
+    FV_ASSERT(dst->mt_rows == src->mt_rows && dst->mt_cols == src->mt_cols &&
+            dst->mt_nchannel == cn && ddepth == dst->mt_depth);
+    FV_ASSERT(ksize <= FV_LAPLACIAN_MAX_KSIZE);
+    FV_ASSERT(src->mt_depth <= FV_64F && dst->mt_depth <= FV_64F);
 
+    /* lp_kd: the second derivative, lp_ks: the smoothing kernel */
     if (ksize == 1 || ksize == 3) {
-        kernel = fv_mat(3, 3, FV_32FC1, k[ksize == 3]);
-        if (scale != 1) {
-            fv_mset_scale(kernel, scale, float);
+        /*
+         * The 3x3 apertures: ks [1 2 1] gives the 8 neighbour kernel,
+         * [0 1 0] the 4 neighbour one of ksize 1.
+         */
+        fv_get_sobel_kernels(&lp.lp_kd, &lp.lp_ks, 2, 0, 3, 0, 0);
+        if (ksize == 1) {
+            ks = lp.lp_ks->mt_data.dt_fl;
+            ks[0] = 0, ks[1] = 1, ks[2] = 0;
         }
-
-        fv_filter2D(dst, src, ddepth, &kernel, fv_point(-1, -1),
-                delta, border_type);
-        return;
+        ksize = 3;
+    } else {
+        fv_get_sobel_kernels(&lp.lp_kd, &lp.lp_ks, 2, 0, ksize, 0, 0);
     }
 
-    cn = src->mt_nchannel;
-    dx = fv_create_mat(src->mt_rows, src->mt_cols,
-            FV_MAKETYPE(FV_DEPTH_64F, cn));
-    FV_ASSERT(dx != NULL);
-    dy = fv_create_mat(src->mt_rows, src->mt_cols,
-            FV_MAKETYPE(FV_DEPTH_64F, cn));
-    FV_ASSERT(dy != NULL);
-    fv_get_sobel_kernels(&kx, &ky, 2, 0, ksize, 0, 0);
-
-    fv_time_meter_set(1);
-    fv_sep_filter2D(dx, src, kx, ky, fv_point(-1, -1), 
-            delta, border_type);
-    fv_sep_filter2D(dy, src, ky, kx, fv_point(-1, -1), 
-            delta, border_type);
-    fv_time_meter_get(1, 0);
-
-    func = fv_get_grad_add_tab(dst->mt_depth);
-    FV_ASSERT(func != NULL);
-    fv_time_meter_set(1);
-    func(dst->mt_data.dt_ptr, dx->mt_data.dt_db,
-            dy->mt_data.dt_db, dst->mt_total*cn);
-    fv_time_meter_get(1, 0);
-    fv_release_mat(&kx);
-    fv_release_mat(&ky);
-    fv_release_mat(&dy);
-    fv_release_mat(&dx);
+    w = src->mt_depth == FV_64F || dst->mt_depth == FV_64F;
+    lp.lp_dst = dst;
+    lp.lp_src = src;
+    lp.lp_ksize = ksize;
+    lp.lp_scale = scale;
+    lp.lp_delta = delta;
+    lp.lp_load = fv_laplacian_load_tab[w][src->mt_depth];
+    lp.lp_store = fv_laplacian_store_tab[w][dst->mt_depth];
+    fv_border_map_init(&lp.lp_border, src, ksize/2, ksize/2, border_type);
+    /* whole blocks of row, and room for the row pass to read past them */
+    lp.lp_len = fv_align(src->mt_cols*cn, FV_LAPLACIAN_BLOCK) +
+        fv_align((ksize - 1)*cn, FV_LAPLACIAN_BLOCK);
+
+    fv_parallel_bands(src->mt_rows, FV_LAPLACIAN_BAND_MIN_ROWS,
+            &lp.lp_band_rows, fv_laplacian_band_tab[w], &lp);
+
+    fv_border_map_release(&lp.lp_border);
+    fv_release_mat(&lp.lp_ks);
+    fv_release_mat(&lp.lp_kd);
 }
 
 void
@@ -359,231 +919,229 @@ fv_laplace(fv_image_t *dst, fv_image_t *src, fv_s32 aperture_size)
 {
     fv_mat_t    _dst;
     fv_mat_t    _src;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
 
     FV_ASSERT(src->ig_image_size == dst->ig_image_size && 
             src->ig_channels == dst->ig_channels);
 
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
-
-    fv_laplacian(&_dst, &_src, dst->ig_depth, aperture_size, 1, 0,
+    /* ksize 1 is filtered with a 3x3 aperture too */
+    _src = fv_image_get_roi_view(src, fv_max(aperture_size/2, 1), &src_coi);
+    _dst = fv_image_get_roi_view(dst, -1, &dst_coi);
+    fv_laplacian(&_dst, &_src, _dst.mt_depth, aperture_size, 1, 0,
                 FV_BORDER_REPLICATE);
+    fv_image_put_roi_view(dst, &_dst, &dst_coi);
+    fv_release_mat(&src_coi);
 }
 
-void
-_fv_canny(fv_mat_t *dst, fv_mat_t *src, double low_thresh, double high_thresh,
-        fv_s32 aperture_size)
+typedef struct _fv_canny_stack_t {
+    fv_u8           **cs_bottom;
+    fv_u8           **cs_top;
+    fv_s32          cs_size;
+} fv_canny_stack_t;
+
+typedef struct _fv_canny_t {
+    fv_mat_t        *cy_dx;
+    fv_mat_t        *cy_dy;
+    fv_u8           *cy_map;
+    fv_s32          cy_mapstep;
+    fv_s64          cy_low;
+    fv_s64          cy_high;
+    fv_bool         cy_l2_gradient;
+    fv_s32          cy_band_rows;
+    fv_mat_t        *cy_dst;
+} fv_canny_t;
+
+#define FV_CANNY_BAND_MIN_ROWS      16
+
+#define FV_CANNY_PUSH(st, d)        (*(d) = 2, *(st)->cs_top++ = (d))
+#define FV_CANNY_POP(st, d)         ((d) = *--(st)->cs_top)
+
+static void
+fv_canny_stack_init(fv_canny_stack_t *st, fv_s32 size)
+{
+    st->cs_size = fv_max(1 << 10, size);
+    st->cs_bottom = fv_alloc(sizeof(*st->cs_bottom)*st->cs_size);
+    FV_ASSERT(st->cs_bottom != NULL);
+    st->cs_top = st->cs_bottom;
+}
+
+/* room for n more pushes, growing the stack by half */
+static void
+fv_canny_stack_reserve(fv_canny_stack_t *st, fv_s32 n)
 {
-    fv_mat_t    *dx;
-    fv_mat_t    *dy;
-    fv_u8       *dst_data;
-    fv_u8       *d;
-    fv_u8       *map;
-    fv_u8       *_map;
-    fv_u8       *pmap;
-    fv_u8       *buffer;
     fv_u8       **stack;
-    fv_u8       **stack_top;
-    fv_u8       **stack_bottom;
-    fv_s16      *dx_data;
-    fv_s16      *dy_data;
-    fv_s32      *mag_buf[3];
-    fv_s32      *mag;
-    fv_s32      *norm;
-    fv_u32      cn;
-    fv_s32      x;
-    fv_s32      y;
-    fv_s32      i;
-    fv_s32      j;
-    fv_s32      width;
-    fv_s32      height;
-    fv_s32      mapstep;
-    fv_s32      magstep1;
-    fv_s32      magstep2;
-    fv_s32      off_y;
-    fv_s32      stack_size = 0;
-    fv_s32      g;
-    fv_s32      g1;
-    fv_s32      g2;
-    fv_s32      g3;
-    fv_s32      g4;
-    fv_s32      temp1 = 0;
-    fv_s32      temp2 = 0;
-    fv_s32      sz = 0;
-    double      t;
-    double      dweight;
-    double      theta;
-    fv_bool     prev_flag;
+    fv_s32      sz;
 
-    if (low_thresh > high_thresh) {
-        fv_swap(low_thresh, high_thresh);
+    sz = st->cs_top - st->cs_bottom;
+    if (sz + n <= st->cs_size) {
+        return;
     }
-    cn = src->mt_nchannel;
-    dx = fv_create_mat(src->mt_rows, src->mt_cols, FV_16SC(cn));
-    FV_ASSERT(dx != NULL);
-    dx->mt_depth = FV_16S;
-    dy = fv_create_mat(src->mt_rows, src->mt_cols, FV_16SC(cn));
-    FV_ASSERT(dy != NULL);
-    dy->mt_depth = FV_16S;
-    _fv_sobel(dx, src, FV_16S, 1, 0, aperture_size, 1, 0, 
-                FV_BORDER_REPLICATE);
-    _fv_sobel(dy, src, FV_16S, 0, 1, aperture_size, 1, 0, 
-                FV_BORDER_REPLICATE);
 
-    width = dst->mt_cols;
-    height = dst->mt_rows;
+    stack = st->cs_bottom;
+    st->cs_size = fv_max(st->cs_size*3/2, sz + n);
+    st->cs_bottom = fv_alloc(sizeof(*st->cs_bottom)*st->cs_size);
+    FV_ASSERT(st->cs_bottom != NULL);
+    st->cs_top = st->cs_bottom + sz;
+    memcpy(st->cs_bottom, stack, sz*sizeof(*st->cs_bottom));
+    fv_free(&stack);
+}
 
-    mapstep = width + 2;
-    buffer = fv_alloc(mapstep*(height + 2) + mapstep * 3 * sizeof(fv_s32));
-    FV_ASSERT(buffer != NULL);
-    mag_buf[0] = (fv_s32 *)buffer;
-    mag_buf[1] = mag_buf[0] + mapstep;
-    mag_buf[2] = mag_buf[1] + mapstep;
-    map = (fv_u8 *)(mag_buf[2] + mapstep);
-    memset(map, 1, mapstep);
-    memset(map + mapstep*(height + 1), 1, mapstep);
+/*
+ * Grow edges from the pixels on the stack to the candidates (0) around
+ * them, keeping to the map between lo and hi.
+ */
+static void
+fv_canny_trace(fv_canny_stack_t *st, fv_u8 *lo, fv_u8 *hi, fv_s32 mapstep)
+{
+    fv_s32      ofs[8] = {1, -1, mapstep, -mapstep, mapstep + 1,
+                    mapstep - 1, -mapstep + 1, -mapstep - 1};
+    fv_u8       *d;
+    fv_u8       *n;
+    fv_s32      k;
 
-    stack_size = fv_max(1 << 10, src->mt_total/10);
-    stack_bottom = fv_alloc(sizeof(*stack_bottom)*stack_size); 
-    FV_ASSERT(stack_bottom != NULL);
-
-    stack_top = stack_bottom;
-
-    #define FV_CANNY_PUSH(d)        *(d) = 2, *stack_top++ = (d)
-    #define FV_CANNY_POP(d)         (d) = *--stack_top
-    
-    // calculate magnitude and angle of gradient, perform non-maxima supression.
-    // fill the map with one of the following values:
-    //   0 - the pixel might belong to an edge
-    //   1 - the pixel can not belong to an edge
-    //   2 - the pixel does belong to an edge
-       
-    prev_flag = 0;
-   
-    for (i = 0, off_y = 0; i <= height; i++, off_y += width) {
-        norm = mag_buf[(i > 0) + 1] + 1;
-        dx_data = &dx->mt_data.dt_s[off_y];
-        dy_data = &dy->mt_data.dt_s[off_y];
-        if (i < height) {
-            for (j = 0; j < width; j++) {
-                norm[j] = fabs(dx_data[j]) + fabs(dy_data[j]);
+    while (st->cs_top > st->cs_bottom) {
+        fv_canny_stack_reserve(st, 8);
+        FV_CANNY_POP(st, d);
+        for (k = 0; k < 8; k++) {
+            n = d + ofs[k];
+            if (n >= lo && n < hi && !*n) {
+                FV_CANNY_PUSH(st, n);
             }
-            norm[-1] = norm[width] = 0;
-        } else {
-            memset(norm - 1, 0, mapstep*sizeof(fv_s32));
         }
+    }
+}
 
-        if (i == 0) {
-            continue;
-        }
+/*
+ * Gradient magnitudes of row y, zero outside the image. The squares
+ * of two saturated derivatives (2^31) do not fit in fv_s32.
+ */
+static void
+fv_canny_mag_row(fv_canny_t *cy, fv_u32 *norm, fv_s32 y)
+{
+    fv_s16      *dx_data;
+    fv_s16      *dy_data;
+    fv_s32      width = cy->cy_dx->mt_cols;
+    fv_s32      j;
 
-        if ((stack_top - stack_bottom) + width > stack_size) {
-            sz = stack_top - stack_bottom;
-            stack = stack_bottom;
-            stack_size = stack_size*3/2;
-            stack_bottom = fv_alloc(sizeof(*stack_bottom)*stack_size); 
-            FV_ASSERT(stack_bottom != NULL);
+    if (y < 0 || y >= cy->cy_dx->mt_rows) {
+        memset(norm - 1, 0, (width + 2)*sizeof(*norm));
+        return;
+    }
 
-            stack_top = stack_bottom + sz;
-            memcpy(stack_bottom, stack, sz*sizeof(*stack_bottom));
-            fv_free(&stack);
+    dx_data = &cy->cy_dx->mt_data.dt_s[y*width];
+    dy_data = &cy->cy_dy->mt_data.dt_s[y*width];
+    if (cy->cy_l2_gradient) {
+        for (j = 0; j < width; j++) {
+            norm[j] = (fv_u32)(dx_data[j]*dx_data[j]) + 
+                (fv_u32)(dy_data[j]*dy_data[j]);
+        }
+    } else {
+        for (j = 0; j < width; j++) {
+            norm[j] = abs(dx_data[j]) + abs(dy_data[j]);
         }
+    }
+    norm[-1] = norm[width] = 0;
+}
+
+/*
+ * Magnitudes, non-maxima suppression and hysteresis of a stripe of
+ * rows. The map gets one of the following values:
+ *   0 - the pixel might belong to an edge
+ *   1 - the pixel can not belong to an edge
+ *   2 - the pixel does belong to an edge
+ * Edges are only grown inside the stripe, the ones crossing into the
+ * next stripes are joined once all are done.
+ */
+static void
+fv_canny_band(void *arg, fv_s32 index)
+{
+    fv_canny_t          *cy = arg;
+    fv_canny_stack_t    st;
+    fv_s32              width = cy->cy_dx->mt_cols;
+    fv_s32              height = cy->cy_dx->mt_rows;
+    fv_s32              mapstep = cy->cy_mapstep;
+    fv_s32              y0 = index*cy->cy_band_rows;
+    fv_s32              y1 = fv_min(y0 + cy->cy_band_rows, height);
+    fv_u32              *buffer;
+    fv_u32              *mag_buf[3];
+    fv_u32              *mag;
+    fv_s16              *dx_data;
+    fv_s16              *dy_data;
+    fv_u8               *_map;
+    fv_s32              magstep1;
+    fv_s32              magstep2;
+    fv_s32              y;
+    fv_s32              j;
+    fv_u32              g;
+    fv_s32              xs;
+    fv_s32              ys;
+    fv_s32              ax;
+    fv_s32              ay;
+    fv_s32              tg22x;
+    fv_s32              s;
+    fv_bool             prev_flag;
+    fv_bool             is_max;
+
+    if (y0 >= y1) {
+        return;
+    }
+
+    buffer = fv_alloc(mapstep*3*sizeof(*buffer));
+    FV_ASSERT(buffer != NULL);
+    mag_buf[0] = buffer;
+    mag_buf[1] = mag_buf[0] + mapstep;
+    mag_buf[2] = mag_buf[1] + mapstep;
+    fv_canny_mag_row(cy, mag_buf[0] + 1, y0 - 1);
+    fv_canny_mag_row(cy, mag_buf[1] + 1, y0);
+    fv_canny_stack_init(&st, width*(y1 - y0)/10);
 
-        _map = map + mapstep*i + 1;
+    for (y = y0; y < y1; y++) {
+        fv_canny_mag_row(cy, mag_buf[2] + 1, y + 1);
+        fv_canny_stack_reserve(&st, width);
+
+        _map = cy->cy_map + mapstep*(y + 1) + 1;
         _map[-1] = _map[width] = 1;
         mag = mag_buf[1] + 1; // take the central row 
         magstep1 = mag_buf[2] - mag_buf[1];
         magstep2 = mag_buf[0] - mag_buf[1];
-        dx_data -= width;
-        dy_data -= width;
-        for (j = 0; j < width; j++, dx_data++, dy_data++) {
+        dx_data = &cy->cy_dx->mt_data.dt_s[y*width];
+        dy_data = &cy->cy_dy->mt_data.dt_s[y*width];
+        prev_flag = 0;
+        for (j = 0; j < width; j++) {
             g = mag[j];
-            if (g <= low_thresh) {
+            if (g <= cy->cy_low) {
                 _map[j] = 1;
                 prev_flag = 0;
                 continue;
             }
-            if (*dx_data == 0) {
-                temp1 = mag[j + magstep2];
-                temp2 = mag[j + magstep1];
-            } else if (*dy_data == 0) {
-                temp1 = mag[j - 1];
-                temp2 = mag[j + 1];
+            /*
+             * The sector of the gradient, from |dy| against |dx| times
+             * tan(22.5) and tan(67.5) in fixed point, picks the two
+             * neighbours across the edge.
+             */
+            xs = dx_data[j];
+            ys = dy_data[j];
+            ax = abs(xs);
+            ay = abs(ys) << FV_CANNY_SHIFT;
+            tg22x = ax*FV_CANNY_TG22;
+            if (ay < tg22x) {
+                is_max = g > mag[j - 1] && g >= mag[j + 1];
+            } else if (ay > tg22x + ((fv_s64)ax << (FV_CANNY_SHIFT + 1))) {
+                is_max = g > mag[j + magstep2] && g >= mag[j + magstep1];
             } else {
-                t = *(dy_data)/(double)(*(dx_data));
-                theta = atan(t)*180/fv_pi;
-                /*
-                 * 首先判断属于那种情况，然后根据情况插值
-                 * First:
-                 *      g1 g2
-                 *         C
-                 *         g3 g4
-                 */
-
-                if (theta <= -45 && theta > -90) {
-                    g1 = mag[j + magstep1 - 1];
-                    g2 = mag[j + magstep1];
-                    g3 = mag[j + magstep2];
-                    g4 = mag[j + magstep2 + 1];
-                    dweight = fabs(*(dx_data)/(double)(*(dy_data)));
-                    temp1 = g1*dweight + g2*(1 - dweight);  
-                    temp2 = g4*dweight + g3*(1 - dweight); 
-                }
-                /*
-                 * Second:
-                 *      g1
-                 *      g2 C g3
-                 *           g4
-                 */
-                else if (theta <= 0 && theta > -45) {
-                    g1 = mag[j + magstep1 - 1];
-                    g2 = mag[j - 1];
-                    g3 = mag[j + 1];
-                    g4 = mag[j + magstep2 + 1];
-                    dweight = fabs(t);
-                    temp1 = g1*dweight + g2*(1 - dweight);  
-                    temp2 = g4*dweight + g3*(1 - dweight); 
-                }
-                /*
-                 * Third:
-                 *         g1 g2
-                 *         C
-                 *      g4 g3
-                 */
-                else if (theta >= 45 && theta < 90) {
-                    g1 = mag[j + magstep1];
-                    g2 = mag[j + magstep1 + 1];
-                    g3 = mag[j + magstep2];
-                    g4 = mag[j + magstep2 - 1];
-                    dweight = fabs(*(dx_data)/(double)(*(dy_data)));
-                    temp1 = g2*dweight + g1*(1 - dweight);  
-                    temp2 = g4*dweight + g3*(1 - dweight); 
-                }
-                /*
-                 * Fourth:
-                 *            g1
-                 *      g4 C  g2
-                 *      g3
-                 */
-                else if (theta > 0 && theta < 45) {
-                    g1 = mag[j + magstep1 + 1];
-                    g2 = mag[j + 1];
-                    g3 = mag[j + magstep2 - 1];
-                    g4 = mag[j - 1];
-                    dweight = fabs(t);
-                    temp1 = g1*dweight + g2*(1 - dweight);  
-                    temp2 = g3*dweight + g4*(1 - dweight); 
-                } else {
-                    temp1 = temp2 = 0;
-                }
+                s = (xs ^ ys) < 0 ? -1 : 1;
+                is_max = g > mag[j + magstep2 - s] &&
+                    g > mag[j + magstep1 + s];
             }
-            if (g < temp1 || g < temp2) {
+            if (!is_max) {
                 _map[j] = 1;
                 prev_flag = 0;
                 continue;
             }
-            if (!prev_flag && g > high_thresh && _map[j - mapstep] != 2) {
-                FV_CANNY_PUSH(_map + j);
+            if (!prev_flag && g > cy->cy_high &&
+                    (y == y0 || _map[j - mapstep] != 2)) {
+                FV_CANNY_PUSH(&st, _map + j);
                 prev_flag = 1;
             } else {
                 _map[j] = 0;
@@ -595,52 +1153,130 @@ _fv_canny(fv_mat_t *dst, fv_mat_t *src, double low_thresh, double high_thresh,
         mag_buf[2] = mag;
     }
 
-    while (stack_top > stack_bottom) {
-        FV_CANNY_POP(d);
+    fv_canny_trace(&st, cy->cy_map + mapstep*(y0 + 1),
+            cy->cy_map + mapstep*(y1 + 1), mapstep);
 
-        if (!d[1]) {
-            FV_CANNY_PUSH(d + 1);
-        }
+    fv_free(&st.cs_bottom);
+    fv_free(&buffer);
+}
 
-        if (!d[-1]) {
-            FV_CANNY_PUSH(d - 1);
+static void
+fv_canny_output_band(void *arg, fv_s32 index)
+{
+    fv_canny_t          *cy = arg;
+    fv_mat_t            *dst = cy->cy_dst;
+    fv_s32              y0 = index*cy->cy_band_rows;
+    fv_s32              y1 = fv_min(y0 + cy->cy_band_rows, dst->mt_rows);
+    fv_u8               *pmap;
+    fv_u8               *dst_data;
+    fv_s32              x;
+    fv_s32              y;
+
+    pmap = cy->cy_map + cy->cy_mapstep*(y0 + 1) + 1;
+    for (y = y0; y < y1; y++, pmap += cy->cy_mapstep) {
+        dst_data = dst->mt_data.dt_ptr + y*dst->mt_step;
+        for (x = 0; x < dst->mt_cols; x++) {
+            dst_data[x] = (fv_u8)-(pmap[x] >> 1);
         }
+    }
+}
 
-        if (!d[mapstep]) {
-            FV_CANNY_PUSH(d + mapstep);
+/*
+ * Canny edges of an 8u image. OR FV_CANNY_L2_GRADIENT into
+ * aperture_size to use the L2 gradient magnitude. Stripes of rows are
+ * suppressed and traced in parallel; afterwards the edge pixels on both
+ * sides of every stripe border are traced again over the whole map, so
+ * the edges do not depend on the number of stripes.
+ */
+void
+_fv_canny(fv_mat_t *dst, fv_mat_t *src, double low_thresh, double high_thresh,
+        fv_s32 aperture_size)
+{
+    fv_canny_t          cy;
+    fv_canny_stack_t    st;
+    fv_mat_t            *dx;
+    fv_mat_t            *dy;
+    fv_u8               *map;
+    fv_u8               *row;
+    fv_u32              cn;
+    fv_s32              width;
+    fv_s32              height;
+    fv_s32              mapstep;
+    fv_s32              nbands;
+    fv_s32              i;
+    fv_s32              x;
+    fv_bool             l2_gradient;
+
+    l2_gradient = (aperture_size & FV_CANNY_L2_GRADIENT) != 0;
+    aperture_size &= ~FV_CANNY_L2_GRADIENT;
+    if (low_thresh > high_thresh) {
+        fv_swap(low_thresh, high_thresh);
+    }
+    if (l2_gradient) {
+        /* the magnitudes are squared, so are the thresholds */
+        low_thresh = fv_min(32767.0, low_thresh);
+        high_thresh = fv_min(32767.0, high_thresh);
+        if (low_thresh > 0) {
+            low_thresh *= low_thresh;
         }
-
-        if (!d[-mapstep]) {
-            FV_CANNY_PUSH(d - mapstep);
+        if (high_thresh > 0) {
+            high_thresh *= high_thresh;
         }
+    }
+    cn = src->mt_nchannel;
+    dx = fv_create_mat(src->mt_rows, src->mt_cols, FV_16SC(cn));
+    FV_ASSERT(dx != NULL);
+    dx->mt_depth = FV_16S;
+    dy = fv_create_mat(src->mt_rows, src->mt_cols, FV_16SC(cn));
+    FV_ASSERT(dy != NULL);
+    dy->mt_depth = FV_16S;
+    _fv_sobel_dxdy(dx, dy, src, FV_16S, aperture_size, 1, 0, 
+                FV_BORDER_REPLICATE);
 
-        if (!d[mapstep + 1]) {
-            FV_CANNY_PUSH(d + mapstep + 1);
-        }
+    width = dst->mt_cols;
+    height = dst->mt_rows;
 
-        if (!d[mapstep - 1]) {
-            FV_CANNY_PUSH(d + mapstep - 1);
-        }
-        
-        if (!d[-mapstep + 1]) {
-            FV_CANNY_PUSH(d - mapstep + 1);
-        }
+    mapstep = width + 2;
+    map = fv_alloc(mapstep*(height + 2));
+    FV_ASSERT(map != NULL);
+    memset(map, 1, mapstep);
+    memset(map + mapstep*(height + 1), 1, mapstep);
 
-        if (!d[-mapstep - 1]) {
-            FV_CANNY_PUSH(d - mapstep - 1);
+    cy.cy_dx = dx;
+    cy.cy_dy = dy;
+    cy.cy_map = map;
+    cy.cy_mapstep = mapstep;
+    /* magnitudes are integers, g <= t and g > t compare with floor(t) */
+    cy.cy_low = floor(low_thresh);
+    cy.cy_high = floor(high_thresh);
+    cy.cy_l2_gradient = l2_gradient;
+    cy.cy_dst = dst;
+
+    nbands = fv_parallel_bands(height, FV_CANNY_BAND_MIN_ROWS,
+            &cy.cy_band_rows, fv_canny_band, &cy);
+
+    /* join the edges crossing the stripe borders */
+    if (nbands > 1) {
+        fv_canny_stack_init(&st, 2*width*nbands);
+        for (i = 1; i < nbands && i*cy.cy_band_rows < height; i++) {
+            row = map + mapstep*(i*cy.cy_band_rows) + 1;
+            fv_canny_stack_reserve(&st, 2*width);
+            for (x = 0; x < width; x++) {
+                if (row[x] == 2) {
+                    *st.cs_top++ = row + x;
+                }
+                if (row[x + mapstep] == 2) {
+                    *st.cs_top++ = row + x + mapstep;
+                }
+            }
         }
+        fv_canny_trace(&st, map, map + mapstep*(height + 2), mapstep);
+        fv_free(&st.cs_bottom);
     }
 
-    dst_data = &dst->mt_data.dt_ptr[0];
-    pmap = map + mapstep + 1;
-    for (y = 0; y < dst->mt_rows; y++, pmap += mapstep) {
-        for (x = 0; x < width; x++, dst_data++) {
-            *dst_data = (fv_u8)-(pmap[x] >> 1);
-        }
-    }
- 
-    fv_free(&buffer);
-    fv_free(&stack_bottom);
+    fv_parallel_for(nbands, fv_canny_output_band, &cy);
+
+    fv_free(&map);
     fv_release_mat(&dy);
     fv_release_mat(&dx);
 }
@@ -651,13 +1287,18 @@ fv_canny(fv_image_t *dst, fv_image_t *src, double thresh1, double thresh2,
 {
     fv_mat_t    _dst;
     fv_mat_t    _src;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
 
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
+    _src = fv_image_get_roi_view(src, 
+            (aperture_size & ~FV_CANNY_L2_GRADIENT)/2, &src_coi);
+    _dst = fv_image_get_roi_view(dst, -1, &dst_coi);
 
     FV_ASSERT(_src.mt_total == _dst.mt_total && _src.mt_atr == FV_8UC1 && 
             _dst.mt_atr == FV_8UC1);
 
     _fv_canny(&_dst, &_src, thresh1, thresh2, aperture_size);
+    fv_image_put_roi_view(dst, &_dst, &dst_coi);
+    fv_release_mat(&src_coi);
 }
 
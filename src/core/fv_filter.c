@@ -11,9 +11,18 @@
 #include "fv_filter.h"
 #include "fv_border.h"
 #include "fv_stat.h"
+#include "fv_thread.h"
+#include "fv_dxt.h"
 
 #define FV_SEP_FILTER_OUTPUT_LINE_NUM       4
+#define FV_SEP_FILTER_BAND_MIN_ROWS         32
+#define FV_FILTER_STRIP_CACHE_SIZE          (256 << 10)
+#define FV_FILTER_STRIP_MIN_WIDTH           64
 #define FV_DFT_FILTER_SIZE                  50
+#define FV_DFT_FILTER_CACHE_SIZE            (256 << 10)
+#define FV_FILTER_FIXED_BITS                8
+#define FV_FILTER_FIXED_MAX_KSIZE           32
+#define FV_FILTER_KS_NUM                    3   /* 3, 5 and 7 taps */
 
 #define fv_preprocess_2D_kernel_core(data, row, col, coords, coeffs) \
     do { \
@@ -250,6 +259,24 @@ fv_get_kernel_type(fv_mat_t *kernel, fv_point_t anchor)
     return type;
 }
 
+/*
+ * Nearly every kernel has 3, 5 or 7 taps and images 1 or 3 channels.
+ * For those the row, column and 2D filters have variants generated
+ * with ksize (and cn) as constants, so the tap loops unroll and the
+ * coefficients stay in registers. They add the taps in the same order
+ * as the generic cores, so the results are the same. Other sizes and
+ * the rarely used depth pairs keep the generic loops.
+ */
+static fv_s32
+fv_filter_ks_index(fv_s32 ksize)
+{
+    if (ksize != 3 && ksize != 5 && ksize != 7) {
+        return -1;
+    }
+
+    return (ksize - 3) >> 1;
+}
+
 #define fv_row_filter_core(dst, src, width, kx_data, filter) \
     do {\
         fv_s32                      kx_row = filter->br_ksize; \
@@ -260,7 +287,9 @@ fv_get_kernel_type(fv_mat_t *kernel, fv_point_t anchor)
         fv_s32                      cn = row_filter->lr_cn; \
                         \
         width *= cn; \
-        for (i = 0; i < width; i++) { \
+        i = row_filter->lr_vec != NULL ? \
+            row_filter->lr_vec(dst, src, width, kx_data, kx_row, cn) : 0; \
+        for (; i < width; i++) { \
             dst[i] = src[i]*kx_data[0]; \
             for (k = 1; k < kx_row; k++) { \
                 dst[i] += src[i + k*cn]*kx_data[k]; \
@@ -269,74 +298,233 @@ fv_get_kernel_type(fv_mat_t *kernel, fv_point_t anchor)
     } while(0)
 
 static void
-fv_row_filter_8u(double *dst, fv_u8 *src, fv_s32 width, 
+fv_row_filter_8u_16s(fv_s16 *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_8u_32s(fv_s32 *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_8u_32f(float *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_8s_32f(float *dst, fv_s8 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_16u_32f(float *dst, fv_u16 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_16s_32f(float *dst, fv_s16 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_row_filter_32f_32f(float *dst, float *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_row_filter_8s(double *dst, fv_s8 *src, fv_s32 width, 
+fv_row_filter_8u_64f(double *dst, fv_u8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_row_filter_16u(double *dst, fv_u16 *src, fv_s32 width, 
+fv_row_filter_8s_64f(double *dst, fv_s8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_row_filter_16s(double *dst, fv_s16 *src, fv_s32 width, 
+fv_row_filter_16u_64f(double *dst, fv_u16 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_row_filter_32s(double *dst, fv_s32 *src, fv_s32 width, 
+fv_row_filter_16s_64f(double *dst, fv_s16 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
+static void
+fv_row_filter_32s_64f(double *dst, fv_s32 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_row_filter_core(dst, src, width, kx_data, filter);
+}
 
 static void
-fv_row_filter_32f(double *dst, float *src, fv_s32 width, 
+fv_row_filter_32f_64f(double *dst, float *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_row_filter_64f(double *dst, double *src, fv_s32 width, 
+fv_row_filter_64f_64f(double *dst, double *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_row_filter_core(dst, src, width, kx_data, filter);
 }
 
-static fv_row_filter_func fv_row_filter_tab[] = {
-    (fv_row_filter_func)fv_row_filter_8u,
-    (fv_row_filter_func)fv_row_filter_8s,
-    (fv_row_filter_func)fv_row_filter_16u,
-    (fv_row_filter_func)fv_row_filter_16s,
-    (fv_row_filter_func)fv_row_filter_32s,
-    (fv_row_filter_func)fv_row_filter_32f,
-    (fv_row_filter_func)fv_row_filter_64f,
+/* [buffer depth][source depth] */
+static fv_row_filter_func 
+fv_row_filter_tab[FV_DEPTH_NUM][FV_DEPTH_NUM] = {
+    [FV_16S] = {
+        [FV_8U] = (fv_row_filter_func)fv_row_filter_8u_16s,
+    },
+    [FV_32S] = {
+        [FV_8U] = (fv_row_filter_func)fv_row_filter_8u_32s,
+    },
+    [FV_32F] = {
+        [FV_8U] = (fv_row_filter_func)fv_row_filter_8u_32f,
+        [FV_8S] = (fv_row_filter_func)fv_row_filter_8s_32f,
+        [FV_16U] = (fv_row_filter_func)fv_row_filter_16u_32f,
+        [FV_16S] = (fv_row_filter_func)fv_row_filter_16s_32f,
+        [FV_32F] = (fv_row_filter_func)fv_row_filter_32f_32f,
+    },
+    [FV_64F] = {
+        [FV_8U] = (fv_row_filter_func)fv_row_filter_8u_64f,
+        [FV_8S] = (fv_row_filter_func)fv_row_filter_8s_64f,
+        [FV_16U] = (fv_row_filter_func)fv_row_filter_16u_64f,
+        [FV_16S] = (fv_row_filter_func)fv_row_filter_16s_64f,
+        [FV_32S] = (fv_row_filter_func)fv_row_filter_32s_64f,
+        [FV_32F] = (fv_row_filter_func)fv_row_filter_32f_64f,
+        [FV_64F] = (fv_row_filter_func)fv_row_filter_64f_64f,
+    },
 };
 
-#define fv_row_filter_tab_size \
-    (sizeof(fv_row_filter_tab)/sizeof(fv_row_filter_func))
+static fv_row_filter_func 
+fv_get_row_filter_tab(fv_u32 bdepth, fv_u32 sdepth)
+{
+    FV_ASSERT(bdepth < FV_DEPTH_NUM && sdepth < FV_DEPTH_NUM);
+
+    return fv_row_filter_tab[bdepth][sdepth];
+}
+
+#define fv_row_filter_ks_core(dst, src, width, kx_data, filter, ks, cn) \
+    do {\
+        fv_linear_row_filter_t      *row_filter = \
+                    (fv_linear_row_filter_t *)filter;\
+        typeof(*dst)                s0; \
+        float                       kx[ks]; \
+        fv_s32                      i; \
+        fv_s32                      k; \
+                        \
+        for (k = 0; k < ks; k++) { \
+            kx[k] = kx_data[k]; \
+        } \
+        width *= cn; \
+        i = row_filter->lr_vec != NULL ? \
+            row_filter->lr_vec(dst, src, width, kx_data, ks, cn) : 0; \
+        for (; i < width; i++) { \
+            s0 = src[i]*kx[0]; \
+            for (k = 1; k < ks; k++) { \
+                s0 += src[i + k*cn]*kx[k]; \
+            } \
+            dst[i] = s0; \
+        } \
+    } while(0)
+
+#define fv_row_filter_ks_func(sname, stype, bname, btype, ks, cn) \
+    static void \
+    fv_row_filter_##sname##_##bname##_##ks##x##cn(btype *dst, stype *src, \
+                fv_s32 width, float *kx_data, fv_base_row_filter_t *filter) \
+    { \
+        fv_row_filter_ks_core(dst, src, width, kx_data, filter, ks, cn); \
+    }
+
+#define fv_row_filter_ks_funcs(sname, stype, bname, btype) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 3, 1) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 3, 3) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 5, 1) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 5, 3) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 7, 1) \
+    fv_row_filter_ks_func(sname, stype, bname, btype, 7, 3)
+
+#define fv_row_filter_ks_entry(sname, bname) \
+    { \
+        { \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_3x1, \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_3x3, \
+        }, \
+        { \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_5x1, \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_5x3, \
+        }, \
+        { \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_7x1, \
+            (fv_row_filter_func)fv_row_filter_##sname##_##bname##_7x3, \
+        }, \
+    }
+
+fv_row_filter_ks_funcs(8u, fv_u8, 16s, fv_s16)
+fv_row_filter_ks_funcs(8u, fv_u8, 32s, fv_s32)
+fv_row_filter_ks_funcs(8u, fv_u8, 32f, float)
+fv_row_filter_ks_funcs(16u, fv_u16, 32f, float)
+fv_row_filter_ks_funcs(16s, fv_s16, 32f, float)
+fv_row_filter_ks_funcs(32f, float, 32f, float)
+
+/* [buffer depth][source depth][ksize][cn == 3] */
+static fv_row_filter_func 
+fv_row_filter_ks_tab[FV_DEPTH_NUM][FV_DEPTH_NUM][FV_FILTER_KS_NUM][2] = {
+    [FV_16S] = {
+        [FV_8U] = fv_row_filter_ks_entry(8u, 16s),
+    },
+    [FV_32S] = {
+        [FV_8U] = fv_row_filter_ks_entry(8u, 32s),
+    },
+    [FV_32F] = {
+        [FV_8U] = fv_row_filter_ks_entry(8u, 32f),
+        [FV_16U] = fv_row_filter_ks_entry(16u, 32f),
+        [FV_16S] = fv_row_filter_ks_entry(16s, 32f),
+        [FV_32F] = fv_row_filter_ks_entry(32f, 32f),
+    },
+};
 
 static fv_row_filter_func 
-fv_get_row_filter_tab(fv_u32 depth)
+fv_get_row_filter(fv_u32 bdepth, fv_u32 sdepth, fv_s32 ksize, fv_u32 cn)
 {
-    FV_ASSERT(depth < fv_row_filter_tab_size);
+    fv_row_filter_func  func;
+    fv_s32              k;
+
+    k = fv_filter_ks_index(ksize);
+    if (k >= 0 && (cn == 1 || cn == 3)) {
+        func = fv_row_filter_ks_tab[bdepth][sdepth][k][cn == 3];
+        if (func != NULL) {
+            return func;
+        }
+    }
 
-    return fv_row_filter_tab[depth];
+    return fv_get_row_filter_tab(bdepth, sdepth);
 }
 
 #define fv_column_filter_core(dst, src, count, width, ky_data, \
@@ -351,12 +539,17 @@ fv_get_row_filter_tab(fv_u32 depth)
         fv_s32          j; \
         fv_s32          k; \
         fv_s32          cn = col_filter->lc_cn; \
+        fv_bool         sym; \
                         \
         width *= cn; \
         ky_data += ky_size; \
-        if (col_filter->lc_type & FV_KERNEL_SYMMETRICAL) { \
+        sym = (col_filter->lc_type & FV_KERNEL_SYMMETRICAL) != 0; \
+        if (sym) { \
             for (j = 0; j < count; j++, dst += width) { \
-                for (i = 0; i < width; i++) { \
+                i = col_filter->lc_vec != NULL ? \
+                    col_filter->lc_vec(dst, (void **)(src + j + ay), \
+                            width, ky_data, ky_size, sym) : 0; \
+                for (; i < width; i++) { \
                     v = ky_data[0]*src[j + ay][i]; \
                     for (k = 1; k <= ky_size; k++) { \
                         v += ky_data[k]*(src[j + ay + k][i] + \
@@ -367,7 +560,10 @@ fv_get_row_filter_tab(fv_u32 depth)
             } \
         } else { \
             for (j = 0; j < count; j++, dst += width) { \
-                for (i = 0; i < width; i++) { \
+                i = col_filter->lc_vec != NULL ? \
+                    col_filter->lc_vec(dst, (void **)(src + j + ay), \
+                            width, ky_data, ky_size, sym) : 0; \
+                for (; i < width; i++) { \
                     v = 0; \
                     for (k = 1; k <= ky_size; k++) { \
                         v += ky_data[k]*(src[j + ay + k][i] - \
@@ -380,7 +576,7 @@ fv_get_row_filter_tab(fv_u32 depth)
     } while(0)
 
 static void
-fv_column_filter_8u(fv_u8 *dst, double **src, 
+fv_column_filter_16s_8u(fv_u8 *dst, fv_s16 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
@@ -389,399 +585,1789 @@ fv_column_filter_8u(fv_u8 *dst, double **src,
 }
 
 static void
-fv_column_filter_8s(fv_s8 *dst, double **src, 
+fv_column_filter_16s_16s(fv_s16 *dst, fv_s16 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
     fv_column_filter_core(dst, src, count, width, ky_data,
-        filter, fv_saturate_cast_8s);
+        filter, fv_saturate_cast_16s);
 }
 
 static void
-fv_column_filter_16u(fv_u16 *dst, double **src, 
+fv_column_filter_16s_32f(float *dst, fv_s16 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
     fv_column_filter_core(dst, src, count, width, ky_data,
-        filter, fv_saturate_cast_16u);
+        filter, fv_saturate_cast_32f);
 }
 
 static void
-fv_column_filter_16s(fv_s16 *dst, double **src, 
+fv_column_filter_16s_64f(double *dst, fv_s16 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
     fv_column_filter_core(dst, src, count, width, ky_data,
-        filter, fv_saturate_cast_16s);
+        filter, fv_saturate_no_cast);
 }
 
 static void
-fv_column_filter_32s(fv_s32 *dst, double **src, 
+fv_column_filter_32s_8u(fv_u8 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
     fv_column_filter_core(dst, src, count, width, ky_data,
-        filter, fv_saturate_cast_32s);
+        filter, fv_saturate_cast_8u);
 }
 
 static void
-fv_column_filter_32f(float *dst, double **src, 
+fv_column_filter_32s_16s(fv_s16 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
     fv_column_filter_core(dst, src, count, width, ky_data,
-        filter, fv_saturate_cast_32f);
+        filter, fv_saturate_cast_16s);
 }
 
 static void
-fv_column_filter_64f(double *dst, double **src, 
+fv_column_filter_32s_32s(fv_s32 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_linear_column_filter_t   *col_filter = 
-        (fv_linear_column_filter_t *)filter;
-    fv_s32      ky_size = filter->bc_ksize;
-    fv_s32      ay = filter->bc_anchor;
-    fv_s32      cn = col_filter->lc_cn;
-    fv_s32      i;
-    fv_s32      j;
-    fv_s32      k;
-    
-    ky_data += ky_size;
-    width *= cn;
-    if (filter->bc_type & FV_KERNEL_SYMMETRICAL) {
-        for (j = 0; j < count; j++, dst += width) {
-            for (i = 0; i < width; i++) {
-                dst[i] = ky_data[0]*src[j + ay][i];
-                for (k = 1; k <= ky_size; k++) {
-                    dst[i] += ky_data[k]*(src[j + ay + k][i] + 
-                            src[j + ay - k][i]);
-                }
-            }
-        }
-    } else {
-        for (j = 0; j < count; j++, dst += width) {
-            for (i = 0; i < width; i++) {
-                dst[i] = 0;
-                for (k = 1; k <= ky_size; k++) {
-                    dst[i] += ky_data[k]*(src[j + ay - k][i] - 
-                            src[j + ay + k][i]);
-                }
-            }
-        }
-    }
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
 }
 
-static fv_column_filter_func fv_column_filter_tab[] = {
-    (fv_column_filter_func)fv_column_filter_8u,
-    (fv_column_filter_func)fv_column_filter_8s,
-    (fv_column_filter_func)fv_column_filter_16u,
-    (fv_column_filter_func)fv_column_filter_16s,
-    (fv_column_filter_func)fv_column_filter_32s,
-    (fv_column_filter_func)fv_column_filter_32f,
-    (fv_column_filter_func)fv_column_filter_64f,
-};
-
-#define fv_column_filter_tab_size \
-    (sizeof(fv_column_filter_tab)/sizeof(fv_column_filter_func))
-
-static fv_column_filter_func 
-fv_get_column_filter_tab(fv_u32 depth)
+static void
+fv_column_filter_32s_32f(float *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    FV_ASSERT(depth < fv_column_filter_tab_size);
-
-    return fv_column_filter_tab[depth];
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32f);
 }
 
-void 
-fv_sep_filter_proceed(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel,
-                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
-                fv_point_t anchor, double delta, 
-                fv_s32 border_type, fv_filter_engine_t *filter)
+static void
+fv_column_filter_32s_64f(double *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_base_filter_t            *filter_2D;
-    fv_base_row_filter_t        *row_filter;
-    fv_base_column_filter_t     *col_filter;
-    fv_border_make_row_func     make_border; 
-    fv_u8                       *dst_data;
-    fv_u8                       *src_data;
-    double                      **buf;
-    void                        *tmp;
-    void                        *src_buf;
-    void                        *row;
-    fv_u32                      src_buf_len;
-    fv_u32                      cn;
-    fv_s32                      kx_row;
-    fv_s32                      ky_row;
-    fv_s32                      buf_row;
-    fv_s32                      buf_col;
-    fv_s32                      src_step;
-    fv_s32                      dst_step;
-    fv_s32                      col;
-    fv_s32                      row_num;
-    fv_s32                      width;
-    fv_s32                      height;
-    fv_s32                      ax;
-    fv_s32                      ay;
-    fv_s32                      s;
-    fv_s32                      i;
-    fv_s32                      j;
-    fv_s32                      k;
-    fv_s32                      h;
-    fv_bool                     first;
-    fv_bool                     is_separable; 
-
-    filter_2D = filter->fe_filter_2D;
-    row_filter = filter->fe_row_filter;
-    col_filter = filter->fe_col_filter;
-
-    FV_ASSERT((row_filter != NULL && col_filter != NULL) ||
-            filter_2D != NULL); 
-
-    is_separable = filter->fe_is_separable;
-    if (is_separable) {
-        kx_row = kernel_x->mt_rows;
-        ky_row = kernel_y->mt_rows;
-    } else {
-        kx_row = ky_row =  kernel->mt_rows;
-    }
-    
-    ax = anchor.pt_x;
-    ay = anchor.pt_y;
-
-    dst_data = dst->mt_data.dt_ptr;
-    src_data = src->mt_data.dt_ptr;
-
-    width = dst->mt_cols;
-    height = dst->mt_rows;
-    row_num = FV_SEP_FILTER_OUTPUT_LINE_NUM;
-    buf_row = row_num + 2*ky_row - 2 - ay;
-    cn = src->mt_nchannel;
-    buf_col = (width + kx_row)*cn;
-
-    dst_step = dst->mt_step;
-    src_step = src->mt_step;
-    src_buf_len = src_step + (kx_row - 1)*src_step/width;
-    src_buf = fv_calloc(src_buf_len);
-    FV_ASSERT(src_buf != NULL);
-    buf = fv_alloc(buf_row*sizeof(*buf));
-    FV_ASSERT(buf != NULL);
-
-    s = buf_col*sizeof(**buf);
-    for (i = 0; i < buf_row; i++) {
-        buf[i] = fv_alloc(s);
-        FV_ASSERT(buf[i] != NULL);
-    }
-
-    make_border = fv_border_get_func(src->mt_depth);
-    FV_ASSERT(make_border != NULL);
-    for (h = 0, j = 0; j < ky_row - 1 - ay; j++, src_data += src_step, h++) {
-        row = is_separable ? src_buf:buf[ay + j];
-        make_border(row, src_data, src_buf_len, src_step, width, 
-                cn, kx_row, ax, border_type);
-        if (is_separable) {
-            row_filter->br_filter(buf[ay + j], row, width, 
-                    kernel_x->mt_data.dt_fl, row_filter);
-        }
-    }
-
-    first = 1;
-    for (; h < height; dst_data += dst_step*row_num) {
-        for (j = 0; j < row_num && h < height; 
-                j++, src_data += src_step, h++) {
-            row = is_separable ? src_buf:buf[ky_row - 1 + j];
-            make_border(row, src_data, src_buf_len, src_step, width,
-                    cn, kx_row, ax, border_type);
-            if (is_separable) {
-                row_filter->br_filter(buf[ky_row - 1 + j], row, width,
-                        kernel_x->mt_data.dt_fl, row_filter);
-            }
-        }
-        if (first) {
-            for (k = 0; k < ay; k++) {
-                if (border_type == FV_BORDER_CONSTANT) {
-                    memset(buf[k], 0, s);
-                } else {
-                    col = fv_border_get_value(border_type, k - ay, height);
-                    memcpy(buf[k], buf[ay + col], s);
-                }
-            }
-            first = 0;
-        }
-        if (h == height) {
-            for (k = 0; k < ky_row - 1 - ay; k++) {
-                if (border_type == FV_BORDER_CONSTANT) {
-                    memset(buf[ky_row - 1 + j + k], 0, s);
-                } else {
-                    col = fv_border_get_value(border_type, 
-                            height - 1 + k, height);
-                    memcpy(buf[ky_row - 1 + j + k], 
-                            buf[ky_row - 1 + j + col - height], s);
-                }
-            }
-            j += ky_row - 1 - ay;
-        }
-
-        if (is_separable) {
-            col_filter->bc_filter(dst_data, buf, j, width, 
-                    kernel_y->mt_data.dt_fl, col_filter);
-        } else {
-            filter_2D->bf_filter(dst_data, buf, j, width, 
-                    kernel->mt_data.dt_fl, cn, filter_2D);
-        }
-        for (k = 0; k < ky_row - 1; k++) {
-            tmp = buf[row_num + k];
-            buf[row_num + k] = buf[k];
-            buf[k] = tmp;
-        }
-    }
-
-    for (i = 0; i < buf_row; i++) {
-        fv_free(&buf[i]);
-    }
-
-    fv_free(&buf);
-    fv_free(&src_buf);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
 }
 
-void 
-fv_sep_filter2D(fv_mat_t *dst, fv_mat_t *src,
-                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
-                fv_point_t anchor, double delta, fv_s32 border_type)
+static void
+fv_column_filter_32f_8u(fv_u8 *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_mat_t                    *kernel;
-    fv_filter_engine_t          filter = {};
-    fv_linear_row_filter_t      row_filter = {};
-    fv_linear_column_filter_t   col_filter = {};
-    fv_s32                      ay;
-    fv_s32                      cn;
-
-    if (anchor.pt_x < 0) {
-        anchor.pt_x = ((kernel_x->mt_rows - 1) >> 1);
-    }
-
-    if (anchor.pt_y < 0) {
-        anchor.pt_y = ((kernel_y->mt_rows - 1) >> 1);
-    }
-
-    ay = anchor.pt_y;
-    cn = src->mt_nchannel;
-    row_filter.lr_filter = fv_get_row_filter_tab(src->mt_depth);
-    row_filter.lr_anchor = anchor.pt_x;
-    row_filter.lr_ksize = kernel_x->mt_rows;
-    row_filter.lr_cn = cn;
-    col_filter.lc_filter = fv_get_column_filter_tab(dst->mt_depth);
-    col_filter.lc_ksize = (kernel_y->mt_rows >> 1);
-    col_filter.lc_anchor = ay;
-    col_filter.lc_cn = cn;
-
-    kernel = fv_create_mat(kernel_y->mt_rows, kernel_y->mt_cols, 
-            FV_MAKETYPE(FV_DEPTH_64F, 1));
-    FV_ASSERT(kernel != NULL);
-    fv_convert_mat(kernel, kernel_y);
-    col_filter.lc_type = 
-        fv_get_kernel_type(kernel, kernel_y->mt_rows == 1 ? 
-            fv_point(ay, 0):fv_point(0, ay));
-    fv_release_mat(&kernel);
-
-    filter.fe_row_filter = &row_filter.lr_base;
-    filter.fe_col_filter = &col_filter.lc_base;
-    filter.fe_is_separable = 1;
-    fv_sep_filter_proceed(dst, src, NULL, kernel_x, kernel_y, anchor, delta,
-            border_type, &filter);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
 }
 
-#define fv_filter_2D_core(dst, src, count, width, cn, filter, castop) \
-    do { \
-        fv_filter_2D_t      *filter_2D = (fv_filter_2D_t *)filter; \
-        fv_point_t          *pt = filter_2D->ft_coords; \
-        float               *kf = (float *)filter_2D->ft_coeffs; \
-        typeof(dst)         *kp = filter_2D->ft_ptrs; \
-        fv_s32              i; \
-        fv_s32              k; \
-        fv_s32              nz = filter_2D->ft_nz; \
-        double              s0; \
-                            \
-        width *= cn; \
-        for (; count > 0; count--, dst += width, src++) { \
-            for (k = 0; k < nz; k++) { \
-                kp[k] = src[pt[k].pt_y] + pt[k].pt_x*cn; \
-            } \
-            \
-            for (i = 0; i < width; i++) { \
-                s0 = kf[0]*kp[0][i]; \
-                for (k = 1; k < nz; k++) { \
-                    s0 += kf[k]*kp[k][i]; \
-                } \
-                dst[i] = castop(s0); \
-            } \
-        } \
-    } while(0)
-
-
 static void
-fv_filter_2D_8u(fv_u8 *dst, fv_u8 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_32f_8s(fv_s8 *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_8u);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8s);
 }
 
 static void
-fv_filter_2D_8s(fv_s8 *dst, fv_s8 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_32f_16u(fv_u16 *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_8s);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16u);
 }
 
 static void
-fv_filter_2D_16u(fv_u16 *dst, fv_u16 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_32f_16s(fv_s16 *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_16u);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
 }
 
 static void
-fv_filter_2D_16s(fv_s16 *dst, fv_s16 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_32f_32f(float *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_16s);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32f);
 }
 
 static void
-fv_filter_2D_32s(fv_s32 *dst, fv_s32 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_64f_8u(fv_u8 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_32s);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
 }
 
 static void
-fv_filter_2D_32f(float *dst, float **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_64f_8s(fv_s8 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_core(dst, src, count, width, cn, filter,
-            fv_saturate_cast_32f);
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8s);
 }
 
 static void
-fv_filter_2D_64f(double *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_column_filter_64f_16u(fv_u16 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
 {
-    fv_filter_2D_t      *filter_2D = (fv_filter_2D_t *)filter;
-    fv_point_t          *pt = filter_2D->ft_coords;
-    float               *kf = (float *)filter_2D->ft_coeffs;
-    double          **kp = filter_2D->ft_ptrs;
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16u);
+}
+
+static void
+fv_column_filter_64f_16s(fv_s16 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
+}
+
+static void
+fv_column_filter_64f_32s(fv_s32 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
+}
+
+static void
+fv_column_filter_64f_32f(float *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32f);
+}
+
+static void
+fv_column_filter_64f_64f(double *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+/* [buffer depth][destination depth] */
+static fv_column_filter_func 
+fv_column_filter_tab[FV_DEPTH_NUM][FV_DEPTH_NUM] = {
+    [FV_16S] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_16s_8u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_16s_16s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_16s_32f,
+        [FV_64F] = (fv_column_filter_func)fv_column_filter_16s_64f,
+    },
+    [FV_32S] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_32s_8u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_32s_16s,
+        [FV_32S] = (fv_column_filter_func)fv_column_filter_32s_32s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_32s_32f,
+        [FV_64F] = (fv_column_filter_func)fv_column_filter_32s_64f,
+    },
+    [FV_32F] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_32f_8u,
+        [FV_8S] = (fv_column_filter_func)fv_column_filter_32f_8s,
+        [FV_16U] = (fv_column_filter_func)fv_column_filter_32f_16u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_32f_16s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_32f_32f,
+    },
+    [FV_64F] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_64f_8u,
+        [FV_8S] = (fv_column_filter_func)fv_column_filter_64f_8s,
+        [FV_16U] = (fv_column_filter_func)fv_column_filter_64f_16u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_64f_16s,
+        [FV_32S] = (fv_column_filter_func)fv_column_filter_64f_32s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_64f_32f,
+        [FV_64F] = (fv_column_filter_func)fv_column_filter_64f_64f,
+    },
+};
+
+static fv_column_filter_func 
+fv_get_column_filter_tab(fv_u32 bdepth, fv_u32 ddepth)
+{
+    FV_ASSERT(bdepth < FV_DEPTH_NUM && ddepth < FV_DEPTH_NUM);
+
+    return fv_column_filter_tab[bdepth][ddepth];
+}
+
+#define fv_column_filter_ks_core(dst, src, count, width, ky_data, \
+        filter, cast, hs) \
+    do { \
+        fv_linear_column_filter_t   *col_filter = \
+            (fv_linear_column_filter_t *)filter;\
+        float           ky[hs + 1]; \
+        double          v; \
+        fv_s32          ay = filter->bc_anchor; \
+        fv_s32          i; \
+        fv_s32          j; \
+        fv_s32          k; \
+        fv_bool         sym; \
+                        \
+        width *= col_filter->lc_cn; \
+        ky_data += hs; \
+        for (k = 0; k <= hs; k++) { \
+            ky[k] = ky_data[k]; \
+        } \
+        sym = (col_filter->lc_type & FV_KERNEL_SYMMETRICAL) != 0; \
+        for (j = 0; j < count; j++, dst += width) { \
+            i = col_filter->lc_vec != NULL ? \
+                col_filter->lc_vec(dst, (void **)(src + j + ay), \
+                        width, ky_data, hs, sym) : 0; \
+            if (sym) { \
+                for (; i < width; i++) { \
+                    v = ky[0]*src[j + ay][i]; \
+                    for (k = 1; k <= hs; k++) { \
+                        v += ky[k]*(src[j + ay + k][i] + \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast(v); \
+                } \
+            } else { \
+                for (; i < width; i++) { \
+                    v = 0; \
+                    for (k = 1; k <= hs; k++) { \
+                        v += ky[k]*(src[j + ay + k][i] - \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast(v); \
+                } \
+            } \
+        } \
+    } while(0)
+
+/* 
+ * Column filters see rows of width*cn elements, so only the kernel
+ * size is specialized (hs is half of it).
+ */
+#define fv_column_filter_ks_func(bname, btype, dname, dtype, cast, hs) \
+    static void \
+    fv_column_filter_##bname##_##dname##_##hs(dtype *dst, btype **src, \
+               fv_s32 count, fv_s32 width, float *ky_data, \
+               fv_base_column_filter_t *filter) \
+    { \
+        fv_column_filter_ks_core(dst, src, count, width, ky_data, \
+            filter, cast, hs); \
+    }
+
+#define fv_column_filter_ks_funcs(bname, btype, dname, dtype, cast) \
+    fv_column_filter_ks_func(bname, btype, dname, dtype, cast, 1) \
+    fv_column_filter_ks_func(bname, btype, dname, dtype, cast, 2) \
+    fv_column_filter_ks_func(bname, btype, dname, dtype, cast, 3)
+
+#define fv_column_filter_ks_entry(bname, dname) \
+    { \
+        (fv_column_filter_func)fv_column_filter_##bname##_##dname##_1, \
+        (fv_column_filter_func)fv_column_filter_##bname##_##dname##_2, \
+        (fv_column_filter_func)fv_column_filter_##bname##_##dname##_3, \
+    }
+
+fv_column_filter_ks_funcs(16s, fv_s16, 8u, fv_u8, fv_saturate_cast_8u)
+fv_column_filter_ks_funcs(16s, fv_s16, 16s, fv_s16, fv_saturate_cast_16s)
+fv_column_filter_ks_funcs(16s, fv_s16, 32f, float, fv_saturate_cast_32f)
+fv_column_filter_ks_funcs(32s, fv_s32, 8u, fv_u8, fv_saturate_cast_8u)
+fv_column_filter_ks_funcs(32s, fv_s32, 16s, fv_s16, fv_saturate_cast_16s)
+fv_column_filter_ks_funcs(32s, fv_s32, 32f, float, fv_saturate_cast_32f)
+fv_column_filter_ks_funcs(32f, float, 8u, fv_u8, fv_saturate_cast_8u)
+fv_column_filter_ks_funcs(32f, float, 16s, fv_s16, fv_saturate_cast_16s)
+fv_column_filter_ks_funcs(32f, float, 32f, float, fv_saturate_cast_32f)
+
+/* [buffer depth][destination depth][ksize] */
+static fv_column_filter_func 
+fv_column_filter_ks_tab[FV_DEPTH_NUM][FV_DEPTH_NUM][FV_FILTER_KS_NUM] = {
+    [FV_16S] = {
+        [FV_8U] = fv_column_filter_ks_entry(16s, 8u),
+        [FV_16S] = fv_column_filter_ks_entry(16s, 16s),
+        [FV_32F] = fv_column_filter_ks_entry(16s, 32f),
+    },
+    [FV_32S] = {
+        [FV_8U] = fv_column_filter_ks_entry(32s, 8u),
+        [FV_16S] = fv_column_filter_ks_entry(32s, 16s),
+        [FV_32F] = fv_column_filter_ks_entry(32s, 32f),
+    },
+    [FV_32F] = {
+        [FV_8U] = fv_column_filter_ks_entry(32f, 8u),
+        [FV_16S] = fv_column_filter_ks_entry(32f, 16s),
+        [FV_32F] = fv_column_filter_ks_entry(32f, 32f),
+    },
+};
+
+static fv_column_filter_func 
+fv_get_column_filter(fv_u32 bdepth, fv_u32 ddepth, fv_s32 ksize)
+{
+    fv_column_filter_func   func;
+    fv_s32                  k;
+
+    k = fv_filter_ks_index(ksize);
+    if (k >= 0) {
+        func = fv_column_filter_ks_tab[bdepth][ddepth][k];
+        if (func != NULL) {
+            return func;
+        }
+    }
+
+    return fv_get_column_filter_tab(bdepth, ddepth);
+}
+
+/*
+ * Integer column filter for 16s/32s rows: ky_data holds integer taps
+ * and the sum is rounded back by lc_shift bits (0 for exact integer
+ * kernels).
+ */
+#define fv_column_filter_fixed_core(dst, src, count, width, ky_data, \
+        filter, cast) \
+    do { \
+        fv_linear_column_filter_t   *col_filter = \
+            (fv_linear_column_filter_t *)filter;\
+        fv_s32          ky[FV_FILTER_FIXED_MAX_KSIZE]; \
+        fv_s32          *kc; \
+        fv_s32          v; \
+        fv_s32          ky_size = filter->bc_ksize; \
+        fv_s32          ay = filter->bc_anchor; \
+        fv_s32          shift = col_filter->lc_shift; \
+        fv_s32          delta = shift > 0 ? 1 << (shift - 1) : 0; \
+        fv_s32          i; \
+        fv_s32          j; \
+        fv_s32          k; \
+        fv_s32          cn = col_filter->lc_cn; \
+        fv_bool         sym; \
+                        \
+        width *= cn; \
+        for (k = 0; k <= ky_size*2; k++) { \
+            ky[k] = (fv_s32)ky_data[k]; \
+        } \
+        kc = ky + ky_size; \
+        sym = (col_filter->lc_type & FV_KERNEL_SYMMETRICAL) != 0; \
+        for (j = 0; j < count; j++, dst += width) { \
+            i = col_filter->lc_vec != NULL ? \
+                col_filter->lc_vec(dst, (void **)(src + j + ay), \
+                        width, ky_data + ky_size, ky_size, sym) : 0; \
+            if (sym) { \
+                for (; i < width; i++) { \
+                    v = kc[0]*src[j + ay][i]; \
+                    for (k = 1; k <= ky_size; k++) { \
+                        v += kc[k]*(src[j + ay + k][i] + \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast((v + delta) >> shift); \
+                } \
+            } else { \
+                for (; i < width; i++) { \
+                    v = 0; \
+                    for (k = 1; k <= ky_size; k++) { \
+                        v += kc[k]*(src[j + ay + k][i] - \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast((v + delta) >> shift); \
+                } \
+            } \
+        } \
+    } while(0)
+
+static void
+fv_column_filter_fixed_16s_8u(fv_u8 *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
+}
+
+static void
+fv_column_filter_fixed_16s_16s(fv_s16 *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
+}
+
+static void
+fv_column_filter_fixed_16s_32s(fv_s32 *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
+}
+
+static void
+fv_column_filter_fixed_16s_32f(float *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+static void
+fv_column_filter_fixed_16s_64f(double *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+static void
+fv_column_filter_fixed_32s_8u(fv_u8 *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
+}
+
+static void
+fv_column_filter_fixed_32s_16s(fv_s16 *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
+}
+
+static void
+fv_column_filter_fixed_32s_32s(fv_s32 *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
+}
+
+static void
+fv_column_filter_fixed_32s_32f(float *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+static void
+fv_column_filter_fixed_32s_64f(double *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_column_filter_fixed_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+/* [buffer depth][destination depth] */
+static fv_column_filter_func 
+fv_column_filter_fixed_tab[FV_DEPTH_NUM][FV_DEPTH_NUM] = {
+    [FV_16S] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_fixed_16s_8u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_fixed_16s_16s,
+        [FV_32S] = (fv_column_filter_func)fv_column_filter_fixed_16s_32s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_fixed_16s_32f,
+        [FV_64F] = (fv_column_filter_func)fv_column_filter_fixed_16s_64f,
+    },
+    [FV_32S] = {
+        [FV_8U] = (fv_column_filter_func)fv_column_filter_fixed_32s_8u,
+        [FV_16S] = (fv_column_filter_func)fv_column_filter_fixed_32s_16s,
+        [FV_32S] = (fv_column_filter_func)fv_column_filter_fixed_32s_32s,
+        [FV_32F] = (fv_column_filter_func)fv_column_filter_fixed_32s_32f,
+        [FV_64F] = (fv_column_filter_func)fv_column_filter_fixed_32s_64f,
+    },
+};
+
+static fv_column_filter_func 
+fv_get_column_filter_fixed_tab(fv_u32 bdepth, fv_u32 ddepth)
+{
+    FV_ASSERT(bdepth < FV_DEPTH_NUM && ddepth < FV_DEPTH_NUM);
+
+    return fv_column_filter_fixed_tab[bdepth][ddepth];
+}
+
+#define fv_column_filter_fixed_ks_core(dst, src, count, width, ky_data, \
+        filter, cast, hs) \
+    do { \
+        fv_linear_column_filter_t   *col_filter = \
+            (fv_linear_column_filter_t *)filter;\
+        fv_s32          kc[hs + 1]; \
+        fv_s32          v; \
+        fv_s32          ay = filter->bc_anchor; \
+        fv_s32          shift = col_filter->lc_shift; \
+        fv_s32          delta = shift > 0 ? 1 << (shift - 1) : 0; \
+        fv_s32          i; \
+        fv_s32          j; \
+        fv_s32          k; \
+        fv_bool         sym; \
+                        \
+        width *= col_filter->lc_cn; \
+        for (k = 0; k <= hs; k++) { \
+            kc[k] = (fv_s32)ky_data[hs + k]; \
+        } \
+        sym = (col_filter->lc_type & FV_KERNEL_SYMMETRICAL) != 0; \
+        for (j = 0; j < count; j++, dst += width) { \
+            i = col_filter->lc_vec != NULL ? \
+                col_filter->lc_vec(dst, (void **)(src + j + ay), \
+                        width, ky_data + hs, hs, sym) : 0; \
+            if (sym) { \
+                for (; i < width; i++) { \
+                    v = kc[0]*src[j + ay][i]; \
+                    for (k = 1; k <= hs; k++) { \
+                        v += kc[k]*(src[j + ay + k][i] + \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast((v + delta) >> shift); \
+                } \
+            } else { \
+                for (; i < width; i++) { \
+                    v = 0; \
+                    for (k = 1; k <= hs; k++) { \
+                        v += kc[k]*(src[j + ay + k][i] - \
+                                src[j + ay - k][i]); \
+                    } \
+                    dst[i] = cast((v + delta) >> shift); \
+                } \
+            } \
+        } \
+    } while(0)
+
+#define fv_column_filter_fixed_ks_func(bname, btype, dname, dtype, cast, hs) \
+    static void \
+    fv_column_filter_fixed_##bname##_##dname##_##hs(dtype *dst, \
+               btype **src, fv_s32 count, fv_s32 width, float *ky_data, \
+               fv_base_column_filter_t *filter) \
+    { \
+        fv_column_filter_fixed_ks_core(dst, src, count, width, ky_data, \
+            filter, cast, hs); \
+    }
+
+#define fv_column_filter_fixed_ks_funcs(bname, btype, dname, dtype, cast) \
+    fv_column_filter_fixed_ks_func(bname, btype, dname, dtype, cast, 1) \
+    fv_column_filter_fixed_ks_func(bname, btype, dname, dtype, cast, 2) \
+    fv_column_filter_fixed_ks_func(bname, btype, dname, dtype, cast, 3)
+
+#define fv_column_filter_fixed_ks_entry(bname, dname) \
+    { \
+        (fv_column_filter_func)fv_column_filter_fixed_##bname##_##dname##_1, \
+        (fv_column_filter_func)fv_column_filter_fixed_##bname##_##dname##_2, \
+        (fv_column_filter_func)fv_column_filter_fixed_##bname##_##dname##_3, \
+    }
+
+fv_column_filter_fixed_ks_funcs(16s, fv_s16, 8u, fv_u8, fv_saturate_cast_8u)
+fv_column_filter_fixed_ks_funcs(16s, fv_s16, 16s, fv_s16, 
+        fv_saturate_cast_16s)
+fv_column_filter_fixed_ks_funcs(32s, fv_s32, 8u, fv_u8, fv_saturate_cast_8u)
+fv_column_filter_fixed_ks_funcs(32s, fv_s32, 16s, fv_s16, 
+        fv_saturate_cast_16s)
+
+/* [buffer depth][destination depth][ksize] */
+static fv_column_filter_func 
+fv_column_filter_fixed_ks_tab[FV_DEPTH_NUM][FV_DEPTH_NUM][FV_FILTER_KS_NUM] = {
+    [FV_16S] = {
+        [FV_8U] = fv_column_filter_fixed_ks_entry(16s, 8u),
+        [FV_16S] = fv_column_filter_fixed_ks_entry(16s, 16s),
+    },
+    [FV_32S] = {
+        [FV_8U] = fv_column_filter_fixed_ks_entry(32s, 8u),
+        [FV_16S] = fv_column_filter_fixed_ks_entry(32s, 16s),
+    },
+};
+
+static fv_column_filter_func 
+fv_get_column_filter_fixed(fv_u32 bdepth, fv_u32 ddepth, fv_s32 ksize)
+{
+    fv_column_filter_func   func;
+    fv_s32                  k;
+
+    k = fv_filter_ks_index(ksize);
+    if (k >= 0) {
+        func = fv_column_filter_fixed_ks_tab[bdepth][ddepth][k];
+        if (func != NULL) {
+            return func;
+        }
+    }
+
+    return fv_get_column_filter_fixed_tab(bdepth, ddepth);
+}
+
+static fv_u32 fv_filter_buf_elem_size[] = {
+    sizeof(fv_u8),
+    sizeof(fv_s8),
+    sizeof(fv_u16),
+    sizeof(fv_s16),
+    sizeof(fv_s32),
+    sizeof(float),
+    sizeof(double),
+};
+
+/*
+ * Pick the type of the rows passed from the row filter to the column
+ * filter: exact 16s/32s sums for 8u images and integer kernels, float
+ * unless the image is 32s/64f, and double as the fallback when there
+ * is no column filter for the destination depth.
+ */
+static fv_u32
+fv_get_sep_filter_buf_depth(fv_u32 sdepth, fv_u32 ddepth, 
+                fv_mat_t *kernel_x, fv_s32 kx_type)
+{
+    float       *kx_data = kernel_x->mt_data.dt_fl;
+    double      sum = 0;
+    fv_u32      bdepth;
+    fv_s32      i;
+
+    if (sdepth == FV_8U && (kx_type & FV_KERNEL_INTEGER)) {
+        for (i = 0; i < kernel_x->mt_rows; i++) {
+            sum += fabs(kx_data[i]);
+        }
+        bdepth = sum*UCHAR_MAX <= fv_short_max ? FV_16S:FV_32S;
+    } else if (sdepth != FV_32S && sdepth != FV_64F) {
+        bdepth = FV_32F;
+    } else {
+        bdepth = FV_64F;
+    }
+
+    if (fv_get_column_filter_tab(bdepth, ddepth) == NULL) {
+        bdepth = FV_64F;
+    }
+
+    return bdepth;
+}
+
+/*
+ * Classify a 1D float kernel (a column vector of mt_rows taps) with
+ * fv_get_kernel_type.
+ */
+static fv_s32
+fv_get_sep_kernel_type(fv_mat_t *kernel_1d, fv_s32 anchor)
+{
+    fv_mat_t    *kernel;
+    fv_s32      type;
+    fv_s32      i;
+
+    kernel = fv_create_mat(kernel_1d->mt_rows, 1, 
+            FV_MAKETYPE(FV_DEPTH_64F, 1));
+    FV_ASSERT(kernel != NULL);
+    for (i = 0; i < kernel->mt_rows; i++) {
+        kernel->mt_data.dt_db[i] = kernel_1d->mt_data.dt_fl[i];
+    }
+    type = fv_get_kernel_type(kernel, fv_point(0, anchor));
+    fv_release_mat(&kernel);
+
+    return type;
+}
+
+/*
+ * 8u images are filtered in integer arithmetic when both kernels are
+ * integer (exact, no shift) or both are smooth, in which case the
+ * taps are quantized to FV_FILTER_FIXED_BITS fraction bits each and
+ * the column filter rounds the sum back. Kernels longer than
+ * FV_FILTER_FIXED_MAX_KSIZE, whose quantization errors add up, use
+ * the float path. The integer kernels go to
+ * *kx_fixed and *ky_fixed (the original ones if already integer).
+ * Returns the buffer depth, or -1 if the float path has to be used.
+ */
+static fv_s32
+fv_sep_filter_fixed_point(fv_mat_t **kx_fixed, fv_mat_t **ky_fixed,
+                fv_s32 *shift, fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_s32 kx_type, fv_s32 ky_type, fv_u32 sdepth, 
+                fv_u32 ddepth)
+{
+    fv_mat_t    *kernel[2] = {kernel_x, kernel_y};
+    fv_mat_t    *fixed[2];
+    double      sum[2] = {};
+    double      scale;
+    float       *data;
+    fv_s32      bdepth;
+    fv_s32      imax;
+    fv_s32      i;
+    fv_s32      k;
+
+    if (sdepth != FV_8U || kernel_y->mt_rows > FV_FILTER_FIXED_MAX_KSIZE ||
+            kernel_x->mt_rows > FV_FILTER_FIXED_MAX_KSIZE ||
+            !(ky_type & (FV_KERNEL_SYMMETRICAL | FV_KERNEL_ASYMMETRICAL))) {
+        return -1;
+    }
+
+    if ((kx_type & ky_type & FV_KERNEL_INTEGER)) {
+        *shift = 0;
+        scale = 1;
+        fixed[0] = kernel_x;
+        fixed[1] = kernel_y;
+    } else if (ddepth == FV_8U && (kx_type & ky_type & FV_KERNEL_SMOOTH)) {
+        *shift = FV_FILTER_FIXED_BITS*2;
+        scale = 1 << FV_FILTER_FIXED_BITS;
+        for (k = 0; k < 2; k++) {
+            fixed[k] = fv_create_mat(kernel[k]->mt_rows, 1, 
+                    FV_MAKETYPE(FV_DEPTH_32F, 1));
+            FV_ASSERT(fixed[k] != NULL);
+            data = fixed[k]->mt_data.dt_fl;
+            for (i = 0, imax = 0; i < kernel[k]->mt_rows; i++) {
+                data[i] = fv_round(kernel[k]->mt_data.dt_fl[i]*scale);
+                sum[k] += data[i];
+                if (data[i] > data[imax]) {
+                    imax = i;
+                }
+            }
+            /* keep the gain at 1: the rounding error goes to the peak */
+            data[imax] += scale - sum[k];
+            sum[k] = 0;
+        }
+    } else {
+        return -1;
+    }
+
+    for (k = 0; k < 2; k++) {
+        data = fixed[k]->mt_data.dt_fl;
+        for (i = 0; i < fixed[k]->mt_rows; i++) {
+            sum[k] += fabs(data[i]);
+        }
+    }
+
+    if (*shift == 0 && sum[0]*UCHAR_MAX <= fv_short_max) {
+        bdepth = FV_16S;
+    } else {
+        bdepth = FV_32S;
+    }
+
+    if (sum[0]*sum[1]*UCHAR_MAX + (1 << *shift) > fv_int_max ||
+            fv_get_column_filter_fixed_tab(bdepth, ddepth) == NULL) {
+        for (k = 0; k < 2; k++) {
+            if (fixed[k] != kernel[k]) {
+                fv_release_mat(&fixed[k]);
+            }
+        }
+        return -1;
+    }
+
+    *kx_fixed = fixed[0];
+    *ky_fixed = fixed[1];
+
+    return bdepth;
+}
+
+typedef struct _fv_filter_proceed_t {
+    fv_filter_engine_t          *fp_filter;
+    fv_mat_t                    *fp_dst;
+    fv_mat_t                    *fp_dst2;
+    fv_mat_t                    *fp_src;
+    fv_bool                     fp_in_place;
+} fv_filter_proceed_t;
+
+/*
+ * Copy n pixels of source columns c0, c0 + 1, ... of row to dst.
+ * Columns outside the image go through the border tables, which give
+ * the column read (outside the view for real ROI neighbours) or
+ * FV_BORDER_MAP_ZERO for a zero pixel.
+ */
+static void
+fv_filter_engine_gather(fv_filter_engine_t *filter, fv_u8 *dst, 
+            fv_u8 *row, fv_s32 c0, fv_s32 n)
+{
+    fv_s32      elem_size;
+    fv_s32      width = filter->fe_width;
+    fv_s32      ax = filter->fe_anchor.pt_x;
+    fv_s32      c1 = c0 + n;
+    fv_s32      c;
+    fv_s32      m;
+
+    elem_size = fv_filter_buf_elem_size[filter->fe_src_depth]*
+        filter->fe_nchannel;
+    for (c = c0; c < c1; c++, dst += elem_size) {
+        if (c >= 0 && c < width) {
+            m = fv_min(c1, width) - c;
+            memcpy(dst, row + c*elem_size, m*elem_size);
+            dst += (m - 1)*elem_size;
+            c += m - 1;
+            continue;
+        }
+        m = filter->fe_border.bm_xmap[c < 0 ? c + ax:ax + c - width];
+        if (m == FV_BORDER_MAP_ZERO) {
+            memset(dst, 0, elem_size);
+        } else {
+            memcpy(dst, row + m*elem_size, elem_size);
+        }
+    }
+}
+
+/*
+ * Row filter n pixels of src into buf_row from pixel x on and, for
+ * engines with a second output, with the second kernel into buf_row2.
+ */
+static void
+fv_filter_engine_row_filter(fv_filter_engine_t *filter, fv_u8 *buf_row,
+            fv_u8 *buf_row2, fv_s32 x, fv_u8 *src, fv_s32 n)
+{
+    fv_base_row_filter_t    *row_filter = filter->fe_row_filter;
+    fv_base_row_filter_t    *row_filter2 = filter->fe_row_filter2;
+    fv_u32                  offset;
+
+    offset = x*filter->fe_nchannel*
+        fv_filter_buf_elem_size[filter->fe_buf_depth];
+    row_filter->br_filter(buf_row + offset, src, n, filter->fe_kx_data, 
+            row_filter);
+    if (row_filter2 != NULL) {
+        row_filter2->br_filter(buf_row2 + offset, src, n, 
+                filter->fe_kx2_data, row_filter2);
+    }
+}
+
+/*
+ * Source row y of src: rows past a view are read from the matrix
+ * around it and only rows past that go through the border. NULL for
+ * a constant border row.
+
+ */
+static fv_u8 *
+fv_filter_engine_src_row(fv_filter_engine_t *filter, fv_mat_t *src,
+            fv_s32 y)
+{
+    y = fv_border_map_y(&filter->fe_border, y);
+    if (y == FV_BORDER_MAP_ZERO) {
+        return NULL;
+    }
+
+    return src->mt_data.dt_ptr + y*src->mt_step;
+}
+
+/*
+ * Columns c0 .. c0 + n - 1 of row with the border: gathered into buf,
+ * or read in place from a row saved bordered.
+ */
+static fv_u8 *
+fv_filter_engine_bordered(fv_filter_engine_t *filter, fv_u8 *buf, 
+            fv_u8 *row, fv_bool saved, fv_s32 c0, fv_s32 n)
+{
+    fv_s32      elem_size;
+
+    if (saved) {
+        elem_size = fv_filter_buf_elem_size[filter->fe_src_depth]*
+            filter->fe_nchannel;
+        return row + c0*elem_size;
+    }
+
+    fv_filter_engine_gather(filter, buf, row, c0, n);
+
+    return buf;
+}
+
+/*
+ * Put columns [x0, x1) of source row y (border rows are mapped back
+ * into the image) into ring row r, bordered for 2D filters and row
+ * filtered for separable ones. In zero-copy mode the row filter
+ * reads the interior straight from the image, together with the
+ * columns a view has around it, and only the head and tail pixels,
+ * whose taps reach past the edges, are filtered from small bordered
+ * copies. Both outputs of a dual engine share the bordered copies
+ * and the source reads.
+ */
+static void
+fv_sep_filter_load_row(fv_filter_proceed_t *fp, fv_filter_band_t *band,
+            fv_s32 r, fv_s32 y, fv_s32 x0, fv_s32 x1)
+{
+    fv_filter_engine_t      *filter = fp->fp_filter;
+    fv_mat_t                *src = fp->fp_src;
+    fv_u8                   *buf_row = band->fb_rows[r];
+    fv_u8                   *buf_row2 = NULL;
+    fv_u8                   *row;
+    fv_u8                   *src_buf = band->fb_src_buf;
+    fv_u8                   *bordered;
+    fv_s32                  src_elem_size;
+    fv_bool                 saved = 0;
+    fv_s32                  width = filter->fe_width;
+    fv_s32                  kx_row = filter->fe_ksize.sz_width;
+    fv_s32                  head = filter->fe_anchor.pt_x;
+    fv_s32                  tail = kx_row - 1 - head;
+    fv_s32                  left;
+    fv_s32                  right;
+    fv_s32                  i0;
+    fv_s32                  i1;
+
+    if (band->fb_rows2 != NULL) {
+        buf_row2 = band->fb_rows2[r];
+    }
+
+    row = fv_filter_engine_src_row(filter, src, y);
+    if (row == NULL) {
+        memset(buf_row, 0, filter->fe_buf_step);
+        if (buf_row2 != NULL) {
+            memset(buf_row2, 0, filter->fe_buf_step);
+        }
+        return;
+    }
+
+    src_elem_size = fv_filter_buf_elem_size[filter->fe_src_depth]*
+        filter->fe_nchannel;
+    if (fp->fp_in_place && (y < band->fb_y0 || y >= band->fb_y1)) {
+        y = y < band->fb_y0 ? y - band->fb_y0 + filter->fe_anchor.pt_y:
+            filter->fe_anchor.pt_y + y - band->fb_y1;
+        row = band->fb_saved + y*filter->fe_src_buf_len + 
+            head*src_elem_size;
+        saved = 1;
+    }
+
+    if (!filter->fe_is_separable) {
+        bordered = fv_filter_engine_bordered(filter, buf_row, row, saved,
+                x0 - head, x1 - x0 + kx_row - 1);
+        if (bordered != buf_row) {
+            memcpy(buf_row, bordered, (x1 - x0 + kx_row - 1)*src_elem_size);
+        }
+        return;
+    }
+
+    if (!filter->fe_zero_copy) {
+        bordered = fv_filter_engine_bordered(filter, src_buf, row, saved,
+                x0 - head, x1 - x0 + kx_row - 1);
+        fv_filter_engine_row_filter(filter, buf_row, buf_row2, 0, 
+                bordered, x1 - x0);
+        return;
+    }
+
+    left = fv_min(filter->fe_border.bm_ofs.pt_x, head);
+    right = fv_min(filter->fe_border.bm_whole.sz_width - 
+            filter->fe_border.bm_ofs.pt_x - width, tail);
+    i0 = fv_max(x0, head - left);
+    i1 = fv_min(x1, width - tail + right);
+    if (x0 < i0) {
+        bordered = fv_filter_engine_bordered(filter, src_buf, row, saved,
+                x0 - head, i0 - x0 + kx_row - 1);
+        fv_filter_engine_row_filter(filter, buf_row, buf_row2, 0, 
+                bordered, i0 - x0);
+    }
+    if (i0 < i1) {
+        fv_filter_engine_row_filter(filter, buf_row, buf_row2, i0 - x0, 
+                row + (i0 - head)*src_elem_size, i1 - i0);
+    }
+    i0 = fv_max(x0, i1);
+    if (i0 < x1) {
+        bordered = fv_filter_engine_bordered(filter, src_buf, row, saved,
+                i0 - head, x1 - i0 + kx_row - 1);
+        fv_filter_engine_row_filter(filter, buf_row, buf_row2, i0 - x0, 
+                bordered, x1 - i0);
+    }
+}
+
+static void
+fv_filter_ring_rotate(void **buf, fv_s32 n, fv_s32 ky_row)
+{
+    void        *tmp;
+    fv_s32      k;
+
+    for (k = 0; k < ky_row - 1; k++) {
+        tmp = buf[n + k];
+        buf[n + k] = buf[k];
+        buf[k] = tmp;
+    }
+}
+
+/*
+ * Filter columns [x0, x1) of destination rows [y0, y1) with the
+ * scratch of one band. Columns outside the strip that the kernel
+ * reaches are read from the image itself, so strips give the same
+ * pixels as one pass over whole rows.
+ */
+static void
+fv_sep_filter_proceed_strip(fv_filter_proceed_t *fp, 
+            fv_filter_band_t *band, fv_s32 y0, fv_s32 y1, 
+            fv_s32 x0, fv_s32 x1)
+{
+    fv_filter_engine_t          *filter = fp->fp_filter;
+    fv_base_filter_t            *filter_2D = band->fb_filter_2D;
+    fv_base_column_filter_t     *col_filter = band->fb_col_filter;
+    fv_base_column_filter_t     *col_filter2 = band->fb_col_filter2;
+    fv_mat_t                    *dst = fp->fp_dst;
+    fv_mat_t                    *dst2 = fp->fp_dst2;
+    fv_u8                       *dst_data;
+    fv_u8                       *dst_data2 = NULL;
+    void                        **buf = band->fb_rows;
+    void                        **buf2 = band->fb_rows2;
+    fv_u32                      cn;
+    fv_u32                      dst_offset;
+    fv_s32                      ky_row = filter->fe_ksize.sz_height;
+    fv_s32                      row_num;
+    fv_s32                      width;
+    fv_s32                      count;
+    fv_s32                      sy;
+    fv_s32                      i;
+    fv_s32                      j;
+    fv_s32                      k;
+    fv_s32                      h;
+
+    if (filter->fe_is_separable && col_filter->bc_reset != NULL) {
+        col_filter->bc_reset(col_filter);
+    }
+    if (col_filter2 != NULL && col_filter2->bc_reset != NULL) {
+        col_filter2->bc_reset(col_filter2);
+    }
+
+    width = x1 - x0;
+    cn = filter->fe_nchannel;
+    row_num = FV_SEP_FILTER_OUTPUT_LINE_NUM;
+    sy = y0 - filter->fe_anchor.pt_y;
+    for (j = 0; j < ky_row - 1; j++, sy++) {
+        fv_sep_filter_load_row(fp, band, j, sy, x0, x1);
+    }
+
+    /* 
+     * Filters write count rows back to back, so a strip narrower
+     * than the image, or a destination view with gaps between its
+     * rows, is written one row at a time.
+     */
+    dst_offset = x0*cn*fv_filter_buf_elem_size[filter->fe_dst_depth];
+    count = width == dst->mt_cols && dst->mt_step == width*cn*
+        fv_filter_buf_elem_size[filter->fe_dst_depth] &&
+        (dst2 == NULL || dst2->mt_step == dst->mt_step) ? row_num:1;
+    dst_data = dst->mt_data.dt_ptr + y0*dst->mt_step + dst_offset;
+    if (dst2 != NULL) {
+        dst_data2 = dst2->mt_data.dt_ptr + y0*dst2->mt_step + dst_offset;
+    }
+    for (h = y0; h < y1; h += j) {
+        for (j = 0; j < row_num && h + j < y1; j++, sy++) {
+            fv_sep_filter_load_row(fp, band, ky_row - 1 + j, sy, x0, x1);
+        }
+
+        for (i = 0; i < j; i += k, dst_data += dst->mt_step*k) {
+            k = fv_min(count, j - i);
+            if (filter->fe_is_separable) {
+                col_filter->bc_filter(dst_data, buf + i, k, width, 
+                        filter->fe_ky_data, col_filter);
+            } else {
+                filter_2D->bf_filter(dst_data, buf + i, k, width, 
+                        NULL, cn, filter_2D);
+            }
+            if (dst_data2 != NULL) {
+                col_filter2->bc_filter(dst_data2, buf2 + i, k, width, 
+                        filter->fe_ky2_data, col_filter2);
+                dst_data2 += dst2->mt_step*k;
+            }
+        }
+        fv_filter_ring_rotate(buf, j, ky_row);
+        if (buf2 != NULL) {
+            fv_filter_ring_rotate(buf2, j, ky_row);
+        }
+    }
+}
+
+/*
+ * Filter destination rows [fb_y0, fb_y1) of band, strip by strip when
+ * the rows of a whole image line would not fit the cache. Source rows
+ * above and below the band are read from the image itself (or from
+ * the rows saved for in-place filtering), so bands are independent of
+ * each other and give the same rows as one pass over the image.
+ */
+static void
+fv_sep_filter_proceed_band(fv_filter_proceed_t *fp, fv_filter_band_t *band)
+{
+    fv_filter_engine_t          *filter = fp->fp_filter;
+    fv_s32                      width = filter->fe_width;
+    fv_s32                      x0;
+    fv_s32                      x1;
+
+    for (x0 = 0; x0 < width; x0 = x1) {
+        x1 = fv_min(x0 + filter->fe_strip_width, width);
+        fv_sep_filter_proceed_strip(fp, band, band->fb_y0, band->fb_y1, 
+                x0, x1);
+    }
+}
+
+static void
+fv_sep_filter_proceed_job(void *arg, fv_s32 index)
+{
+    fv_filter_proceed_t     *fp = arg;
+
+    fv_sep_filter_proceed_band(fp, &fp->fp_filter->fe_bands[index]);
+}
+
+/*
+ * Before any band of an in-place pass writes, keep the source rows
+ * each band reads outside its own destination rows: ay rows above it
+ * and ky - 1 - ay rows below it, border rows mapped into the image.
+ * Rows are saved bordered, as gathered for a strip of the full width.
+ */
+static void
+fv_filter_engine_save_rows(fv_filter_engine_t *filter, 
+            fv_filter_band_t *band, fv_mat_t *src)
+{
+    fv_u8       *row;
+    fv_u32      row_len = filter->fe_src_buf_len;
+    fv_s32      ky_row = filter->fe_ksize.sz_height;
+    fv_s32      y;
+    fv_s32      k;
+
+    if (band->fb_saved == NULL) {
+        band->fb_saved = fv_alloc(fv_max(ky_row - 1, 1)*row_len);
+        FV_ASSERT(band->fb_saved != NULL);
+    }
+
+    for (k = 0; k < ky_row - 1; k++) {
+        y = band->fb_y0 - filter->fe_anchor.pt_y + k;
+        if (y >= band->fb_y0) {
+            y += band->fb_y1 - band->fb_y0;
+        }
+        row = fv_filter_engine_src_row(filter, src, y);
+        if (row == NULL) {
+            continue;
+        }
+        fv_filter_engine_gather(filter, band->fb_saved + k*row_len, row, 
+                -filter->fe_anchor.pt_x, 
+                filter->fe_width + filter->fe_ksize.sz_width - 1);
+    }
+}
+
+static fv_s32
+fv_filter_engine_nbands(fv_filter_engine_t *filter, fv_s32 height)
+{
+    return fv_get_num_bands(height, fv_max(FV_SEP_FILTER_BAND_MIN_ROWS,
+                filter->fe_ksize.sz_height*2));
+}
+
+/*
+ * Make sure there is scratch for nbands bands. Bands are only ever
+ * added, so repeated frames of the same size reuse them.
+ */
+static void
+fv_filter_engine_alloc_bands(fv_filter_engine_t *filter, fv_s32 nbands)
+{
+    fv_filter_band_t    *bands;
+    fv_filter_band_t    *band;
+    fv_s32              nrings;
+    fv_s32              i;
+    fv_s32              k;
+
+    if (nbands <= filter->fe_nbands) {
+        return;
+    }
+
+    bands = fv_calloc(nbands*sizeof(*bands));
+    FV_ASSERT(bands != NULL);
+    if (filter->fe_bands != NULL) {
+        memcpy(bands, filter->fe_bands, 
+                filter->fe_nbands*sizeof(*bands));
+        fv_free(&filter->fe_bands);
+    }
+
+    nrings = filter->fe_row_filter2 != NULL ? 2:1;
+    for (i = filter->fe_nbands; i < nbands; i++) {
+        band = &bands[i];
+        band->fb_rows = fv_alloc(nrings*filter->fe_buf_rows*sizeof(void *));
+        band->fb_ring = fv_alloc(nrings*filter->fe_buf_rows*
+                filter->fe_buf_step);
+        FV_ASSERT(band->fb_rows != NULL && band->fb_ring != NULL);
+        for (k = 0; k < nrings*filter->fe_buf_rows; k++) {
+            band->fb_rows[k] = band->fb_ring + k*filter->fe_buf_step;
+        }
+
+        band->fb_filter_2D = filter->fe_filter_2D;
+        band->fb_col_filter = filter->fe_col_filter;
+        band->fb_col_filter2 = filter->fe_col_filter2;
+        if (nrings > 1) {
+            band->fb_rows2 = band->fb_rows + filter->fe_buf_rows;
+            if (band->fb_col_filter2->bc_clone != NULL) {
+                band->fb_col_filter2 = 
+                    band->fb_col_filter2->bc_clone(band->fb_col_filter2);
+            }
+        }
+        if (filter->fe_is_separable) {
+            band->fb_src_buf = fv_calloc(filter->fe_src_buf_len);
+            FV_ASSERT(band->fb_src_buf != NULL);
+            if (band->fb_col_filter->bc_clone != NULL) {
+                band->fb_col_filter = 
+                    band->fb_col_filter->bc_clone(band->fb_col_filter);
+            }
+        } else if (band->fb_filter_2D->bf_clone != NULL) {
+            band->fb_filter_2D = 
+                band->fb_filter_2D->bf_clone(band->fb_filter_2D);
+        }
+    }
+
+    filter->fe_bands = bands;
+    filter->fe_nbands = nbands;
+}
+
+static void
+fv_filter_engine_free_bands(fv_filter_engine_t *filter)
+{
+    fv_filter_band_t    *band;
+    fv_s32              i;
+
+    for (i = 0; i < filter->fe_nbands; i++) {
+        band = &filter->fe_bands[i];
+        fv_free(&band->fb_rows);
+        fv_free(&band->fb_ring);
+        if (band->fb_src_buf != NULL) {
+            fv_free(&band->fb_src_buf);
+        }
+        if (band->fb_saved != NULL) {
+            fv_free(&band->fb_saved);
+        }
+        if (band->fb_col_filter != filter->fe_col_filter) {
+            band->fb_col_filter->bc_release(band->fb_col_filter);
+        }
+        if (band->fb_col_filter2 != filter->fe_col_filter2) {
+            band->fb_col_filter2->bc_release(band->fb_col_filter2);
+        }
+        if (band->fb_filter_2D != filter->fe_filter_2D) {
+            band->fb_filter_2D->bf_release(band->fb_filter_2D);
+        }
+    }
+    if (filter->fe_bands != NULL) {
+        fv_free(&filter->fe_bands);
+    }
+    filter->fe_nbands = 0;
+}
+
+/*
+ * Ring row and bordered row sizes for strips of strip_width columns.
+ */
+static void
+fv_filter_engine_set_strip_width(fv_filter_engine_t *filter, 
+            fv_s32 strip_width)
+{
+    fv_u32      elem_size;
+    fv_u32      buf_step;
+    fv_s32      kx_row = filter->fe_ksize.sz_width;
+    fv_u32      cn = filter->fe_nchannel;
+
+    elem_size = fv_filter_buf_elem_size[filter->fe_is_separable ? 
+        filter->fe_buf_depth:filter->fe_src_depth];
+    filter->fe_strip_width = strip_width;
+    filter->fe_src_buf_len = (strip_width + kx_row - 1)*cn*
+        fv_filter_buf_elem_size[filter->fe_src_depth];
+    buf_step = (strip_width + kx_row)*cn*elem_size;
+    if (!filter->fe_is_separable) {
+        buf_step = fv_max(buf_step, filter->fe_src_buf_len);
+    }
+    filter->fe_buf_step = fv_align(buf_step, 16);
+}
+
+/*
+ * Plan filter, whose row/column or 2D filters are already set, for
+ * frames shaped like dst and src: ring buffer and bordered row sizes,
+ * and the bands the current thread count asks for.
+ */
+void
+fv_init_filter_engine(fv_filter_engine_t *filter, fv_mat_t *dst, 
+            fv_mat_t *src, fv_size_t ksize, fv_point_t anchor, 
+            double delta, fv_s32 border_type)
+{
+    fv_u32      elem_size;
+    fv_s32      strip_width;
+    fv_s32      nstrips;
+
+    FV_ASSERT((filter->fe_row_filter != NULL && 
+                filter->fe_col_filter != NULL) ||
+            filter->fe_filter_2D != NULL); 
+    FV_ASSERT(filter->fe_release != NULL);
+
+    filter->fe_ksize = ksize;
+    filter->fe_anchor = anchor;
+    filter->fe_delta = delta;
+    filter->fe_src_depth = src->mt_depth;
+    filter->fe_dst_depth = dst->mt_depth;
+    filter->fe_nchannel = src->mt_nchannel;
+    filter->fe_width = src->mt_cols;
+    /* the ax pixels left of the image, ksize - 1 - ax right of it */
+    fv_border_map_init(&filter->fe_border, src, anchor.pt_x,
+            ksize.sz_width - 1 - anchor.pt_x, border_type);
+    filter->fe_zero_copy = filter->fe_is_separable &&
+        src->mt_cols >= ksize.sz_width;
+
+    /*
+     * Wide images are filtered in vertical strips whose ring rows
+     * stay within FV_FILTER_STRIP_CACHE_SIZE. Neighbouring strips
+     * read ksize.width - 1 common source columns, so in-place
+     * engines filter whole rows.
+     */
+    elem_size = fv_filter_buf_elem_size[filter->fe_is_separable ? 
+        filter->fe_buf_depth:src->mt_depth];
+    filter->fe_buf_rows = FV_SEP_FILTER_OUTPUT_LINE_NUM + ksize.sz_height - 1;
+    strip_width = FV_FILTER_STRIP_CACHE_SIZE/(filter->fe_buf_rows*
+            src->mt_nchannel*elem_size) - ksize.sz_width;
+    strip_width = fv_max(strip_width, fv_max(FV_FILTER_STRIP_MIN_WIDTH,
+                ksize.sz_width*2));
+    if (dst->mt_data.dt_ptr == src->mt_data.dt_ptr) {
+        strip_width = src->mt_cols;
+    } else if (strip_width < src->mt_cols) {
+        nstrips = (src->mt_cols + strip_width - 1)/strip_width;
+        strip_width = fv_align((src->mt_cols + nstrips - 1)/nstrips, 16);
+    }
+    fv_filter_engine_set_strip_width(filter, 
+            fv_min(strip_width, src->mt_cols));
+
+    fv_filter_engine_alloc_bands(filter, 
+            fv_filter_engine_nbands(filter, src->mt_rows));
+}
+
+static void
+fv_filter_engine_run(fv_filter_engine_t *filter, fv_mat_t *dst,
+            fv_mat_t *dst2, fv_mat_t *src)
+{
+    fv_filter_proceed_t         fp = {};
+    fv_filter_band_t            *band;
+    fv_s32                      band_rows;
+    fv_s32                      height;
+    fv_s32                      nbands;
+    fv_s32                      i;
+
+    FV_ASSERT(src->mt_cols == filter->fe_width && 
+            dst->mt_cols == src->mt_cols && dst->mt_rows == src->mt_rows &&
+            src->mt_nchannel == filter->fe_nchannel &&
+            dst->mt_nchannel == filter->fe_nchannel &&
+            src->mt_depth == filter->fe_src_depth &&
+            dst->mt_depth == filter->fe_dst_depth);
+    FV_ASSERT((dst2 != NULL) == (filter->fe_row_filter2 != NULL));
+    FV_ASSERT(dst2 == NULL || (dst2->mt_cols == dst->mt_cols && 
+            dst2->mt_rows == dst->mt_rows && 
+            dst2->mt_nchannel == dst->mt_nchannel &&
+            dst2->mt_depth == dst->mt_depth &&
+            dst2->mt_data.dt_ptr != dst->mt_data.dt_ptr));
+
+    /* The border columns were mapped for the columns around src then */
+    fv_border_map_rebind(&filter->fe_border, src);
+
+
+    fp.fp_filter = filter;
+    fp.fp_dst = dst;
+    fp.fp_dst2 = dst2;
+    fp.fp_src = src;
+
+    /* 
+     * In place, each band consumes its own source rows through the
+     * ring buffer before writing over them. Rows it reads from its
+     * neighbours and bottom border rows, which may map onto rows
+     * already written, are saved up front. Strips would read columns
+     * the strip before has written, so whole rows are filtered.
+     */
+    fp.fp_in_place = dst->mt_data.dt_ptr == src->mt_data.dt_ptr ||
+        (dst2 != NULL && dst2->mt_data.dt_ptr == src->mt_data.dt_ptr);
+    if (fp.fp_in_place && filter->fe_strip_width < filter->fe_width) {
+        fv_filter_engine_free_bands(filter);
+        fv_filter_engine_set_strip_width(filter, filter->fe_width);
+    }
+
+    height = dst->mt_rows;
+    nbands = fv_filter_engine_nbands(filter, height);
+    fv_filter_engine_alloc_bands(filter, nbands);
+    band_rows = (height + nbands - 1)/nbands;
+    nbands = (height + band_rows - 1)/band_rows;
+    for (i = 0; i < nbands; i++) {
+        band = &filter->fe_bands[i];
+        band->fb_y0 = i*band_rows;
+        band->fb_y1 = fv_min(band->fb_y0 + band_rows, height);
+        if (fp.fp_in_place) {
+            fv_filter_engine_save_rows(filter, band, src);
+        }
+    }
+
+    fv_parallel_for(nbands, fv_sep_filter_proceed_job, &fp);
+}
+
+void 
+fv_filter_engine_apply(fv_filter_engine_t *filter, fv_mat_t *dst,
+            fv_mat_t *src)
+{
+    fv_filter_engine_run(filter, dst, NULL, src);
+}
+
+/*
+ * Both outputs of a dual engine from one pass over src. dst2 has the
+ * shape and depth of dst.
+ */
+void 
+fv_filter_engine_apply_dual(fv_filter_engine_t *filter, fv_mat_t *dst,
+            fv_mat_t *dst2, fv_mat_t *src)
+{
+    fv_filter_engine_run(filter, dst, dst2, src);
+}
+
+void
+fv_release_filter_engine(fv_filter_engine_t **filter)
+{
+    fv_filter_engine_t  *f = *filter;
+
+    fv_filter_engine_free_bands(f);
+    fv_border_map_release(&f->fe_border);
+
+
+    f->fe_release(f);
+    *filter = NULL;
+}
+
+typedef struct _fv_sep_filter_engine_t {
+    fv_filter_engine_t          se_engine;
+    fv_linear_row_filter_t      se_row_filter;
+    fv_linear_column_filter_t   se_col_filter;
+    fv_mat_t                    *se_kernel_x;
+    fv_mat_t                    *se_kernel_y;
+} fv_sep_filter_engine_t;
+
+static fv_mat_t *
+fv_copy_sep_kernel(fv_mat_t *kernel_1d)
+{
+    fv_mat_t    *kernel;
+
+    kernel = fv_create_mat(kernel_1d->mt_rows, 1, 
+            FV_MAKETYPE(FV_DEPTH_32F, 1));
+    FV_ASSERT(kernel != NULL);
+    memcpy(kernel->mt_data.dt_fl, kernel_1d->mt_data.dt_fl,
+            kernel_1d->mt_rows*sizeof(float));
+
+    return kernel;
+}
+
+static void
+fv_release_sep_filter_engine(fv_filter_engine_t *filter)
+{
+    fv_sep_filter_engine_t  *f = (fv_sep_filter_engine_t *)filter;
+
+    fv_release_mat(&f->se_kernel_x);
+    fv_release_mat(&f->se_kernel_y);
+    fv_free(&f);
+}
+
+/*
+ * Set up the row and column filters of one separable kernel pair and
+ * keep the kernels they use in *kx_copy and *ky_copy. bdepth < 0
+ * picks the buffer depth (fixed point for 8u when possible), otherwise
+ * the float path is used with the given buffer depth.
+ */
+static fv_s32
+fv_sep_filter_setup(fv_linear_row_filter_t *row_filter, 
+            fv_linear_column_filter_t *col_filter, fv_mat_t **kx_copy,
+            fv_mat_t **ky_copy, fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+            fv_point_t anchor, fv_mat_t *dst, fv_mat_t *src, 
+            fv_s32 bdepth)
+{
+    fv_mat_t                    *kx = kernel_x;
+    fv_mat_t                    *ky = kernel_y;
+    fv_s32                      ay = anchor.pt_y;
+    fv_s32                      cn = src->mt_nchannel;
+
+    row_filter->lr_type = fv_get_sep_kernel_type(kernel_x, anchor.pt_x);
+    col_filter->lc_type = fv_get_sep_kernel_type(kernel_y, ay);
+    col_filter->lc_shift = 0;
+    if (bdepth < 0 && (bdepth = fv_sep_filter_fixed_point(&kx, &ky, 
+                    &col_filter->lc_shift, kernel_x, kernel_y, 
+                    row_filter->lr_type, col_filter->lc_type,
+                    src->mt_depth, dst->mt_depth)) >= 0) {
+        col_filter->lc_filter = fv_get_column_filter_fixed(bdepth, 
+                dst->mt_depth, ky->mt_rows);
+    } else {
+        col_filter->lc_shift = 0;
+        if (bdepth < 0) {
+            bdepth = fv_get_sep_filter_buf_depth(src->mt_depth, 
+                    dst->mt_depth, kernel_x, row_filter->lr_type);
+        }
+        col_filter->lc_filter = fv_get_column_filter(bdepth, 
+                dst->mt_depth, ky->mt_rows);
+    }
+    FV_ASSERT(col_filter->lc_filter != NULL);
+
+    *kx_copy = kx != kernel_x ? kx:fv_copy_sep_kernel(kx);
+    *ky_copy = ky != kernel_y ? ky:fv_copy_sep_kernel(ky);
+    kx = *kx_copy;
+    ky = *ky_copy;
+
+    row_filter->lr_filter = fv_get_row_filter(bdepth, src->mt_depth,
+            kx->mt_rows, cn);
+    FV_ASSERT(row_filter->lr_filter != NULL);
+    row_filter->lr_anchor = anchor.pt_x;
+    row_filter->lr_ksize = kx->mt_rows;
+    row_filter->lr_cn = cn;
+    row_filter->lr_vec = fv_get_row_vec(bdepth, src->mt_depth,
+            kx->mt_data.dt_fl, kx->mt_rows);
+    col_filter->lc_ksize = (ky->mt_rows >> 1);
+    col_filter->lc_anchor = ay;
+    col_filter->lc_cn = cn;
+    col_filter->lc_vec = NULL;
+    if (col_filter->lc_shift == 0) {
+        col_filter->lc_vec = fv_get_column_vec(bdepth, dst->mt_depth,
+                ky->mt_data.dt_fl, ky->mt_rows, col_filter->lc_type);
+    }
+
+    return bdepth;
+}
+
+static fv_point_t
+fv_sep_filter_anchor(fv_point_t anchor, fv_mat_t *kernel_x, 
+            fv_mat_t *kernel_y)
+{
+    if (anchor.pt_x < 0) {
+        anchor.pt_x = ((kernel_x->mt_rows - 1) >> 1);
+    }
+
+    if (anchor.pt_y < 0) {
+        anchor.pt_y = ((kernel_y->mt_rows - 1) >> 1);
+    }
+
+    return anchor;
+}
+
+fv_filter_engine_t *
+fv_create_sep_filter_engine(fv_mat_t *dst, fv_mat_t *src,
+                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_point_t anchor, double delta, fv_s32 border_type)
+{
+    fv_sep_filter_engine_t      *engine;
+    fv_mat_t                    *kx;
+    fv_mat_t                    *ky;
+    fv_s32                      bdepth;
+
+    engine = fv_calloc(sizeof(*engine));
+    FV_ASSERT(engine != NULL);
+
+    anchor = fv_sep_filter_anchor(anchor, kernel_x, kernel_y);
+    bdepth = fv_sep_filter_setup(&engine->se_row_filter, 
+            &engine->se_col_filter, &engine->se_kernel_x, 
+            &engine->se_kernel_y, kernel_x, kernel_y, anchor, dst, src, -1);
+    kx = engine->se_kernel_x;
+    ky = engine->se_kernel_y;
+
+    engine->se_engine.fe_row_filter = &engine->se_row_filter.lr_base;
+    engine->se_engine.fe_col_filter = &engine->se_col_filter.lc_base;
+    engine->se_engine.fe_buf_depth = bdepth;
+    engine->se_engine.fe_is_separable = 1;
+    engine->se_engine.fe_release = fv_release_sep_filter_engine;
+    engine->se_engine.fe_kx_data = kx->mt_data.dt_fl;
+    engine->se_engine.fe_ky_data = ky->mt_data.dt_fl;
+    fv_init_filter_engine(&engine->se_engine, dst, src, 
+            fv_size(kx->mt_rows, ky->mt_rows), anchor, delta, border_type);
+
+    return &engine->se_engine;
+}
+
+typedef struct _fv_dual_sep_filter_engine_t {
+    fv_sep_filter_engine_t      de_sep;
+    fv_linear_row_filter_t      de_row_filter;
+    fv_linear_column_filter_t   de_col_filter;
+    fv_mat_t                    *de_kernel_x;
+    fv_mat_t                    *de_kernel_y;
+} fv_dual_sep_filter_engine_t;
+
+static void
+fv_release_dual_sep_filter_engine(fv_filter_engine_t *filter)
+{
+    fv_dual_sep_filter_engine_t *f = (fv_dual_sep_filter_engine_t *)filter;
+
+    fv_release_mat(&f->de_kernel_x);
+    fv_release_mat(&f->de_kernel_y);
+    fv_release_sep_filter_engine(filter);
+}
+
+/*
+ * Two separable filters of the same size over the same source, e.g.
+ * the dx and dy derivatives: every source row is read and bordered
+ * once for both. Both pairs must run on one buffer depth, so when
+ * they would pick different ones both fall back to the float path
+ * with the wider depth.
+ */
+fv_filter_engine_t *
+fv_create_dual_sep_filter_engine(fv_mat_t *dst, fv_mat_t *dst2, 
+                fv_mat_t *src, fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_mat_t *kernel_x2, fv_mat_t *kernel_y2, 
+                fv_point_t anchor, double delta, fv_s32 border_type)
+{
+    fv_dual_sep_filter_engine_t *engine;
+    fv_sep_filter_engine_t      *sep;
+    fv_mat_t                    *kx;
+    fv_mat_t                    *ky;
+    fv_s32                      bdepth;
+    fv_s32                      bdepth2;
+
+    FV_ASSERT(kernel_x->mt_rows == kernel_x2->mt_rows && 
+            kernel_y->mt_rows == kernel_y2->mt_rows &&
+            dst2->mt_depth == dst->mt_depth);
+
+    engine = fv_calloc(sizeof(*engine));
+    FV_ASSERT(engine != NULL);
+    sep = &engine->de_sep;
+
+    anchor = fv_sep_filter_anchor(anchor, kernel_x, kernel_y);
+    bdepth = fv_sep_filter_setup(&sep->se_row_filter, &sep->se_col_filter,
+            &sep->se_kernel_x, &sep->se_kernel_y, kernel_x, kernel_y, 
+            anchor, dst, src, -1);
+    bdepth2 = fv_sep_filter_setup(&engine->de_row_filter, 
+            &engine->de_col_filter, &engine->de_kernel_x, 
+            &engine->de_kernel_y, kernel_x2, kernel_y2, anchor, dst, src, 
+            -1);
+    if (bdepth != bdepth2) {
+        fv_release_mat(&sep->se_kernel_x);
+        fv_release_mat(&sep->se_kernel_y);
+        fv_release_mat(&engine->de_kernel_x);
+        fv_release_mat(&engine->de_kernel_y);
+        bdepth = fv_max(fv_get_sep_filter_buf_depth(src->mt_depth, 
+                    dst->mt_depth, kernel_x, 
+                    fv_get_sep_kernel_type(kernel_x, anchor.pt_x)),
+                fv_get_sep_filter_buf_depth(src->mt_depth, dst->mt_depth, 
+                    kernel_x2, 
+                    fv_get_sep_kernel_type(kernel_x2, anchor.pt_x)));
+        fv_sep_filter_setup(&sep->se_row_filter, &sep->se_col_filter,
+                &sep->se_kernel_x, &sep->se_kernel_y, kernel_x, kernel_y, 
+                anchor, dst, src, bdepth);
+        fv_sep_filter_setup(&engine->de_row_filter, &engine->de_col_filter, 
+                &engine->de_kernel_x, &engine->de_kernel_y, kernel_x2, 
+                kernel_y2, anchor, dst, src, bdepth);
+    }
+    kx = sep->se_kernel_x;
+    ky = sep->se_kernel_y;
+
+    sep->se_engine.fe_row_filter = &sep->se_row_filter.lr_base;
+    sep->se_engine.fe_col_filter = &sep->se_col_filter.lc_base;
+    sep->se_engine.fe_row_filter2 = &engine->de_row_filter.lr_base;
+    sep->se_engine.fe_col_filter2 = &engine->de_col_filter.lc_base;
+    sep->se_engine.fe_buf_depth = bdepth;
+    sep->se_engine.fe_is_separable = 1;
+    sep->se_engine.fe_release = fv_release_dual_sep_filter_engine;
+    sep->se_engine.fe_kx_data = kx->mt_data.dt_fl;
+    sep->se_engine.fe_ky_data = ky->mt_data.dt_fl;
+    sep->se_engine.fe_kx2_data = engine->de_kernel_x->mt_data.dt_fl;
+    sep->se_engine.fe_ky2_data = engine->de_kernel_y->mt_data.dt_fl;
+    fv_init_filter_engine(&sep->se_engine, dst, src, 
+            fv_size(kx->mt_rows, ky->mt_rows), anchor, delta, border_type);
+
+    return &sep->se_engine;
+}
+
+void 
+fv_sep_filter2D(fv_mat_t *dst, fv_mat_t *src,
+                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_point_t anchor, double delta, fv_s32 border_type)
+{
+    fv_filter_engine_t          *filter;
+
+    filter = fv_create_sep_filter_engine(dst, src, kernel_x, kernel_y,
+            anchor, delta, border_type);
+    fv_filter_engine_apply(filter, dst, src);
+    fv_release_filter_engine(&filter);
+}
+
+void 
+fv_sep_filter2D_dual(fv_mat_t *dst, fv_mat_t *dst2, fv_mat_t *src,
+                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_mat_t *kernel_x2, fv_mat_t *kernel_y2, 
+                fv_point_t anchor, double delta, fv_s32 border_type)
+{
+    fv_filter_engine_t          *filter;
+
+    filter = fv_create_dual_sep_filter_engine(dst, dst2, src, kernel_x, 
+            kernel_y, kernel_x2, kernel_y2, anchor, delta, border_type);
+    fv_filter_engine_apply_dual(filter, dst, dst2, src);
+    fv_release_filter_engine(&filter);
+}
+
+/*
+ * The 2D filters, direct and through the DFT, add delta and round
+ * to integer destinations the same way
+ */
+#define fv_filter_round_8u(v) fv_saturate_cast_8u(fv_round(v))
+#define fv_filter_round_8s(v) fv_saturate_cast_8s(fv_round(v))
+#define fv_filter_round_16u(v) fv_saturate_cast_16u(fv_round(v))
+#define fv_filter_round_16s(v) fv_saturate_cast_16s(fv_round(v))
+#define fv_filter_round_32s(v) \
+    ((fv_s32)lrint(fv_saturate_cast(v, fv_int_max, fv_int_min)))
+
+#define fv_filter_2D_core(dst, src, count, width, cn, filter, castop) \
+    do { \
+        fv_filter_2D_t      *filter_2D = (fv_filter_2D_t *)filter; \
+        fv_point_t          *pt = filter_2D->ft_coords; \
+        float               *kf = (float *)filter_2D->ft_coeffs; \
+        typeof(dst)         *kp = filter_2D->ft_ptrs; \
+        fv_s32              i; \
+        fv_s32              k; \
+        fv_s32              nz = filter_2D->ft_nz; \
+        double              delta = filter_2D->ft_delta; \
+        double              s0; \
+                            \
+        width *= cn; \
+        for (; count > 0; count--, dst += width, src++) { \
+            for (k = 0; k < nz; k++) { \
+                kp[k] = src[pt[k].pt_y] + pt[k].pt_x*cn; \
+            } \
+            \
+            for (i = 0; i < width; i++) { \
+                s0 = kf[0]*kp[0][i]; \
+                for (k = 1; k < nz; k++) { \
+                    s0 += kf[k]*kp[k][i]; \
+                } \
+                dst[i] = castop(s0 + delta); \
+            } \
+        } \
+    } while(0)
+
+
+static void
+fv_filter_2D_8u(fv_u8 *dst, fv_u8 **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_filter_round_8u);
+}
+
+static void
+fv_filter_2D_8s(fv_s8 *dst, fv_s8 **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_filter_round_8s);
+}
+
+static void
+fv_filter_2D_16u(fv_u16 *dst, fv_u16 **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_filter_round_16u);
+}
+
+static void
+fv_filter_2D_16s(fv_s16 *dst, fv_s16 **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_filter_round_16s);
+}
+
+static void
+fv_filter_2D_32s(fv_s32 *dst, fv_s32 **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_filter_round_32s);
+}
+
+static void
+fv_filter_2D_32f(float *dst, float **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_core(dst, src, count, width, cn, filter,
+            fv_saturate_cast_32f);
+}
+
+static void
+fv_filter_2D_64f(double *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *k_data,
+           fv_u32 cn, fv_base_filter_t *filter)
+{
+    fv_filter_2D_t      *filter_2D = (fv_filter_2D_t *)filter;
+    fv_point_t          *pt = filter_2D->ft_coords;
+    float               *kf = (float *)filter_2D->ft_coeffs;
+    double          **kp = filter_2D->ft_ptrs;
     fv_s32              i;
     fv_s32              k;
     fv_s32              nz = filter_2D->ft_nz;
@@ -797,6 +2383,7 @@ fv_filter_2D_64f(double *dst, double **src,
             for (k = 1; k < nz; k++) {
                 dst[i] += kf[k]*kp[k][i];
             }
+            dst[i] += filter_2D->ft_delta;
         }
     } 
 }
@@ -822,63 +2409,645 @@ fv_get_filter_2D_tab(fv_u32 depth)
     return fv_filter_2D_tab[depth];
 }
 
+/*
+ * Dense square kernels: every tap is non-zero, so the taps are the
+ * kernel in row-major order and need no coordinate table.
+ */
+#define fv_filter_2D_ks_core(dst, src, count, width, filter, castop, \
+        ks, cn) \
+    do { \
+        fv_filter_2D_t      *filter_2D = (fv_filter_2D_t *)filter; \
+        float               kf[ks*ks]; \
+        typeof(*src)        kp[ks*ks]; \
+        fv_s32              i; \
+        fv_s32              k; \
+        double              delta = filter_2D->ft_delta; \
+        double              s0; \
+                            \
+        for (k = 0; k < ks*ks; k++) { \
+            kf[k] = ((float *)filter_2D->ft_coeffs)[k]; \
+        } \
+        width *= cn; \
+        for (; count > 0; count--, dst += width, src++) { \
+            for (k = 0; k < ks*ks; k++) { \
+                kp[k] = src[k/ks] + (k%ks)*cn; \
+            } \
+            \
+            for (i = 0; i < width; i++) { \
+                s0 = kf[0]*kp[0][i]; \
+                for (k = 1; k < ks*ks; k++) { \
+                    s0 += kf[k]*kp[k][i]; \
+                } \
+                dst[i] = castop(s0 + delta); \
+            } \
+        } \
+    } while(0)
+
+#define fv_filter_2D_ks_func(name, type, castop, ks, cn) \
+    static void \
+    fv_filter_2D_##name##_##ks##x##cn(type *dst, type **src, \
+               fv_s32 count, fv_s32 width, float *k_data, \
+               fv_u32 _cn, fv_base_filter_t *filter) \
+    { \
+        fv_filter_2D_ks_core(dst, src, count, width, filter, castop, \
+                ks, cn); \
+    }
+
+#define fv_filter_2D_ks_funcs(name, type, castop) \
+    fv_filter_2D_ks_func(name, type, castop, 3, 1) \
+    fv_filter_2D_ks_func(name, type, castop, 3, 3) \
+    fv_filter_2D_ks_func(name, type, castop, 5, 1) \
+    fv_filter_2D_ks_func(name, type, castop, 5, 3) \
+    fv_filter_2D_ks_func(name, type, castop, 7, 1) \
+    fv_filter_2D_ks_func(name, type, castop, 7, 3)
+
+#define fv_filter_2D_ks_entry(name) \
+    { \
+        { \
+            (fv_filter_2D_func)fv_filter_2D_##name##_3x1, \
+            (fv_filter_2D_func)fv_filter_2D_##name##_3x3, \
+        }, \
+        { \
+            (fv_filter_2D_func)fv_filter_2D_##name##_5x1, \
+            (fv_filter_2D_func)fv_filter_2D_##name##_5x3, \
+        }, \
+        { \
+            (fv_filter_2D_func)fv_filter_2D_##name##_7x1, \
+            (fv_filter_2D_func)fv_filter_2D_##name##_7x3, \
+        }, \
+    }
+
+fv_filter_2D_ks_funcs(8u, fv_u8, fv_filter_round_8u)
+fv_filter_2D_ks_funcs(16s, fv_s16, fv_filter_round_16s)
+fv_filter_2D_ks_funcs(32f, float, fv_saturate_cast_32f)
+
+/* [depth][ksize][cn == 3] */
+static fv_filter_2D_func 
+fv_filter_2D_ks_tab[FV_DEPTH_NUM][FV_FILTER_KS_NUM][2] = {
+    [FV_8U] = fv_filter_2D_ks_entry(8u),
+    [FV_16S] = fv_filter_2D_ks_entry(16s),
+    [FV_32F] = fv_filter_2D_ks_entry(32f),
+};
+
+static fv_filter_2D_func 
+fv_get_filter_2D(fv_u32 depth, fv_size_t ksize, fv_u32 nz, fv_u32 cn)
+{
+    fv_filter_2D_func   func;
+    fv_s32              k;
+
+    k = fv_filter_ks_index(ksize.sz_width);
+    if (k >= 0 && ksize.sz_height == ksize.sz_width && 
+            nz == ksize.sz_width*ksize.sz_height && (cn == 1 || cn == 3)) {
+        func = fv_filter_2D_ks_tab[depth][k][cn == 3];
+        if (func != NULL) {
+            return func;
+        }
+    }
+
+    return fv_get_filter_2D_tab(depth);
+}
+
+static fv_base_filter_t *
+fv_filter_2D_clone(fv_base_filter_t *filter)
+{
+    fv_filter_2D_t      *f;
+
+    f = fv_alloc(sizeof(*f));
+    FV_ASSERT(f != NULL);
+    *f = *(fv_filter_2D_t *)filter;
+    f->ft_ptrs = fv_alloc(f->ft_nz*sizeof(void *));
+    FV_ASSERT(f->ft_ptrs != NULL);
+
+    return &f->ft_base;
+}
+
+static void
+fv_filter_2D_release(fv_base_filter_t *filter)
+{
+    fv_filter_2D_t      *f = (fv_filter_2D_t *)filter;
+
+    fv_free(&f->ft_ptrs);
+    fv_free(&f);
+}
+
 static void
 fv_create_filter_2D(fv_filter_2D_t *filter, fv_mat_t *src, 
         fv_s32 depth, fv_u32 nz, fv_size_t ksize,
-        fv_mat_t *kernel, fv_point_t anchor)
+        fv_mat_t *kernel, fv_point_t anchor, double delta)
 {
     fv_u32              cn;
 
     cn = src->mt_nchannel;
-    filter->ft_filter = fv_get_filter_2D_tab(depth);
+    filter->ft_filter = fv_get_filter_2D(depth, ksize, nz, cn);
     filter->ft_ksize = ksize;
     filter->ft_anchor = anchor;
     filter->ft_nchannels = cn;
     fv_preprocess_2D_kernel(kernel, &filter->ft_coords, 
             &filter->ft_coeffs, nz);
     filter->ft_nz = nz;
+    filter->ft_delta = delta;
     filter->ft_ptrs = fv_alloc(nz*sizeof(void *));
     FV_ASSERT(filter->ft_ptrs != NULL);
+    filter->ft_clone = fv_filter_2D_clone;
+    filter->ft_release = fv_filter_2D_release;
 }
 
+typedef struct _fv_linear_filter_engine_t {
+    fv_filter_engine_t      le_engine;
+    fv_filter_2D_t          le_filter_2D;
+} fv_linear_filter_engine_t;
+
 static void
-fv_release_filter_2D(fv_filter_engine_t *filter)
+fv_release_linear_filter_engine(fv_filter_engine_t *filter)
 {
-    fv_filter_2D_t      *f = (fv_filter_2D_t *)filter->fe_filter_2D;
+    fv_linear_filter_engine_t   *f = (fv_linear_filter_engine_t *)filter;
 
-    if (!filter->fe_is_separable) {
-        fv_free(&f->ft_coords);
-        fv_free(&f->ft_coeffs);
-        fv_free(&f->ft_ptrs);
-    }
+    fv_free(&f->le_filter_2D.ft_coords);
+    fv_free(&f->le_filter_2D.ft_coeffs);
+    fv_free(&f->le_filter_2D.ft_ptrs);
+    fv_free(&f);
 }
 
-void
-fv_filter2D(fv_mat_t *dst, fv_mat_t *src, fv_u16 depth,
+/*
+ * Direct 2D filter engine; fv_filter2D() takes the DFT path instead
+ * for kernels of FV_DFT_FILTER_SIZE taps or more.
+ */
+fv_filter_engine_t *
+fv_create_linear_filter_engine(fv_mat_t *dst, fv_mat_t *src,
                 fv_mat_t *kernel, fv_point_t anchor, 
                 double delta, fv_s32 border_type)
 {
-    fv_filter_engine_t      filter = {};
-    fv_filter_2D_t          filter_2D = {};
-    fv_size_t               ksize;
-    fv_u32                  nz;
+    fv_linear_filter_engine_t   *engine;
+    fv_size_t                   ksize;
+    fv_u32                      nz;
 
-    if (kernel->mt_total >= FV_DFT_FILTER_SIZE) {
-        /* DFT */
-        return;
-    }
+    engine = fv_calloc(sizeof(*engine));
+    FV_ASSERT(engine != NULL);
 
     ksize = fv_get_size(kernel);
     anchor = fv_normalize_anchor(anchor, ksize);
     nz = _fv_count_non_zero(kernel);
-    fv_create_filter_2D(&filter_2D, src, dst->mt_depth, 
-            nz, ksize, kernel, anchor);
-    filter.fe_filter_2D = &filter_2D.ft_base;
-    filter.fe_is_separable = 0;
+    fv_create_filter_2D(&engine->le_filter_2D, src, dst->mt_depth, 
+            nz, ksize, kernel, anchor, delta);
+    engine->le_engine.fe_filter_2D = &engine->le_filter_2D.ft_base;
+    engine->le_engine.fe_is_separable = 0;
+    engine->le_engine.fe_release = fv_release_linear_filter_engine;
+    fv_init_filter_engine(&engine->le_engine, dst, src, ksize, anchor,
+            delta, border_type);
+
+    return &engine->le_engine;
+}
+
+typedef void (*fv_dft_filter_load_func)(float *, void *, fv_s32 *, 
+        fv_s32, fv_u32, fv_u32);
+typedef void (*fv_dft_filter_store_func)(void *, float *, fv_s32, 
+        fv_u32, fv_u32, double);
+
+/*
+ * Large kernels are applied by overlap-save: the source is cut into
+ * tiles of df_tile_w x df_tile_h (powers of 2, kept within
+ * FV_DFT_FILTER_CACHE_SIZE), each tile is multiplied with the kernel
+ * spectrum, and only the part of the circular result that did not wrap
+ * around is written out.
+ */
+typedef struct _fv_dft_filter_t {
+    fv_mat_t                *df_dst;
+    fv_mat_t                *df_src;
+    fv_mat_t                *df_spectrum;
+    fv_s32                  *df_xmap;
+    fv_dft_filter_load_func df_load;
+    fv_dft_filter_store_func df_store;
+    fv_size_t               df_ksize;
+    fv_point_t              df_anchor;
+    fv_s32                  df_tile_w;
+    fv_s32                  df_tile_h;
+    fv_s32                  df_valid_w;
+    fv_s32                  df_valid_h;
+    fv_s32                  df_ntiles_x;
+    fv_s32                  df_border_type;
+    fv_point_t              df_roi_ofs;     /* src in its whole matrix */
+    fv_size_t               df_whole;
+    double                  df_delta;
+} fv_dft_filter_t;
+
+#define fv_dft_filter_load_core(dst, src, xmap, width, cn, coi) \
+    do { \
+        fv_s32      i; \
+        for (i = 0; i < width; i++) { \
+            dst[i] = xmap[i] == FV_BORDER_MAP_ZERO ? 0 : \
+                src[xmap[i]*(fv_s32)cn + (fv_s32)coi]; \
+        } \
+    } while(0)
 
-    fv_sep_filter_proceed(dst, src, kernel, NULL, NULL, 
-            anchor, delta, border_type, &filter);
+#define fv_dft_filter_store_core(dst, src, width, cn, coi, delta, castop) \
+    do { \
+        fv_s32      i; \
+        for (i = 0; i < width; i++) { \
+            dst[i*cn + coi] = castop(src[i] + delta); \
+        } \
+    } while(0)
+
+static void
+fv_dft_filter_load_8u(float *dst, fv_u8 *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_8s(float *dst, fv_s8 *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_16u(float *dst, fv_u16 *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_16s(float *dst, fv_s16 *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_32s(float *dst, fv_s32 *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_32f(float *dst, float *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static void
+fv_dft_filter_load_64f(float *dst, double *src, fv_s32 *xmap, 
+        fv_s32 width, fv_u32 cn, fv_u32 coi)
+{
+    fv_dft_filter_load_core(dst, src, xmap, width, cn, coi);
+}
+
+static fv_dft_filter_load_func fv_dft_filter_load_tab[] = {
+    (fv_dft_filter_load_func)fv_dft_filter_load_8u,
+    (fv_dft_filter_load_func)fv_dft_filter_load_8s,
+    (fv_dft_filter_load_func)fv_dft_filter_load_16u,
+    (fv_dft_filter_load_func)fv_dft_filter_load_16s,
+    (fv_dft_filter_load_func)fv_dft_filter_load_32s,
+    (fv_dft_filter_load_func)fv_dft_filter_load_32f,
+    (fv_dft_filter_load_func)fv_dft_filter_load_64f,
+};
+
+#define fv_dft_filter_load_tab_size \
+    (sizeof(fv_dft_filter_load_tab)/sizeof(fv_dft_filter_load_func))
+
+static fv_dft_filter_load_func 
+fv_get_dft_filter_load_tab(fv_u32 depth)
+{
+    FV_ASSERT(depth < fv_dft_filter_load_tab_size);
+
+    return fv_dft_filter_load_tab[depth];
+}
+
+static void
+fv_dft_filter_store_8u(fv_u8 *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_filter_round_8u);
+}
+
+static void
+fv_dft_filter_store_8s(fv_s8 *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_filter_round_8s);
+}
+
+static void
+fv_dft_filter_store_16u(fv_u16 *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_filter_round_16u);
+}
+
+static void
+fv_dft_filter_store_16s(fv_s16 *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_filter_round_16s);
+}
+
+static void
+fv_dft_filter_store_32s(fv_s32 *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_filter_round_32s);
+}
+
+static void
+fv_dft_filter_store_32f(float *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_saturate_cast_32f);
+}
 
-    fv_release_filter_2D(&filter);
+static void
+fv_dft_filter_store_64f(double *dst, float *src, fv_s32 width, 
+        fv_u32 cn, fv_u32 coi, double delta)
+{
+    fv_dft_filter_store_core(dst, src, width, cn, coi, delta,
+            fv_saturate_no_cast);
+}
+
+static fv_dft_filter_store_func fv_dft_filter_store_tab[] = {
+    (fv_dft_filter_store_func)fv_dft_filter_store_8u,
+    (fv_dft_filter_store_func)fv_dft_filter_store_8s,
+    (fv_dft_filter_store_func)fv_dft_filter_store_16u,
+    (fv_dft_filter_store_func)fv_dft_filter_store_16s,
+    (fv_dft_filter_store_func)fv_dft_filter_store_32s,
+    (fv_dft_filter_store_func)fv_dft_filter_store_32f,
+    (fv_dft_filter_store_func)fv_dft_filter_store_64f,
+};
+
+#define fv_dft_filter_store_tab_size \
+    (sizeof(fv_dft_filter_store_tab)/sizeof(fv_dft_filter_store_func))
+
+static fv_dft_filter_store_func 
+fv_get_dft_filter_store_tab(fv_u32 depth)
+{
+    FV_ASSERT(depth < fv_dft_filter_store_tab_size);
+
+    return fv_dft_filter_store_tab[depth];
+}
+
+/*
+ * Smallest power of 2 that leaves at least ksize valid outputs per
+ * tile, grown up to the cache budget but never past the bordered image.
+ */
+static fv_s32
+fv_dft_filter_tile_size(fv_s32 ksize, fv_s32 size, fv_s32 tile_max)
+{
+    fv_s32      tile;
+
+    tile = fv_max(fv_get_optimal_dft_size(2*ksize), tile_max);
+
+    return fv_min(tile, fv_get_optimal_dft_size(size + ksize - 1));
+}
+
+static void
+fv_dft_filter_job(void *arg, fv_s32 index)
+{
+    fv_dft_filter_t     *df = arg;
+    fv_mat_t            *dst = df->df_dst;
+    fv_mat_t            *src = df->df_src;
+    fv_mat_t            *tile;
+    fv_mat_t            *spectrum;
+    fv_mat_t            *result;
+    fv_u8               *src_row;
+    fv_u8               *dst_row;
+    float               *tile_row;
+    fv_u32              cn;
+    fv_u32              c;
+    fv_u32              dst_elem_size;
+    fv_s32              tw = df->df_tile_w;
+    fv_s32              th = df->df_tile_h;
+    fv_s32              kw = df->df_ksize.sz_width;
+    fv_s32              kh = df->df_ksize.sz_height;
+    fv_s32              x0;
+    fv_s32              y0;
+    fv_s32              sy;
+    fv_s32              tx;
+    fv_s32              oy = df->df_roi_ofs.pt_y;
+    fv_s32              r;
+    fv_s32              rows;
+    fv_s32              cols;
+
+    cn = src->mt_nchannel;
+    dst_elem_size = FV_ELEM_SIZE(dst->mt_atr);
+    y0 = (index/df->df_ntiles_x)*df->df_valid_h;
+    tx = index%df->df_ntiles_x;
+    x0 = tx*df->df_valid_w;
+    rows = fv_min(df->df_valid_h, dst->mt_rows - y0);
+    cols = fv_min(df->df_valid_w, dst->mt_cols - x0);
+
+    tile = fv_create_mat(th, tw, FV_32FC1);
+    spectrum = fv_create_mat(th, tw, FV_32FC2);
+    result = fv_create_mat(th, tw, FV_32FC1);
+    FV_ASSERT(tile != NULL && spectrum != NULL && result != NULL);
+
+    for (c = 0; c < cn; c++) {
+        tile_row = tile->mt_data.dt_fl;
+        for (r = 0; r < th; r++, tile_row += tw) {
+            sy = y0 - df->df_anchor.pt_y + r + oy;
+            if (r >= rows + kh - 1 || ((sy < 0 || 
+                        sy >= df->df_whole.sz_height) &&
+                        df->df_border_type == FV_BORDER_CONSTANT)) {
+                memset(tile_row, 0, tw*sizeof(*tile_row));
+                continue;
+            }
+            if (sy < 0 || sy >= df->df_whole.sz_height) {
+                sy = fv_border_get_value(df->df_border_type, sy,
+                        df->df_whole.sz_height);
+            }
+            src_row = src->mt_data.dt_ptr + (sy - oy)*src->mt_step;
+            df->df_load(tile_row, src_row, df->df_xmap + x0, tw, cn, c);
+        }
+
+        fv_dft(spectrum, tile, FV_DXT_FORWARD, th);
+        fv_mul_spectrums(spectrum, spectrum, df->df_spectrum);
+        fv_dft(result, spectrum, FV_DXT_INVERSE, th);
+
+        tile_row = result->mt_data.dt_fl + (kh - 1)*tw + kw - 1;
+        dst_row = dst->mt_data.dt_ptr + y0*dst->mt_step + x0*dst_elem_size;
+        for (r = 0; r < rows; r++, tile_row += tw, dst_row += dst->mt_step) {
+            df->df_store(dst_row, tile_row, cols, cn, c, df->df_delta);
+        }
+    }
+
+    fv_release_mat(&result);
+    fv_release_mat(&spectrum);
+    fv_release_mat(&tile);
+}
+
+static void
+fv_dft_filter(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel,
+        fv_point_t anchor, double delta, fv_s32 border_type)
+{
+    fv_dft_filter_t     df = {};
+    fv_mat_t            *kflip;
+    float               *kdata;
+    fv_s32              tile_max;
+    fv_s32              kw;
+    fv_s32              kh;
+    fv_s32              width;
+    fv_s32              ox;
+    fv_s32              sx;
+    fv_s32              i;
+    fv_s32              j;
+    fv_s32              ntiles_y;
+
+    FV_ASSERT(dst->mt_rows == src->mt_rows && dst->mt_cols == src->mt_cols &&
+            dst->mt_nchannel == src->mt_nchannel);
+
+    if (border_type & FV_BORDER_ISOLATED) {
+        df.df_whole = fv_size(src->mt_cols, src->mt_rows);
+    } else {
+        fv_mat_locate_roi(src, &df.df_whole, &df.df_roi_ofs);
+    }
+    border_type &= ~FV_BORDER_ISOLATED;
+    ox = df.df_roi_ofs.pt_x;
+
+    df.df_ksize = fv_get_size(kernel);
+    df.df_anchor = fv_normalize_anchor(anchor, df.df_ksize);
+    kw = df.df_ksize.sz_width;
+    kh = df.df_ksize.sz_height;
+
+    /* tile, its spectrum and the inverse result: 16 bytes per point */
+    tile_max = 1;
+    while ((tile_max*tile_max << 6) <= FV_DFT_FILTER_CACHE_SIZE) {
+        tile_max <<= 1;
+    }
+    df.df_tile_w = fv_dft_filter_tile_size(kw, src->mt_cols, tile_max);
+    df.df_tile_h = fv_dft_filter_tile_size(kh, src->mt_rows, tile_max);
+    df.df_valid_w = df.df_tile_w - kw + 1;
+    df.df_valid_h = df.df_tile_h - kh + 1;
+    df.df_ntiles_x = (dst->mt_cols + df.df_valid_w - 1)/df.df_valid_w;
+    ntiles_y = (dst->mt_rows + df.df_valid_h - 1)/df.df_valid_h;
+    df.df_dst = dst;
+    df.df_src = src;
+    df.df_delta = delta;
+    df.df_border_type = border_type;
+    df.df_load = fv_get_dft_filter_load_tab(src->mt_depth);
+    df.df_store = fv_get_dft_filter_store_tab(dst->mt_depth);
+
+    /* 
+     * Source column of every tile column, relative to src and read
+     * around it when src is a view, FV_BORDER_MAP_ZERO for zeros:
+     * constant border or points past the last tile's valid area.
+     */
+    width = df.df_ntiles_x*df.df_valid_w + kw - 1;
+    df.df_xmap = fv_alloc(width*sizeof(*df.df_xmap));
+    FV_ASSERT(df.df_xmap != NULL);
+    for (i = 0; i < width; i++) {
+        sx = i - df.df_anchor.pt_x + ox;
+        if (i >= src->mt_cols + kw - 1 || ((sx < 0 || 
+                    sx >= df.df_whole.sz_width) && 
+                    border_type == FV_BORDER_CONSTANT)) {
+            df.df_xmap[i] = FV_BORDER_MAP_ZERO;
+            continue;
+        }
+        if (sx < 0 || sx >= df.df_whole.sz_width) {
+            sx = fv_border_get_value(border_type, sx, df.df_whole.sz_width);
+        }
+        df.df_xmap[i] = sx - ox;
+    }
+
+    /* 
+     * fv_filter2D correlates, so the kernel goes in flipped; the
+     * spectrum is shared by all tiles.
+     */
+    kflip = fv_create_mat(df.df_tile_h, df.df_tile_w, FV_32FC1);
+    df.df_spectrum = fv_create_mat(df.df_tile_h, df.df_tile_w, FV_32FC2);
+    FV_ASSERT(kflip != NULL && df.df_spectrum != NULL);
+    kdata = kflip->mt_data.dt_fl;
+    for (i = 0; i < kh; i++) {
+        for (j = 0; j < kw; j++) {
+            kdata[i*df.df_tile_w + j] = fv_mget(kernel, kh - 1 - i,
+                    kw - 1 - j, 0, FV_BORDER_CONSTANT);
+        }
+    }
+    fv_dft(df.df_spectrum, kflip, FV_DXT_FORWARD, kh);
+    fv_release_mat(&kflip);
+
+    fv_parallel_for(ntiles_y*df.df_ntiles_x, fv_dft_filter_job, &df);
+
+    fv_release_mat(&df.df_spectrum);
+    fv_free(&df.df_xmap);
 }
 
+void
+fv_filter2D(fv_mat_t *dst, fv_mat_t *src, fv_u16 depth,
+                fv_mat_t *kernel, fv_point_t anchor, 
+                double delta, fv_s32 border_type)
+{
+    fv_filter_engine_t      *filter;
+    fv_mat_t                *src_copy;
+    fv_mat_t                around;
+    fv_mat_t                view;
+    fv_size_t               ksize;
+    fv_size_t               whole;
+    fv_point_t              ofs;
+    fv_s32                  x0;
+    fv_s32                  y0;
+    fv_s32                  x1;
+    fv_s32                  y1;
+
+    /* tiles read past the rows and columns they write */
+    if (kernel->mt_total >= FV_DFT_FILTER_SIZE) {
+        if (dst->mt_data.dt_ptr != src->mt_data.dt_ptr) {
+            fv_dft_filter(dst, src, kernel, anchor, delta, border_type);
+            return;
+        }
+
+        /* 
+         * In place, copy src together with the pixels around a view
+         * the kernel reaches, so they stay its neighbours. A wrapped
+         * border reads the far side of the whole matrix, which is
+         * then copied entirely.
+         */
+        ksize = fv_get_size(kernel);
+        anchor = fv_normalize_anchor(anchor, ksize);
+        if (border_type & FV_BORDER_ISOLATED) {
+            whole = fv_size(src->mt_cols, src->mt_rows);
+            ofs = fv_point(0, 0);
+        } else {
+            fv_mat_locate_roi(src, &whole, &ofs);
+        }
+        if (border_type == FV_BORDER_WRAP) {
+            x0 = y0 = 0;
+            x1 = whole.sz_width;
+            y1 = whole.sz_height;
+        } else {
+            x0 = fv_max(ofs.pt_x - anchor.pt_x, 0);
+            y0 = fv_max(ofs.pt_y - anchor.pt_y, 0);
+            x1 = fv_min(ofs.pt_x + src->mt_cols + ksize.sz_width - 1 - 
+                    anchor.pt_x, whole.sz_width);
+            y1 = fv_min(ofs.pt_y + src->mt_rows + ksize.sz_height - 1 - 
+                    anchor.pt_y, whole.sz_height);
+        }
+        around = *src;
+        around.mt_data.dt_ptr -= (ofs.pt_y - y0)*src->mt_step + 
+            (ofs.pt_x - x0)*FV_ELEM_SIZE(src->mt_atr);
+        around.mt_rows = y1 - y0;
+        around.mt_cols = x1 - x0;
+        src_copy = fv_create_mat(around.mt_rows, around.mt_cols, 
+                src->mt_atr);
+        FV_ASSERT(src_copy != NULL);
+        src_copy->mt_depth = src->mt_depth;
+        fv_copy_mat(src_copy, &around);
+        fv_mat_get_roi_view(&view, src_copy, fv_rect(ofs.pt_x - x0, 
+                    ofs.pt_y - y0, src->mt_cols, src->mt_rows));
+        fv_dft_filter(dst, &view, kernel, anchor, delta, border_type);
+        fv_release_mat(&src_copy);
+        return;
+    }
+
+    filter = fv_create_linear_filter_engine(dst, src, kernel, anchor,
+            delta, border_type);
+    fv_filter_engine_apply(filter, dst, src);
+    fv_release_filter_engine(&filter);
+}
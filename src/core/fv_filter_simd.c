@@ -0,0 +1,546 @@
+#include <string.h>
+
+#include "fv_types.h"
+#include "fv_imgproc.h"
+#include "fv_math.h"
+#include "fv_debug.h"
+#include "fv_filter.h"
+#include "fv_cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * Vector parts of the linear row/column filters. Every function
+ * returns how many elements it wrote, the scalar filter does the
+ * rest. Results are bit-exact with the scalar code: 16s rows are
+ * exact integer sums, float rows use the same multiply/add order
+ * (no FMA) and 32f columns still accumulate in double.
+ */
+#define FV_FILTER_VEC_MAX_KSIZE     32
+
+#define FV_SSE2     __attribute__((target("sse2")))
+#define FV_AVX2     __attribute__((target("avx2")))
+
+static inline FV_SSE2 __m128i
+fv_load_u8x4(fv_u8 *src)
+{
+    fv_s32      v;
+
+    memcpy(&v, src, sizeof(v));
+
+    return _mm_cvtsi32_si128(v);
+}
+
+static FV_SSE2 fv_s32
+fv_row_vec_8u_16s_sse2(fv_s16 *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m128i     kf[FV_FILTER_VEC_MAX_KSIZE];
+    __m128i     z = _mm_setzero_si128();
+    __m128i     s;
+    __m128i     x;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (k = 0; k < ksize; k++) {
+        kf[k] = _mm_set1_epi16((fv_s16)kx_data[k]);
+    }
+
+    for (i = 0; i <= width - 8; i += 8) {
+        s = z;
+        for (k = 0; k < ksize; k++) {
+            x = _mm_loadl_epi64((__m128i *)(src + i + k*cn));
+            x = _mm_unpacklo_epi8(x, z);
+            s = _mm_add_epi16(s, _mm_mullo_epi16(x, kf[k]));
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), s);
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_row_vec_8u_16s_avx2(fv_s16 *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m256i     kf[FV_FILTER_VEC_MAX_KSIZE];
+    __m256i     s;
+    __m256i     x;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (k = 0; k < ksize; k++) {
+        kf[k] = _mm256_set1_epi16((fv_s16)kx_data[k]);
+    }
+
+    for (i = 0; i <= width - 16; i += 16) {
+        s = _mm256_setzero_si256();
+        for (k = 0; k < ksize; k++) {
+            x = _mm256_cvtepu8_epi16(
+                    _mm_loadu_si128((__m128i *)(src + i + k*cn)));
+            s = _mm256_add_epi16(s, _mm256_mullo_epi16(x, kf[k]));
+        }
+        _mm256_storeu_si256((__m256i *)(dst + i), s);
+    }
+
+    return i;
+}
+
+static FV_SSE2 fv_s32
+fv_row_vec_8u_32f_sse2(float *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m128i     z = _mm_setzero_si128();
+    __m128i     x;
+    __m128      f;
+    __m128      s;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 4; i += 4) {
+        x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(fv_load_u8x4(src + i), 
+                    z), z);
+        s = _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(kx_data[0]));
+        for (k = 1; k < ksize; k++) {
+            x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+                        fv_load_u8x4(src + i + k*cn), z), z);
+            f = _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(kx_data[k]));
+            s = _mm_add_ps(s, f);
+        }
+        _mm_storeu_ps(dst + i, s);
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_row_vec_8u_32f_avx2(float *dst, fv_u8 *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m256i     x;
+    __m256      f;
+    __m256      s;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(src + i)));
+        s = _mm256_mul_ps(_mm256_cvtepi32_ps(x), 
+                _mm256_set1_ps(kx_data[0]));
+        for (k = 1; k < ksize; k++) {
+            x = _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64((__m128i *)(src + i + k*cn)));
+            f = _mm256_mul_ps(_mm256_cvtepi32_ps(x), 
+                    _mm256_set1_ps(kx_data[k]));
+            s = _mm256_add_ps(s, f);
+        }
+        _mm256_storeu_ps(dst + i, s);
+    }
+
+    return i;
+}
+
+static FV_SSE2 fv_s32
+fv_row_vec_32f_32f_sse2(float *dst, float *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m128      f;
+    __m128      s;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 4; i += 4) {
+        s = _mm_mul_ps(_mm_loadu_ps(src + i), _mm_set1_ps(kx_data[0]));
+        for (k = 1; k < ksize; k++) {
+            f = _mm_mul_ps(_mm_loadu_ps(src + i + k*cn), 
+                    _mm_set1_ps(kx_data[k]));
+            s = _mm_add_ps(s, f);
+        }
+        _mm_storeu_ps(dst + i, s);
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_row_vec_32f_32f_avx2(float *dst, float *src, fv_s32 width, 
+            float *kx_data, fv_s32 ksize, fv_s32 cn)
+{
+    __m256      f;
+    __m256      s;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        s = _mm256_mul_ps(_mm256_loadu_ps(src + i), 
+                _mm256_set1_ps(kx_data[0]));
+        for (k = 1; k < ksize; k++) {
+            f = _mm256_mul_ps(_mm256_loadu_ps(src + i + k*cn), 
+                    _mm256_set1_ps(kx_data[k]));
+            s = _mm256_add_ps(s, f);
+        }
+        _mm256_storeu_ps(dst + i, s);
+    }
+
+    return i;
+}
+
+/*
+ * 16s rows times an integer kernel, 8 sums of 32 bits in lo/hi.
+ * Taps k and -k are interleaved so that one madd gives 
+ * ky[k]*src[k] +- ky[k]*src[-k].
+ */
+#define fv_column_vec_16s_sse2_core(src, i, ky_data, ksize, sym, lo, hi) \
+    do { \
+        __m128i     _z = _mm_setzero_si128(); \
+        __m128i     _p; \
+        __m128i     _m; \
+        __m128i     _c; \
+        fv_s32      _k; \
+                    \
+        if (sym) { \
+            _c = _mm_set1_epi32((fv_u16)(fv_s16)ky_data[0]); \
+            _p = _mm_loadu_si128((__m128i *)(src[0] + i)); \
+            lo = _mm_madd_epi16(_mm_unpacklo_epi16(_p, _z), _c); \
+            hi = _mm_madd_epi16(_mm_unpackhi_epi16(_p, _z), _c); \
+        } else { \
+            lo = hi = _z; \
+        } \
+        for (_k = 1; _k <= ksize; _k++) { \
+            _c = _mm_set1_epi32(((fv_u32)(fv_u16)(fv_s16)ky_data[_k]) | \
+                    ((fv_u32)(fv_u16)(fv_s16)(sym ? ky_data[_k]: \
+                        -ky_data[_k]) << 16)); \
+            _p = _mm_loadu_si128((__m128i *)(src[_k] + i)); \
+            _m = _mm_loadu_si128((__m128i *)(src[-_k] + i)); \
+            lo = _mm_add_epi32(lo, _mm_madd_epi16( \
+                        _mm_unpacklo_epi16(_p, _m), _c)); \
+            hi = _mm_add_epi32(hi, _mm_madd_epi16( \
+                        _mm_unpackhi_epi16(_p, _m), _c)); \
+        } \
+    } while(0)
+
+#define fv_column_vec_16s_avx2_core(src, i, ky_data, ksize, sym, lo, hi) \
+    do { \
+        __m256i     _z = _mm256_setzero_si256(); \
+        __m256i     _p; \
+        __m256i     _m; \
+        __m256i     _c; \
+        fv_s32      _k; \
+                    \
+        if (sym) { \
+            _c = _mm256_set1_epi32((fv_u16)(fv_s16)ky_data[0]); \
+            _p = _mm256_loadu_si256((__m256i *)(src[0] + i)); \
+            lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(_p, _z), _c); \
+            hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(_p, _z), _c); \
+        } else { \
+            lo = hi = _z; \
+        } \
+        for (_k = 1; _k <= ksize; _k++) { \
+            _c = _mm256_set1_epi32(((fv_u32)(fv_u16)(fv_s16)ky_data[_k]) | \
+                    ((fv_u32)(fv_u16)(fv_s16)(sym ? ky_data[_k]: \
+                        -ky_data[_k]) << 16)); \
+            _p = _mm256_loadu_si256((__m256i *)(src[_k] + i)); \
+            _m = _mm256_loadu_si256((__m256i *)(src[-_k] + i)); \
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16( \
+                        _mm256_unpacklo_epi16(_p, _m), _c)); \
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16( \
+                        _mm256_unpackhi_epi16(_p, _m), _c)); \
+        } \
+    } while(0)
+
+static FV_SSE2 fv_s32
+fv_column_vec_16s_8u_sse2(fv_u8 *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m128i     lo;
+    __m128i     hi;
+    __m128i     x;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        fv_column_vec_16s_sse2_core(src, i, ky_data, ksize, sym, lo, hi);
+        x = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(x, x));
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_column_vec_16s_8u_avx2(fv_u8 *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m256i     lo;
+    __m256i     hi;
+    __m256i     x;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 16; i += 16) {
+        fv_column_vec_16s_avx2_core(src, i, ky_data, ksize, sym, lo, hi);
+        x = _mm256_packs_epi32(lo, hi);
+        x = _mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08);
+        _mm_storeu_si128((__m128i *)(dst + i), 
+                _mm256_castsi256_si128(x));
+    }
+
+    return i;
+}
+
+static FV_SSE2 fv_s32
+fv_column_vec_16s_16s_sse2(fv_s16 *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m128i     lo;
+    __m128i     hi;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        fv_column_vec_16s_sse2_core(src, i, ky_data, ksize, sym, lo, hi);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_column_vec_16s_16s_avx2(fv_s16 *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m256i     lo;
+    __m256i     hi;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 16; i += 16) {
+        fv_column_vec_16s_avx2_core(src, i, ky_data, ksize, sym, lo, hi);
+        _mm256_storeu_si256((__m256i *)(dst + i), 
+                _mm256_packs_epi32(lo, hi));
+    }
+
+    return i;
+}
+
+static FV_SSE2 fv_s32
+fv_column_vec_16s_32f_sse2(float *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m128i     lo;
+    __m128i     hi;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        fv_column_vec_16s_sse2_core(src, i, ky_data, ksize, sym, lo, hi);
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(lo));
+        _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(hi));
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_column_vec_16s_32f_avx2(float *dst, fv_s16 **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m256i     lo;
+    __m256i     hi;
+    fv_s32      i;
+
+    for (i = 0; i <= width - 16; i += 16) {
+        fv_column_vec_16s_avx2_core(src, i, ky_data, ksize, sym, lo, hi);
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(
+                    _mm256_permute2x128_si256(lo, hi, 0x20)));
+        _mm256_storeu_ps(dst + i + 8, _mm256_cvtepi32_ps(
+                    _mm256_permute2x128_si256(lo, hi, 0x31)));
+    }
+
+    return i;
+}
+
+static FV_SSE2 fv_s32
+fv_column_vec_32f_32f_sse2(float *dst, float **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m128d     max = _mm_set1_pd(FLT_MAX);
+    __m128d     min = _mm_set1_pd(-FLT_MAX);
+    __m128d     lo;
+    __m128d     hi;
+    __m128      f;
+    __m128      p;
+    __m128      m;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 4; i += 4) {
+        if (sym) {
+            f = _mm_mul_ps(_mm_set1_ps(ky_data[0]), 
+                    _mm_loadu_ps(src[0] + i));
+            lo = _mm_cvtps_pd(f);
+            hi = _mm_cvtps_pd(_mm_movehl_ps(f, f));
+        } else {
+            lo = hi = _mm_setzero_pd();
+        }
+        for (k = 1; k <= ksize; k++) {
+            p = _mm_loadu_ps(src[k] + i);
+            m = _mm_loadu_ps(src[-k] + i);
+            f = _mm_mul_ps(_mm_set1_ps(ky_data[k]), 
+                    sym ? _mm_add_ps(p, m):_mm_sub_ps(p, m));
+            lo = _mm_add_pd(lo, _mm_cvtps_pd(f));
+            hi = _mm_add_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+        }
+        lo = _mm_min_pd(_mm_max_pd(lo, min), max);
+        hi = _mm_min_pd(_mm_max_pd(hi, min), max);
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), 
+                    _mm_cvtpd_ps(hi)));
+    }
+
+    return i;
+}
+
+static FV_AVX2 fv_s32
+fv_column_vec_32f_32f_avx2(float *dst, float **src, fv_s32 width, 
+            float *ky_data, fv_s32 ksize, fv_bool sym)
+{
+    __m256d     max = _mm256_set1_pd(FLT_MAX);
+    __m256d     min = _mm256_set1_pd(-FLT_MAX);
+    __m256d     lo;
+    __m256d     hi;
+    __m256      f;
+    __m256      p;
+    __m256      m;
+    fv_s32      i;
+    fv_s32      k;
+
+    for (i = 0; i <= width - 8; i += 8) {
+        if (sym) {
+            f = _mm256_mul_ps(_mm256_set1_ps(ky_data[0]), 
+                    _mm256_loadu_ps(src[0] + i));
+            lo = _mm256_cvtps_pd(_mm256_castps256_ps128(f));
+            hi = _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1));
+        } else {
+            lo = hi = _mm256_setzero_pd();
+        }
+        for (k = 1; k <= ksize; k++) {
+            p = _mm256_loadu_ps(src[k] + i);
+            m = _mm256_loadu_ps(src[-k] + i);
+            f = _mm256_mul_ps(_mm256_set1_ps(ky_data[k]), 
+                    sym ? _mm256_add_ps(p, m):_mm256_sub_ps(p, m));
+            lo = _mm256_add_pd(lo, 
+                    _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+            hi = _mm256_add_pd(hi, 
+                    _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+        }
+        lo = _mm256_min_pd(_mm256_max_pd(lo, min), max);
+        hi = _mm256_min_pd(_mm256_max_pd(hi, min), max);
+        _mm256_storeu_ps(dst + i, _mm256_insertf128_ps(
+                    _mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), 
+                    _mm256_cvtpd_ps(hi), 1));
+    }
+
+    return i;
+}
+
+typedef struct _fv_filter_vec_t {
+    fv_u32      fv_src_depth;
+    fv_u32      fv_dst_depth;
+    void        *fv_sse2;
+    void        *fv_avx2;
+} fv_filter_vec_t;
+
+static fv_filter_vec_t fv_row_vec_tab[] = {
+    {FV_8U, FV_16S, fv_row_vec_8u_16s_sse2, fv_row_vec_8u_16s_avx2},
+    {FV_8U, FV_32F, fv_row_vec_8u_32f_sse2, fv_row_vec_8u_32f_avx2},
+    {FV_32F, FV_32F, fv_row_vec_32f_32f_sse2, fv_row_vec_32f_32f_avx2},
+};
+
+static fv_filter_vec_t fv_column_vec_tab[] = {
+    {FV_16S, FV_8U, fv_column_vec_16s_8u_sse2, fv_column_vec_16s_8u_avx2},
+    {FV_16S, FV_16S, fv_column_vec_16s_16s_sse2, fv_column_vec_16s_16s_avx2},
+    {FV_16S, FV_32F, fv_column_vec_16s_32f_sse2, fv_column_vec_16s_32f_avx2},
+    {FV_32F, FV_32F, fv_column_vec_32f_32f_sse2, fv_column_vec_32f_32f_avx2},
+};
+
+#define fv_filter_vec_tab_size(tab) (sizeof(tab)/sizeof(fv_filter_vec_t))
+
+static void *
+fv_get_filter_vec(fv_filter_vec_t *tab, fv_u32 size, fv_u32 sdepth, 
+            fv_u32 ddepth)
+{
+    fv_u32      i;
+
+    for (i = 0; i < size; i++, tab++) {
+        if (tab->fv_src_depth != sdepth || tab->fv_dst_depth != ddepth) {
+            continue;
+        }
+        if (fv_cpu_has(FV_CPU_AVX2)) {
+            return tab->fv_avx2;
+        }
+        if (fv_cpu_has(FV_CPU_SSE2)) {
+            return tab->fv_sse2;
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+fv_row_vec_func
+fv_get_row_vec(fv_u32 bdepth, fv_u32 sdepth, float *kx_data, fv_s32 ksize)
+{
+    if (ksize > FV_FILTER_VEC_MAX_KSIZE) {
+        return NULL;
+    }
+
+    return fv_get_filter_vec(fv_row_vec_tab, 
+            fv_filter_vec_tab_size(fv_row_vec_tab), sdepth, bdepth);
+}
+
+/*
+ * The 16s columns multiply in 16 bits and sum in 32 bits, so they
+ * need a small integer kernel.
+ */
+fv_column_vec_func
+fv_get_column_vec(fv_u32 bdepth, fv_u32 ddepth, float *ky_data,
+            fv_s32 ksize, fv_s32 type)
+{
+    double      sum = 0;
+    fv_s32      i;
+
+    if (!(type & (FV_KERNEL_SYMMETRICAL | FV_KERNEL_ASYMMETRICAL))) {
+        return NULL;
+    }
+
+    if (bdepth == FV_16S) {
+        if (!(type & FV_KERNEL_INTEGER)) {
+            return NULL;
+        }
+        for (i = 0; i < ksize; i++) {
+            if (fabs(ky_data[i]) > fv_short_max) {
+                return NULL;
+            }
+            sum += fabs(ky_data[i]);
+        }
+        if (sum*(fv_short_max + 1) > fv_int_max) {
+            return NULL;
+        }
+    }
+
+    return fv_get_filter_vec(fv_column_vec_tab, 
+            fv_filter_vec_tab_size(fv_column_vec_tab), bdepth, ddepth);
+}
+
+#else
+
+fv_row_vec_func
+fv_get_row_vec(fv_u32 bdepth, fv_u32 sdepth, float *kx_data, fv_s32 ksize)
+{
+    return NULL;
+}
+
+fv_column_vec_func
+fv_get_column_vec(fv_u32 bdepth, fv_u32 ddepth, float *ky_data,
+            fv_s32 ksize, fv_s32 type)
+{
+    return NULL;
+}
+
+#endif
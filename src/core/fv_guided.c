@@ -0,0 +1,373 @@
+#include <string.h>
+
+#include "fv_types.h"
+#include "fv_smooth.h"
+#include "fv_core.h"
+#include "fv_debug.h"
+#include "fv_mem.h"
+#include "fv_math.h"
+#include "fv_thread.h"
+
+#define FV_GUIDED_BAND_MIN_ROWS             32
+#define FV_GUIDED_BLOCK                     16          /* values */
+
+typedef struct _fv_guided_t {
+    fv_mat_t            *gf_dst;
+    fv_mat_t            *gf_src;
+    fv_mat_t            *gf_guide;
+    fv_s32              gf_radius;
+    double              gf_eps;
+    double              *gf_inv_width;  /* 1/columns of a window, a value */
+    fv_s32              gf_row_len;     /* values a row, whole blocks */
+    fv_s32              gf_band_rows;
+} fv_guided_t;
+
+/*
+ * Row y of m as floats, one a channel of the source: a single channel
+ * guide is repeated for every channel it guides.
+ */
+static void
+fv_guided_load_row(float *dst, fv_mat_t *m, fv_s32 y, fv_s32 cn)
+{
+    fv_u8       *row = m->mt_data.dt_ptr + y*m->mt_step;
+    fv_s32      n = m->mt_cols*m->mt_nchannel;
+    fv_s32      rep = cn/m->mt_nchannel;
+    fv_s32      i;
+    fv_s32      k;
+
+    if (rep == 1) {
+        if (m->mt_depth == FV_8U) {
+            for (i = 0; i < n; i++) {
+                dst[i] = row[i];
+            }
+        } else {
+            memcpy(dst, row, n*sizeof(*dst));
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        float   v;
+
+        v = m->mt_depth == FV_8U ? ((fv_u8 *)row)[i] : ((float *)row)[i];
+        for (k = 0; k < rep; k++) {
+            dst[i*rep + k] = v;
+        }
+    }
+}
+
+/* adds (sign 1) or removes (sign -1) a block of a row, stage 1 */
+static inline void
+fv_guided_acc_block(double *restrict sum_i, double *restrict sum_p,
+            double *restrict sum_ii, double *restrict sum_ip,
+            const float *restrict guide, const float *restrict src,
+            double sign)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_GUIDED_BLOCK; i++) {
+        double  g = guide[i]*sign;
+
+        sum_i[i] += g;
+        sum_p[i] += src[i]*sign;
+        sum_ii[i] += g*guide[i];
+        sum_ip[i] += g*src[i];
+    }
+}
+
+/* a and b of a block from the window sums of I, p, I*I and I*p */
+static inline void
+fv_guided_coef_block(float *restrict a, float *restrict b,
+            double *restrict sum_a, double *restrict sum_b,
+            const double *restrict box_i, const double *restrict box_p,
+            const double *restrict box_ii, const double *restrict box_ip,
+            const double *restrict inv_width, double inv_height, double eps)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_GUIDED_BLOCK; i++) {
+        double  inv = inv_height*inv_width[i];
+        double  mean_i = box_i[i]*inv;
+        double  mean_p = box_p[i]*inv;
+        double  var = box_ii[i]*inv - mean_i*mean_i;
+        double  cov = box_ip[i]*inv - mean_i*mean_p;
+        double  ai = cov/(var + eps);
+
+        a[i] = ai;
+        b[i] = mean_p - ai*mean_i;
+        sum_a[i] += a[i];
+        sum_b[i] += b[i];
+    }
+}
+
+static inline void
+fv_guided_sub_block(double *restrict sum_a, double *restrict sum_b,
+            const float *restrict a, const float *restrict b)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_GUIDED_BLOCK; i++) {
+        sum_a[i] -= a[i];
+        sum_b[i] -= b[i];
+    }
+}
+
+/* q = mean(a)*I + mean(b) of a block */
+static inline void
+fv_guided_out_block(float *restrict q, const double *restrict box_a,
+            const double *restrict box_b, const float *restrict guide,
+            const double *restrict inv_width, double inv_height)
+{
+    fv_s32      i;
+
+    for (i = 0; i < FV_GUIDED_BLOCK; i++) {
+        q[i] = (box_a[i]*guide[i] + box_b[i])*inv_height*inv_width[i];
+    }
+}
+
+/*
+ * Row sums of the 2r + 1 columns around each column, cut at the edges,
+ * of two rows at once.
+ */
+static void
+fv_guided_box_row2(double *restrict dst0, double *restrict dst1,
+            const double *restrict src0, const double *restrict src1,
+            fv_s32 width, fv_s32 cn, fv_s32 r)
+{
+    fv_s32      x;
+    fv_s32      k;
+
+    for (k = 0; k < cn; k++) {
+        double  s0 = 0;
+        double  s1 = 0;
+
+        for (x = 0; x < fv_min(r, width); x++) {
+            s0 += src0[x*cn + k];
+            s1 += src1[x*cn + k];
+        }
+        for (x = 0; x < width; x++) {
+            if (x + r < width) {
+                s0 += src0[(x + r)*cn + k];
+                s1 += src1[(x + r)*cn + k];
+            }
+            dst0[x*cn + k] = s0;
+            dst1[x*cn + k] = s1;
+            if (x - r >= 0) {
+                s0 -= src0[(x - r)*cn + k];
+                s1 -= src1[(x - r)*cn + k];
+            }
+        }
+    }
+}
+
+/* saturating first lets the rounding skip the lrint call */
+#define fv_guided_store_8u(v) \
+    ({ \
+        float   _v = (v); \
+        _v <= 0 ? 0 : _v >= 255 ? 255 : (fv_u8)(_v + 0.5f); \
+     })
+
+/*
+ * Rows of a band. Stage 1 keeps column sums of I, p, I*I and I*p over
+ * the 2r + 1 source rows around the row it is at and turns their box
+ * means into the coefficients a and b of the row; stage 2 keeps column
+ * sums of a and b over the last 2r + 1 stage 1 rows, which stay in a
+ * ring for their removal, and q = mean(a)*I + mean(b). Nothing is as
+ * large as the image. Rows are padded to whole blocks.
+ */
+static void
+fv_guided_band(void *arg, fv_s32 index)
+{
+    fv_guided_t     *gf = arg;
+    fv_mat_t        *dst = gf->gf_dst;
+    fv_s32          r = gf->gf_radius;
+    fv_s32          width = dst->mt_cols;
+    fv_s32          height = dst->mt_rows;
+    fv_s32          cn = dst->mt_nchannel;
+    fv_s32          n = width*cn;
+    fv_s32          np = gf->gf_row_len;
+    fv_s32          nring = 2*r + 1;
+    fv_s32          y0 = index*gf->gf_band_rows;
+    fv_s32          y1 = fv_min(y0 + gf->gf_band_rows, height);
+    fv_s32          first;
+    fv_s32          next_src;
+    fv_s32          next_ab;
+    fv_s32          y;
+    fv_s32          j;
+    fv_s32          i;
+    double          *buf;
+    double          *sum_i;
+    double          *sum_p;
+    double          *sum_ii;
+    double          *sum_ip;
+    double          *sum_a;
+    double          *sum_b;
+    double          *box_i;
+    double          *box_p;
+    double          *box_ii;
+    double          *box_ip;
+    double          inv_h;
+    float           *row_i;
+    float           *row_p;
+    float           *ring;
+    float           *a;
+    fv_u8           *d;
+
+    if (y0 >= y1) {
+        return;
+    }
+
+    buf = fv_calloc(np*10*sizeof(*buf) + (2 + 2*nring)*np*sizeof(*ring));
+    FV_ASSERT(buf != NULL);
+    sum_i = buf;
+    sum_p = sum_i + np;
+    sum_ii = sum_p + np;
+    sum_ip = sum_ii + np;
+    sum_a = sum_ip + np;
+    sum_b = sum_a + np;
+    box_i = sum_b + np;
+    box_p = box_i + np;
+    box_ii = box_p + np;
+    box_ip = box_ii + np;
+    row_i = (float *)(box_ip + np);
+    row_p = row_i + np;
+    ring = row_p + np;
+
+    first = fv_max(y0 - 2*r, 0);
+    next_src = first;
+    next_ab = fv_max(y0 - r, 0);
+    for (y = y0; y < y1; y++) {
+        if (y - r - 1 >= fv_max(y0 - r, 0)) {
+            a = ring + ((y - r - 1)%nring)*2*np;
+            for (i = 0; i < np; i += FV_GUIDED_BLOCK) {
+                fv_guided_sub_block(sum_a + i, sum_b + i, a + i, a + np + i);
+            }
+        }
+        for (; next_ab <= fv_min(y + r, height - 1); next_ab++) {
+            j = next_ab;
+            if (j - r - 1 >= first) {
+                fv_guided_load_row(row_i, gf->gf_guide, j - r - 1, cn);
+                fv_guided_load_row(row_p, gf->gf_src, j - r - 1, cn);
+                for (i = 0; i < np; i += FV_GUIDED_BLOCK) {
+                    fv_guided_acc_block(sum_i + i, sum_p + i, sum_ii + i,
+                            sum_ip + i, row_i + i, row_p + i, -1);
+                }
+            }
+            for (; next_src <= fv_min(j + r, height - 1); next_src++) {
+                fv_guided_load_row(row_i, gf->gf_guide, next_src, cn);
+                fv_guided_load_row(row_p, gf->gf_src, next_src, cn);
+                for (i = 0; i < np; i += FV_GUIDED_BLOCK) {
+                    fv_guided_acc_block(sum_i + i, sum_p + i, sum_ii + i,
+                            sum_ip + i, row_i + i, row_p + i, 1);
+                }
+            }
+            fv_guided_box_row2(box_i, box_p, sum_i, sum_p, width, cn, r);
+            fv_guided_box_row2(box_ii, box_ip, sum_ii, sum_ip, width, cn, r);
+            inv_h = 1.0/(fv_min(j + r, height - 1) - fv_max(j - r, 0) + 1);
+            a = ring + (j%nring)*2*np;
+            for (i = 0; i < np; i += FV_GUIDED_BLOCK) {
+                fv_guided_coef_block(a + i, a + np + i, sum_a + i, sum_b + i,
+                        box_i + i, box_p + i, box_ii + i, box_ip + i,
+                        gf->gf_inv_width + i, inv_h, gf->gf_eps);
+            }
+        }
+
+        /* stage 2, box_i and box_p take the sums of a and b */
+        fv_guided_box_row2(box_i, box_p, sum_a, sum_b, width, cn, r);
+        fv_guided_load_row(row_i, gf->gf_guide, y, cn);
+        inv_h = 1.0/(fv_min(y + r, height - 1) - fv_max(y - r, 0) + 1);
+        for (i = 0; i < np; i += FV_GUIDED_BLOCK) {
+            fv_guided_out_block(row_p + i, box_i + i, box_p + i, row_i + i,
+                    gf->gf_inv_width + i, inv_h);
+        }
+        d = dst->mt_data.dt_ptr + y*dst->mt_step;
+        if (dst->mt_depth == FV_8U) {
+            for (i = 0; i < n; i++) {
+                d[i] = fv_guided_store_8u(row_p[i]);
+            }
+        } else {
+            memcpy(d, row_p, n*sizeof(*row_p));
+        }
+    }
+
+    fv_free(&buf);
+}
+
+/*
+ * Guided filter (He et al.) of src with guide, or with itself when
+ * guide is NULL: every output is a linear function of the guide in a
+ * (2*radius + 1)^2 window, fitted to src by least squares regularized
+ * by eps, in squared units of the guide. Edges of the guide are kept,
+ * flat areas are smoothed as a box filter would. The guide has one
+ * channel, guiding all of src, or one for each channel of src; 8u and
+ * 32f, both. Windows are cut at the edges of the image, the cost per
+ * pixel does not depend on radius.
+ */
+void
+fv_guided_filter(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *guide,
+            fv_s32 radius, double eps)
+{
+    fv_guided_t     gf;
+    fv_mat_t        *src_copy = NULL;
+    fv_mat_t        *guide_copy = NULL;
+    fv_s32          width = src->mt_cols;
+    fv_s32          height = src->mt_rows;
+    fv_s32          cn = src->mt_nchannel;
+    fv_s32          x;
+    fv_s32          k;
+
+    if (guide == NULL) {
+        guide = src;
+    }
+
+    FV_ASSERT(dst->mt_atr == src->mt_atr && dst->mt_rows == height &&
+            dst->mt_cols == width);
+    FV_ASSERT(guide->mt_rows == height && guide->mt_cols == width &&
+            (guide->mt_nchannel == 1 || guide->mt_nchannel == cn));
+    FV_ASSERT((src->mt_depth == FV_8U || src->mt_depth == FV_32F) &&
+            (guide->mt_depth == FV_8U || guide->mt_depth == FV_32F));
+    FV_ASSERT(radius >= 0);
+
+    /* rows of dst are written while rows below still read src and guide */
+    if (dst->mt_data.dt_ptr == src->mt_data.dt_ptr) {
+        src_copy = fv_create_mat(height, width, src->mt_atr);
+        FV_ASSERT(src_copy != NULL);
+        src_copy->mt_depth = src->mt_depth;
+        fv_copy_mat(src_copy, src);
+        src = src_copy;
+    }
+    if (dst->mt_data.dt_ptr == guide->mt_data.dt_ptr) {
+        if (src_copy != NULL && guide->mt_atr == src_copy->mt_atr) {
+            guide = src_copy;
+        } else {
+            guide_copy = fv_create_mat(height, width, guide->mt_atr);
+            FV_ASSERT(guide_copy != NULL);
+            guide_copy->mt_depth = guide->mt_depth;
+            fv_copy_mat(guide_copy, guide);
+            guide = guide_copy;
+        }
+    }
+
+    gf.gf_dst = dst;
+    gf.gf_src = src;
+    gf.gf_guide = guide;
+    gf.gf_radius = radius;
+    gf.gf_eps = eps;
+    gf.gf_row_len = (width*cn + FV_GUIDED_BLOCK - 1)/FV_GUIDED_BLOCK*
+        FV_GUIDED_BLOCK;
+    gf.gf_inv_width = fv_calloc(gf.gf_row_len*sizeof(*gf.gf_inv_width));
+    FV_ASSERT(gf.gf_inv_width != NULL);
+    for (x = 0; x < width; x++) {
+        for (k = 0; k < cn; k++) {
+            gf.gf_inv_width[x*cn + k] = 1.0/(fv_min(x + radius, width - 1) -
+                    fv_max(x - radius, 0) + 1);
+        }
+    }
+
+    fv_parallel_bands(height, fv_max(FV_GUIDED_BAND_MIN_ROWS, radius*4),
+            &gf.gf_band_rows, fv_guided_band, &gf);
+
+    fv_free(&gf.gf_inv_width);
+    fv_release_mat(&guide_copy);
+    fv_release_mat(&src_copy);
+}
@@ -466,7 +466,7 @@ fv_hough_circles_gradient(fv_mat_t *mat, float dp, float min_dist,
     float           _dx;
     float           _dy;
     float           _r2;
-    float           mag;
+    float           inv_mag;
     float           cx;
     float           cy;
     float           start_dist;
@@ -521,8 +521,7 @@ fv_hough_circles_gradient(fv_mat_t *mat, float dp, float min_dist,
     FV_ASSERT(dy != NULL);
     dy->mt_depth = FV_16S;
 
-    _fv_sobel(dx, mat, FV_16S, 1, 0, 3, 1, 0, FV_BORDER_CONSTANT);
-    _fv_sobel(dy, mat, FV_16S, 0, 1, 3, 1, 0, FV_BORDER_CONSTANT);
+    _fv_sobel_dxdy(dx, dy, mat, FV_16S, 3, 1, 0, FV_BORDER_CONSTANT);
 
     if (dp < 1.0) {
         dp = 1.0;
@@ -565,10 +564,10 @@ fv_hough_circles_gradient(fv_mat_t *mat, float dp, float min_dist,
                 continue;
             }
 
-            mag = sqrt(vx*vx+vy*vy);
-            FV_ASSERT(mag >= 1);
-            sx = vx*idp*FV_HOUGH_ONE/mag;
-            sy = vy*idp*FV_HOUGH_ONE/mag;
+            /* (vx, vy) scaled to idp*FV_HOUGH_ONE long */
+            inv_mag = idp*FV_HOUGH_ONE*fv_fast_rsqrt(vx*vx + vy*vy);
+            sx = vx*inv_mag;
+            sy = vy*inv_mag;
 
             x0 = x*idp*FV_HOUGH_ONE;
             y0 = y*idp*FV_HOUGH_ONE;
@@ -0,0 +1,461 @@
+#include <string.h>
+
+#include "fv_types.h"
+#include "fv_integral.h"
+#include "fv_core.h"
+#include "fv_debug.h"
+#include "fv_mem.h"
+#include "fv_math.h"
+#include "fv_thread.h"
+
+#define FV_INTEGRAL_BAND_MIN_ROWS           32
+
+/*
+ * The tables are one row and one column larger than the source, row
+ * 0 and column 0 are zero and sum(X, Y) holds the sum of the pixels
+ * above and left of (X, Y). Each row is the row above plus a running
+ * sum of its source row, so squared sums come along for free.
+ */
+#define fv_integral_core(stype, ttype, src, sstep, sum, sumstep, sqsum, \
+        sqstep, width, height, cn) \
+    do { \
+        fv_s32      _w = (width)*(cn); \
+        fv_s32      _x; \
+        fv_s32      _y; \
+        fv_s32      _k; \
+        \
+        memset(sum, 0, (_w + cn)*sizeof(*(sum))); \
+        if (sqsum != NULL) { \
+            memset(sqsum, 0, (_w + cn)*sizeof(*(sqsum))); \
+        } \
+        for (_y = 0; _y < height; _y++) { \
+            stype       *_s = src + _y*(sstep); \
+            ttype       *_prev = sum + _y*(sumstep); \
+            ttype       *_cur = _prev + (sumstep); \
+            \
+            for (_k = 0; _k < cn; _k++) { \
+                ttype   _acc = 0; \
+                \
+                _cur[_k] = 0; \
+                for (_x = _k; _x < _w; _x += cn) { \
+                    _acc += _s[_x]; \
+                    _cur[_x + cn] = _prev[_x + cn] + _acc; \
+                } \
+            } \
+            if (sqsum == NULL) { \
+                continue; \
+            } \
+            for (_k = 0; _k < cn; _k++) { \
+                double  *_qprev = sqsum + _y*(sqstep); \
+                double  *_qcur = _qprev + (sqstep); \
+                double  _acc = 0; \
+                \
+                _qcur[_k] = 0; \
+                for (_x = _k; _x < _w; _x += cn) { \
+                    _acc += (double)_s[_x]*_s[_x]; \
+                    _qcur[_x + cn] = _qprev[_x + cn] + _acc; \
+                } \
+            } \
+        } \
+    } while (0)
+
+/*
+ * Tilted sums, tilted(X, Y) holds the pixels (x, y) with y < Y and
+ * |x - X + 1| <= Y - y - 1, the triangle opening upwards from the
+ * pixel above and left of (X, Y). buf keeps, per column, the diagonal
+ * sums the triangle of the next row needs beyond the ones of this row.
+ */
+#define fv_integral_tilted_core(stype, ttype, src, sstep, tilted, tstep, \
+        buf, width, height, cn) \
+    do { \
+        fv_s32      _w = (width)*(cn); \
+        fv_s32      _x; \
+        fv_s32      _y; \
+        fv_s32      _k; \
+        \
+        memset(tilted, 0, (_w + cn)*sizeof(*(tilted))); \
+        if (height <= 0) { \
+            break; \
+        } \
+        for (_k = 0; _k < cn; _k++) { \
+            ttype   *_cur = tilted + (tstep); \
+            \
+            _cur[_k] = 0; \
+            for (_x = _k; _x < _w; _x += cn) { \
+                buf[_x] = _cur[_x + cn] = src[_x]; \
+            } \
+            if (width == 1) { \
+                buf[_k + cn] = 0; \
+            } \
+        } \
+        for (_y = 1; _y < height; _y++) { \
+            stype       *_s = src + _y*(sstep); \
+            ttype       *_prev = tilted + _y*(tstep); \
+            ttype       *_cur = _prev + (tstep); \
+            \
+            for (_k = 0; _k < cn; _k++) { \
+                ttype   _t0 = _s[_k]; \
+                ttype   _t1; \
+                \
+                _cur[_k] = _prev[_k + cn]; \
+                _cur[_k + cn] = _prev[_k + cn] + _t0 + buf[_k + cn]; \
+                for (_x = _k + cn; _x < _w - cn; _x += cn) { \
+                    _t1 = buf[_x]; \
+                    buf[_x - cn] = _t1 + _t0; \
+                    _t0 = _s[_x]; \
+                    _cur[_x + cn] = _t1 + buf[_x + cn] + _t0 + _prev[_x]; \
+                } \
+                if (width > 1) { \
+                    _t1 = buf[_x]; \
+                    buf[_x - cn] = _t1 + _t0; \
+                    _t0 = _s[_x]; \
+                    _cur[_x + cn] = _t0 + _t1 + _prev[_x]; \
+                    buf[_x] = _t0; \
+                } \
+            } \
+        } \
+    } while (0)
+
+#define fv_integral_funcs(name, stype, ttype) \
+    static void \
+    fv_integral_##name(void *src, fv_s32 sstep, void *sum, fv_s32 sumstep, \
+            double *sqsum, fv_s32 sqstep, fv_s32 width, fv_s32 height, \
+            fv_s32 cn) \
+    { \
+        stype   *s = src; \
+        ttype   *t = sum; \
+        \
+        fv_integral_core(stype, ttype, s, sstep, t, sumstep, sqsum, \
+                sqstep, width, height, cn); \
+    } \
+    \
+    static void \
+    fv_integral_tilted_##name(void *src, fv_s32 sstep, void *tilted, \
+            fv_s32 tstep, fv_s32 width, fv_s32 height, fv_s32 cn) \
+    { \
+        stype   *s = src; \
+        ttype   *t = tilted; \
+        ttype   *buf; \
+        \
+        buf = fv_alloc((width + 1)*cn*sizeof(*buf)); \
+        FV_ASSERT(buf != NULL); \
+        fv_integral_tilted_core(stype, ttype, s, sstep, t, tstep, buf, \
+                width, height, cn); \
+        fv_free(&buf); \
+    }
+
+fv_integral_funcs(8u_32s, fv_u8, fv_s32)
+fv_integral_funcs(8u_32f, fv_u8, float)
+fv_integral_funcs(8u_64f, fv_u8, double)
+fv_integral_funcs(32f_32f, float, float)
+fv_integral_funcs(32f_64f, float, double)
+
+typedef void (*fv_integral_func)(void *, fv_s32, void *, fv_s32, double *,
+        fv_s32, fv_s32, fv_s32, fv_s32);
+typedef void (*fv_integral_tilted_func)(void *, fv_s32, void *, fv_s32,
+        fv_s32, fv_s32, fv_s32);
+
+typedef struct _fv_integral_func_t {
+    fv_integral_func            if_sum;
+    fv_integral_tilted_func     if_tilted;
+} fv_integral_func_t;
+
+static fv_integral_func_t fv_integral_tab[][FV_DEPTH_NUM] = {
+    {
+        {}, {}, {}, {},
+        { fv_integral_8u_32s, fv_integral_tilted_8u_32s, },
+        { fv_integral_8u_32f, fv_integral_tilted_8u_32f, },
+        { fv_integral_8u_64f, fv_integral_tilted_8u_64f, },
+    },
+    {}, {}, {}, {},
+    {
+        {}, {}, {}, {}, {},
+        { fv_integral_32f_32f, fv_integral_tilted_32f_32f, },
+        { fv_integral_32f_64f, fv_integral_tilted_32f_64f, },
+    },
+    {},
+};
+
+static fv_integral_func_t *
+fv_get_integral_func(fv_u32 sdepth, fv_u32 tdepth)
+{
+    fv_integral_func_t  *func;
+
+    FV_ASSERT(sdepth < FV_DEPTH_NUM && tdepth < FV_DEPTH_NUM);
+
+    func = &fv_integral_tab[sdepth][tdepth];
+    FV_ASSERT(func->if_sum != NULL);
+
+    return func;
+}
+
+/*
+ * Summed-area tables of src: sum, and optionally the squared sums
+ * (64f) and the 45 degree tilted sums (the depth of sum). 8u sources
+ * sum to 32s, 32f or 64f, 32f sources to 32f or 64f. A view sums its
+ * own pixels only.
+ */
+void
+fv_integral(fv_mat_t *sum, fv_mat_t *sqsum, fv_mat_t *tilted,
+            fv_mat_t *src)
+{
+    fv_integral_func_t  *func;
+    fv_s32              width = src->mt_cols;
+    fv_s32              height = src->mt_rows;
+    fv_s32              cn = src->mt_nchannel;
+    fv_s32              sstep;
+    fv_s32              esize;
+
+    FV_ASSERT(sum->mt_rows == height + 1 && sum->mt_cols == width + 1 &&
+            sum->mt_nchannel == cn);
+
+    func = fv_get_integral_func(src->mt_depth, sum->mt_depth);
+    sstep = src->mt_step/(FV_ELEM_SIZE(src->mt_atr)/cn);
+    esize = FV_ELEM_SIZE(sum->mt_atr)/cn;
+    if (sqsum != NULL) {
+        FV_ASSERT(sqsum->mt_rows == height + 1 &&
+                sqsum->mt_cols == width + 1 && sqsum->mt_nchannel == cn &&
+                sqsum->mt_depth == FV_64F);
+    }
+
+    func->if_sum(src->mt_data.dt_ptr, sstep,
+            sum->mt_data.dt_ptr, sum->mt_step/esize,
+            sqsum != NULL ? sqsum->mt_data.dt_db : NULL,
+            sqsum != NULL ? sqsum->mt_step/sizeof(double) : 0,
+            width, height, cn);
+
+    if (tilted == NULL) {
+        return;
+    }
+
+    FV_ASSERT(tilted->mt_rows == height + 1 &&
+            tilted->mt_cols == width + 1 && tilted->mt_nchannel == cn &&
+            tilted->mt_depth == sum->mt_depth);
+    func->if_tilted(src->mt_data.dt_ptr, sstep,
+            tilted->mt_data.dt_ptr, tilted->mt_step/esize, width, height, cn);
+}
+
+/*
+ * Sum of channel channel over rect, read from the four corners of a
+ * sum table.
+ */
+double
+fv_integral_rect_sum(fv_mat_t *sum, fv_rect_t rect, fv_s32 channel)
+{
+    fv_s32      cn = sum->mt_nchannel;
+    fv_s32      x0 = rect.rt_x*cn + channel;
+    fv_s32      x1 = (rect.rt_x + rect.rt_width)*cn + channel;
+    fv_u8       *r0;
+    fv_u8       *r1;
+
+    FV_ASSERT(rect.rt_x >= 0 && rect.rt_y >= 0 && rect.rt_width >= 0 &&
+            rect.rt_height >= 0 && channel >= 0 && channel < cn &&
+            rect.rt_x + rect.rt_width < sum->mt_cols &&
+            rect.rt_y + rect.rt_height < sum->mt_rows);
+
+    r0 = sum->mt_data.dt_ptr + rect.rt_y*sum->mt_step;
+    r1 = r0 + rect.rt_height*sum->mt_step;
+    switch (sum->mt_depth) {
+        case FV_32S:
+            return (double)(((fv_s32 *)r1)[x1] - ((fv_s32 *)r0)[x1] -
+                    ((fv_s32 *)r1)[x0] + ((fv_s32 *)r0)[x0]);
+        case FV_32F:
+            return (double)((float *)r1)[x1] - ((float *)r0)[x1] -
+                    ((float *)r1)[x0] + ((float *)r0)[x0];
+        case FV_64F:
+            return ((double *)r1)[x1] - ((double *)r0)[x1] -
+                    ((double *)r1)[x0] + ((double *)r0)[x0];
+        default:
+            FV_ASSERT(0);
+    }
+
+    return 0;
+}
+
+typedef struct _fv_integral_box_t {
+    fv_mat_t            *ib_dst;
+    fv_mat_t            *ib_sum;
+    fv_size_t           ib_ksize;
+    fv_point_t          ib_anchor;
+    fv_bool             ib_normalize;
+    fv_s32              ib_band_rows;
+    void                (*ib_func)(struct _fv_integral_box_t *, fv_s32,
+                            fv_s32);
+} fv_integral_box_t;
+
+/* saturating first lets the rounding skip the lrint call */
+#define fv_integral_store_8u(v) \
+    ({ \
+        double  _v = (v); \
+        _v <= 0 ? 0 : _v >= 255 ? 255 : (fv_u8)(_v + 0.5); \
+     })
+#define fv_integral_store_32f(v) ((float)(v))
+#define fv_integral_store_64f(v) (v)
+
+/*
+ * Rows y0 to y1 of the box filter. Windows are cut at the image
+ * edges and the normalized filter divides by the pixels left, so
+ * only the columns near the edges need their own window; the rest
+ * read the table at fixed offsets.
+ */
+#define fv_integral_box_core(ttype, dtype, ib, y0, y1, store) \
+    do { \
+        fv_mat_t    *_sum = (ib)->ib_sum; \
+        fv_mat_t    *_dst = (ib)->ib_dst; \
+        fv_s32      _cn = _dst->mt_nchannel; \
+        fv_s32      _width = _dst->mt_cols; \
+        fv_s32      _height = _dst->mt_rows; \
+        fv_s32      _kw = (ib)->ib_ksize.sz_width; \
+        fv_s32      _kh = (ib)->ib_ksize.sz_height; \
+        fv_s32      _ax = (ib)->ib_anchor.pt_x; \
+        fv_s32      _ay = (ib)->ib_anchor.pt_y; \
+        fv_s32      _in0 = fv_min(_ax, _width); \
+        fv_s32      _in1 = fv_max(_width - _kw + _ax + 1, _in0); \
+        fv_s32      _y; \
+        fv_s32      _x; \
+        fv_s32      _k; \
+        fv_s32      _i; \
+        \
+        for (_y = y0; _y < y1; _y++) { \
+            fv_s32  _ya = fv_max(_y - _ay, 0); \
+            fv_s32  _yb = fv_min(_y - _ay + _kh, _height); \
+            ttype   *_r0 = (ttype *)(_sum->mt_data.dt_ptr + \
+                        _ya*_sum->mt_step); \
+            ttype   *_r1 = (ttype *)(_sum->mt_data.dt_ptr + \
+                        _yb*_sum->mt_step); \
+            dtype   *_d = (dtype *)(_dst->mt_data.dt_ptr + \
+                        _y*_dst->mt_step); \
+            double  _scale = (ib)->ib_normalize ? 1.0/(_yb - _ya) : 1; \
+            \
+            for (_x = 0; _x < _width; _x++) { \
+                fv_s32  _xa; \
+                fv_s32  _xb; \
+                double  _s; \
+                \
+                if (_x == _in0) { \
+                    _s = (ib)->ib_normalize ? _scale/_kw : _scale; \
+                    for (_i = _in0*_cn; _i < _in1*_cn; _i++) { \
+                        fv_s32  _a = _i - _ax*_cn; \
+                        fv_s32  _b = _a + _kw*_cn; \
+                        _d[_i] = store(((_r1[_b] - _r0[_b]) - \
+                                (_r1[_a] - _r0[_a]))*_s); \
+                    } \
+                    _x = _in1; \
+                    if (_x >= _width) { \
+                        break; \
+                    } \
+                } \
+                _xa = fv_max(_x - _ax, 0)*_cn; \
+                _xb = fv_min(_x - _ax + _kw, _width)*_cn; \
+                _s = (ib)->ib_normalize ? _scale*_cn/(_xb - _xa) : _scale; \
+                for (_k = 0; _k < _cn; _k++) { \
+                    _d[_x*_cn + _k] = store(((_r1[_xb + _k] - \
+                                _r0[_xb + _k]) - (_r1[_xa + _k] - \
+                                _r0[_xa + _k]))*_s); \
+                } \
+            } \
+        } \
+    } while (0)
+
+#define fv_integral_box_func(tname, ttype, dname, dtype) \
+    static void \
+    fv_integral_box_##tname##_##dname(fv_integral_box_t *ib, fv_s32 y0, \
+            fv_s32 y1) \
+    { \
+        fv_integral_box_core(ttype, dtype, ib, y0, y1, \
+                fv_integral_store_##dname); \
+    }
+
+fv_integral_box_func(32s, fv_s32, 8u, fv_u8)
+fv_integral_box_func(32s, fv_s32, 32f, float)
+fv_integral_box_func(32s, fv_s32, 64f, double)
+fv_integral_box_func(32f, float, 8u, fv_u8)
+fv_integral_box_func(32f, float, 32f, float)
+fv_integral_box_func(32f, float, 64f, double)
+fv_integral_box_func(64f, double, 8u, fv_u8)
+fv_integral_box_func(64f, double, 32f, float)
+fv_integral_box_func(64f, double, 64f, double)
+
+typedef void (*fv_integral_box_func_t)(fv_integral_box_t *, fv_s32, fv_s32);
+
+static fv_integral_box_func_t fv_integral_box_tab[][3] = {
+    {
+        fv_integral_box_32s_8u,
+        fv_integral_box_32s_32f,
+        fv_integral_box_32s_64f,
+    },
+    {
+        fv_integral_box_32f_8u,
+        fv_integral_box_32f_32f,
+        fv_integral_box_32f_64f,
+    },
+    {
+        fv_integral_box_64f_8u,
+        fv_integral_box_64f_32f,
+        fv_integral_box_64f_64f,
+    },
+};
+
+static fv_integral_box_func_t
+fv_get_integral_box_func(fv_u32 tdepth, fv_u32 ddepth)
+{
+    fv_s32      t;
+    fv_s32      d;
+
+    t = tdepth == FV_32S ? 0 : tdepth == FV_32F ? 1 : 2;
+    d = ddepth == FV_8U ? 0 : ddepth == FV_32F ? 1 : 2;
+    FV_ASSERT(tdepth == FV_32S || tdepth == FV_32F || tdepth == FV_64F);
+    FV_ASSERT(ddepth == FV_8U || ddepth == FV_32F || ddepth == FV_64F);
+
+    return fv_integral_box_tab[t][d];
+}
+
+static void
+fv_integral_box_band(void *arg, fv_s32 index)
+{
+    fv_integral_box_t   *ib = arg;
+    fv_s32              y0 = index*ib->ib_band_rows;
+    fv_s32              y1;
+
+    y1 = fv_min(y0 + ib->ib_band_rows, ib->ib_dst->mt_rows);
+    ib->ib_func(ib, y0, y1);
+}
+
+/*
+ * Box filter of the image sum was built from, read from the table:
+ * every pixel costs four reads whatever ksize, so one table serves any
+ * number of window sizes. Windows are cut at the image edges and, when
+ * normalized, averaged over the pixels they still cover. A sqsum table
+ * gives the local mean of the squares the same way.
+ */
+void
+fv_box_filter_integral(fv_mat_t *dst, fv_mat_t *sum, fv_size_t ksize,
+            fv_point_t anchor, fv_bool normalize)
+{
+    fv_integral_box_t   ib;
+
+    FV_ASSERT(dst->mt_rows + 1 == sum->mt_rows &&
+            dst->mt_cols + 1 == sum->mt_cols &&
+            dst->mt_nchannel == sum->mt_nchannel);
+    FV_ASSERT(ksize.sz_width > 0 && ksize.sz_height > 0);
+
+    if (anchor.pt_x < 0) {
+        anchor.pt_x = ksize.sz_width >> 1;
+    }
+
+    if (anchor.pt_y < 0) {
+        anchor.pt_y = ksize.sz_height >> 1;
+    }
+
+    FV_ASSERT(anchor.pt_x < ksize.sz_width && anchor.pt_y < ksize.sz_height);
+
+    ib.ib_dst = dst;
+    ib.ib_sum = sum;
+    ib.ib_ksize = ksize;
+    ib.ib_anchor = anchor;
+    ib.ib_normalize = normalize;
+    ib.ib_func = fv_get_integral_box_func(sum->mt_depth, dst->mt_depth);
+
+    fv_parallel_bands(dst->mt_rows, FV_INTEGRAL_BAND_MIN_ROWS,
+            &ib.ib_band_rows, fv_integral_box_band, &ib);
+}
@@ -1,8 +1,10 @@
 
 #include <math.h>
+#include <string.h>
 #include "fv_types.h"
 #include "fv_math.h"
 #include "fv_debug.h"
+#include "fv_thread.h"
 
 #define fv_pow_core(dst, src, total, pfunc, p, castop) \
     do { \
@@ -175,3 +177,220 @@ fv_pow(fv_mat_t *dst, fv_mat_t *src, double pow)
 
     pow_func(dst->mt_data.dt_ptr, src->mt_data.dt_ptr, src->mt_total, pow);
 }
+
+/*
+ * Magnitude and direction of the vectors (x, y), 16 at a time in the
+ * fv_fast_atan2() and fv_fast_rsqrt() approximations.
+ */
+#define FV_POLAR_BLOCK              16
+#define FV_POLAR_BAND_MIN_ROWS      16
+
+typedef struct _fv_polar_t {
+    fv_mat_t        *pl_mag;
+    fv_mat_t        *pl_angle;
+    fv_mat_t        *pl_x;
+    fv_mat_t        *pl_y;
+    float           pl_scale;
+    float           pl_range;
+    float           pl_inv_range;
+    fv_s32          pl_nbins;
+    fv_s32          pl_band_rows;
+    void            (*pl_row)(struct _fv_polar_t *, fv_s32);
+} fv_polar_t;
+
+static inline void
+fv_polar_block(float *restrict mag, float *restrict angle,
+            const float *restrict x, const float *restrict y)
+{
+    float       sx;
+    float       sy;
+    float       v;
+    fv_s32      e;
+    fv_s32      i;
+
+    for (i = 0; i < FV_POLAR_BLOCK; i++) {
+        /*
+         * x and y scaled exactly by the power of 2 of the larger one,
+         * so the sum of squares neither overflows nor underflows
+         */
+        e = fv_max(fv_float_bits(x[i]) & 0x7f800000, 
+                fv_float_bits(y[i]) & 0x7f800000);
+        e = fv_min(fv_max(e, 1 << 23), 253 << 23);
+        sx = x[i]*fv_bits_float(0x7f000000 - e);
+        sy = y[i]*fv_bits_float(0x7f000000 - e);
+        v = sx*sx + sy*sy;
+        mag[i] = v*fv_fast_rsqrt(v)*fv_bits_float(e);
+        angle[i] = fv_fast_atan2(y[i], x[i]);
+    }
+}
+
+/*
+ * n results of the block at column i of row y out: the angle scaled
+ * from degrees, or as bin of nbins over pl_range degrees.
+ */
+static void
+fv_polar_store(fv_polar_t *pl, fv_s32 y, fv_s32 i, float *mag,
+            float *angle, fv_s32 n)
+{
+    fv_u8       bins[FV_POLAR_BLOCK];
+    float       v;
+    fv_s32      nbins = pl->pl_nbins;
+    fv_s32      b;
+    fv_s32      j;
+
+    if (pl->pl_mag != NULL) {
+        memcpy((float *)(pl->pl_mag->mt_data.dt_ptr +
+                    y*pl->pl_mag->mt_step) + i, mag, n*sizeof(*mag));
+    }
+
+    if (pl->pl_angle == NULL) {
+        return;
+    }
+
+    if (nbins == 0) {
+        for (j = 0; j < FV_POLAR_BLOCK; j++) {
+            angle[j] *= pl->pl_scale;
+        }
+        memcpy((float *)(pl->pl_angle->mt_data.dt_ptr +
+                    y*pl->pl_angle->mt_step) + i, angle, n*sizeof(*angle));
+        return;
+    }
+
+    for (j = 0; j < FV_POLAR_BLOCK; j++) {
+        /* angles of pl_range and more come round to 0 */
+        v = angle[j];
+        v -= pl->pl_range*(fv_s32)(v*pl->pl_inv_range);
+        b = (fv_s32)(v*pl->pl_scale);
+        bins[j] = b < nbins ? b : nbins - 1;
+    }
+    memcpy(pl->pl_angle->mt_data.dt_ptr + y*pl->pl_angle->mt_step + i,
+            bins, n);
+}
+
+#define fv_polar_row_core(pl, y, type) \
+    do { \
+        type        *xs; \
+        type        *ys; \
+        float       fx[FV_POLAR_BLOCK]; \
+        float       fy[FV_POLAR_BLOCK]; \
+        float       mag[FV_POLAR_BLOCK]; \
+        float       angle[FV_POLAR_BLOCK]; \
+        fv_s32      n = pl->pl_x->mt_cols*pl->pl_x->mt_nchannel; \
+        fv_s32      i; \
+        fv_s32      j; \
+        \
+        xs = (type *)(pl->pl_x->mt_data.dt_ptr + y*pl->pl_x->mt_step); \
+        ys = (type *)(pl->pl_y->mt_data.dt_ptr + y*pl->pl_y->mt_step); \
+        for (i = 0; i + FV_POLAR_BLOCK <= n; i += FV_POLAR_BLOCK) { \
+            for (j = 0; j < FV_POLAR_BLOCK; j++) { \
+                fx[j] = xs[i + j]; \
+                fy[j] = ys[i + j]; \
+            } \
+            fv_polar_block(mag, angle, fx, fy); \
+            fv_polar_store(pl, y, i, mag, angle, FV_POLAR_BLOCK); \
+        } \
+        if (i < n) { \
+            for (j = 0; j < FV_POLAR_BLOCK; j++) { \
+                fx[j] = i + j < n ? xs[i + j] : 0; \
+                fy[j] = i + j < n ? ys[i + j] : 0; \
+            } \
+            fv_polar_block(mag, angle, fx, fy); \
+            fv_polar_store(pl, y, i, mag, angle, n - i); \
+        } \
+    } while (0)
+
+static void
+fv_polar_row_16s(fv_polar_t *pl, fv_s32 y)
+{
+    fv_polar_row_core(pl, y, fv_s16);
+}
+
+static void
+fv_polar_row_32f(fv_polar_t *pl, fv_s32 y)
+{
+    fv_polar_row_core(pl, y, float);
+}
+
+static void
+fv_polar_band(void *arg, fv_s32 index)
+{
+    fv_polar_t      *pl = arg;
+    fv_s32          y0 = index*pl->pl_band_rows;
+    fv_s32          y1;
+    fv_s32          y;
+
+    y1 = fv_min(y0 + pl->pl_band_rows, pl->pl_x->mt_rows);
+    for (y = y0; y < y1; y++) {
+        pl->pl_row(pl, y);
+    }
+}
+
+static void
+fv_polar(fv_polar_t *pl)
+{
+    fv_mat_t        *x = pl->pl_x;
+    fv_mat_t        *y = pl->pl_y;
+    fv_mat_t        *d[2] = {pl->pl_mag, pl->pl_angle};
+    fv_s32          i;
+
+    FV_ASSERT(x->mt_atr == y->mt_atr && x->mt_depth == y->mt_depth &&
+            x->mt_rows == y->mt_rows && x->mt_cols == y->mt_cols);
+    FV_ASSERT(x->mt_depth == FV_16S || x->mt_depth == FV_32F);
+    for (i = 0; i < 2; i++) {
+        FV_ASSERT(d[i] == NULL || (d[i]->mt_rows == x->mt_rows &&
+                    d[i]->mt_cols == x->mt_cols &&
+                    d[i]->mt_nchannel == x->mt_nchannel));
+    }
+    FV_ASSERT(pl->pl_mag == NULL || pl->pl_mag->mt_depth == FV_32F);
+
+    pl->pl_row = x->mt_depth == FV_16S ? fv_polar_row_16s : fv_polar_row_32f;
+    fv_parallel_bands(x->mt_rows, FV_POLAR_BAND_MIN_ROWS, &pl->pl_band_rows,
+            fv_polar_band, pl);
+}
+
+/*
+ * Magnitude (32f) and angle (32f, radians or degrees in [0, 360]) of
+ * the 16s or 32f vectors (x, y); either output may be NULL. The
+ * magnitude is off by 5e-6 relative at most for every finite (x, y)
+ * whose magnitude is a float, the angle by less than 0.01 degrees.
+ */
+void
+fv_cart_to_polar(fv_mat_t *mag, fv_mat_t *angle, fv_mat_t *x, fv_mat_t *y,
+            fv_bool angle_in_degrees)
+{
+    fv_polar_t      pl = {
+        .pl_mag = mag,
+        .pl_angle = angle,
+        .pl_x = x,
+        .pl_y = y,
+        .pl_scale = angle_in_degrees ? 1 : fv_pi/180,
+    };
+
+    FV_ASSERT(angle == NULL || angle->mt_depth == FV_32F);
+    fv_polar(&pl);
+}
+
+/*
+ * As fv_cart_to_polar(), the angle quantized into nbins 8u bins: over
+ * the full circle when oriented, else over 180 degrees, opposite
+ * directions sharing a bin.
+ */
+void
+fv_cart_to_polar_bins(fv_mat_t *mag, fv_mat_t *bins, fv_mat_t *x,
+            fv_mat_t *y, fv_s32 nbins, fv_bool oriented)
+{
+    fv_polar_t      pl = {
+        .pl_mag = mag,
+        .pl_angle = bins,
+        .pl_x = x,
+        .pl_y = y,
+        .pl_range = oriented ? 360 : 180,
+        .pl_nbins = nbins,
+    };
+
+    FV_ASSERT(nbins > 0 && nbins <= 256);
+    FV_ASSERT(bins == NULL || bins->mt_depth == FV_8U);
+    pl.pl_scale = nbins/pl.pl_range;
+    pl.pl_inv_range = 1/pl.pl_range;
+    fv_polar(&pl);
+}
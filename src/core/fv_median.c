@@ -0,0 +1,490 @@
+#include <string.h>
+
+#include "fv_types.h"
+#include "fv_smooth.h"
+#include "fv_core.h"
+#include "fv_debug.h"
+#include "fv_mem.h"
+#include "fv_math.h"
+#include "fv_thread.h"
+
+#define FV_MEDIAN_LANES                 64
+#define FV_MEDIAN_BAND_MIN_ROWS         16
+#define FV_MEDIAN_MAX_KSIZE             255     /* counts fit in 16 bits */
+#define FV_MEDIAN_HIST_SIZE             256
+#define FV_MEDIAN_COARSE_SIZE           16
+
+/*
+ * Median selection networks: compare-exchange (a, b) leaves the smaller
+ * value in a, after all of them the median is in the middle element.
+ */
+static const fv_u8 fv_median_net_3x3[][2] = {
+    {1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2}, {4, 5},
+    {7, 8}, {0, 3}, {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5}, {4, 7},
+    {4, 2}, {6, 4}, {4, 2},
+};
+
+static const fv_u8 fv_median_net_5x5[][2] = {
+    {1, 2}, {0, 1}, {1, 2}, {4, 5}, {3, 4}, {4, 5}, {0, 3}, {2, 5},
+    {2, 3}, {1, 4}, {1, 2}, {3, 4}, {7, 8}, {6, 7}, {7, 8}, {10, 11},
+    {9, 10}, {10, 11}, {6, 9}, {8, 11}, {8, 9}, {7, 10}, {7, 8}, {9, 10},
+    {0, 6}, {4, 10}, {4, 6}, {2, 8}, {2, 4}, {6, 8}, {1, 7}, {5, 11},
+    {5, 7}, {3, 9}, {3, 5}, {7, 9}, {1, 2}, {3, 4}, {5, 6}, {7, 8},
+    {9, 10}, {13, 14}, {12, 13}, {13, 14}, {16, 17}, {15, 16}, {16, 17},
+    {12, 15}, {14, 17}, {14, 15}, {13, 16}, {13, 14}, {15, 16}, {19, 20},
+    {18, 19}, {19, 20}, {21, 22}, {23, 24}, {21, 23}, {22, 24}, {22, 23},
+    {18, 21}, {20, 23}, {20, 21}, {19, 22}, {22, 24}, {19, 20}, {21, 22},
+    {23, 24}, {12, 18}, {16, 22}, {16, 18}, {14, 20}, {20, 24}, {14, 16},
+    {18, 20}, {22, 24}, {13, 19}, {17, 23}, {17, 19}, {15, 21}, {15, 17},
+    {19, 21}, {13, 14}, {15, 16}, {17, 18}, {19, 20}, {21, 22}, {23, 24},
+    {0, 12}, {8, 20}, {8, 12}, {4, 16}, {16, 24}, {12, 16}, {2, 14},
+    {10, 22}, {10, 14}, {6, 18}, {6, 10}, {10, 12}, {1, 13}, {9, 21},
+    {9, 13}, {5, 17}, {13, 17}, {3, 15}, {11, 23}, {11, 15}, {7, 19},
+    {7, 11}, {11, 13}, {11, 12},
+};
+
+#define fv_median_net_size(net) (sizeof(net)/sizeof(net[0]))
+
+typedef void (*fv_median_net_func)(void *, void **, fv_s32, fv_s32,
+            fv_s32, const fv_u8 (*)[2], fv_s32);
+
+/*
+ * Compare-exchange of two lane vectors; a and b are distinct rows of
+ * the lane block, which lets the compiler keep the whole loop in
+ * vector min/max.
+ */
+#define fv_median_sort_lanes(type, a, b) \
+    do { \
+        type        t; \
+        fv_s32      l; \
+        for (l = 0; l < FV_MEDIAN_LANES; l++) { \
+            t = fv_min(a[l], b[l]); \
+            b[l] = fv_max(a[l], b[l]); \
+            a[l] = t; \
+        } \
+    } while(0)
+
+static inline void
+fv_median_sort_8u(fv_u8 *restrict a, fv_u8 *restrict b)
+{
+    fv_median_sort_lanes(fv_u8, a, b);
+}
+
+static inline void
+fv_median_sort_16u(fv_u16 *restrict a, fv_u16 *restrict b)
+{
+    fv_median_sort_lanes(fv_u16, a, b);
+}
+
+static inline void
+fv_median_sort_16s(fv_s16 *restrict a, fv_s16 *restrict b)
+{
+    fv_median_sort_lanes(fv_s16, a, b);
+}
+
+static inline void
+fv_median_sort_32f(float *restrict a, float *restrict b)
+{
+    fv_median_sort_lanes(float, a, b);
+}
+
+/*
+ * One row of n values: rows[i] is the bordered source row i of the
+ * aperture, starting ksize/2 pixels left of the first one, readable
+ * FV_MEDIAN_LANES values past its end. The network runs on
+ * FV_MEDIAN_LANES values at a time, every compare-exchange on a whole
+ * lane vector.
+ */
+#define fv_median_net_core(type, sort, dst, rows, n, cn, ksize, net, nops) \
+    do { \
+        type        v[25][FV_MEDIAN_LANES]; \
+        type        *row; \
+        fv_s32      x; \
+        fv_s32      i; \
+        fv_s32      j; \
+        fv_s32      k; \
+        for (x = 0; x < n; x += FV_MEDIAN_LANES) { \
+            for (i = 0, k = 0; i < ksize; i++) { \
+                row = (type *)rows[i] + x; \
+                for (j = 0; j < ksize; j++, k++) { \
+                    memcpy(v[k], row + j*cn, sizeof(v[k])); \
+                } \
+            } \
+            for (k = 0; k < nops; k++) { \
+                sort(v[net[k][0]], v[net[k][1]]); \
+            } \
+            memcpy(dst + x, v[ksize*ksize >> 1], \
+                    fv_min(FV_MEDIAN_LANES, n - x)*sizeof(type)); \
+        } \
+    } while(0)
+
+static void
+fv_median_net_8u(fv_u8 *dst, void **rows, fv_s32 n, fv_s32 cn,
+            fv_s32 ksize, const fv_u8 (*net)[2], fv_s32 nops)
+{
+    fv_median_net_core(fv_u8, fv_median_sort_8u, dst, rows, n, cn, ksize,
+            net, nops);
+}
+
+static void
+fv_median_net_16u(fv_u16 *dst, void **rows, fv_s32 n, fv_s32 cn,
+            fv_s32 ksize, const fv_u8 (*net)[2], fv_s32 nops)
+{
+    fv_median_net_core(fv_u16, fv_median_sort_16u, dst, rows, n, cn, ksize,
+            net, nops);
+}
+
+static void
+fv_median_net_16s(fv_s16 *dst, void **rows, fv_s32 n, fv_s32 cn,
+            fv_s32 ksize, const fv_u8 (*net)[2], fv_s32 nops)
+{
+    fv_median_net_core(fv_s16, fv_median_sort_16s, dst, rows, n, cn, ksize,
+            net, nops);
+}
+
+static void
+fv_median_net_32f(float *dst, void **rows, fv_s32 n, fv_s32 cn,
+            fv_s32 ksize, const fv_u8 (*net)[2], fv_s32 nops)
+{
+    fv_median_net_core(float, fv_median_sort_32f, dst, rows, n, cn, ksize,
+            net, nops);
+}
+
+static fv_median_net_func fv_median_net_tab[FV_DEPTH_NUM] = {
+    [FV_8U] = (fv_median_net_func)fv_median_net_8u,
+    [FV_16U] = (fv_median_net_func)fv_median_net_16u,
+    [FV_16S] = (fv_median_net_func)fv_median_net_16s,
+    [FV_32F] = (fv_median_net_func)fv_median_net_32f,
+};
+
+static fv_median_net_func
+fv_get_median_net_tab(fv_u32 depth)
+{
+    FV_ASSERT(depth < FV_DEPTH_NUM);
+
+    return fv_median_net_tab[depth];
+}
+
+typedef struct _fv_median_proceed_t {
+    fv_mat_t            *mp_dst;
+    fv_mat_t            *mp_src;
+    fv_s32              *mp_xmap;
+    fv_size_t           mp_whole;
+    fv_point_t          mp_ofs;
+    fv_s32              mp_ksize;
+    fv_s32              mp_band_rows;
+    fv_median_net_func  mp_net;
+    const fv_u8         (*mp_ops)[2];
+    fv_s32              mp_nops;
+} fv_median_proceed_t;
+
+/*
+ * Source row y: rows past a view come from the matrix around it, past
+ * that the border replicates.
+ */
+static fv_u8 *
+fv_median_src_row(fv_median_proceed_t *mp, fv_s32 y)
+{
+    fv_s32      oy = mp->mp_ofs.pt_y;
+
+    y = fv_min(fv_max(y + oy, 0), mp->mp_whole.sz_height - 1) - oy;
+
+    return mp->mp_src->mt_data.dt_ptr + y*mp->mp_src->mt_step;
+}
+
+/*
+ * Row y bordered by ksize/2 pixels each side into buf; the columns
+ * the matrix has there are copied in one go.
+ */
+static void
+fv_median_bordered_row(fv_median_proceed_t *mp, fv_u8 *buf, fv_s32 y)
+{
+    fv_mat_t    *src = mp->mp_src;
+    fv_u8       *row = fv_median_src_row(mp, y);
+    fv_s32      r = mp->mp_ksize >> 1;
+    fv_s32      pix = FV_ELEM_SIZE(src->mt_atr);
+    fv_s32      x0;
+    fv_s32      x1;
+    fv_s32      i;
+
+    x0 = fv_max(-r, -mp->mp_ofs.pt_x);
+    x1 = fv_min(src->mt_cols + r, mp->mp_whole.sz_width - mp->mp_ofs.pt_x);
+    memcpy(buf + (x0 + r)*pix, row + x0*pix, (x1 - x0)*pix);
+    for (i = -r; i < x0; i++) {
+        memcpy(buf + (i + r)*pix, row + mp->mp_xmap[i + r]*pix, pix);
+    }
+    for (i = x1; i < src->mt_cols + r; i++) {
+        memcpy(buf + (i + r)*pix, row + mp->mp_xmap[i + r]*pix, pix);
+    }
+}
+
+/*
+ * 3x3 and 5x5 apertures: a ring of ksize bordered rows, one new row a
+ * line.
+ */
+static void
+fv_median_net_band(void *arg, fv_s32 index)
+{
+    fv_median_proceed_t *mp = arg;
+    fv_mat_t            *dst = mp->mp_dst;
+    fv_mat_t            *src = mp->mp_src;
+    fv_u8               *ring;
+    void                *rows[5];
+    fv_s32              ksize = mp->mp_ksize;
+    fv_s32              r = ksize >> 1;
+    fv_s32              row_len;
+    fv_s32              y0 = index*mp->mp_band_rows;
+    fv_s32              y1;
+    fv_s32              y;
+    fv_s32              i;
+
+    y1 = fv_min(y0 + mp->mp_band_rows, dst->mt_rows);
+    row_len = fv_align((src->mt_cols + ksize - 1)*FV_ELEM_SIZE(src->mt_atr) +
+            FV_MEDIAN_LANES*FV_MAT_ELEM_SIZE(src), 16);
+    ring = fv_calloc(row_len*ksize);
+    FV_ASSERT(ring != NULL);
+    for (y = y0 - r; y < y0 + r; y++) {
+        fv_median_bordered_row(mp, ring + (y - y0 + ksize)%ksize*row_len, y);
+    }
+
+    for (y = y0; y < y1; y++) {
+        fv_median_bordered_row(mp, ring + (y + r - y0 + ksize)%ksize*row_len,
+                y + r);
+        for (i = 0; i < ksize; i++) {
+            rows[i] = ring + (y - r + i - y0 + ksize)%ksize*row_len;
+        }
+        mp->mp_net(dst->mt_data.dt_ptr + y*dst->mt_step, rows,
+                dst->mt_cols*dst->mt_nchannel, src->mt_nchannel, ksize,
+                mp->mp_ops, mp->mp_nops);
+    }
+    fv_free(&ring);
+}
+
+/*
+ * Larger 8u apertures, Perreault and Hebert: each padded column keeps
+ * the histogram of its ksize pixels, updated by one pixel in and one
+ * out going down a row, and the aperture histogram by one column in
+ * and one out going right. The histograms are split into 16 coarse
+ * bins of 16 fine ones. The coarse aperture histogram is kept up to
+ * date and finds the bin of the median, only that fine histogram is
+ * then brought up to date (rebuilt when it has fallen more than an
+ * aperture behind), so the cost per pixel does not grow with ksize.
+ */
+static void
+fv_median_hist_band(void *arg, fv_s32 index)
+{
+    fv_median_proceed_t *mp = arg;
+    fv_mat_t            *dst = mp->mp_dst;
+    fv_mat_t            *src = mp->mp_src;
+    fv_u16              *hf;
+    fv_u16              *hc;
+    fv_u16              *h;
+    fv_u16              *h_in;
+    fv_u16              *h_out;
+    fv_u16              kc[FV_MEDIAN_COARSE_SIZE];
+    fv_u16              kf[FV_MEDIAN_HIST_SIZE];
+    fv_s32              luc[FV_MEDIAN_COARSE_SIZE];
+    fv_u8               *d;
+    fv_u8               *row_in;
+    fv_u8               *row_out;
+    fv_s32              *xmap = mp->mp_xmap;
+    fv_s32              ksize = mp->mp_ksize;
+    fv_s32              r = ksize >> 1;
+    fv_s32              cn = src->mt_nchannel;
+    fv_s32              ncols = src->mt_cols + ksize - 1;
+    fv_s32              t = ksize*ksize >> 1;
+    fv_s32              y0 = index*mp->mp_band_rows;
+    fv_s32              y1;
+    fv_s32              sum;
+    fv_s32              c;
+    fv_s32              b;
+    fv_s32              f;
+    fv_s32              p;
+    fv_s32              q;
+    fv_s32              x;
+    fv_s32              y;
+    fv_u8               v;
+
+    y1 = fv_min(y0 + mp->mp_band_rows, dst->mt_rows);
+    hf = fv_alloc(ncols*FV_MEDIAN_HIST_SIZE*sizeof(*hf));
+    FV_ASSERT(hf != NULL);
+    hc = fv_alloc(ncols*FV_MEDIAN_COARSE_SIZE*sizeof(*hc));
+    FV_ASSERT(hc != NULL);
+
+    for (c = 0; c < cn; c++) {
+        memset(hf, 0, ncols*FV_MEDIAN_HIST_SIZE*sizeof(*hf));
+        memset(hc, 0, ncols*FV_MEDIAN_COARSE_SIZE*sizeof(*hc));
+        for (y = y0 - r; y <= y0 + r; y++) {
+            row_in = fv_median_src_row(mp, y) + c;
+            for (p = 0; p < ncols; p++) {
+                v = row_in[xmap[p]*cn];
+                hf[p*FV_MEDIAN_HIST_SIZE + v]++;
+                hc[p*FV_MEDIAN_COARSE_SIZE + (v >> 4)]++;
+            }
+        }
+
+        for (y = y0; y < y1; y++) {
+            if (y > y0) {
+                row_in = fv_median_src_row(mp, y + r) + c;
+                row_out = fv_median_src_row(mp, y - r - 1) + c;
+                for (p = 0; p < ncols; p++) {
+                    v = row_out[xmap[p]*cn];
+                    hf[p*FV_MEDIAN_HIST_SIZE + v]--;
+                    hc[p*FV_MEDIAN_COARSE_SIZE + (v >> 4)]--;
+                    v = row_in[xmap[p]*cn];
+                    hf[p*FV_MEDIAN_HIST_SIZE + v]++;
+                    hc[p*FV_MEDIAN_COARSE_SIZE + (v >> 4)]++;
+                }
+            }
+
+            memset(kc, 0, sizeof(kc));
+            for (p = 0; p < ksize; p++) {
+                h = hc + p*FV_MEDIAN_COARSE_SIZE;
+                for (b = 0; b < FV_MEDIAN_COARSE_SIZE; b++) {
+                    kc[b] += h[b];
+                }
+            }
+            for (b = 0; b < FV_MEDIAN_COARSE_SIZE; b++) {
+                luc[b] = -ksize;
+            }
+
+            d = dst->mt_data.dt_ptr + y*dst->mt_step + c;
+            for (x = 0; x < dst->mt_cols; x++) {
+                /* the aperture of x covers padded columns x .. x + ksize - 1 */
+                if (x > 0) {
+                    h_in = hc + (x + ksize - 1)*FV_MEDIAN_COARSE_SIZE;
+                    h_out = hc + (x - 1)*FV_MEDIAN_COARSE_SIZE;
+                    for (b = 0; b < FV_MEDIAN_COARSE_SIZE; b++) {
+                        kc[b] += h_in[b] - h_out[b];
+                    }
+                }
+
+                for (b = 0, sum = 0; sum + kc[b] <= t; b++) {
+                    sum += kc[b];
+                }
+
+                h = kf + b*FV_MEDIAN_COARSE_SIZE;
+                if (x - luc[b] >= ksize) {
+                    memset(h, 0, FV_MEDIAN_COARSE_SIZE*sizeof(*h));
+                    for (p = x; p < x + ksize; p++) {
+                        h_in = hf + p*FV_MEDIAN_HIST_SIZE +
+                            b*FV_MEDIAN_COARSE_SIZE;
+                        for (f = 0; f < FV_MEDIAN_COARSE_SIZE; f++) {
+                            h[f] += h_in[f];
+                        }
+                    }
+                } else {
+                    for (q = luc[b] + 1; q <= x; q++) {
+                        h_in = hf + (q + ksize - 1)*FV_MEDIAN_HIST_SIZE +
+                            b*FV_MEDIAN_COARSE_SIZE;
+                        h_out = hf + (q - 1)*FV_MEDIAN_HIST_SIZE +
+                            b*FV_MEDIAN_COARSE_SIZE;
+                        for (f = 0; f < FV_MEDIAN_COARSE_SIZE; f++) {
+                            h[f] += h_in[f] - h_out[f];
+                        }
+                    }
+                }
+                luc[b] = x;
+
+                for (f = 0; sum + h[f] <= t; f++) {
+                    sum += h[f];
+                }
+                d[x*cn] = b*FV_MEDIAN_COARSE_SIZE + f;
+            }
+        }
+    }
+
+    fv_free(&hc);
+    fv_free(&hf);
+}
+
+/*
+ * Median of the ksize x ksize aperture with a replicated border (the
+ * pixels around a view are used where there are some). 3x3 and 5x5
+ * take the selection networks and work on 8u, 16u, 16s and 32f,
+ * larger odd apertures up to 255 are for 8u and take the constant
+ * time histograms.
+ */
+void
+fv_median_blur(fv_mat_t *dst, fv_mat_t *src, fv_s32 ksize)
+{
+    fv_median_proceed_t mp = {};
+    fv_mat_t            *src_copy = NULL;
+    fv_mat_t            around;
+    fv_mat_t            view;
+    fv_s32              r = ksize >> 1;
+    fv_s32              x0;
+    fv_s32              y0;
+    fv_s32              x1;
+    fv_s32              y1;
+    fv_s32              i;
+    fv_thread_job_func  band;
+
+    FV_ASSERT(dst->mt_atr == src->mt_atr && dst->mt_rows == src->mt_rows &&
+            dst->mt_cols == src->mt_cols);
+    FV_ASSERT((ksize & 0x1) && ksize <= FV_MEDIAN_MAX_KSIZE);
+
+    if (ksize == 1) {
+        if (dst->mt_data.dt_ptr != src->mt_data.dt_ptr) {
+            fv_copy_mat(dst, src);
+        }
+        return;
+    }
+
+    if (ksize <= 5) {
+        mp.mp_net = fv_get_median_net_tab(src->mt_depth);
+        FV_ASSERT(mp.mp_net != NULL);
+        if (ksize == 3) {
+            mp.mp_ops = fv_median_net_3x3;
+            mp.mp_nops = fv_median_net_size(fv_median_net_3x3);
+        } else {
+            mp.mp_ops = fv_median_net_5x5;
+            mp.mp_nops = fv_median_net_size(fv_median_net_5x5);
+        }
+        band = fv_median_net_band;
+    } else {
+        FV_ASSERT(src->mt_depth == FV_8U);
+        band = fv_median_hist_band;
+    }
+
+    fv_mat_locate_roi(src, &mp.mp_whole, &mp.mp_ofs);
+    if (dst->mt_data.dt_ptr == src->mt_data.dt_ptr) {
+        /* in place, work from a copy of src and the pixels around it */
+        x0 = fv_max(mp.mp_ofs.pt_x - r, 0);
+        y0 = fv_max(mp.mp_ofs.pt_y - r, 0);
+        x1 = fv_min(mp.mp_ofs.pt_x + src->mt_cols + r,
+                mp.mp_whole.sz_width);
+        y1 = fv_min(mp.mp_ofs.pt_y + src->mt_rows + r,
+                mp.mp_whole.sz_height);
+        around = *src;
+        around.mt_data.dt_ptr -= (mp.mp_ofs.pt_y - y0)*src->mt_step +
+            (mp.mp_ofs.pt_x - x0)*FV_ELEM_SIZE(src->mt_atr);
+        around.mt_rows = y1 - y0;
+        around.mt_cols = x1 - x0;
+        src_copy = fv_create_mat(around.mt_rows, around.mt_cols,
+                src->mt_atr);
+        FV_ASSERT(src_copy != NULL);
+        src_copy->mt_depth = src->mt_depth;
+        fv_copy_mat(src_copy, &around);
+        fv_mat_get_roi_view(&view, src_copy, fv_rect(mp.mp_ofs.pt_x - x0,
+                    mp.mp_ofs.pt_y - y0, src->mt_cols, src->mt_rows));
+        src = &view;
+        fv_mat_locate_roi(src, &mp.mp_whole, &mp.mp_ofs);
+    }
+
+    mp.mp_dst = dst;
+    mp.mp_src = src;
+    mp.mp_ksize = ksize;
+    mp.mp_xmap = fv_alloc((src->mt_cols + ksize - 1)*sizeof(*mp.mp_xmap));
+    FV_ASSERT(mp.mp_xmap != NULL);
+    for (i = -r; i < src->mt_cols + r; i++) {
+        mp.mp_xmap[i + r] = fv_min(fv_max(i + mp.mp_ofs.pt_x, 0),
+                mp.mp_whole.sz_width - 1) - mp.mp_ofs.pt_x;
+    }
+
+    fv_parallel_bands(src->mt_rows, fv_max(FV_MEDIAN_BAND_MIN_ROWS, ksize*2),
+            &mp.mp_band_rows, band, &mp);
+
+    fv_free(&mp.mp_xmap);
+    fv_release_mat(&src_copy);
+}
@@ -1,31 +1,25 @@
 
+#include <string.h>
+
 #include "fv_types.h"
 #include "fv_core.h"
 #include "fv_debug.h"
 #include "fv_imgproc.h"
 #include "fv_morph.h"
 #include "fv_filter.h"
+#include "fv_border.h"
 #include "fv_stat.h"
 #include "fv_math.h"
 #include "fv_time.h"
 #include "fv_mem.h"
+#include "fv_thread.h"
 
-static double
-fv_morph_op_erode(double v1, double v2)
-{
-    return fv_min(v1, v2);
-}
-
-static double
-fv_morph_op_dilate(double v1, double v2)
-{
-    return fv_max(v1, v2);
-}
-
-static fv_morph_op_func fv_morph_op_proc[FV_MOP_MAX] = {
-    fv_morph_op_erode,
-    fv_morph_op_dilate,
-};
+/*
+ * Full rectangular kernels at least this high run the van
+ * Herk/Gil-Werman column pass, whose cost does not grow with the
+ * kernel, instead of taking the op of every tap
+ */
+#define FV_MORPH_VHGW_MIN_KSIZE     11
 
 static fv_mat_t *
 fv_convert_conv_kernel(fv_conv_kernel_t *kernel, fv_point_t *anchor)
@@ -166,282 +160,244 @@ fv_release_structuring_element(fv_conv_kernel_t **element)
     fv_free(element);
 }
 
-#define fv_morph_row_filter_core(dst, src, width, filter) \
+/*
+ * Filters are generated for erode (min) and dilate (max) and every
+ * depth, samples stay in their own type. Rows are combined
+ * FV_MORPH_BLOCK elements at a time, so that the loops vectorize
+ * (pminub/pmaxub for 8u).
+ */
+#define FV_MORPH_BLOCK              16
+
+#define fv_morph_min(a, b)          ((b) < (a) ? (b) : (a))
+#define fv_morph_max(a, b)          ((b) > (a) ? (b) : (a))
+
+/* d = op(a, b) and d = op(d, s) over n elements */
+#define fv_morph_row_op_func(op, name, type) \
+    static inline void \
+    fv_morph_##op##_block_##name(type *restrict d, const type *restrict a, \
+                const type *restrict b) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i < FV_MORPH_BLOCK; i++) { \
+            d[i] = fv_morph_##op(a[i], b[i]); \
+        } \
+    } \
+    \
+    static inline void \
+    fv_morph_##op##_update_block_##name(type *restrict d, \
+                const type *restrict s) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i < FV_MORPH_BLOCK; i++) { \
+            d[i] = fv_morph_##op(d[i], s[i]); \
+        } \
+    } \
+    \
+    static inline void \
+    fv_morph_##op##_##name(type *d, const type *a, const type *b, fv_s32 n) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i <= n - FV_MORPH_BLOCK; i += FV_MORPH_BLOCK) { \
+            fv_morph_##op##_block_##name(d + i, a + i, b + i); \
+        } \
+        for (; i < n; i++) { \
+            d[i] = fv_morph_##op(a[i], b[i]); \
+        } \
+    } \
+    \
+    static inline void \
+    fv_morph_##op##_update_##name(type *d, const type *s, fv_s32 n) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i <= n - FV_MORPH_BLOCK; i += FV_MORPH_BLOCK) { \
+            fv_morph_##op##_update_block_##name(d + i, s + i); \
+        } \
+        for (; i < n; i++) { \
+            d[i] = fv_morph_##op(d[i], s[i]); \
+        } \
+    }
+
+/* Every tap is one pass over the width*cn elements of the row */
+#define fv_morph_row_filter_core(dst, src, width, filter, op, name) \
+    do { \
+        fv_morphology_row_filter_t  *row_filter = \
+            (fv_morphology_row_filter_t *)filter; \
+        fv_s32                      cn = row_filter->mr_nchannels; \
+        fv_s32                      ksize = filter->br_ksize; \
+        fv_s32                      k; \
+                                    \
+        width *= cn; \
+        if (ksize == 1) { \
+            memcpy(dst, src, width*sizeof(*dst)); \
+            break; \
+        } \
+        \
+        fv_morph_##op##_##name(dst, src, src + cn, width); \
+        for (k = 2; k < ksize; k++) { \
+            fv_morph_##op##_update_##name(dst, src + k*cn, width); \
+        } \
+    } while(0)
+
+/*
+ * van Herk/Gil-Werman: the bordered row is cut into blocks of ksize
+ * pixels, and the window starting at i is the op of the suffix of its
+ * block from i and the prefix of the next block up to i + ksize - 1.
+ * The prefixes are written to dst at the windows they end, the
+ * suffixes are folded into them on the way back, about 3 ops per pixel
+ * whatever ksize is.
+ */
+#define fv_morph_vhgw_row_filter_core(dst, src, width, filter, op) \
     do { \
         fv_morphology_row_filter_t  *row_filter = \
         (fv_morphology_row_filter_t *)filter; \
-        fv_morph_op_func            op = row_filter->mr_op; \
         typeof(src)                 s; \
+        typeof(dst)                 d; \
         typeof(*src)                m; \
         fv_s32                      i; \
         fv_s32                      j; \
+        fv_s32                      e; \
         fv_s32                      k; \
         fv_s32                      cn = row_filter->mr_nchannels; \
-        fv_s32                      ksize = filter->br_ksize*cn; \
+        fv_s32                      ksize = filter->br_ksize; \
+        fv_s32                      len = width + ksize - 1; \
                                     \
-        if (ksize == cn) { \
-            for (i = 0; i < width*cn; i++) {\
-                dst[i] = src[i]; \
+        for (k = 0; k < cn; k++) { \
+            s = src + k; \
+            d = dst + k; \
+            m = s[0]; \
+            for (i = 1; i < ksize; i++) { \
+                m = fv_morph_##op(m, s[i*cn]); \
             } \
-            return; \
-        } \
-        \
-        width *= cn; \
-        \
-        for (k = 0; k < cn; k++, src++, dst++) { \
-            for (i = 0; i <= width - cn*2; i += cn*2) { \
-                s = src + i; \
-                m = s[cn]; \
-                for (j = cn*2; j < ksize; j += cn) { \
-                    m = op(m, s[j]); \
+            d[0] = m; \
+            for (j = ksize; j < len; j = e) { \
+                e = fv_min(j + ksize, len); \
+                m = s[j*cn]; \
+                d[(j - ksize + 1)*cn] = m; \
+                for (i = j + 1; i < e; i++) { \
+                    m = fv_morph_##op(m, s[i*cn]); \
+                    d[(i - ksize + 1)*cn] = m; \
                 } \
-                dst[i] = op(m, s[0]); \
-                dst[i + cn] = op(m, s[j]); \
             } \
             \
-            for (; i < width; i += cn) {\
-                s = src + i; \
-                m = s[0]; \
-                for (j = cn; j < ksize; j += cn) { \
-                    m = op(m, s[j]); \
-                }\
-                dst[i] = m; \
+            for (j = 0; j < width; j += ksize) { \
+                e = fv_min(j + ksize, len); \
+                m = s[(e - 1)*cn]; \
+                for (i = e - 1; i >= j; i--) { \
+                    m = fv_morph_##op(s[i*cn], m); \
+                    if (i < width) { \
+                        d[i*cn] = fv_morph_##op(m, d[i*cn]); \
+                    } \
+                } \
             } \
         } \
     } while(0)
 
-static void
-fv_morph_row_filter_8u(double *dst, fv_u8 *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_8s(double *dst, fv_s8 *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_16u(double *dst, fv_u16 *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_16s(double *dst, fv_s16 *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_32s(double *dst, fv_s32 *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_32f(double *dst, float *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static void
-fv_morph_row_filter_64f(double *dst, double *src, fv_s32 width, 
-            float *kx_data, fv_base_row_filter_t *filter)
-{
-    fv_morph_row_filter_core(dst, src, width, filter);
-}
-
-static fv_row_filter_func fv_morph_row_filter_tab[] = {
-    (fv_row_filter_func)fv_morph_row_filter_8u,
-    (fv_row_filter_func)fv_morph_row_filter_8s,
-    (fv_row_filter_func)fv_morph_row_filter_16u,
-    (fv_row_filter_func)fv_morph_row_filter_16s,
-    (fv_row_filter_func)fv_morph_row_filter_32s,
-    (fv_row_filter_func)fv_morph_row_filter_32f,
-    (fv_row_filter_func)fv_morph_row_filter_64f,
-};
-
-#define fv_morph_row_filter_tab_size \
-    (sizeof(fv_morph_row_filter_tab)/sizeof(fv_row_filter_func))
-
-static fv_row_filter_func 
-fv_get_morph_row_filter_tab(fv_u32 depth)
-{
-    FV_ASSERT(depth < fv_morph_row_filter_tab_size);
-
-    return fv_morph_row_filter_tab[depth];
-}
-
-
-#define fv_morph_column_filter_core(dst, src, count, width, ky_data, \
-           filter) \
+/*
+ * Two windows share ksize - 1 rows: their op is built in the first
+ * destination row, which then gives both.
+ */
+#define fv_morph_column_filter_core(dst, src, count, width, filter, \
+           op, name) \
     do { \
         fv_morphology_column_filter_t   *col_filter = \
             (fv_morphology_column_filter_t *)filter; \
-        fv_morph_op_func                op = col_filter->mc_op; \
-        typeof(**src)                   s0; \
-        fv_s32                          i; \
-        fv_s32                          j; \
-        fv_s32                          k; \
-        fv_s32                          cn = col_filter->mc_nchannels; \
         fv_s32                          ksize = filter->bc_ksize; \
-        fv_s32                          dststep = width*cn; \
+        fv_s32                          k; \
                                         \
-        width *= cn; \
+        width *= col_filter->mc_nchannels; \
         for (; ksize > 1 && count > 1; \
-                count -= 2, dst += dststep*2, src += 2) { \
-            for (j = 0 ; j < cn; j++) { \
-                for (i = 0 ; i < width; i += cn) { \
-                    s0 = src[1][i + j]; \
-                    for (k = 2; k < ksize; k++) { \
-                        s0 = op(s0, src[k][i + j]); \
-                    } \
-                    \
-                    dst[i + j] = op(s0, src[0][i + j]); \
-                    dst[i + j +dststep] = op(s0, src[k][i + j]); \
-                } \
+                count -= 2, dst += width*2, src += 2) { \
+            if (ksize == 2) { \
+                memcpy(dst, src[1], width*sizeof(*dst)); \
+            } else { \
+                fv_morph_##op##_##name(dst, src[1], src[2], width); \
+            } \
+            for (k = 3; k < ksize; k++) { \
+                fv_morph_##op##_update_##name(dst, src[k], width); \
             } \
+            fv_morph_##op##_##name(dst + width, dst, src[ksize], width); \
+            fv_morph_##op##_update_##name(dst, src[0], width); \
         } \
         \
-        for (; count > 0; count--, dst += dststep, src++) { \
-            for (j = 0 ; j < cn; j++) { \
-                for (i = 0 ; i < width; i += cn) { \
-                    s0 = src[0][i + j]; \
-                    for (k = 1; k < ksize; k++) {\
-                        s0 = op(s0, src[k][i + j]); \
-                    } \
-                    dst[i + j] = s0; \
-                } \
+        for (; count > 0; count--, dst += width, src++) { \
+            if (ksize == 1) { \
+                memcpy(dst, src[0], width*sizeof(*dst)); \
+                continue; \
+            } \
+            fv_morph_##op##_##name(dst, src[0], src[1], width); \
+            for (k = 2; k < ksize; k++) { \
+                fv_morph_##op##_update_##name(dst, src[k], width); \
             } \
         } \
     } while(0)
- 
-static void
-fv_morph_column_filter_8u(fv_u8 *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
 
-static void
-fv_morph_column_filter_8s(fv_s8 *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static void
-fv_morph_column_filter_16u(fv_u16 *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static void
-fv_morph_column_filter_16s(fv_s16 *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static void
-fv_morph_column_filter_32s(fv_s32 *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static void
-fv_morph_column_filter_32f(float *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static void
-fv_morph_column_filter_64f(double *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *ky_data,
-           fv_base_column_filter_t *filter)
-{
-    fv_morph_column_filter_core(dst, src, count, width, ky_data, 
-           filter);
-}
-
-static fv_column_filter_func fv_morph_column_filter_tab[] = {
-    (fv_column_filter_func)fv_morph_column_filter_8u,
-    (fv_column_filter_func)fv_morph_column_filter_8s,
-    (fv_column_filter_func)fv_morph_column_filter_16u,
-    (fv_column_filter_func)fv_morph_column_filter_16s,
-    (fv_column_filter_func)fv_morph_column_filter_32s,
-    (fv_column_filter_func)fv_morph_column_filter_32f,
-    (fv_column_filter_func)fv_morph_column_filter_64f,
-};
-
-#define fv_morph_column_filter_tab_size \
-    (sizeof(fv_morph_column_filter_tab)/sizeof(fv_column_filter_func))
-
-static fv_column_filter_func 
-fv_get_morph_col_filter_tab(fv_u32 depth)
-{
-    FV_ASSERT(depth < fv_morph_column_filter_tab_size);
-
-    return fv_morph_column_filter_tab[depth];
-}
-
-static void
-fv_create_morph_filter(fv_u32 op, fv_morphology_row_filter_t *row_filter, 
-        fv_morphology_column_filter_t *col_filter, fv_mat_t *src,
-        fv_s32 ddepth, fv_s32 sdepth, fv_size_t ksize, 
-        fv_point_t anchor)
-{
-    fv_morph_op_func    func;
-    fv_u32              cn;
-
-    func = fv_morph_op_proc[op];
-    FV_ASSERT(op < FV_MOP_MAX && func != NULL);
-    cn = src->mt_nchannel;
-    row_filter->mr_filter = fv_get_morph_row_filter_tab(sdepth);
-    row_filter->mr_ksize = ksize.sz_width;
-    row_filter->mr_nchannels = cn;
-    row_filter->mr_op = func;
-    col_filter->mc_filter = fv_get_morph_col_filter_tab(ddepth);
-    col_filter->mc_ksize = ksize.sz_height;
-    col_filter->mc_nchannels = cn;
-    col_filter->mc_op = func;
-}
+/*
+ * van Herk/Gil-Werman over the rows of the ring. When a window starts
+ * a block of ksize rows, the suffixes of the block from its rows
+ * 1 .. ksize - 2 are kept in mc_buf (the last one is the top row of
+ * the ring when it is needed). The following windows of the block
+ * take the op of their suffix and the running prefix of the next
+ * block in the first row of mc_buf, which grows by the new bottom
+ * row, so the rows the engine hands in a few at a time cost about 3
+ * ops per pixel.
+ */
+#define fv_morph_vhgw_column_filter_core(dst, src, count, width, filter, \
+           op, name) \
+    do { \
+        fv_morphology_column_filter_t   *col_filter = \
+            (fv_morphology_column_filter_t *)filter; \
+        typeof(*src)                    h; \
+        typeof(*src)                    h1; \
+        typeof(*src)                    g; \
+        fv_u8                           *buf = col_filter->mc_buf; \
+        fv_u32                          buf_step = col_filter->mc_buf_step; \
+        fv_s32                          phase = col_filter->mc_count; \
+        fv_s32                          ksize = filter->bc_ksize; \
+        fv_s32                          t; \
+                                        \
+        width *= col_filter->mc_nchannels; \
+        g = (typeof(g))buf; \
+        for (; count > 0; count--, dst += width, src++) { \
+            if (phase == 0) { \
+                h1 = (typeof(h1))(buf + (ksize - 2)*buf_step); \
+                fv_morph_##op##_##name(h1, src[ksize - 2], src[ksize - 1], \
+                        width); \
+                for (t = ksize - 3; t > 0; t--, h1 = h) { \
+                    h = (typeof(h))(buf + t*buf_step); \
+                    fv_morph_##op##_##name(h, src[t], h1, width); \
+                } \
+                fv_morph_##op##_##name(dst, src[0], h1, width); \
+            } else { \
+                h = phase < ksize - 1 ? \
+                    (typeof(h))(buf + phase*buf_step) : src[0]; \
+                if (phase == 1) { \
+                    memcpy(g, src[ksize - 1], width*sizeof(*g)); \
+                } else { \
+                    fv_morph_##op##_update_##name(g, src[ksize - 1], width); \
+                } \
+                fv_morph_##op##_##name(dst, h, g, width); \
+            } \
+            if (++phase == ksize) { \
+                phase = 0; \
+            } \
+        } \
+        col_filter->mc_count = phase; \
+    } while(0)
 
-#define fv_morph_filter_2D_core(dst, src, count, width, cn, filter) \
+#define fv_morph_filter_2D_core(dst, src, count, width, cn, filter, \
+           op, name) \
     do { \
         fv_morphology_filter_2D_t   *f = \
             (fv_morphology_filter_2D_t *)filter; \
-        fv_morph_op_func                op = f->mf_op; \
-        typeof(src)                     kp; \
-        typeof(**src)                   s0; \
-        fv_point_t                      *pt; \
-        fv_u32                          nz; \
-        fv_u32                          i; \
-        fv_u32                          k; \
-                                        \
+        typeof(src)                 kp; \
+        fv_point_t                  *pt; \
+        fv_u32                      nz; \
+        fv_u32                      k; \
+                                    \
         nz = f->mf_nz; \
         pt = f->mf_coords; \
         kp = f->mf_ptrs; \
@@ -451,91 +407,213 @@ fv_create_morph_filter(fv_u32 op, fv_morphology_row_filter_t *row_filter,
             for (k = 0; k < nz; k++) { \
                 kp[k] = src[pt[k].pt_y] + pt[k].pt_x*cn; \
             } \
-                \
-            for (i = 0; i < width; i++) { \
-                s0 = kp[0][i]; \
-                for( k = 1; k < nz; k++ ) \
-                    s0 = op(s0, kp[k][i]); \
-                dst[i] = s0; \
+            \
+            if (nz == 1) { \
+                memcpy(dst, kp[0], width*sizeof(*dst)); \
+                continue; \
+            } \
+            fv_morph_##op##_##name(dst, kp[0], kp[1], width); \
+            for (k = 2; k < nz; k++) { \
+                fv_morph_##op##_update_##name(dst, kp[k], width); \
             } \
         } \
     } while(0)
- 
-static void
-fv_morph_filter_2D_8u(fv_u8 *dst, fv_u8 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
-{
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
-}
 
-static void
-fv_morph_filter_2D_8s(fv_s8 *dst, fv_s8 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
-{
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
-}
+#define fv_morph_funcs(op, name, type) \
+    fv_morph_row_op_func(op, name, type) \
+    static void \
+    fv_morph_##op##_row_filter_##name(type *dst, type *src, fv_s32 width, \
+                float *kx_data, fv_base_row_filter_t *filter) \
+    { \
+        fv_morph_row_filter_core(dst, src, width, filter, op, name); \
+    } \
+    \
+    static void \
+    fv_morph_##op##_vhgw_row_filter_##name(type *dst, type *src, \
+                fv_s32 width, float *kx_data, fv_base_row_filter_t *filter) \
+    { \
+        fv_morph_vhgw_row_filter_core(dst, src, width, filter, op); \
+    } \
+    \
+    static void \
+    fv_morph_##op##_column_filter_##name(type *dst, type **src, \
+                fv_s32 count, fv_s32 width, float *ky_data, \
+                fv_base_column_filter_t *filter) \
+    { \
+        fv_morph_column_filter_core(dst, src, count, width, filter, \
+                op, name); \
+    } \
+    \
+    static void \
+    fv_morph_##op##_vhgw_column_filter_##name(type *dst, type **src, \
+                fv_s32 count, fv_s32 width, float *ky_data, \
+                fv_base_column_filter_t *filter) \
+    { \
+        fv_morph_vhgw_column_filter_core(dst, src, count, width, filter, \
+                op, name); \
+    } \
+    \
+    static void \
+    fv_morph_##op##_filter_2D_##name(type *dst, type **src, \
+                fv_s32 count, fv_s32 width, float *k_data, \
+                fv_u32 cn, fv_base_filter_t *filter) \
+    { \
+        fv_morph_filter_2D_core(dst, src, count, width, cn, filter, \
+                op, name); \
+    }
 
-static void
-fv_morph_filter_2D_16u(fv_u16 *dst, fv_u16 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_morph_funcs(min, 8u, fv_u8)
+fv_morph_funcs(min, 8s, fv_s8)
+fv_morph_funcs(min, 16u, fv_u16)
+fv_morph_funcs(min, 16s, fv_s16)
+fv_morph_funcs(min, 32s, fv_s32)
+fv_morph_funcs(min, 32f, float)
+fv_morph_funcs(min, 64f, double)
+fv_morph_funcs(max, 8u, fv_u8)
+fv_morph_funcs(max, 8s, fv_s8)
+fv_morph_funcs(max, 16u, fv_u16)
+fv_morph_funcs(max, 16s, fv_s16)
+fv_morph_funcs(max, 32s, fv_s32)
+fv_morph_funcs(max, 32f, float)
+fv_morph_funcs(max, 64f, double)
+
+#define fv_morph_tab(kind, op, func) \
+    { \
+        (func)fv_morph_##op##_##kind##_8u, \
+        (func)fv_morph_##op##_##kind##_8s, \
+        (func)fv_morph_##op##_##kind##_16u, \
+        (func)fv_morph_##op##_##kind##_16s, \
+        (func)fv_morph_##op##_##kind##_32s, \
+        (func)fv_morph_##op##_##kind##_32f, \
+        (func)fv_morph_##op##_##kind##_64f, \
+    }
+
+static fv_row_filter_func fv_morph_row_filter_tab[][FV_DEPTH_NUM] = {
+    [FV_MOP_ERODE] = fv_morph_tab(row_filter, min, fv_row_filter_func),
+    [FV_MOP_DILATE] = fv_morph_tab(row_filter, max, fv_row_filter_func),
+};
+
+static fv_row_filter_func fv_morph_vhgw_row_filter_tab[][FV_DEPTH_NUM] = {
+    [FV_MOP_ERODE] = fv_morph_tab(vhgw_row_filter, min, fv_row_filter_func),
+    [FV_MOP_DILATE] = fv_morph_tab(vhgw_row_filter, max, fv_row_filter_func),
+};
+
+static fv_column_filter_func fv_morph_column_filter_tab[][FV_DEPTH_NUM] = {
+    [FV_MOP_ERODE] = fv_morph_tab(column_filter, min, fv_column_filter_func),
+    [FV_MOP_DILATE] = fv_morph_tab(column_filter, max, fv_column_filter_func),
+};
+
+static fv_column_filter_func 
+fv_morph_vhgw_column_filter_tab[][FV_DEPTH_NUM] = {
+    [FV_MOP_ERODE] = fv_morph_tab(vhgw_column_filter, min, 
+            fv_column_filter_func),
+    [FV_MOP_DILATE] = fv_morph_tab(vhgw_column_filter, max, 
+            fv_column_filter_func),
+};
+
+static fv_filter_2D_func fv_morph_filter_2D_tab[][FV_DEPTH_NUM] = {
+    [FV_MOP_ERODE] = fv_morph_tab(filter_2D, min, fv_filter_2D_func),
+    [FV_MOP_DILATE] = fv_morph_tab(filter_2D, max, fv_filter_2D_func),
+};
+
+#define fv_morph_filter_tab_size \
+    (sizeof(fv_morph_row_filter_tab)/sizeof(fv_morph_row_filter_tab[0]))
+
+/*
+ * The van Herk/Gil-Werman row pass runs along the channels of one row
+ * and does not vectorize, so it only pays off over the direct pass
+ * for kernels about as wide as 4 vectors of the depth
+ */
+static fv_s32 fv_morph_vhgw_row_min_ksize[FV_DEPTH_NUM] = {
+    64, 64, 16, 16, 8, 8, 8,
+};
+
+/* Every row band streams its own blocks of rows */
+static fv_base_column_filter_t *
+fv_morph_vhgw_column_filter_clone(fv_base_column_filter_t *filter)
 {
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
+    fv_morphology_column_filter_t   *f;
+
+    f = fv_alloc(sizeof(*f));
+    FV_ASSERT(f != NULL);
+    *f = *(fv_morphology_column_filter_t *)filter;
+    f->mc_buf = fv_alloc((f->mc_ksize - 1)*f->mc_buf_step);
+    FV_ASSERT(f->mc_buf != NULL);
+    f->mc_count = 0;
+
+    return &f->mc_base;
 }
 
 static void
-fv_morph_filter_2D_16s(fv_s16 *dst, fv_s16 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_morph_vhgw_column_filter_release(fv_base_column_filter_t *filter)
 {
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
+    fv_morphology_column_filter_t   *f = 
+        (fv_morphology_column_filter_t *)filter;
+
+    fv_free(&f->mc_buf);
+    fv_free(&f);
 }
 
 static void
-fv_morph_filter_2D_32s(fv_s32 *dst, fv_s32 **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_morph_vhgw_column_filter_reset(fv_base_column_filter_t *filter)
 {
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
+    ((fv_morphology_column_filter_t *)filter)->mc_count = 0;
 }
 
 static void
-fv_morph_filter_2D_32f(float *dst, float **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+fv_create_morph_filter(fv_u32 op, fv_morphology_row_filter_t *row_filter, 
+        fv_morphology_column_filter_t *col_filter, fv_mat_t *src,
+        fv_s32 ddepth, fv_s32 sdepth, fv_size_t ksize, 
+        fv_point_t anchor)
 {
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
+    fv_u32              cn;
+
+    FV_ASSERT(op < fv_morph_filter_tab_size && 
+            sdepth < FV_DEPTH_NUM && ddepth < FV_DEPTH_NUM);
+    cn = src->mt_nchannel;
+    row_filter->mr_filter = 
+        ksize.sz_width < fv_morph_vhgw_row_min_ksize[sdepth] ?
+        fv_morph_row_filter_tab[op][sdepth] : 
+        fv_morph_vhgw_row_filter_tab[op][sdepth];
+    row_filter->mr_ksize = ksize.sz_width;
+    row_filter->mr_nchannels = cn;
+    col_filter->mc_ksize = ksize.sz_height;
+    col_filter->mc_nchannels = cn;
+    if (ksize.sz_height < FV_MORPH_VHGW_MIN_KSIZE) {
+        col_filter->mc_filter = fv_morph_column_filter_tab[op][ddepth];
+        return;
+    }
+
+    /* The bands' clones allocate the block rows */
+    col_filter->mc_filter = fv_morph_vhgw_column_filter_tab[op][ddepth];
+    col_filter->mc_buf_step = fv_align(src->mt_cols*
+            FV_ELEM_SIZE(src->mt_atr), 16);
+    col_filter->mc_clone = fv_morph_vhgw_column_filter_clone;
+    col_filter->mc_release = fv_morph_vhgw_column_filter_release;
+    col_filter->mc_reset = fv_morph_vhgw_column_filter_reset;
 }
 
-static void
-fv_morph_filter_2D_64f(double *dst, double **src, 
-           fv_s32 count, fv_s32 width, float *k_data,
-           fv_u32 cn, fv_base_filter_t *filter)
+static fv_base_filter_t *
+fv_morph_filter_2D_clone(fv_base_filter_t *filter)
 {
-    fv_morph_filter_2D_core(dst, src, count, width, cn, filter);
-}
+    fv_morphology_filter_2D_t   *f;
 
-static fv_filter_2D_func fv_morph_filter_2D_tab[] = {
-    (fv_filter_2D_func)fv_morph_filter_2D_8u,
-    (fv_filter_2D_func)fv_morph_filter_2D_8s,
-    (fv_filter_2D_func)fv_morph_filter_2D_16u,
-    (fv_filter_2D_func)fv_morph_filter_2D_16s,
-    (fv_filter_2D_func)fv_morph_filter_2D_32s,
-    (fv_filter_2D_func)fv_morph_filter_2D_32f,
-    (fv_filter_2D_func)fv_morph_filter_2D_64f,
-};
+    f = fv_alloc(sizeof(*f));
+    FV_ASSERT(f != NULL);
+    *f = *(fv_morphology_filter_2D_t *)filter;
+    f->mf_ptrs = fv_alloc(f->mf_nz*sizeof(void *));
+    FV_ASSERT(f->mf_ptrs != NULL);
 
-#define fv_morph_filter_2D_tab_size \
-    (sizeof(fv_morph_filter_2D_tab)/sizeof(fv_filter_2D_func))
+    return &f->mf_base;
+}
 
-static fv_filter_2D_func 
-fv_get_morph_filter_2D_tab(fv_u32 depth)
+static void
+fv_morph_filter_2D_release(fv_base_filter_t *filter)
 {
-    FV_ASSERT(depth < fv_morph_filter_2D_tab_size);
+    fv_morphology_filter_2D_t   *f = (fv_morphology_filter_2D_t *)filter;
 
-    return fv_morph_filter_2D_tab[depth];
+    fv_free(&f->mf_ptrs);
+    fv_free(&f);
 }
 
 static void
@@ -543,74 +621,136 @@ fv_create_morph_filter_2D(fv_u32 op, fv_morphology_filter_2D_t *filter,
         fv_mat_t *src, fv_s32 depth, fv_u32 nz, fv_size_t ksize,
         fv_mat_t *kernel, fv_point_t anchor)
 {
-    fv_morph_op_func    func;
     fv_u32              cn;
 
-    func = fv_morph_op_proc[op];
-    FV_ASSERT(op < FV_MOP_MAX && func != NULL);
+    FV_ASSERT(op < fv_morph_filter_tab_size && depth < FV_DEPTH_NUM);
 
     cn = src->mt_nchannel;
-    filter->mf_filter = fv_get_morph_filter_2D_tab(depth);
+    filter->mf_filter = fv_morph_filter_2D_tab[op][depth];
     filter->mf_ksize = ksize;
     filter->mf_anchor = anchor;
     filter->mf_nchannels = cn;
-    filter->mf_op = func;
     fv_preprocess_2D_kernel(kernel, &filter->mf_coords, &filter->mf_coeffs, nz);
     filter->mf_nz = nz;
     filter->mf_ptrs = fv_alloc(nz*sizeof(void *));
     FV_ASSERT(filter->mf_ptrs != NULL);
+    filter->mf_clone = fv_morph_filter_2D_clone;
+    filter->mf_release = fv_morph_filter_2D_release;
 }
 
+typedef struct _fv_morph_filter_engine_t {
+    fv_filter_engine_t              me_engine;
+    fv_morphology_filter_2D_t       me_filter_2D;
+    fv_morphology_row_filter_t      me_row_filter;
+    fv_morphology_column_filter_t   me_col_filter;
+} fv_morph_filter_engine_t;
+
 static void
-fv_release_morph_filter_2D(fv_filter_engine_t *filter)
+fv_release_morph_filter_engine(fv_filter_engine_t *filter)
 {
-    fv_morphology_filter_2D_t   *f = 
-        (fv_morphology_filter_2D_t *)filter->fe_filter_2D;
+    fv_morph_filter_engine_t    *f = (fv_morph_filter_engine_t *)filter;
 
     if (!filter->fe_is_separable) {
-        fv_free(&f->mf_coords);
-        fv_free(&f->mf_coeffs);
-        fv_free(&f->mf_ptrs);
+        fv_free(&f->me_filter_2D.mf_coords);
+        fv_free(&f->me_filter_2D.mf_coeffs);
+        fv_free(&f->me_filter_2D.mf_ptrs);
     }
+    fv_free(&f);
 }
 
-static void 
-fv_morph_op_iterate(fv_s32 op, fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel,
-        fv_point_t anchor, fv_s32 iterations, fv_u32 border_type)
+fv_filter_engine_t *
+fv_create_morph_filter_engine(fv_s32 op, fv_mat_t *dst, fv_mat_t *src, 
+        fv_mat_t *kernel, fv_point_t anchor, fv_u32 border_type)
 {
-    fv_filter_engine_t              filter = {};
-    fv_morphology_filter_2D_t       filter_2D = {};
-    fv_morphology_row_filter_t      row_filter = {};
-    fv_morphology_column_filter_t   col_filter = {};
+    fv_morph_filter_engine_t        *engine;
+    fv_filter_engine_t              *filter;
     fv_size_t                       ksize;
-    fv_u32                          i;
     fv_u32                          nz;
 
-    ksize = kernel != NULL && kernel->mt_data.dt_ptr != NULL? 
-        fv_size(kernel->mt_cols, kernel->mt_rows) : fv_size(3, 3);
+    engine = fv_calloc(sizeof(*engine));
+    FV_ASSERT(engine != NULL);
+    filter = &engine->me_engine;
+
+    ksize = fv_size(kernel->mt_cols, kernel->mt_rows);
+    anchor = fv_normalize_anchor(anchor, ksize);
     nz = _fv_count_non_zero(kernel);
     if (nz == kernel->mt_rows*kernel->mt_cols) {
-        fv_create_morph_filter(op, &row_filter, &col_filter, src, dst->mt_depth, 
+        fv_create_morph_filter(op, &engine->me_row_filter, 
+                &engine->me_col_filter, src, dst->mt_depth, 
                 src->mt_depth, ksize, anchor);
-        filter.fe_row_filter = &row_filter.mr_base;
-        filter.fe_col_filter = &col_filter.mc_base;
-        filter.fe_is_separable = 1;
+        filter->fe_row_filter = &engine->me_row_filter.mr_base;
+        filter->fe_col_filter = &engine->me_col_filter.mc_base;
+        filter->fe_buf_depth = src->mt_depth;
+        filter->fe_is_separable = 1;
     } else {
-        fv_create_morph_filter_2D(op, &filter_2D, src, dst->mt_depth, 
-                nz, ksize, kernel, anchor);
-        filter.fe_filter_2D = &filter_2D.mf_base;
-        filter.fe_is_separable = 0;
+        fv_create_morph_filter_2D(op, &engine->me_filter_2D, src, 
+                dst->mt_depth, nz, ksize, kernel, anchor);
+        filter->fe_filter_2D = &engine->me_filter_2D.mf_base;
+        filter->fe_is_separable = 0;
     }
+    filter->fe_release = fv_release_morph_filter_engine;
+    fv_init_filter_engine(filter, dst, src, ksize, anchor, 0, border_type);
 
-    fv_sep_filter_proceed(dst, src, kernel, kernel, kernel, 
-            anchor, 0, border_type, &filter);
+    return filter;
+}
 
+static void 
+fv_morph_op_iterate(fv_s32 op, fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel,
+        fv_point_t anchor, fv_s32 iterations, fv_u32 border_type)
+{
+    fv_filter_engine_t              *filter;
+    fv_size_t                       whole;
+    fv_point_t                      ofs;
+    fv_u32                          i;
+
+    filter = fv_create_morph_filter_engine(op, dst, src, kernel, 
+            anchor, border_type);
+
+    fv_filter_engine_apply(filter, dst, src);
+
+    /* 
+     * The pixels around a destination view are not filtered, so
+     * later iterations take the view alone with the border
+     */
+    fv_mat_locate_roi(dst, &whole, &ofs);
+    if (iterations > 1 && (whole.sz_width != dst->mt_cols || 
+                whole.sz_height != dst->mt_rows)) {
+        fv_release_filter_engine(&filter);
+        filter = fv_create_morph_filter_engine(op, dst, dst, kernel, 
+                anchor, border_type | FV_BORDER_ISOLATED);
+    }
     for (i = 1; i < iterations; i++) {
-        fv_sep_filter_proceed(dst, dst, kernel, kernel, kernel,
-                anchor, 0, border_type, &filter);
+        fv_filter_engine_apply(filter, dst, dst);
+    }
+
+    fv_release_filter_engine(&filter);
+}
+
+/*
+ * Iterations of a full rect kernel, or of the default 3x3 one, are
+ * one pass of a larger rect; anchor is the normalized one and moves
+ * with it.
+ */
+static fv_mat_t *
+fv_morph_iterate_kernel(fv_mat_t *kernel, fv_point_t *anchor, 
+        fv_s32 iterations)
+{
+    fv_size_t           ksize;
+
+    if (kernel == NULL || kernel->mt_data.dt_ptr == NULL) {
+        *anchor = fv_point(iterations, iterations);
+        return fv_get_structuring_element(FV_SHAPE_RECT, 
+                fv_size(1 + iterations*2, 1 + iterations*2), 
+                fv_point(-1, -1));
     }
 
-    fv_release_morph_filter_2D(&filter);
+    ksize = fv_size(kernel->mt_cols, kernel->mt_rows);
+    *anchor = fv_point(anchor->pt_x*iterations, anchor->pt_y*iterations);
+
+    return fv_get_structuring_element(FV_SHAPE_RECT, 
+            fv_size(ksize.sz_width + (iterations - 1)*(ksize.sz_width - 1),
+                ksize.sz_height + (iterations - 1)*(ksize.sz_height - 1)),
+            *anchor);
 }
 
 static void
@@ -635,18 +775,9 @@ fv_morph_op(fv_u32 op, fv_mat_t *dst, fv_mat_t *src,
         return;
     }
 
-    if (!kernel_set) {
-        _ker = fv_get_structuring_element(FV_SHAPE_RECT, 
-                fv_size(1 + iterations*2, 1 + iterations*2), fv_point(-1, -1));
-        anchor = fv_point(iterations, iterations);
-        iterations = 1;
-    } else if (iterations > 1 && 
-            _fv_count_non_zero(kernel) == kernel->mt_rows*kernel->mt_cols) {
-        anchor = fv_point(anchor.pt_x*iterations, anchor.pt_y*iterations);
-        _ker = fv_get_structuring_element(FV_SHAPE_RECT, 
-                fv_size(ksize.sz_width + (iterations - 1)*(ksize.sz_width - 1),
-                    ksize.sz_height + (iterations - 1)*(ksize.sz_height - 1)),
-                anchor);
+    if (!kernel_set || (iterations > 1 && 
+            _fv_count_non_zero(kernel) == kernel->mt_rows*kernel->mt_cols)) {
+        _ker = fv_morph_iterate_kernel(kernel, &anchor, iterations);
         iterations = 1;
     }
 
@@ -659,6 +790,578 @@ fv_morph_op(fv_u32 op, fv_mat_t *dst, fv_mat_t *src,
     }
 }
 
+/*
+ * Compound operations run row bands through two morphology stages.
+ * Open and close (and top-hat, black-hat) feed the rows of the first
+ * stage to the second one as they come out, so the intermediate image
+ * only exists as the few rows the second stage still reads; gradient
+ * runs both stages over the same source rows. The difference with the
+ * source or between the stages is taken row by row.
+ */
+#define FV_MORPH_EX_BAND_MIN_ROWS   16
+
+typedef void (*fv_morph_sub_func)(void *d, void *a, void *b, fv_s32 n);
+
+/* d = a - b, saturated */
+#define fv_morph_sub_func(name, type, wtype, cast) \
+    static inline void \
+    fv_morph_sub_block_##name(type *restrict d, const type *restrict a, \
+                const type *restrict b) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i < FV_MORPH_BLOCK; i++) { \
+            d[i] = cast((wtype)a[i] - b[i]); \
+        } \
+    } \
+    \
+    static void \
+    fv_morph_sub_##name(type *d, type *a, type *b, fv_s32 n) \
+    { \
+        fv_s32      i; \
+        \
+        for (i = 0; i <= n - FV_MORPH_BLOCK; i += FV_MORPH_BLOCK) { \
+            fv_morph_sub_block_##name(d + i, a + i, b + i); \
+        } \
+        for (; i < n; i++) { \
+            d[i] = cast((wtype)a[i] - b[i]); \
+        } \
+    }
+
+fv_morph_sub_func(8u, fv_u8, fv_s32, fv_saturate_cast_8u)
+fv_morph_sub_func(8s, fv_s8, fv_s32, fv_saturate_cast_8s)
+fv_morph_sub_func(16u, fv_u16, fv_s32, fv_saturate_cast_16u)
+fv_morph_sub_func(16s, fv_s16, fv_s32, fv_saturate_cast_16s)
+fv_morph_sub_func(32s, fv_s32, fv_s64, fv_saturate_cast_32s)
+fv_morph_sub_func(32f, float, float, fv_saturate_no_cast)
+fv_morph_sub_func(64f, double, double, fv_saturate_no_cast)
+
+static fv_morph_sub_func fv_morph_sub_tab[FV_DEPTH_NUM] = {
+    (fv_morph_sub_func)fv_morph_sub_8u,
+    (fv_morph_sub_func)fv_morph_sub_8s,
+    (fv_morph_sub_func)fv_morph_sub_16u,
+    (fv_morph_sub_func)fv_morph_sub_16s,
+    (fv_morph_sub_func)fv_morph_sub_32s,
+    (fv_morph_sub_func)fv_morph_sub_32f,
+    (fv_morph_sub_func)fv_morph_sub_64f,
+};
+
+/*
+ * An erode or dilate of a compound operation. The rows its column
+ * pass reads are kept in ms_nslots slots, row y in slot y % ms_nslots
+ * (row filtered rows, or bordered ones for kernels that are not full
+ * rects), a last slot of zeros stands for rows of a constant border.
+ */
+typedef struct _fv_morph_stage_t {
+    fv_morphology_row_filter_t      ms_row_filter;
+    fv_morphology_column_filter_t   ms_col_filter;
+    fv_morphology_filter_2D_t       ms_filter_2D;
+    fv_bool                         ms_separable;
+    fv_size_t                       ms_ksize;
+    fv_point_t                      ms_anchor;
+    fv_s32                          ms_cols;
+    fv_u32                          ms_cn;
+    fv_u32                          ms_in_len;      /* bordered row */
+    fv_u32                          ms_slot_len;
+    fv_s32                          ms_nslots;
+} fv_morph_stage_t;
+
+/* The slots and the stateful filters of a stage in one row band */
+typedef struct _fv_morph_stage_band_t {
+    fv_morph_stage_t            *mb_stage;
+    fv_base_column_filter_t     *mb_col_filter;
+    fv_base_filter_t            *mb_filter_2D;
+    fv_u8                       *mb_slots;
+    fv_u8                       *mb_in;
+    void                        **mb_rows;
+} fv_morph_stage_band_t;
+
+typedef struct _fv_morph_ex_t {
+    fv_mat_t                    *mx_dst;
+    fv_mat_t                    *mx_src;
+    fv_s32                      mx_op;
+    fv_bool                     mx_chained;
+    fv_morph_stage_t            mx_stage[2];
+    fv_border_map_t             mx_src_border;
+    fv_border_map_t             mx_mid_border;  /* chained stage 2 */
+    fv_morph_sub_func           mx_sub;
+    fv_s32                      mx_band_rows;
+} fv_morph_ex_t;
+
+static void
+fv_morph_stage_init(fv_morph_stage_t *ms, fv_u32 op, fv_mat_t *src, 
+        fv_mat_t *kernel, fv_point_t anchor)
+{
+    fv_u32      nz;
+    fv_u32      pix;
+
+    ms->ms_ksize = fv_size(kernel->mt_cols, kernel->mt_rows);
+    ms->ms_anchor = anchor;
+    ms->ms_cols = src->mt_cols;
+    ms->ms_cn = src->mt_nchannel;
+    ms->ms_nslots = kernel->mt_rows;
+    pix = FV_ELEM_SIZE(src->mt_atr);
+    ms->ms_in_len = (src->mt_cols + kernel->mt_cols - 1)*pix;
+    nz = _fv_count_non_zero(kernel);
+    ms->ms_separable = nz == kernel->mt_rows*kernel->mt_cols;
+    if (ms->ms_separable) {
+        fv_create_morph_filter(op, &ms->ms_row_filter, &ms->ms_col_filter, 
+                src, src->mt_depth, src->mt_depth, ms->ms_ksize, anchor);
+        ms->ms_slot_len = fv_align(src->mt_cols*pix, 16);
+    } else {
+        fv_create_morph_filter_2D(op, &ms->ms_filter_2D, src, 
+                src->mt_depth, nz, ms->ms_ksize, kernel, anchor);
+        ms->ms_slot_len = fv_align(ms->ms_in_len, 16);
+    }
+}
+
+static void
+fv_morph_stage_release(fv_morph_stage_t *ms)
+{
+    if (!ms->ms_separable) {
+        fv_free(&ms->ms_filter_2D.mf_coords);
+        fv_free(&ms->ms_filter_2D.mf_coeffs);
+        fv_free(&ms->ms_filter_2D.mf_ptrs);
+    }
+}
+
+static void
+fv_morph_stage_band_init(fv_morph_stage_band_t *mb, fv_morph_stage_t *ms)
+{
+    fv_base_column_filter_t     *col_filter = &ms->ms_col_filter.mc_base;
+    fv_base_filter_t            *filter_2D = &ms->ms_filter_2D.mf_base;
+
+    mb->mb_stage = ms;
+    mb->mb_slots = fv_calloc((ms->ms_nslots + 1)*ms->ms_slot_len +
+            ms->ms_in_len);
+    FV_ASSERT(mb->mb_slots != NULL);
+    mb->mb_in = mb->mb_slots + (ms->ms_nslots + 1)*ms->ms_slot_len;
+    mb->mb_rows = fv_alloc(ms->ms_nslots*sizeof(*mb->mb_rows));
+    FV_ASSERT(mb->mb_rows != NULL);
+    mb->mb_col_filter = NULL;
+    mb->mb_filter_2D = NULL;
+    if (!ms->ms_separable) {
+        mb->mb_filter_2D = filter_2D->bf_clone(filter_2D);
+    } else if (col_filter->bc_clone != NULL) {
+        mb->mb_col_filter = col_filter->bc_clone(col_filter);
+    } else {
+        mb->mb_col_filter = col_filter;
+    }
+}
+
+static void
+fv_morph_stage_band_release(fv_morph_stage_band_t *mb)
+{
+    fv_morph_stage_t    *ms = mb->mb_stage;
+
+    if (mb->mb_filter_2D != NULL) {
+        mb->mb_filter_2D->bf_release(mb->mb_filter_2D);
+    } else if (mb->mb_col_filter != &ms->ms_col_filter.mc_base) {
+        mb->mb_col_filter->bc_release(mb->mb_col_filter);
+    }
+    fv_free(&mb->mb_rows);
+    fv_free(&mb->mb_slots);
+}
+
+static fv_u8 *
+fv_morph_stage_slot(fv_morph_stage_band_t *mb, fv_s32 y)
+{
+    fv_morph_stage_t    *ms = mb->mb_stage;
+    fv_s32              n = ms->ms_nslots;
+
+    if (y == FV_BORDER_MAP_ZERO) {
+        return mb->mb_slots + n*ms->ms_slot_len;
+    }
+
+    return mb->mb_slots + ((y % n + n) % n)*ms->ms_slot_len;
+}
+
+/* Where bordered row y of the stage input goes before the push */
+static fv_u8 *
+fv_morph_stage_in(fv_morph_stage_band_t *mb, fv_s32 y)
+{
+    return mb->mb_stage->ms_separable ? 
+        mb->mb_in : fv_morph_stage_slot(mb, y);
+}
+
+/* Row y of the stage input, bordered, to the slots */
+static void
+fv_morph_stage_push(fv_morph_stage_band_t *mb, fv_s32 y, fv_u8 *in)
+{
+    fv_morph_stage_t    *ms = mb->mb_stage;
+    fv_u8               *slot = fv_morph_stage_slot(mb, y);
+
+    if (ms->ms_separable) {
+        ms->ms_row_filter.mr_filter(slot, in, ms->ms_cols, NULL, 
+                &ms->ms_row_filter.mr_base);
+    } else if (slot != in) {
+        memcpy(slot, in, ms->ms_in_len);
+    }
+}
+
+/*
+ * The output row whose window starts at input row y, the rows of the
+ * window mapped through border when it is not NULL.
+ */
+static void
+fv_morph_stage_emit(fv_morph_stage_band_t *mb, fv_s32 y, 
+        fv_border_map_t *border, fv_u8 *dst)
+{
+    fv_morph_stage_t    *ms = mb->mb_stage;
+    fv_s32              t;
+
+    for (t = 0; t < ms->ms_nslots; t++) {
+        mb->mb_rows[t] = fv_morph_stage_slot(mb, border == NULL ? y + t :
+                fv_border_map_y(border, y + t));
+    }
+
+    if (ms->ms_separable) {
+        mb->mb_col_filter->bc_filter(dst, mb->mb_rows, 1, ms->ms_cols, 
+                NULL, mb->mb_col_filter);
+    } else {
+        mb->mb_filter_2D->bf_filter(dst, mb->mb_rows, 1, ms->ms_cols, 
+                NULL, ms->ms_cn, mb->mb_filter_2D);
+    }
+}
+
+/* Both stages over the source rows, dst the difference of them */
+static void
+fv_morph_ex_gradient_band(fv_morph_ex_t *mx, fv_morph_stage_band_t *mb,
+        fv_u8 *out, fv_s32 y0, fv_s32 y1)
+{
+    fv_morph_stage_t    *ms = &mx->mx_stage[0];
+    fv_mat_t            *src = mx->mx_src;
+    fv_mat_t            *dst = mx->mx_dst;
+    fv_u8               *in;
+    fv_u32              len = ms->ms_slot_len;
+    fv_s32              ay = ms->ms_anchor.pt_y;
+    fv_s32              kh = ms->ms_ksize.sz_height;
+    fv_s32              y;
+
+    for (y = y0 - ay; y < y1 - ay + kh - 1; y++) {
+        in = fv_morph_stage_in(&mb[0], y);
+        fv_border_map_read(&mx->mx_src_border, src, in, y);
+        fv_morph_stage_push(&mb[0], y, in);
+        fv_morph_stage_push(&mb[1], y, in);
+        if (y < y0 - ay + kh - 1) {
+            continue;
+        }
+
+        fv_morph_stage_emit(&mb[0], y - kh + 1, NULL, out);
+        fv_morph_stage_emit(&mb[1], y - kh + 1, NULL, out + len);
+        mx->mx_sub(dst->mt_data.dt_ptr + (y - kh + 1 + ay)*dst->mt_step,
+                out, out + len, ms->ms_cols*ms->ms_cn);
+    }
+}
+
+/*
+ * The second stage reads the rows of the first one through the border
+ * of the intermediate image: they are made in order, when a window
+ * first reaches them, and stay in its slots while windows read them.
+ */
+static void
+fv_morph_ex_chain_band(fv_morph_ex_t *mx, fv_morph_stage_band_t *mb,
+        fv_u8 *out, fv_s32 y0, fv_s32 y1)
+{
+    fv_morph_stage_t    *ms = &mx->mx_stage[0];
+    fv_morph_stage_t    *ms2 = &mx->mx_stage[1];
+    fv_border_map_t     *mid = &mx->mx_mid_border;
+    fv_mat_t            *src = mx->mx_src;
+    fv_mat_t            *dst = mx->mx_dst;
+    fv_u8               *in;
+    fv_u8               *d;
+    fv_u8               *s;
+    fv_s32              ay = ms->ms_anchor.pt_y;
+    fv_s32              kh = ms->ms_ksize.sz_height;
+    fv_s32              ay2 = ms2->ms_anchor.pt_y;
+    fv_s32              kh2 = ms2->ms_ksize.sz_height;
+    fv_s32              n = ms->ms_cols*ms->ms_cn;
+    fv_s32              pix = mid->bm_pix;
+    fv_s32              next = fv_int_max;
+    fv_s32              sy;
+    fv_s32              m;
+    fv_s32              y;
+    fv_s32              t;
+
+    /* the first intermediate row the band reads */
+    for (y = y0 - ay2; y < y1 - ay2 + kh2 - 1; y++) {
+        m = fv_border_map_y(mid, y);
+        if (m != FV_BORDER_MAP_ZERO) {
+            next = fv_min(next, m);
+        }
+    }
+    sy = next - ay;
+
+    for (y = y0; y < y1; y++) {
+        for (t = y - ay2; t < y - ay2 + kh2; t++) {
+            m = fv_border_map_y(mid, t);
+            if (m == FV_BORDER_MAP_ZERO) {
+                continue;
+            }
+            FV_ASSERT(m > next - 1 - ms2->ms_nslots);
+            for (; next <= m; next++) {
+                for (; sy < next - ay + kh; sy++) {
+                    in = fv_morph_stage_in(&mb[0], sy);
+                    fv_border_map_read(&mx->mx_src_border, src, in, sy);
+                    fv_morph_stage_push(&mb[0], sy, in);
+                }
+                in = fv_morph_stage_in(&mb[1], next);
+                fv_morph_stage_emit(&mb[0], next - ay, NULL, 
+                        in + mid->bm_left*pix);
+                fv_border_map_row(mid, in, in + mid->bm_left*pix);
+                fv_morph_stage_push(&mb[1], next, in);
+            }
+        }
+
+        d = dst->mt_data.dt_ptr + y*dst->mt_step;
+        s = src->mt_data.dt_ptr + y*src->mt_step;
+        switch (mx->mx_op) {
+        case FV_MOP_TOPHAT:
+            fv_morph_stage_emit(&mb[1], y - ay2, mid, out);
+            mx->mx_sub(d, s, out, n);
+            break;
+        case FV_MOP_BLACKHAT:
+            fv_morph_stage_emit(&mb[1], y - ay2, mid, out);
+            mx->mx_sub(d, out, s, n);
+            break;
+        default:
+            fv_morph_stage_emit(&mb[1], y - ay2, mid, d);
+            break;
+        }
+    }
+}
+
+static void
+fv_morph_ex_band(void *arg, fv_s32 index)
+{
+    fv_morph_ex_t           *mx = arg;
+    fv_morph_stage_band_t   mb[2];
+    fv_u8                   *out;
+    fv_s32                  y0 = index*mx->mx_band_rows;
+    fv_s32                  y1;
+
+    y1 = fv_min(y0 + mx->mx_band_rows, mx->mx_src->mt_rows);
+    if (y0 >= y1) {
+        return;
+    }
+
+    fv_morph_stage_band_init(&mb[0], &mx->mx_stage[0]);
+    fv_morph_stage_band_init(&mb[1], &mx->mx_stage[1]);
+    out = fv_alloc(2*mx->mx_stage[0].ms_slot_len);
+    FV_ASSERT(out != NULL);
+    if (mx->mx_chained) {
+        fv_morph_ex_chain_band(mx, mb, out, y0, y1);
+    } else {
+        fv_morph_ex_gradient_band(mx, mb, out, y0, y1);
+    }
+    fv_free(&out);
+    fv_morph_stage_band_release(&mb[1]);
+    fv_morph_stage_band_release(&mb[0]);
+}
+
+/*
+ * A copy of src and of the pixels around it the operation reads, for
+ * filtering in place; view is set to the ROI of src in it, so the
+ * copied pixels stay its neighbours.
+ */
+static fv_mat_t *
+fv_morph_ex_copy_src(fv_mat_t *view, fv_mat_t *src, fv_s32 left, 
+        fv_s32 top, fv_s32 right, fv_s32 bottom, fv_u32 border_type)
+{
+    fv_mat_t        around;
+    fv_mat_t        *copy;
+    fv_size_t       whole;
+    fv_point_t      ofs;
+    fv_s32          x0;
+    fv_s32          y0;
+    fv_s32          x1;
+    fv_s32          y1;
+
+    if (border_type & FV_BORDER_ISOLATED) {
+        whole = fv_size(src->mt_cols, src->mt_rows);
+        ofs = fv_point(0, 0);
+    } else {
+        fv_mat_locate_roi(src, &whole, &ofs);
+    }
+    x0 = fv_max(ofs.pt_x - left, 0);
+    y0 = fv_max(ofs.pt_y - top, 0);
+    x1 = fv_min(ofs.pt_x + src->mt_cols + right, whole.sz_width);
+    y1 = fv_min(ofs.pt_y + src->mt_rows + bottom, whole.sz_height);
+    around = *src;
+    around.mt_data.dt_ptr -= (ofs.pt_y - y0)*src->mt_step + 
+        (ofs.pt_x - x0)*FV_ELEM_SIZE(src->mt_atr);
+    around.mt_rows = y1 - y0;
+    around.mt_cols = x1 - x0;
+    copy = fv_create_mat(around.mt_rows, around.mt_cols, src->mt_atr);
+    FV_ASSERT(copy != NULL);
+    copy->mt_depth = src->mt_depth;
+    fv_copy_mat(copy, &around);
+    fv_mat_get_roi_view(view, copy, fv_rect(ofs.pt_x - x0, ofs.pt_y - y0, 
+                src->mt_cols, src->mt_rows));
+
+    return copy;
+}
+
+static void
+fv_morph_ex(fv_u32 op, fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel,
+        fv_point_t anchor, fv_u32 border_type)
+{
+    fv_morph_ex_t       mx = {};
+    fv_mat_t            view;
+    fv_mat_t            *copy = NULL;
+    fv_u32              op1;
+    fv_u32              op2;
+    fv_s32              ax = anchor.pt_x;
+    fv_s32              ay = anchor.pt_y;
+    fv_s32              bx = kernel->mt_cols - 1 - ax;
+    fv_s32              by = kernel->mt_rows - 1 - ay;
+
+    /* The second stage of a chain only reads rows of the view */
+    if (dst->mt_data.dt_ptr == src->mt_data.dt_ptr) {
+        copy = fv_morph_ex_copy_src(&view, src, ax, ay, bx, by, 
+                border_type);
+        src = &view;
+    }
+
+    op1 = op == FV_MOP_OPEN || op == FV_MOP_TOPHAT ? 
+        FV_MOP_ERODE:FV_MOP_DILATE;
+    op2 = op1 == FV_MOP_ERODE ? FV_MOP_DILATE:FV_MOP_ERODE;
+    mx.mx_chained = op != FV_MOP_GRADIENT;
+    mx.mx_dst = dst;
+    mx.mx_src = src;
+    mx.mx_op = op;
+    mx.mx_sub = fv_morph_sub_tab[src->mt_depth];
+    fv_morph_stage_init(&mx.mx_stage[0], op1, src, kernel, anchor);
+    fv_morph_stage_init(&mx.mx_stage[1], op2, src, kernel, anchor);
+    fv_border_map_init(&mx.mx_src_border, src, ax, bx, border_type);
+    if (mx.mx_chained) {
+        fv_border_map_init(&mx.mx_mid_border, src, ax, bx, 
+                border_type | FV_BORDER_ISOLATED);
+    }
+
+    fv_parallel_bands(src->mt_rows, FV_MORPH_EX_BAND_MIN_ROWS,
+            &mx.mx_band_rows, fv_morph_ex_band, &mx);
+
+    if (mx.mx_chained) {
+        fv_border_map_release(&mx.mx_mid_border);
+    }
+    fv_border_map_release(&mx.mx_src_border);
+    fv_morph_stage_release(&mx.mx_stage[1]);
+    fv_morph_stage_release(&mx.mx_stage[0]);
+    if (copy != NULL) {
+        fv_release_mat(&copy);
+    }
+}
+
+/*
+ * Compound operations the fused pass does not cover (kernels that
+ * are not full rects iterated more than once, wrapping borders whose
+ * windows reach across the image) chain whole images.
+ */
+static void
+fv_morph_ex_images(fv_u32 op, fv_mat_t *dst, fv_mat_t *src, 
+        fv_mat_t *kernel, fv_point_t anchor, fv_s32 iterations, 
+        fv_u32 border_type)
+{
+    fv_morph_sub_func   sub = fv_morph_sub_tab[src->mt_depth];
+    fv_mat_t            *tmp;
+    fv_mat_t            *tmp2;
+    fv_u8               *d;
+    fv_u8               *s;
+    fv_u8               *a;
+    fv_u8               *b;
+    fv_u32              op1;
+    fv_u32              op2;
+    fv_s32              n = src->mt_cols*src->mt_nchannel;
+    fv_s32              y;
+
+    op1 = op == FV_MOP_OPEN || op == FV_MOP_TOPHAT ? 
+        FV_MOP_ERODE:FV_MOP_DILATE;
+    op2 = op1 == FV_MOP_ERODE ? FV_MOP_DILATE:FV_MOP_ERODE;
+    tmp = fv_create_mat(src->mt_rows, src->mt_cols, src->mt_atr);
+    tmp2 = fv_create_mat(src->mt_rows, src->mt_cols, src->mt_atr);
+    FV_ASSERT(tmp != NULL && tmp2 != NULL);
+    tmp->mt_depth = tmp2->mt_depth = src->mt_depth;
+
+    fv_morph_op(op1, tmp, src, kernel, anchor, iterations, border_type);
+    if (op == FV_MOP_OPEN || op == FV_MOP_CLOSE) {
+        fv_morph_op(op2, dst, tmp, kernel, anchor, iterations, 
+                border_type);
+        goto out;
+    }
+    fv_morph_op(op2, tmp2, op == FV_MOP_GRADIENT ? src:tmp, kernel, 
+            anchor, iterations, border_type);
+
+    for (y = 0; y < src->mt_rows; y++) {
+        d = dst->mt_data.dt_ptr + y*dst->mt_step;
+        s = src->mt_data.dt_ptr + y*src->mt_step;
+        a = tmp->mt_data.dt_ptr + y*tmp->mt_step;
+        b = tmp2->mt_data.dt_ptr + y*tmp2->mt_step;
+        switch (op) {
+        case FV_MOP_GRADIENT:
+            sub(d, a, b, n);
+            break;
+        case FV_MOP_TOPHAT:
+            sub(d, s, b, n);
+            break;
+        default:
+            sub(d, b, s, n);
+            break;
+        }
+    }
+
+out:
+    fv_release_mat(&tmp2);
+    fv_release_mat(&tmp);
+}
+
+void 
+_fv_morphology_ex(fv_mat_t *dst, fv_mat_t *src, fv_s32 op, 
+        fv_mat_t *kernel, fv_point_t anchor, fv_s32 iterations, 
+        fv_u32 border_type)
+{
+    fv_mat_t            *_ker = kernel;
+    fv_size_t           ksize;
+    fv_bool             kernel_set;
+    fv_bool             wrap;
+
+    FV_ASSERT(op >= 0 && op < FV_MOP_MAX);
+    FV_ASSERT(dst->mt_rows == src->mt_rows && 
+            dst->mt_cols == src->mt_cols && dst->mt_atr == src->mt_atr &&
+            src->mt_depth < FV_DEPTH_NUM);
+
+    if (op == FV_MOP_ERODE || op == FV_MOP_DILATE) {
+        fv_morph_op(op, dst, src, kernel, anchor, iterations, border_type);
+        return;
+    }
+
+    kernel_set = kernel != NULL && kernel->mt_data.dt_ptr != NULL;
+    wrap = (border_type & ~FV_BORDER_ISOLATED) == FV_BORDER_WRAP;
+    if (wrap || (kernel_set && iterations > 1 && 
+            _fv_count_non_zero(kernel) != kernel->mt_rows*kernel->mt_cols)) {
+        fv_morph_ex_images(op, dst, src, kernel, anchor, iterations, 
+                border_type);
+        return;
+    }
+
+    ksize = kernel_set ? 
+        fv_size(kernel->mt_cols, kernel->mt_rows) : fv_size(3, 3);
+    anchor = fv_normalize_anchor(anchor, ksize);
+    if (iterations == 0) {
+        _ker = fv_get_structuring_element(FV_SHAPE_RECT, fv_size(1, 1), 
+                fv_point(0, 0));
+        anchor = fv_point(0, 0);
+    } else if (!kernel_set || iterations > 1) {
+        _ker = fv_morph_iterate_kernel(kernel, &anchor, iterations);
+    }
+
+    fv_morph_ex(op, dst, src, _ker, anchor, border_type);
+
+    if (_ker != kernel) {
+        fv_release_mat(&_ker);
+    }
+}
+
 void 
 _fv_dilate(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel, fv_point_t anchor,
         fv_s32 iterations, fv_u32 border_type)
@@ -677,20 +1380,7 @@ void
 fv_dilate(fv_image_t *dst, fv_image_t *src, fv_conv_kernel_t *element,
             fv_s32 iterations)
 {
-    fv_point_t  anchor;
-    fv_mat_t    _dst;
-    fv_mat_t    _src;
-    fv_mat_t    *kernel;
-
-    FV_ASSERT(dst->ig_image_size == src->ig_image_size &&
-            dst->ig_depth == src->ig_depth && 
-            dst->ig_channels == src->ig_channels);
-
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
-    kernel = fv_convert_conv_kernel(element, &anchor);
-    _fv_dilate(&_dst, &_src, kernel, anchor, iterations, FV_BORDER_REPLICATE);
-    fv_release_mat(&kernel);
+    fv_morphology_ex(dst, src, element, FV_MOP_DILATE, iterations);
 }
 
 void 
@@ -704,19 +1394,34 @@ _fv_erode(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel, fv_point_t anchor,
 void 
 fv_erode(fv_image_t *dst, fv_image_t *src, fv_conv_kernel_t *element,
             fv_s32 iterations)
+{
+    fv_morphology_ex(dst, src, element, FV_MOP_ERODE, iterations);
+}
+
+void 
+fv_morphology_ex(fv_image_t *dst, fv_image_t *src, fv_conv_kernel_t *element,
+            fv_s32 operation, fv_s32 iterations)
 {
     fv_point_t  anchor;
     fv_mat_t    _dst;
     fv_mat_t    _src;
     fv_mat_t    *kernel;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
+    fv_s32      margin;
 
     FV_ASSERT(dst->ig_image_size == src->ig_image_size &&
             dst->ig_depth == src->ig_depth && 
             dst->ig_channels == src->ig_channels);
 
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
     kernel = fv_convert_conv_kernel(element, &anchor);
-    _fv_erode(&_dst, &_src, kernel, anchor, iterations, FV_BORDER_REPLICATE);
+    margin = kernel == NULL ? 3:fv_max(kernel->mt_rows, kernel->mt_cols);
+    margin *= fv_max(iterations, 1);
+    _src = fv_image_get_roi_view(src, margin, &src_coi);
+    _dst = fv_image_get_roi_view(dst, -1, &dst_coi);
+    _fv_morphology_ex(&_dst, &_src, operation, kernel, anchor, iterations, 
+            FV_BORDER_REPLICATE);
+    fv_image_put_roi_view(dst, &_dst, &dst_coi);
+    fv_release_mat(&src_coi);
     fv_release_mat(&kernel);
 }
@@ -1,4 +1,6 @@
 
+#include <string.h>
+
 #include "fv_types.h"
 #include "fv_smooth.h"
 #include "fv_core.h"
@@ -6,6 +8,17 @@
 #include "fv_filter.h"
 #include "fv_mem.h"
 #include "fv_math.h"
+#include "fv_imgproc.h"
+#include "fv_border.h"
+#include "fv_thread.h"
+
+/*
+ * Gaussians sized from sigma alone use the recursive filter from
+ * this sigma on, where it beats the separable kernels.
+ */
+#define FV_GAUSSIAN_IIR_MIN_SIGMA           3.0
+#define FV_GAUSSIAN_IIR_LANES               64
+#define FV_GAUSSIAN_IIR_BAND_MIN_ROWS       16
 
 #define fv_box_row_filter_core(dst, src, width, kx_data, filter) \
     do { \
@@ -32,73 +45,118 @@
     } while(0) \
 
 static void
-fv_box_row_filter_8u(double *dst, fv_u8 *src, fv_s32 width, 
+fv_box_row_filter_8u_32s(fv_s32 *dst, fv_u8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_8s(double *dst, fv_s8 *src, fv_s32 width, 
+fv_box_row_filter_8s_32s(fv_s32 *dst, fv_s8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_16u(double *dst, fv_u16 *src, fv_s32 width, 
+fv_box_row_filter_16u_32s(fv_s32 *dst, fv_u16 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_16s(double *dst, fv_s16 *src, fv_s32 width, 
+fv_box_row_filter_16s_32s(fv_s32 *dst, fv_s16 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_32s(double *dst, fv_s32 *src, fv_s32 width, 
+fv_box_row_filter_32f_32f(float *dst, float *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_32f(double *dst, float *src, fv_s32 width, 
+fv_box_row_filter_8u_64f(double *dst, fv_u8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
 static void
-fv_box_row_filter_64f(double *dst, double *src, fv_s32 width, 
+fv_box_row_filter_8s_64f(double *dst, fv_s8 *src, fv_s32 width, 
             float *kx_data, fv_base_row_filter_t *filter)
 {
     fv_box_row_filter_core(dst, src, width, kx_data, filter);
 }
 
-static fv_row_filter_func fv_box_row_filter_tab[] = {
-    (fv_row_filter_func)fv_box_row_filter_8u,
-    (fv_row_filter_func)fv_box_row_filter_8s,
-    (fv_row_filter_func)fv_box_row_filter_16u,
-    (fv_row_filter_func)fv_box_row_filter_16s,
-    (fv_row_filter_func)fv_box_row_filter_32s,
-    (fv_row_filter_func)fv_box_row_filter_32f,
-    (fv_row_filter_func)fv_box_row_filter_64f,
-};
+static void
+fv_box_row_filter_16u_64f(double *dst, fv_u16 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_box_row_filter_core(dst, src, width, kx_data, filter);
+}
 
-#define fv_box_row_filter_tab_size \
-    (sizeof(fv_box_row_filter_tab)/sizeof(fv_row_filter_func))
+static void
+fv_box_row_filter_16s_64f(double *dst, fv_s16 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_box_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_box_row_filter_32s_64f(double *dst, fv_s32 *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_box_row_filter_core(dst, src, width, kx_data, filter);
+}
 
+static void
+fv_box_row_filter_32f_64f(double *dst, float *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_box_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+static void
+fv_box_row_filter_64f_64f(double *dst, double *src, fv_s32 width, 
+            float *kx_data, fv_base_row_filter_t *filter)
+{
+    fv_box_row_filter_core(dst, src, width, kx_data, filter);
+}
+
+/* [buffer depth][source depth] */
 static fv_row_filter_func 
-fv_get_box_row_filter_tab(fv_u32 depth)
+fv_box_row_filter_tab[FV_DEPTH_NUM][FV_DEPTH_NUM] = {
+    [FV_32S] = {
+        [FV_8U] = (fv_row_filter_func)fv_box_row_filter_8u_32s,
+        [FV_8S] = (fv_row_filter_func)fv_box_row_filter_8s_32s,
+        [FV_16U] = (fv_row_filter_func)fv_box_row_filter_16u_32s,
+        [FV_16S] = (fv_row_filter_func)fv_box_row_filter_16s_32s,
+    },
+    [FV_32F] = {
+        [FV_32F] = (fv_row_filter_func)fv_box_row_filter_32f_32f,
+    },
+    [FV_64F] = {
+        [FV_8U] = (fv_row_filter_func)fv_box_row_filter_8u_64f,
+        [FV_8S] = (fv_row_filter_func)fv_box_row_filter_8s_64f,
+        [FV_16U] = (fv_row_filter_func)fv_box_row_filter_16u_64f,
+        [FV_16S] = (fv_row_filter_func)fv_box_row_filter_16s_64f,
+        [FV_32S] = (fv_row_filter_func)fv_box_row_filter_32s_64f,
+        [FV_32F] = (fv_row_filter_func)fv_box_row_filter_32f_64f,
+        [FV_64F] = (fv_row_filter_func)fv_box_row_filter_64f_64f,
+    },
+};
+
+static fv_row_filter_func 
+fv_get_box_row_filter_tab(fv_u32 bdepth, fv_u32 sdepth)
 {
-    FV_ASSERT(depth < fv_box_row_filter_tab_size);
+    FV_ASSERT(bdepth < FV_DEPTH_NUM && sdepth < FV_DEPTH_NUM);
 
-    return fv_box_row_filter_tab[depth];
+    return fv_box_row_filter_tab[bdepth][sdepth];
 }
 
 #define fv_box_column_filter_core(dst, src, count, width, ky_data, \
@@ -106,9 +164,9 @@ fv_get_box_row_filter_tab(fv_u32 depth)
     do { \
         fv_sum_column_filter_t  *col_filter = (fv_sum_column_filter_t *)filter; \
         double                  *sum = col_filter->sc_sum; \
-        double                  *sp; \
-        double                  *sm; \
-        double                  **src_data; \
+        typeof(*src)            sp; \
+        typeof(*src)            sm; \
+        typeof(src)             src_data; \
         fv_s32                  sum_count = col_filter->sc_sum_count; \
         fv_s32                  cn = col_filter->sc_nchannels; \
         fv_s32                  ksize = filter->bc_ksize; \
@@ -164,180 +222,270 @@ fv_get_box_row_filter_tab(fv_u32 depth)
     } while(0)
 
 static void
-fv_box_column_filter_8u(fv_u8 *dst, double **src, 
+fv_box_column_filter_32s_8u(fv_u8 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_8u);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
 }
 
 static void
-fv_box_column_filter_8s(fv_s8 *dst, double **src, 
+fv_box_column_filter_32s_8s(fv_s8 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_8s);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8s);
 }
 
 static void
-fv_box_column_filter_16u(fv_u16 *dst, double **src, 
+fv_box_column_filter_32s_16u(fv_u16 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_16u);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16u);
 }
 
 static void
-fv_box_column_filter_16s(fv_s16 *dst, double **src, 
+fv_box_column_filter_32s_16s(fv_s16 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_16s);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
 }
 
 static void
-fv_box_column_filter_32s(fv_s32 *dst, double **src, 
+fv_box_column_filter_32s_32s(fv_s32 *dst, fv_s32 **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_32s);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
 }
 
 static void
-fv_box_column_filter_32f(float *dst, double **src, 
+fv_box_column_filter_32f_32f(float *dst, float **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_box_column_filter_core(dst, src, count, width, ky_data, 
-           filter, fv_saturate_cast_32f);
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32f);
 }
 
 static void
-fv_box_column_filter_64f(double *dst, double **src, 
+fv_box_column_filter_64f_8u(fv_u8 *dst, double **src, 
            fv_s32 count, fv_s32 width, float *ky_data,
            fv_base_column_filter_t *filter)
 {
-    fv_sum_column_filter_t  *col_filter = (fv_sum_column_filter_t *)filter;
-    double                  *sum = col_filter->sc_sum;
-    double                  *sp;
-    double                  *sm;
-    fv_s32                  sum_count = col_filter->sc_sum_count;
-    fv_s32                  ksize = filter->bc_ksize;
-    fv_s32                  i;
-    double                  scale = col_filter->sc_scale;
-    double                  s0;
-    fv_bool                 have_scale = col_filter->sc_scale != 1;
-
-    if (sum_count == 0) {
-        memset(sum, 0, width*sizeof(*sum));
-        for (; sum_count < ksize - 1; sum_count++, src++) {
-            sp = src[0];
-            for (i = 0; i < width; i++) {
-                sum[i] += sp[i];
-            }
-        }
-        col_filter->sc_sum_count = sum_count;
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8u);
+}
+
+static void
+fv_box_column_filter_64f_8s(fv_s8 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_8s);
+}
+
+static void
+fv_box_column_filter_64f_16u(fv_u16 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16u);
+}
+
+static void
+fv_box_column_filter_64f_16s(fv_s16 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_16s);
+}
+
+static void
+fv_box_column_filter_64f_32s(fv_s32 *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32s);
+}
+
+static void
+fv_box_column_filter_64f_32f(float *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_cast_32f);
+}
+
+static void
+fv_box_column_filter_64f_64f(double *dst, double **src, 
+           fv_s32 count, fv_s32 width, float *ky_data,
+           fv_base_column_filter_t *filter)
+{
+    fv_box_column_filter_core(dst, src, count, width, ky_data,
+        filter, fv_saturate_no_cast);
+}
+
+/* [buffer depth][destination depth] */
+static fv_column_filter_func 
+fv_box_column_filter_tab[FV_DEPTH_NUM][FV_DEPTH_NUM] = {
+    [FV_32S] = {
+        [FV_8U] = (fv_column_filter_func)fv_box_column_filter_32s_8u,
+        [FV_8S] = (fv_column_filter_func)fv_box_column_filter_32s_8s,
+        [FV_16U] = (fv_column_filter_func)fv_box_column_filter_32s_16u,
+        [FV_16S] = (fv_column_filter_func)fv_box_column_filter_32s_16s,
+        [FV_32S] = (fv_column_filter_func)fv_box_column_filter_32s_32s,
+    },
+    [FV_32F] = {
+        [FV_32F] = (fv_column_filter_func)fv_box_column_filter_32f_32f,
+    },
+    [FV_64F] = {
+        [FV_8U] = (fv_column_filter_func)fv_box_column_filter_64f_8u,
+        [FV_8S] = (fv_column_filter_func)fv_box_column_filter_64f_8s,
+        [FV_16U] = (fv_column_filter_func)fv_box_column_filter_64f_16u,
+        [FV_16S] = (fv_column_filter_func)fv_box_column_filter_64f_16s,
+        [FV_32S] = (fv_column_filter_func)fv_box_column_filter_64f_32s,
+        [FV_32F] = (fv_column_filter_func)fv_box_column_filter_64f_32f,
+        [FV_64F] = (fv_column_filter_func)fv_box_column_filter_64f_64f,
+    },
+};
+
+static fv_column_filter_func 
+fv_get_box_col_filter_tab(fv_u32 bdepth, fv_u32 ddepth)
+{
+    FV_ASSERT(bdepth < FV_DEPTH_NUM && ddepth < FV_DEPTH_NUM);
+
+    return fv_box_column_filter_tab[bdepth][ddepth];
+}
+
+/*
+ * Row sums of integer images are kept exactly in 32s, 32f images
+ * are summed in float and everything else in double.
+ */
+static fv_u32
+fv_get_box_filter_buf_depth(fv_u32 sdepth, fv_u32 ddepth)
+{
+    fv_u32      bdepth;
+
+    if (sdepth <= FV_16S) {
+        bdepth = FV_32S;
+    } else if (sdepth == FV_32F) {
+        bdepth = FV_32F;
     } else {
-        FV_ASSERT(sum_count == ksize - 1);
-        src += ksize - 1;
+        bdepth = FV_64F;
     }
 
-    for (; count--; src++) {
-        sp = src[0];
-        sm = src[1 - ksize];
-        if (have_scale) {
-            for (i = 0; i < width; i++) {
-                s0 = sum[i] + sp[i];
-                dst[i] = s0*scale;
-                sum[i] = s0 - sm[i];
-            }
-        } else {
-            i = 0;
-            for (; i < width; i++) {
-                s0 = sum[i] + sp[i];
-                dst[i] = s0;
-                sum[i] = s0 - sm[i];
-            }
-        }
+    if (fv_get_box_col_filter_tab(bdepth, ddepth) == NULL) {
+        bdepth = FV_64F;
+    }
 
-        dst += width;
-    } 
+    return bdepth;
 }
 
-static fv_column_filter_func fv_box_column_filter_tab[] = {
-    (fv_column_filter_func)fv_box_column_filter_8u,
-    (fv_column_filter_func)fv_box_column_filter_8s,
-    (fv_column_filter_func)fv_box_column_filter_16u,
-    (fv_column_filter_func)fv_box_column_filter_16s,
-    (fv_column_filter_func)fv_box_column_filter_32s,
-    (fv_column_filter_func)fv_box_column_filter_32f,
-    (fv_column_filter_func)fv_box_column_filter_64f,
-};
+static fv_base_column_filter_t *
+fv_box_column_filter_clone(fv_base_column_filter_t *filter)
+{
+    fv_sum_column_filter_t  *f;
+    fv_s32                  width;
 
-#define fv_box_column_filter_tab_size \
-    (sizeof(fv_box_column_filter_tab)/sizeof(fv_column_filter_func))
+    f = fv_alloc(sizeof(*f));
+    FV_ASSERT(f != NULL);
+    *f = *(fv_sum_column_filter_t *)filter;
+    width = f->sc_sum_width;
+    f->sc_sum = fv_alloc(sizeof(*(f->sc_sum))*width); 
+    FV_ASSERT(f->sc_sum != NULL);
+    f->sc_sum_count = 0;
 
-static fv_column_filter_func 
-fv_get_box_col_filter_tab(fv_u32 depth)
+    return &f->sc_base;
+}
+
+static void
+fv_box_column_filter_release(fv_base_column_filter_t *filter)
 {
-    FV_ASSERT(depth < fv_box_column_filter_tab_size);
+    fv_sum_column_filter_t  *f = (fv_sum_column_filter_t *)filter;
 
-    return fv_box_column_filter_tab[depth];
+    fv_free(&f->sc_sum);
+    fv_free(&f);
+}
+
+static void
+fv_box_column_filter_reset(fv_base_column_filter_t *filter)
+{
+    ((fv_sum_column_filter_t *)filter)->sc_sum_count = 0;
 }
 
 static void
 fv_create_box_filter(fv_sum_row_filter_t *row_filter, 
         fv_sum_column_filter_t *col_filter, fv_mat_t *src,
-        fv_s32 ddepth, fv_s32 sdepth, fv_size_t ksize, 
+        fv_s32 ddepth, fv_s32 sdepth, fv_u32 bdepth, fv_size_t ksize, 
         fv_point_t anchor, fv_bool normalize)
 {
     fv_u32      cn;
 
     cn = src->mt_nchannel;
-    row_filter->sr_filter = fv_get_box_row_filter_tab(sdepth);
+    row_filter->sr_filter = fv_get_box_row_filter_tab(bdepth, sdepth);
+    FV_ASSERT(row_filter->sr_filter != NULL);
     row_filter->sr_ksize = ksize.sz_width;
     row_filter->sr_nchannels = cn;
-    col_filter->sc_filter = fv_get_box_col_filter_tab(ddepth);
+    col_filter->sc_filter = fv_get_box_col_filter_tab(bdepth, ddepth);
+    FV_ASSERT(col_filter->sc_filter != NULL);
     col_filter->sc_ksize = ksize.sz_height;
     col_filter->sc_nchannels = cn;
     col_filter->sc_scale =
         normalize ? 1.0/(ksize.sz_width*ksize.sz_height) : 1;
+    col_filter->sc_sum_width = src->mt_cols*cn;
     col_filter->sc_sum = 
-        fv_alloc(sizeof(*(col_filter->sc_sum))*src->mt_cols*cn); 
+        fv_alloc(sizeof(*(col_filter->sc_sum))*col_filter->sc_sum_width); 
     FV_ASSERT(col_filter->sc_sum != NULL);
     col_filter->sc_sum_count = 0;
+    col_filter->sc_clone = fv_box_column_filter_clone;
+    col_filter->sc_release = fv_box_column_filter_release;
+    col_filter->sc_reset = fv_box_column_filter_reset;
 }
 
+typedef struct _fv_box_filter_engine_t {
+    fv_filter_engine_t          be_engine;
+    fv_sum_row_filter_t         be_row_filter;
+    fv_sum_column_filter_t      be_col_filter;
+} fv_box_filter_engine_t;
+
 static void
-fv_release_box_filter(fv_sum_row_filter_t *row_filter, 
-        fv_sum_column_filter_t *col_filter)
+fv_release_box_filter_engine(fv_filter_engine_t *filter)
 {
-    fv_free(&col_filter->sc_sum);
+    fv_box_filter_engine_t  *f = (fv_box_filter_engine_t *)filter;
+
+    fv_free(&f->be_col_filter.sc_sum);
+    fv_free(&f);
 }
 
-void 
-fv_box_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_size_t ksize, 
+fv_filter_engine_t *
+fv_create_box_filter_engine(fv_mat_t *dst, fv_mat_t *src, fv_size_t ksize, 
         fv_point_t anchor, fv_bool normalize, fv_s32 border_type)
 {
-    fv_mat_t                    kernel = {};
-    fv_filter_engine_t          filter = {};
-    fv_sum_row_filter_t         row_filter = {};
-    fv_sum_column_filter_t      col_filter = {};
+    fv_box_filter_engine_t      *engine;
     fv_u32                      sdepth;
+    fv_u32                      ddepth;
+    fv_u32                      bdepth;
 
     FV_ASSERT(dst->mt_nchannel == src->mt_nchannel);
 
+    engine = fv_calloc(sizeof(*engine));
+    FV_ASSERT(engine != NULL);
+
     sdepth = src->mt_depth;
     ddepth = dst->mt_depth;
-    if (ddepth < 0) {
-        ddepth = sdepth;
-    }
-
     if (border_type != FV_BORDER_CONSTANT && normalize) {
         if (src->mt_rows == 1) {
             ksize.sz_height = 1;
@@ -347,10 +495,6 @@ fv_box_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_size_t ksize,
         }
     }
 
-    kernel.mt_nchannel = 1;
-    kernel.mt_rows = ksize.sz_height;
-    kernel.mt_cols = ksize.sz_width;
-
     if (anchor.pt_x < 0) {
         anchor.pt_x = (ksize.sz_width >> 1);
     }
@@ -359,33 +503,663 @@ fv_box_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_size_t ksize,
         anchor.pt_y = (ksize.sz_height >> 1);
     }
 
-    fv_create_box_filter(&row_filter, &col_filter, src, 
-            ddepth, sdepth, ksize, anchor, normalize);
+    bdepth = fv_get_box_filter_buf_depth(sdepth, ddepth);
+    fv_create_box_filter(&engine->be_row_filter, &engine->be_col_filter, 
+            src, ddepth, sdepth, bdepth, ksize, anchor, normalize);
 
-    filter.fe_row_filter = &row_filter.sr_base;
-    filter.fe_col_filter = &col_filter.sc_base;
-    filter.fe_is_separable = 1;
-    fv_sep_filter_proceed(dst, src, NULL, &kernel, &kernel, 
-            anchor, 0, border_type, &filter);
+    engine->be_engine.fe_row_filter = &engine->be_row_filter.sr_base;
+    engine->be_engine.fe_col_filter = &engine->be_col_filter.sc_base;
+    engine->be_engine.fe_buf_depth = bdepth;
+    engine->be_engine.fe_is_separable = 1;
+    engine->be_engine.fe_release = fv_release_box_filter_engine;
+    fv_init_filter_engine(&engine->be_engine, dst, src, ksize, anchor,
+            0, border_type);
 
-    fv_release_box_filter(&row_filter, &col_filter);
+    return &engine->be_engine;
 }
 
 void 
-fv_gaussian_blur(fv_mat_t *dst, fv_mat_t *src, fv_size_t ksize, 
-        double param3, double param4, fv_s32 border_type)
+fv_box_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, fv_size_t ksize, 
+        fv_point_t anchor, fv_bool normalize, fv_s32 border_type)
 {
+    fv_filter_engine_t          *filter;
+
+    filter = fv_create_box_filter_engine(dst, src, ksize, anchor,
+            normalize, border_type);
+    fv_filter_engine_apply(filter, dst, src);
+    fv_release_filter_engine(&filter);
 }
 
-void 
-fv_median_blur(fv_mat_t *dst, fv_mat_t *src, double param1)
+/*
+ * n taps of a Gaussian with the given sigma, summing to 1. With
+ * sigma <= 0 sigma follows from n, and the small odd sizes use the
+ * binomial kernels.
+ */
+fv_mat_t *
+fv_get_gaussian_kernel(fv_s32 n, double sigma)
+{
+    static const float  small_gaussian_tab[][7] = {
+        {1.f},
+        {0.25f, 0.5f, 0.25f},
+        {0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f},
+        {0.03125f, 0.109375f, 0.21875f, 0.28125f, 0.21875f, 0.109375f,
+            0.03125f},
+    };
+    fv_mat_t            *kernel;
+    float               *k;
+    double              *v;
+    double              scale;
+    double              sum = 0;
+    double              x;
+    fv_s32              i;
+
+    FV_ASSERT(n > 0);
+
+    kernel = fv_create_mat(n, 1, FV_MAKETYPE(FV_DEPTH_32F, 1));
+    FV_ASSERT(kernel != NULL);
+    k = kernel->mt_data.dt_fl;
+    if ((n & 0x1) && n <= 7 && sigma <= 0) {
+        memcpy(k, small_gaussian_tab[n >> 1], n*sizeof(*k));
+        return kernel;
+    }
+
+    if (sigma <= 0) {
+        sigma = ((n - 1)*0.5 - 1)*0.3 + 0.8;
+    }
+
+    v = fv_alloc(n*sizeof(*v));
+    FV_ASSERT(v != NULL);
+    scale = -0.5/(sigma*sigma);
+    for (i = 0; i < n; i++) {
+        x = i - (n - 1)*0.5;
+        v[i] = exp(scale*x*x);
+        sum += v[i];
+    }
+
+    for (i = 0; i < n; i++) {
+        k[i] = v[i]/sum;
+    }
+    fv_free(&v);
+
+    return kernel;
+}
+
+/*
+ * Young - van Vliet recursive Gaussian: a causal and an anti-causal
+ * 3rd order pass, w[n] = b*x[n] + a1*w[n-1] + a2*w[n-2] + a3*w[n-3]
+ * and the same backwards, cost a few multiplies a sample whatever
+ * sigma is. The poles are the ones van Vliet, Young and Verbeek fit
+ * for sigma 2, taken to the power 1/q with q chosen so that the
+ * variance of the filter is sigma^2. gi_m gives the anti-causal
+ * state past the end of a line from the causal one for a line
+ * continued by a constant (Triggs - Sdika); it is taken from the
+ * response of the filter itself.
+ */
+typedef struct _fv_gaussian_iir_t {
+    double      gi_b;
+    double      gi_a[3];
+    double      gi_m[3][3];
+    fv_s32      gi_pad;
+} fv_gaussian_iir_t;
+
+/* d1 = re + im*i, d2 = conj(d1), d3 = real */
+static const double fv_gaussian_iir_poles[3] = {1.41650, 1.00829, 1.86543};
+
+/* Variance of the filter with the poles taken to the power 1/q */
+static double
+fv_gaussian_iir_variance(double q)
 {
+    const double    *d = fv_gaussian_iir_poles;
+    double          m;
+    double          t;
+    double          zr;
+    double          zi;
+    double          ur;
+    double          ui;
+    double          var;
+
+    /* 2*Re(z/(z - 1)^2) for each pole, twice for the complex pair */
+    m = pow(hypot(d[0], d[1]), 1/q);
+    t = atan2(d[1], d[0])/q;
+    zr = m*cos(t);
+    zi = m*sin(t);
+    ur = (zr - 1)*(zr - 1) - zi*zi;
+    ui = 2*(zr - 1)*zi;
+    var = 4*(zr*ur + zi*ui)/(ur*ur + ui*ui);
+    zr = pow(d[2], 1/q);
+    var += 2*zr/((zr - 1)*(zr - 1));
+
+    return var;
 }
 
-void 
-fv_bilateral_filter(fv_mat_t *dst, fv_mat_t *src, double param1,
-        double param3, double param4, fv_s32 border_type)
+static void
+fv_gaussian_iir_init(fv_gaussian_iir_t *iir, double sigma)
 {
+    const double    *d = fv_gaussian_iir_poles;
+    double          *w;
+    double          q;
+    double          h;
+    double          f;
+    double          m;
+    double          t;
+    double          alpha;
+    double          beta;
+    double          gamma;
+    double          s[3];
+    fv_s32          len;
+    fv_s32          i;
+    fv_s32          j;
+    fv_s32          k;
+
+    FV_ASSERT(sigma >= 0.5);
+
+    /* the variance grows with q, Newton from the linear guess */
+    q = sigma/2;
+    for (i = 0; i < 20; i++) {
+        h = q*1e-6;
+        f = fv_gaussian_iir_variance(q) - sigma*sigma;
+        q -= f*2*h/(fv_gaussian_iir_variance(q + h) - 
+                fv_gaussian_iir_variance(q - h));
+        if (fabs(f) < sigma*sigma*1e-10) {
+            break;
+        }
+    }
+
+    /*
+     * (1 - z^-1/p1)(1 - z^-1/p2)(1 - z^-1/p3) with the poles
+     * p = d^(1/q) is 1 - (alpha + gamma)z^-1 + (beta + alpha*gamma)z^-2
+     * - beta*gamma*z^-3.
+     */
+    m = pow(hypot(d[0], d[1]), 1/q);
+    t = atan2(d[1], d[0])/q;
+    alpha = 2*cos(t)/m;
+    beta = 1/(m*m);
+    gamma = 1/pow(d[2], 1/q);
+    iir->gi_a[0] = alpha + gamma;
+    iir->gi_a[1] = -(beta + alpha*gamma);
+    iir->gi_a[2] = beta*gamma;
+    iir->gi_b = 1 - (iir->gi_a[0] + iir->gi_a[1] + iir->gi_a[2]);
+    iir->gi_pad = (fv_s32)ceil(sigma*4);
+
+    /*
+     * Column j of gi_m: run both passes over zeros after a unit causal
+     * state w[n-1-j], the response has died out after 10 sigma.
+     */
+    len = fv_round(sigma*10) + 8;
+    w = fv_alloc(len*sizeof(*w));
+    FV_ASSERT(w != NULL);
+    for (j = 0; j < 3; j++) {
+        s[0] = s[1] = s[2] = 0;
+        s[j] = 1;
+        for (k = 0; k < len; k++) {
+            w[k] = iir->gi_a[0]*s[0] + iir->gi_a[1]*s[1] +
+                iir->gi_a[2]*s[2];
+            s[2] = s[1], s[1] = s[0], s[0] = w[k];
+        }
+        s[0] = s[1] = s[2] = 0;
+        for (k = len - 1; k >= 0; k--) {
+            w[k] = iir->gi_b*w[k] + iir->gi_a[0]*s[0] +
+                iir->gi_a[1]*s[1] + iir->gi_a[2]*s[2];
+            s[2] = s[1], s[1] = s[0], s[0] = w[k];
+        }
+        for (i = 0; i < 3; i++) {
+            iir->gi_m[i][j] = w[i];
+        }
+    }
+    fv_free(&w);
+}
+
+/*
+ * Filter lanes parallel lines of n samples, sample k of lane x at
+ * data[k*step + x]. Past its ends a line continues with its first
+ * and last samples, or with zeros. The state is kept in double: the
+ * poles get close to 1 for large sigma.
+ */
+static void
+fv_gaussian_iir_run(float *data, fv_s32 n, fv_s32 step, fv_s32 lanes,
+            fv_gaussian_iir_t *iir, fv_bool zero)
+{
+    double      state[3][FV_GAUSSIAN_IIR_LANES];
+    double      c[FV_GAUSSIAN_IIR_LANES];
+    double      *w1 = state[0];
+    double      *w2 = state[1];
+    double      *w3 = state[2];
+    double      *t;
+    double      b = iir->gi_b;
+    double      a1 = iir->gi_a[0];
+    double      a2 = iir->gi_a[1];
+    double      a3 = iir->gi_a[2];
+    double      d1;
+    double      d2;
+    double      d3;
+    float       *row;
+    fv_s32      k;
+    fv_s32      x;
+
+    FV_ASSERT(lanes <= FV_GAUSSIAN_IIR_LANES);
+
+    row = data + (n - 1)*step;
+    for (x = 0; x < lanes; x++) {
+        w1[x] = w2[x] = w3[x] = zero ? 0 : data[x];
+        c[x] = zero ? 0 : row[x];
+    }
+
+    for (k = 0, row = data; k < n; k++, row += step) {
+        for (x = 0; x < lanes; x++) {
+            w3[x] = b*row[x] + a1*w1[x] + a2*w2[x] + a3*w3[x];
+            row[x] = w3[x];
+        }
+        t = w3, w3 = w2, w2 = w1, w1 = t;
+    }
+
+    for (x = 0; x < lanes; x++) {
+        d1 = w1[x] - c[x];
+        d2 = w2[x] - c[x];
+        d3 = w3[x] - c[x];
+        w1[x] = c[x] + iir->gi_m[0][0]*d1 + iir->gi_m[0][1]*d2 +
+            iir->gi_m[0][2]*d3;
+        w2[x] = c[x] + iir->gi_m[1][0]*d1 + iir->gi_m[1][1]*d2 +
+            iir->gi_m[1][2]*d3;
+        w3[x] = c[x] + iir->gi_m[2][0]*d1 + iir->gi_m[2][1]*d2 +
+            iir->gi_m[2][2]*d3;
+    }
+
+    for (k = n - 1, row = data + k*step; k >= 0; k--, row -= step) {
+        for (x = 0; x < lanes; x++) {
+            w3[x] = b*row[x] + a1*w1[x] + a2*w2[x] + a3*w3[x];
+            row[x] = w3[x];
+        }
+        t = w3, w3 = w2, w2 = w1, w1 = t;
+    }
+}
+
+#define fv_gaussian_iir_load_core(dst, src, map, n, cn) \
+    do { \
+        fv_s32      i; \
+        fv_s32      k; \
+        for (i = 0; i < n; i++, dst += cn) { \
+            for (k = 0; k < cn; k++) { \
+                dst[k] = src[map[i]*cn + k]; \
+            } \
+        } \
+    } while(0)
+
+#define fv_gaussian_iir_store_core(dst, src, width, castop) \
+    do { \
+        fv_s32      i; \
+        for (i = 0; i < width; i++) { \
+            dst[i] = castop(src[i]); \
+        } \
+    } while(0)
+
+#define fv_gaussian_iir_round_8u(v) fv_saturate_cast_8u(fv_round(v))
+#define fv_gaussian_iir_round_8s(v) fv_saturate_cast_8s(fv_round(v))
+#define fv_gaussian_iir_round_16u(v) fv_saturate_cast_16u(fv_round(v))
+#define fv_gaussian_iir_round_16s(v) fv_saturate_cast_16s(fv_round(v))
+#define fv_gaussian_iir_round_32s(v) \
+    ((fv_s32)lrint(fv_saturate_cast(v, fv_int_max, fv_int_min)))
+
+typedef void (*fv_gaussian_iir_load_func)(float *, void *, fv_s32 *,
+            fv_s32, fv_s32);
+typedef void (*fv_gaussian_iir_store_func)(void *, float *, fv_s32);
+
+static void
+fv_gaussian_iir_load_8u(float *dst, fv_u8 *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_8s(float *dst, fv_s8 *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_16u(float *dst, fv_u16 *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_16s(float *dst, fv_s16 *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_32s(float *dst, fv_s32 *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_32f(float *dst, float *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static void
+fv_gaussian_iir_load_64f(float *dst, double *src, fv_s32 *map,
+            fv_s32 n, fv_s32 cn)
+{
+    fv_gaussian_iir_load_core(dst, src, map, n, cn);
+}
+
+static fv_gaussian_iir_load_func fv_gaussian_iir_load_tab[] = {
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_8u,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_8s,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_16u,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_16s,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_32s,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_32f,
+    (fv_gaussian_iir_load_func)fv_gaussian_iir_load_64f,
+};
+
+#define fv_gaussian_iir_load_tab_size \
+    (sizeof(fv_gaussian_iir_load_tab)/sizeof(fv_gaussian_iir_load_func))
+
+static fv_gaussian_iir_load_func
+fv_get_gaussian_iir_load_tab(fv_u32 depth)
+{
+    FV_ASSERT(depth < fv_gaussian_iir_load_tab_size);
+
+    return fv_gaussian_iir_load_tab[depth];
+}
+
+static void
+fv_gaussian_iir_store_8u(fv_u8 *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_gaussian_iir_round_8u);
+}
+
+static void
+fv_gaussian_iir_store_8s(fv_s8 *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_gaussian_iir_round_8s);
+}
+
+static void
+fv_gaussian_iir_store_16u(fv_u16 *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_gaussian_iir_round_16u);
+}
+
+static void
+fv_gaussian_iir_store_16s(fv_s16 *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_gaussian_iir_round_16s);
+}
+
+static void
+fv_gaussian_iir_store_32s(fv_s32 *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_gaussian_iir_round_32s);
+}
+
+static void
+fv_gaussian_iir_store_32f(float *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_saturate_no_cast);
+}
+
+static void
+fv_gaussian_iir_store_64f(double *dst, float *src, fv_s32 width)
+{
+    fv_gaussian_iir_store_core(dst, src, width, fv_saturate_no_cast);
+}
+
+static fv_gaussian_iir_store_func fv_gaussian_iir_store_tab[] = {
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_8u,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_8s,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_16u,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_16s,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_32s,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_32f,
+    (fv_gaussian_iir_store_func)fv_gaussian_iir_store_64f,
+};
+
+#define fv_gaussian_iir_store_tab_size \
+    (sizeof(fv_gaussian_iir_store_tab)/sizeof(fv_gaussian_iir_store_func))
+
+static fv_gaussian_iir_store_func
+fv_get_gaussian_iir_store_tab(fv_u32 depth)
+{
+    FV_ASSERT(depth < fv_gaussian_iir_store_tab_size);
+
+    return fv_gaussian_iir_store_tab[depth];
+}
+
+/*
+ * One axis of the recursive blur. The line is extended by up to
+ * gi_pad samples on each side: the columns (rows) a view has around
+ * it, then the border. Past them the filter itself continues the
+ * line with its end samples, which is exact for the replicate and
+ * constant borders, so those only take the real neighbours.
+ * ga_map[i] is the source index of padded sample i, relative to the
+ * view, ga_lo of them come before sample 0.
+ */
+typedef struct _fv_gaussian_iir_axis_t {
+    fv_gaussian_iir_t   ga_iir;
+    fv_s32              *ga_map;
+    fv_s32              ga_lo;
+    fv_s32              ga_len;
+} fv_gaussian_iir_axis_t;
+
+static void
+fv_gaussian_iir_axis_init(fv_gaussian_iir_axis_t *axis, double sigma,
+            fv_s32 n, fv_s32 ofs, fv_s32 whole, fv_s32 border_type)
+{
+    fv_s32      pad;
+    fv_s32      lo;
+    fv_s32      hi;
+    fv_s32      c;
+    fv_s32      i;
+
+    fv_gaussian_iir_init(&axis->ga_iir, sigma);
+    pad = fv_min(axis->ga_iir.gi_pad, whole - 1);
+    lo = hi = pad;
+    if (border_type == FV_BORDER_REPLICATE ||
+            border_type == FV_BORDER_CONSTANT) {
+        lo = fv_min(pad, ofs);
+        hi = fv_min(pad, whole - ofs - n);
+    }
+
+    axis->ga_lo = lo;
+    axis->ga_len = lo + n + hi;
+    axis->ga_map = fv_alloc(axis->ga_len*sizeof(*axis->ga_map));
+    FV_ASSERT(axis->ga_map != NULL);
+    for (i = 0; i < axis->ga_len; i++) {
+        c = i - lo + ofs;
+        if (c < 0 || c >= whole) {
+            c = fv_border_get_value(border_type, c, whole);
+        }
+        axis->ga_map[i] = c - ofs;
+    }
+}
+
+typedef struct _fv_gaussian_iir_proceed_t {
+    fv_gaussian_iir_axis_t      gp_x;
+    fv_gaussian_iir_axis_t      gp_y;
+    fv_mat_t                    *gp_dst;
+    fv_mat_t                    *gp_src;
+    float                       *gp_buf;
+    fv_s32                      gp_buf_step;
+    fv_s32                      gp_band_rows;
+    fv_bool                     gp_zero;
+    fv_gaussian_iir_load_func   gp_load;
+    fv_gaussian_iir_store_func  gp_store;
+} fv_gaussian_iir_proceed_t;
+
+/*
+ * Rows of band index, padded rows included, filtered along x into
+ * the float buffer.
+ */
+static void
+fv_gaussian_iir_rows(void *arg, fv_s32 index)
+{
+    fv_gaussian_iir_proceed_t   *gp = arg;
+    fv_gaussian_iir_axis_t      *ax = &gp->gp_x;
+    fv_mat_t                    *src = gp->gp_src;
+    float                       *line;
+    fv_s32                      cn = src->mt_nchannel;
+    fv_s32                      r0 = index*gp->gp_band_rows;
+    fv_s32                      r1;
+    fv_s32                      r;
+
+    r1 = fv_min(r0 + gp->gp_band_rows, gp->gp_y.ga_len);
+    line = fv_alloc(ax->ga_len*cn*sizeof(*line));
+    FV_ASSERT(line != NULL);
+    for (r = r0; r < r1; r++) {
+        gp->gp_load(line, src->mt_data.dt_ptr +
+                gp->gp_y.ga_map[r]*src->mt_step, ax->ga_map,
+                ax->ga_len, cn);
+        fv_gaussian_iir_run(line, ax->ga_len, cn, cn, &ax->ga_iir,
+                gp->gp_zero);
+        memcpy(gp->gp_buf + r*gp->gp_buf_step, line + ax->ga_lo*cn,
+                src->mt_cols*cn*sizeof(*line));
+    }
+    fv_free(&line);
+}
+
+/*
+ * FV_GAUSSIAN_IIR_LANES buffer columns of strip index filtered along
+ * y and stored to dst.
+ */
+static void
+fv_gaussian_iir_columns(void *arg, fv_s32 index)
+{
+    fv_gaussian_iir_proceed_t   *gp = arg;
+    fv_mat_t                    *dst = gp->gp_dst;
+    float                       *buf;
+    fv_s32                      x0 = index*FV_GAUSSIAN_IIR_LANES;
+    fv_s32                      lanes;
+    fv_s32                      y;
+
+    lanes = fv_min(FV_GAUSSIAN_IIR_LANES, dst->mt_cols*dst->mt_nchannel - x0);
+    buf = gp->gp_buf + x0;
+    fv_gaussian_iir_run(buf, gp->gp_y.ga_len, gp->gp_buf_step, lanes,
+            &gp->gp_y.ga_iir, gp->gp_zero);
+    buf += gp->gp_y.ga_lo*gp->gp_buf_step;
+    for (y = 0; y < dst->mt_rows; y++, buf += gp->gp_buf_step) {
+        gp->gp_store(dst->mt_data.dt_ptr + y*dst->mt_step +
+                x0*FV_MAT_ELEM_SIZE(dst), buf, lanes);
+    }
+}
+
+/*
+ * Gaussian blur whose cost does not grow with sigma. For sigma >= 2
+ * it stays within about 1% of the signal range of the sampled
+ * Gaussian; the reflect and wrap borders are followed for 4 sigma
+ * past the edges. The whole source is read before dst is written, so
+ * dst may be src.
+ */
+void
+fv_gaussian_blur_iir(fv_mat_t *dst, fv_mat_t *src, double sigma_x,
+        double sigma_y, fv_s32 border_type)
+{
+    fv_gaussian_iir_proceed_t   gp = {};
+    fv_size_t                   whole;
+    fv_point_t                  ofs;
+    fv_s32                      width;
+    fv_s32                      njobs;
+
+    FV_ASSERT(dst->mt_rows == src->mt_rows &&
+            dst->mt_cols == src->mt_cols &&
+            dst->mt_nchannel == src->mt_nchannel);
+
+    if (sigma_y <= 0) {
+        sigma_y = sigma_x;
+    }
+
+    if (border_type & FV_BORDER_ISOLATED) {
+        whole = fv_size(src->mt_cols, src->mt_rows);
+        ofs = fv_point(0, 0);
+    } else {
+        fv_mat_locate_roi(src, &whole, &ofs);
+    }
+    border_type &= ~FV_BORDER_ISOLATED;
+
+    gp.gp_dst = dst;
+    gp.gp_src = src;
+    gp.gp_zero = border_type == FV_BORDER_CONSTANT;
+    gp.gp_load = fv_get_gaussian_iir_load_tab(src->mt_depth);
+    gp.gp_store = fv_get_gaussian_iir_store_tab(dst->mt_depth);
+    fv_gaussian_iir_axis_init(&gp.gp_x, sigma_x, src->mt_cols, ofs.pt_x,
+            whole.sz_width, border_type);
+    fv_gaussian_iir_axis_init(&gp.gp_y, sigma_y, src->mt_rows, ofs.pt_y,
+            whole.sz_height, border_type);
+
+    width = src->mt_cols*src->mt_nchannel;
+    gp.gp_buf_step = width;
+    gp.gp_buf = fv_alloc(gp.gp_y.ga_len*width*sizeof(*gp.gp_buf));
+    FV_ASSERT(gp.gp_buf != NULL);
+
+    fv_parallel_bands(gp.gp_y.ga_len, FV_GAUSSIAN_IIR_BAND_MIN_ROWS,
+            &gp.gp_band_rows, fv_gaussian_iir_rows, &gp);
+    njobs = (width + FV_GAUSSIAN_IIR_LANES - 1)/FV_GAUSSIAN_IIR_LANES;
+    fv_parallel_for(njobs, fv_gaussian_iir_columns, &gp);
+
+    fv_free(&gp.gp_buf);
+    fv_free(&gp.gp_y.ga_map);
+    fv_free(&gp.gp_x.ga_map);
+}
+
+/*
+ * Kernel sizes <= 0 follow from sigma (3 sigma each side for 8u, 4
+ * otherwise), sigma <= 0 from the kernel size, sigma_y <= 0 is
+ * sigma_x. When both sizes come from a sigma of at least
+ * FV_GAUSSIAN_IIR_MIN_SIGMA the recursive filter is used, otherwise
+ * the separable kernels go through the filter engine.
+ */
+void
+fv_gaussian_blur(fv_mat_t *dst, fv_mat_t *src, fv_size_t ksize,
+        double sigma_x, double sigma_y, fv_s32 border_type)
+{
+    fv_mat_t    *kx;
+    fv_mat_t    *ky;
+    double      nsigma;
+
+    if (sigma_y <= 0) {
+        sigma_y = sigma_x;
+    }
+
+    if (ksize.sz_width <= 0 && ksize.sz_height <= 0 &&
+            fv_min(sigma_x, sigma_y) >= FV_GAUSSIAN_IIR_MIN_SIGMA) {
+        fv_gaussian_blur_iir(dst, src, sigma_x, sigma_y, border_type);
+        return;
+    }
+
+    nsigma = src->mt_depth == FV_8U ? 3 : 4;
+    if (ksize.sz_width <= 0 && sigma_x > 0) {
+        ksize.sz_width = fv_round(sigma_x*nsigma*2 + 1) | 1;
+    }
+    if (ksize.sz_height <= 0 && sigma_y > 0) {
+        ksize.sz_height = fv_round(sigma_y*nsigma*2 + 1) | 1;
+    }
+
+    FV_ASSERT(ksize.sz_width > 0 && (ksize.sz_width & 0x1) &&
+            ksize.sz_height > 0 && (ksize.sz_height & 0x1));
+
+    kx = fv_get_gaussian_kernel(ksize.sz_width, sigma_x);
+    if (ksize.sz_height == ksize.sz_width &&
+            fabs(sigma_y - sigma_x) < DBL_EPSILON) {
+        ky = kx;
+    } else {
+        ky = fv_get_gaussian_kernel(ksize.sz_height, sigma_y);
+    }
+
+    fv_sep_filter2D(dst, src, kx, ky, fv_point(-1, -1), 0, border_type);
+    if (ky != kx) {
+        fv_release_mat(&ky);
+    }
+    fv_release_mat(&kx);
 }
 
 void
@@ -394,9 +1168,17 @@ fv_smooth(fv_image_t *dstarr, fv_image_t *srcarr, fv_u32 smooth_type,
 {
     fv_mat_t    dst;
     fv_mat_t    src;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
+    fv_s32      margin;
 
-    dst = fv_image_to_mat(dstarr);
-    src = fv_image_to_mat(srcarr);
+    /* the kernel is sized from sigma when param1 is 0 */
+    margin = fv_max(param1, param2)/2;
+    if (margin == 0) {
+        margin = fv_round(fv_max(param3, param4)*4) + 1;
+    }
+    src = fv_image_get_roi_view(srcarr, margin, &src_coi);
+    dst = fv_image_get_roi_view(dstarr, -1, &dst_coi);
  
     FV_ASSERT(dst.mt_total == src.mt_total &&
         (smooth_type == FV_BLUR_NO_SCALE || 
@@ -419,6 +1201,9 @@ fv_smooth(fv_image_t *dstarr, fv_image_t *srcarr, fv_u32 smooth_type,
         fv_bilateral_filter(&dst, &src, param1, param3, param4, 
                 FV_BORDER_REPLICATE);
     }
+
+    fv_image_put_roi_view(dstarr, &dst, &dst_coi);
+    fv_release_mat(&src_coi);
 }
 
 
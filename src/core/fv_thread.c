@@ -0,0 +1,172 @@
+#include <pthread.h>
+
+#include "fv_types.h"
+#include "fv_debug.h"
+#include "fv_math.h"
+#include "fv_thread.h"
+
+/*
+ * Shared worker pool. Workers are created on demand by
+ * fv_set_num_threads() and live until the process exits.
+ * fv_parallel_for() hands out the job indexes of one batch to the
+ * workers and to the calling thread, and returns once all of them
+ * are done. A call made while another batch is running (from a job
+ * or from a second thread) runs its jobs serially.
+ */
+typedef struct _fv_thread_pool_t {
+    pthread_t           tp_threads[FV_THREAD_MAX];
+    pthread_mutex_t     tp_run_lock;
+    pthread_mutex_t     tp_lock;
+    pthread_cond_t      tp_job_cond;
+    pthread_cond_t      tp_done_cond;
+    fv_thread_job_func  tp_func;
+    void                *tp_arg;
+    fv_s32              tp_nworkers;
+    fv_s32              tp_njobs;
+    fv_s32              tp_next;
+    fv_s32              tp_running;
+    fv_u32              tp_generation;
+} fv_thread_pool_t;
+
+static fv_thread_pool_t fv_thread_pool = {
+    .tp_run_lock = PTHREAD_MUTEX_INITIALIZER,
+    .tp_lock = PTHREAD_MUTEX_INITIALIZER,
+    .tp_job_cond = PTHREAD_COND_INITIALIZER,
+    .tp_done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static fv_s32 fv_num_threads = 1;
+
+static void
+fv_thread_run_jobs(fv_thread_pool_t *pool)
+{
+    fv_s32      index;
+
+    while ((index = __sync_fetch_and_add(&pool->tp_next, 1)) <
+            pool->tp_njobs) {
+        pool->tp_func(pool->tp_arg, index);
+    }
+}
+
+static void *
+fv_thread_worker(void *arg)
+{
+    fv_thread_pool_t    *pool = &fv_thread_pool;
+    fv_u32              generation = (fv_ulong)arg;
+
+    pthread_mutex_lock(&pool->tp_lock);
+    for (;;) {
+        while (pool->tp_generation == generation) {
+            pthread_cond_wait(&pool->tp_job_cond, &pool->tp_lock);
+        }
+        generation = pool->tp_generation;
+        pthread_mutex_unlock(&pool->tp_lock);
+
+        fv_thread_run_jobs(pool);
+
+        pthread_mutex_lock(&pool->tp_lock);
+        if (--pool->tp_running == 0) {
+            pthread_cond_signal(&pool->tp_done_cond);
+        }
+    }
+
+    return NULL;
+}
+
+void
+fv_set_num_threads(fv_s32 num)
+{
+    fv_thread_pool_t    *pool = &fv_thread_pool;
+    fv_ulong            generation;
+    fv_s32              ret;
+
+    num = fv_max(fv_min(num, FV_THREAD_MAX), 1);
+
+    pthread_mutex_lock(&pool->tp_run_lock);
+    pthread_mutex_lock(&pool->tp_lock);
+    generation = pool->tp_generation;
+    for (; pool->tp_nworkers < num - 1; pool->tp_nworkers++) {
+        ret = pthread_create(&pool->tp_threads[pool->tp_nworkers], NULL,
+                fv_thread_worker, (void *)generation);
+        if (ret != 0) {
+            break;
+        }
+        pthread_detach(pool->tp_threads[pool->tp_nworkers]);
+    }
+    fv_num_threads = fv_min(num, pool->tp_nworkers + 1);
+    pthread_mutex_unlock(&pool->tp_lock);
+    pthread_mutex_unlock(&pool->tp_run_lock);
+}
+
+fv_s32
+fv_get_num_threads(void)
+{
+    return fv_num_threads;
+}
+
+void
+fv_parallel_for(fv_s32 njobs, fv_thread_job_func func, void *arg)
+{
+    fv_thread_pool_t    *pool = &fv_thread_pool;
+    fv_s32              i;
+
+    if (njobs <= 1 || fv_num_threads <= 1 ||
+            pthread_mutex_trylock(&pool->tp_run_lock) != 0) {
+        for (i = 0; i < njobs; i++) {
+            func(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->tp_lock);
+    pool->tp_func = func;
+    pool->tp_arg = arg;
+    pool->tp_njobs = njobs;
+    pool->tp_next = 0;
+    pool->tp_running = pool->tp_nworkers;
+    pool->tp_generation++;
+    pthread_cond_broadcast(&pool->tp_job_cond);
+    pthread_mutex_unlock(&pool->tp_lock);
+
+    fv_thread_run_jobs(pool);
+
+    pthread_mutex_lock(&pool->tp_lock);
+    while (pool->tp_running > 0) {
+        pthread_cond_wait(&pool->tp_done_cond, &pool->tp_lock);
+    }
+    pthread_mutex_unlock(&pool->tp_lock);
+    pthread_mutex_unlock(&pool->tp_run_lock);
+}
+
+/*
+ * Bands to split rows into: one per thread at most, none shorter than
+ * min_rows unless there is only one.
+ */
+fv_s32
+fv_get_num_bands(fv_s32 rows, fv_s32 min_rows)
+{
+    fv_s32      nbands;
+
+    nbands = fv_min(fv_num_threads, rows/min_rows);
+
+    return fv_max(nbands, 1);
+}
+
+/*
+ * Run func on the bands of rows: job index covers rows
+ * index*band_rows on. *band_rows is set before any job starts, the
+ * number of bands, none of them empty, is returned.
+ */
+fv_s32
+fv_parallel_bands(fv_s32 rows, fv_s32 min_rows, fv_s32 *band_rows,
+            fv_thread_job_func func, void *arg)
+{
+    fv_s32      nbands;
+
+    nbands = fv_get_num_bands(rows, min_rows);
+    *band_rows = fv_max((rows + nbands - 1)/nbands, 1);
+    nbands = (rows + *band_rows - 1)/(*band_rows);
+    fv_parallel_for(nbands, func, arg);
+
+    return nbands;
+}
@@ -72,14 +72,17 @@ fv_get_thresh_val_otsu_8u(fv_mat_t *mat)
     double      total_num;
     fv_u32      i;
     fv_u32      j;
+    fv_s32      y;
 
     FV_ASSERT(mat->mt_atr == FV_8UC1);
 
-    src = mat->mt_data.dt_ptr;
     total_num = mat->mt_total;
     fv_time_meter_set(FV_TIME_METER2);
-    for (j = 0; j < total_num; j++) {
-        dist[src[j]]++;
+    for (y = 0; y < mat->mt_rows; y++) {
+        src = mat->mt_data.dt_ptr + y*mat->mt_step;
+        for (j = 0; j < mat->mt_cols; j++) {
+            dist[src[j]]++;
+        }
     }
     fv_time_meter_get(FV_TIME_METER2, 0);
 
@@ -263,6 +266,8 @@ _fv_threshold(fv_mat_t *dst, fv_mat_t *src, double thresh,
 {
     fv_threshold_func   func;
     fv_s32              total;
+    fv_s32              rows;
+    fv_s32              y;
     fv_bool             use_otsu;
 
     FV_ASSERT(dst->mt_rows == src->mt_rows &&
@@ -281,10 +286,20 @@ _fv_threshold(fv_mat_t *dst, fv_mat_t *src, double thresh,
     func = fv_get_threshold_tab(src->mt_depth);
     FV_ASSERT(func != NULL);
 
-    total = dst->mt_total*FV_MAT_NCHANNEL(dst);
-    func(dst->mt_data.dt_ptr, src->mt_data.dt_ptr, total, 
-        thresh, max_value, type,
-        fv_thresh_proc[type].tp_get_value);
+    /* ROI views are done row by row */
+    total = dst->mt_cols*FV_MAT_NCHANNEL(dst);
+    rows = dst->mt_rows;
+    if (dst->mt_step == total*FV_MAT_ELEM_SIZE(dst) && 
+            src->mt_step == total*FV_MAT_ELEM_SIZE(src)) {
+        total *= rows;
+        rows = 1;
+    }
+    for (y = 0; y < rows; y++) {
+        func(dst->mt_data.dt_ptr + y*dst->mt_step, 
+            src->mt_data.dt_ptr + y*src->mt_step, total, 
+            thresh, max_value, type,
+            fv_thresh_proc[type].tp_get_value);
+    }
 }
 
 void 
@@ -293,8 +308,12 @@ fv_threshold(fv_image_t *dst, fv_image_t *src, double thresh,
 {
     fv_mat_t    _dst;
     fv_mat_t    _src;
+    fv_mat_t    *dst_coi;
+    fv_mat_t    *src_coi;
 
-    _dst = fv_image_to_mat(dst);
-    _src = fv_image_to_mat(src);
+    _src = fv_image_get_roi_view(src, 0, &src_coi);
+    _dst = fv_image_get_roi_view(dst, -1, &dst_coi);
     _fv_threshold(&_dst, &_src, thresh, max_value, type);
+    fv_image_put_roi_view(dst, &_dst, &dst_coi);
+    fv_release_mat(&src_coi);
 }
@@ -9,8 +9,38 @@ typedef struct _fv_border_value_t {
 typedef void (*fv_border_make_row_func)(void *, void *, fv_u32, fv_s32, 
             fv_s32, fv_u32, fv_s32,  fv_s32, fv_s32);
 
+#define FV_BORDER_MAP_ZERO          fv_int_min
+
+/*
+ * Where the rows of a filter reaching bm_left pixels left and
+ * bm_right pixels right come from: rows and columns past a view are
+ * read from the matrix around it, the border starts past that.
+ * bm_xmap holds the bm_left columns left of the view, then the
+ * bm_right right of it, FV_BORDER_MAP_ZERO for zeros.
+ */
+typedef struct _fv_border_map_t {
+    fv_s32          bm_left;
+    fv_s32          bm_right;
+    fv_s32          bm_border_type;
+    fv_bool         bm_isolated;    /* ignore ROI neighbours */
+    fv_s32          bm_rows;
+    fv_s32          bm_cols;
+    fv_s32          bm_pix;
+    fv_size_t       bm_whole;
+    fv_point_t      bm_ofs;
+    fv_s32          *bm_xmap;
+} fv_border_map_t;
+
 extern fv_s32 fv_border_get_value(fv_u32 border_type, 
             fv_s32 index, fv_s32 border);
 extern fv_border_make_row_func fv_border_get_func(fv_u32 depth);
+extern void fv_border_map_init(fv_border_map_t *bm, fv_mat_t *src,
+            fv_s32 left, fv_s32 right, fv_s32 border_type);
+extern void fv_border_map_rebind(fv_border_map_t *bm, fv_mat_t *src);
+extern void fv_border_map_release(fv_border_map_t *bm);
+extern fv_s32 fv_border_map_y(fv_border_map_t *bm, fv_s32 y);
+extern void fv_border_map_row(fv_border_map_t *bm, fv_u8 *d, fv_u8 *s);
+extern void fv_border_map_read(fv_border_map_t *bm, fv_mat_t *src,
+            fv_u8 *d, fv_s32 y);
 
 #endif
@@ -24,5 +24,14 @@ extern void fv_mset(fv_mat_t *mat, fv_s32 row, fv_s32 col,
 extern fv_mat_t *fv_mat_extract_image_coi(fv_image_t *image);
 extern void fv_convert_mat(fv_mat_t *dst, fv_mat_t *src);
 extern void fv_get_sub_rect(fv_mat_t *submat, fv_mat_t *src, fv_rect_t rect);
+extern void fv_mat_get_roi_view(fv_mat_t *view, fv_mat_t *src, 
+            fv_rect_t rect);
+extern void fv_mat_locate_roi(fv_mat_t *mat, fv_size_t *whole, 
+            fv_point_t *ofs);
+extern fv_mat_t fv_image_roi_to_mat(fv_image_t *image);
+extern fv_mat_t fv_image_get_roi_view(fv_image_t *image, fv_s32 margin, 
+            fv_mat_t **coi_buf);
+extern void fv_image_put_roi_view(fv_image_t *image, fv_mat_t *view, 
+            fv_mat_t **coi_buf);
 
 #endif
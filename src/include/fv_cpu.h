@@ -0,0 +1,12 @@
+#ifndef __FV_CPU_H__
+#define __FV_CPU_H__
+
+#define FV_CPU_SSE2         0x0001
+#define FV_CPU_AVX2         0x0002
+
+extern fv_u32 fv_cpu_features(void);
+extern fv_bool fv_cpu_has(fv_u32 feature);
+extern void fv_set_use_optimized(fv_bool on);
+extern fv_bool fv_use_optimized(void);
+
+#endif
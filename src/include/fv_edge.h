@@ -1,6 +1,9 @@
 #ifndef __FV_EDGE_H__
 #define __FV_EDGE_H__
 
+/* or'ed into the aperture size: Canny on sqrt(dx^2 + dy^2), not |dx| + |dy| */
+#define FV_CANNY_L2_GRADIENT    ((fv_s32)(1u << 31))
+
 extern void _fv_sobel(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, 
                 fv_s32 dx, fv_s32 dy, fv_s32 ksize, 
                 double scale, double delta, fv_s32 border_type);
@@ -9,13 +12,25 @@ extern void fv_sobel(fv_image_t *dst, fv_image_t *src, fv_s32 dx,
 extern void _fv_scharr(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth, 
                 fv_s32 dx, fv_s32 dy, double scale, 
                 double delta, fv_s32 border_type);
+extern void _fv_sobel_dxdy(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, 
+                fv_s32 ddepth, fv_s32 ksize, double scale, 
+                double delta, fv_s32 border_type);
+extern void _fv_scharr_dxdy(fv_mat_t *dx, fv_mat_t *dy, fv_mat_t *src, 
+                fv_s32 ddepth, double scale, double delta, 
+                fv_s32 border_type);
+extern void fv_laplacian(fv_mat_t *dst, fv_mat_t *src, fv_u16 ddepth, 
+                fv_s32 ksize, double scale, double delta, 
+                fv_s32 border_type);
 extern void fv_laplace(fv_image_t *dst, fv_image_t *src, fv_s32 aperture_size);
 extern void _fv_canny(fv_mat_t *dst, fv_mat_t *src, double low_thresh, 
                 double high_thresh, fv_s32 aperture_size);
 extern void fv_canny(fv_image_t *dst, fv_image_t *src, double thresh1,
             double thresh2, fv_s32 aperture_size);
 extern fv_s32 fv_cv_sobel(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_sobel_8u16s(IplImage *cv_img, fv_bool image);
 extern fv_s32 fv_cv_laplace(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_laplacian(IplImage *cv_img, fv_bool image);
 extern fv_s32 fv_cv_canny(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_canny_threads(IplImage *cv_img, fv_bool image);
 
 #endif
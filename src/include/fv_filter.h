@@ -2,6 +2,7 @@
 #define __FV_FILTER_H__
 
 #include "fv_debug.h"
+#include "fv_border.h"
 
 struct _fv_base_filter_t;
 struct _fv_base_row_filter_t;
@@ -10,13 +11,47 @@ struct _fv_base_column_filter_t;
 typedef void (*fv_filter_2D_func)(void *dst, void *src, fv_s32, 
             fv_s32 , float *, fv_u32 cn, struct _fv_base_filter_t *);
 
-typedef void (*fv_row_filter_func)(double *dst, void *src, fv_s32, 
+/* 
+ * Row filters write rows of the engine buffer type (fe_buf_depth),
+ * column filters read them.
+ */
+typedef void (*fv_row_filter_func)(void *dst, void *src, fv_s32, 
             float *, struct _fv_base_row_filter_t *);
-typedef void (*fv_column_filter_func)(void *dst, double **src, fv_s32, 
+typedef void (*fv_column_filter_func)(void *dst, void **src, fv_s32, 
             fv_s32 , float *, struct _fv_base_column_filter_t *);
 
+/*
+ * Optional vector parts of the linear filters for one row: they
+ * return how many of the width*cn elements they wrote and the scalar
+ * loop finishes the row. A column vector op gets src[0] at the anchor
+ * row, ky_data at the center tap and ksize as the half size.
+ */
+typedef fv_s32 (*fv_row_vec_func)(void *dst, void *src, fv_s32 width,
+            float *kx_data, fv_s32 ksize, fv_s32 cn);
+typedef fv_s32 (*fv_column_vec_func)(void *dst, void **src, fv_s32 width,
+            float *ky_data, fv_s32 ksize, fv_bool symmetrical);
+
+/*
+ * Filters that keep per-pass state (running sums, row pointer
+ * scratch) provide clone/release, so that every row band of a
+ * parallel pass works on its own copy. Stateless filters leave
+ * them NULL and are shared.
+ */
+typedef struct _fv_base_filter_t *(*fv_filter_2D_clone_func)(
+            struct _fv_base_filter_t *);
+typedef void (*fv_filter_2D_release_func)(struct _fv_base_filter_t *);
+typedef struct _fv_base_column_filter_t *(*fv_column_filter_clone_func)(
+            struct _fv_base_column_filter_t *);
+typedef void (*fv_column_filter_release_func)(
+            struct _fv_base_column_filter_t *);
+/* Drop the state left by the previous pass, before a band starts */
+typedef void (*fv_column_filter_reset_func)(
+            struct _fv_base_column_filter_t *);
+
 typedef struct _fv_base_filter_t {
     fv_filter_2D_func       bf_filter;
+    fv_filter_2D_clone_func bf_clone;
+    fv_filter_2D_release_func   bf_release;
     fv_point_t              bf_anchor;
     fv_size_t               bf_ksize;
 } fv_base_filter_t;
@@ -30,6 +65,9 @@ typedef struct _fv_base_row_filter_t {
 
 typedef struct _fv_base_column_filter_t {
     fv_column_filter_func   bc_filter;
+    fv_column_filter_clone_func     bc_clone;
+    fv_column_filter_release_func   bc_release;
+    fv_column_filter_reset_func     bc_reset;
     fv_s32                  bc_anchor;
     fv_s32                  bc_ksize;
     fv_s32                  bc_type;
@@ -42,6 +80,7 @@ typedef struct _fv_linear_row_filter_t {
 #define lr_ksize    lr_base.br_ksize    
 #define lr_type     lr_base.br_type     
     fv_u32                  lr_cn;
+    fv_row_vec_func         lr_vec;
 } fv_linear_row_filter_t;
 
 typedef struct _fv_linear_column_filter_t {
@@ -51,11 +90,15 @@ typedef struct _fv_linear_column_filter_t {
 #define lc_ksize    lc_base.bc_ksize    
 #define lc_type     lc_base.bc_type     
     fv_u32                  lc_cn;
+    fv_s32                  lc_shift;   /* fixed point fraction bits */
+    fv_column_vec_func      lc_vec;
 } fv_linear_column_filter_t;
 
 typedef struct _fv_filter_2D_t {
     fv_base_filter_t        ft_base;
 #define ft_filter           ft_base.bf_filter
+#define ft_clone            ft_base.bf_clone
+#define ft_release          ft_base.bf_release
 #define ft_anchor           ft_base.bf_anchor
 #define ft_ksize            ft_base.bf_ksize
     fv_u32                  ft_nchannels;
@@ -63,13 +106,78 @@ typedef struct _fv_filter_2D_t {
     fv_point_t              *ft_coords;
     double                  *ft_coeffs;
     void                    *ft_ptrs;
+    double                  ft_delta;
 } fv_filter_2D_t;
 
+/*
+ * Scratch of one row band: ky rows + FV_SEP_FILTER_OUTPUT_LINE_NUM
+ * ring rows carved out of the single block fb_ring, the bordered
+ * source row and the band's own copies of stateful filters. When
+ * filtering in place, fb_saved keeps the ky - 1 source rows around
+ * destination rows [fb_y0, fb_y1) that other bands or the bottom
+ * border would otherwise read after they are written. Dual engines
+ * keep the ring of their second output behind the first one in
+ * fb_ring, fb_rows2 pointing into fb_rows.
+ */
+typedef struct _fv_filter_band_t {
+    fv_base_filter_t            *fb_filter_2D;
+    fv_base_column_filter_t     *fb_col_filter;
+    fv_base_column_filter_t     *fb_col_filter2;
+    void                        **fb_rows;
+    void                        **fb_rows2;
+    fv_u8                       *fb_ring;
+    void                        *fb_src_buf;
+    fv_u8                       *fb_saved;
+    fv_s32                      fb_y0;
+    fv_s32                      fb_y1;
+} fv_filter_band_t;
+
+struct _fv_filter_engine_t;
+typedef void (*fv_filter_engine_release_func)(struct _fv_filter_engine_t *);
+
+/*
+ * A filter planned once for frames of one width, channel count and
+ * depth pair: kernels, coordinate tables and band scratch are kept
+ * until fv_release_filter_engine(), so fv_filter_engine_apply() does
+ * not allocate once the bands it needs exist. dst may be src: rows
+ * are consumed through the ring buffer before they are overwritten,
+ * so filtering in place costs ksize.height - 1 saved rows per band
+ * rather than a copy of the frame. A dual engine runs a second pair
+ * of separable kernels over the same bordered source rows, writing a
+ * second destination in the same pass. When src is a view into a
+ * larger matrix (an image ROI), pixels around the view are read as
+ * they are and the border only extends the whole matrix, unless
+ * FV_BORDER_ISOLATED is set. fe_release frees the object holding the
+ * engine and its filters.
+ */
 typedef struct _fv_filter_engine_t {
     fv_base_filter_t            *fe_filter_2D;
     fv_base_row_filter_t        *fe_row_filter;
     fv_base_column_filter_t     *fe_col_filter;
+    fv_base_row_filter_t        *fe_row_filter2;    /* dual engines */
+    fv_base_column_filter_t     *fe_col_filter2;
+    fv_u32                      fe_buf_depth;   /* FV_8U ... FV_64F */
     fv_bool                     fe_is_separable;
+    fv_filter_engine_release_func   fe_release;
+    float                       *fe_kx_data;
+    float                       *fe_ky_data;
+    float                       *fe_kx2_data;
+    float                       *fe_ky2_data;
+    fv_size_t                   fe_ksize;
+    fv_point_t                  fe_anchor;
+    double                      fe_delta;
+    fv_u32                      fe_src_depth;
+    fv_u32                      fe_dst_depth;
+    fv_u32                      fe_nchannel;
+    fv_s32                      fe_width;
+    fv_border_map_t             fe_border;      /* rows and columns of src */
+    fv_bool                     fe_zero_copy;
+    fv_s32                      fe_strip_width;
+    fv_u32                      fe_src_buf_len;
+    fv_u32                      fe_buf_step;
+    fv_s32                      fe_buf_rows;
+    fv_filter_band_t            *fe_bands;
+    fv_s32                      fe_nbands;
 } fv_filter_engine_t;
 
 static inline void 
@@ -93,19 +201,42 @@ fv_normalize_anchor(fv_point_t anchor, fv_size_t ksize)
     return _anchor;
 }
 
-extern void fv_sep_filter_proceed(fv_mat_t *dst, fv_mat_t *src,
-                fv_mat_t *kernel, fv_mat_t *kernel_x, fv_mat_t *kernel_y,
-                fv_point_t anchor, double delta, fv_s32 border_type, 
-                fv_filter_engine_t *filter);
+extern void fv_init_filter_engine(fv_filter_engine_t *filter,
+                fv_mat_t *dst, fv_mat_t *src, fv_size_t ksize,
+                fv_point_t anchor, double delta, fv_s32 border_type);
+extern void fv_filter_engine_apply(fv_filter_engine_t *filter,
+                fv_mat_t *dst, fv_mat_t *src);
+extern void fv_filter_engine_apply_dual(fv_filter_engine_t *filter,
+                fv_mat_t *dst, fv_mat_t *dst2, fv_mat_t *src);
+extern void fv_release_filter_engine(fv_filter_engine_t **filter);
+extern fv_filter_engine_t *fv_create_sep_filter_engine(fv_mat_t *dst,
+                fv_mat_t *src, fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_point_t anchor, double delta, fv_s32 border_type);
+extern fv_filter_engine_t *fv_create_dual_sep_filter_engine(
+                fv_mat_t *dst, fv_mat_t *dst2, fv_mat_t *src, 
+                fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_mat_t *kernel_x2, fv_mat_t *kernel_y2, 
+                fv_point_t anchor, double delta, fv_s32 border_type);
+extern fv_filter_engine_t *fv_create_linear_filter_engine(fv_mat_t *dst,
+                fv_mat_t *src, fv_mat_t *kernel, fv_point_t anchor, 
+                double delta, fv_s32 border_type);
 extern void fv_filter2D(fv_mat_t *dst, fv_mat_t *src, fv_u16 depth,
                 fv_mat_t *kernel, fv_point_t anchor, 
                 double delta, fv_s32 border_type);
 extern void fv_sep_filter2D(fv_mat_t *dst, fv_mat_t *src,
                 fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
                 fv_point_t anchor, double delta, fv_s32 border_type);
+extern void fv_sep_filter2D_dual(fv_mat_t *dst, fv_mat_t *dst2, 
+                fv_mat_t *src, fv_mat_t *kernel_x, fv_mat_t *kernel_y, 
+                fv_mat_t *kernel_x2, fv_mat_t *kernel_y2, 
+                fv_point_t anchor, double delta, fv_s32 border_type);
 extern void fv_sep_conv_small3_32f(float *dst, fv_s32 dst_step, 
             float *src, fv_s32 src_step, fv_size_t src_size, 
             float *kx, float *ky, float *buffer);
+extern fv_row_vec_func fv_get_row_vec(fv_u32 bdepth, fv_u32 sdepth,
+            float *kx_data, fv_s32 ksize);
+extern fv_column_vec_func fv_get_column_vec(fv_u32 bdepth, fv_u32 ddepth,
+            float *ky_data, fv_s32 ksize, fv_s32 type);
 extern void fv_preprocess_2D_kernel(fv_mat_t *kernel,
             fv_point_t **coords, double **coeffs, fv_u32 nz);
 
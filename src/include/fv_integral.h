@@ -0,0 +1,15 @@
+#ifndef __FV_INTEGRAL_H__
+#define __FV_INTEGRAL_H__
+
+#include <opencv/cv.h>  
+#include <opencv/highgui.h>
+
+extern void fv_integral(fv_mat_t *sum, fv_mat_t *sqsum, fv_mat_t *tilted,
+            fv_mat_t *src);
+extern double fv_integral_rect_sum(fv_mat_t *sum, fv_rect_t rect,
+            fv_s32 channel);
+extern void fv_box_filter_integral(fv_mat_t *dst, fv_mat_t *sum,
+            fv_size_t ksize, fv_point_t anchor, fv_bool normalize);
+extern fv_s32 fv_cv_integral(IplImage *cv_img, fv_bool image);
+
+#endif
@@ -18,6 +18,7 @@
 
 #define fv_min(a, b) ((a) < (b) ? (a) : (b))
 #define fv_max(a, b) ((a) > (b) ? (a) : (b))
+#define fv_round(v) ((fv_s32)lrint(v))
 #define fv_swap(a, b) \
     do { \
         double  t; \
@@ -281,7 +282,94 @@ fv_num_map(fv_u32 n, fv_u8 b)
      return ret;
 }
 
+/*
+ * atan(t) for t in [0, 1] in degrees, a minimax odd polynomial: off
+ * by less than 0.01 degrees.
+ */
+#define FV_ATAN2_P1     (0.9997878412794807*180/fv_pi)
+#define FV_ATAN2_P3     (-0.3258083974640975*180/fv_pi)
+#define FV_ATAN2_P5     (0.1555786518463281*180/fv_pi)
+#define FV_ATAN2_P7     (-0.04432655554792128*180/fv_pi)
+
+static inline fv_s32
+fv_float_bits(float f)
+{
+    union {
+        float   f;
+        fv_s32  i;
+    } u;
+
+    u.f = f;
+    return u.i;
+}
+
+static inline float
+fv_bits_float(fv_s32 i)
+{
+    union {
+        float   f;
+        fv_s32  i;
+    } u;
+
+    u.i = i;
+    return u.f;
+}
+
+/*
+ * atan2(y, x) in degrees, in [0, 360], 0 for x = y = 0. The octant
+ * comes from the bits of x and y and is picked by arithmetic, not
+ * branches, so loops over it vectorize.
+ */
+static inline float
+fv_fast_atan2(float y, float x)
+{
+    fv_s32      xb = fv_float_bits(x);
+    fv_s32      yb = fv_float_bits(y);
+    fv_s32      ax = xb & 0x7fffffff;
+    fv_s32      ay = yb & 0x7fffffff;
+    fv_s32      swap = ax < ay;
+    float       t;
+    float       t2;
+    float       a;
+    float       s;
+
+    /* non-negative floats order like their bits */
+    t = fv_bits_float(swap ? ax : ay)/
+        (fv_bits_float(swap ? ay : ax) + FLT_MIN);
+    t2 = t*t;
+    a = ((((float)FV_ATAN2_P7*t2 + (float)FV_ATAN2_P5)*t2 +
+                (float)FV_ATAN2_P3)*t2 + (float)FV_ATAN2_P1)*t;
+    s = swap;
+    a = s*90 + (1 - 2*s)*a;
+    s = (xb < 0) & (ax != 0);
+    a = s*180 + (1 - 2*s)*a;
+    s = (yb < 0) & (ay != 0);
+
+    return s*360 + (1 - 2*s)*a;
+}
+
+/*
+ * 1/sqrt(v): the bit trick seed and two Newton steps. For normal v,
+ * v*fv_fast_rsqrt(v) is off from sqrt(v) by 4.8e-6 relative at most;
+ * subnormal v are not covered. Finite for v = 0, so v*fv_fast_rsqrt(v)
+ * is 0 there.
+ */
+static inline float
+fv_fast_rsqrt(float v)
+{
+    float       r;
+
+    r = fv_bits_float(0x5f375a86 - (fv_float_bits(v) >> 1));
+    r *= 1.5f - 0.5f*v*r*r;
+    r *= 1.5f - 0.5f*v*r*r;
+
+    return r;
+}
 
 extern void fv_pow(fv_mat_t *dst, fv_mat_t *src, double pow);
+extern void fv_cart_to_polar(fv_mat_t *mag, fv_mat_t *angle, fv_mat_t *x,
+            fv_mat_t *y, fv_bool angle_in_degrees);
+extern void fv_cart_to_polar_bins(fv_mat_t *mag, fv_mat_t *bins,
+            fv_mat_t *x, fv_mat_t *y, fv_s32 nbins, fv_bool oriented);
 
 #endif
@@ -17,5 +17,6 @@ extern void _fv_min_max_loc(fv_mat_t *img, double *min_val, double *max_val,
 extern void fv_min_max_loc(fv_arr *arr, double *min_val, double *max_val,
         fv_point_t* min_loc, fv_point_t* max_loc, fv_arr *mask);
 extern fv_s32 fv_cv_min_max_loc(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_cart_to_polar(IplImage *cv_img, fv_bool image);
 
 #endif
@@ -23,16 +23,15 @@ enum {
     FV_SHAPE_CUSTOM = 100,
 };
 
-typedef double (*fv_morph_op_func)(double, double);
-
 typedef struct _fv_morphology_filter_2D_t {
     fv_base_filter_t        mf_base;
 #define mf_filter           mf_base.bf_filter
+#define mf_clone            mf_base.bf_clone
+#define mf_release          mf_base.bf_release
 #define mf_anchor           mf_base.bf_anchor
 #define mf_ksize            mf_base.bf_ksize
     fv_u32                  mf_nchannels;
     fv_u32                  mf_nz;
-    fv_morph_op_func        mf_op;
     fv_point_t              *mf_coords;
     double                  *mf_coeffs;
     void                    *mf_ptrs;
@@ -45,30 +44,50 @@ typedef struct _fv_morphology_row_filter_t {
 #define mr_ksize            mr_base.br_ksize
 #define mr_type             mr_base.br_type
     fv_u32                  mr_nchannels;
-    fv_morph_op_func        mr_op;
 } fv_morphology_row_filter_t;
 
+/*
+ * The van Herk/Gil-Werman column filter keeps the prefix of the next
+ * block of ksize rows and the suffixes of the current one in mc_buf,
+ * mc_count being the position of the next window in the block.
+ */
 typedef struct _fv_morphology_column_filter_t {
     fv_base_column_filter_t mc_base;
 #define mc_filter           mc_base.bc_filter
+#define mc_clone            mc_base.bc_clone
+#define mc_release          mc_base.bc_release
+#define mc_reset            mc_base.bc_reset
 #define mc_anchor           mc_base.bc_anchor
 #define mc_ksize            mc_base.bc_ksize
 #define mc_type             mc_base.bc_type
     fv_u32                  mc_nchannels;
-    fv_morph_op_func        mc_op;
+    void                    *mc_buf;
+    fv_u32                  mc_buf_step;
+    fv_s32                  mc_count;
 } fv_morphology_column_filter_t;
 
 
+extern fv_filter_engine_t *fv_create_morph_filter_engine(fv_s32 op,
+            fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel, 
+            fv_point_t anchor, fv_u32 border_type);
 extern void _fv_dilate(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel, 
             fv_point_t anchor, fv_s32 iterations, fv_u32 border_type);
+extern void _fv_erode(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *kernel, 
+            fv_point_t anchor, fv_s32 iterations, fv_u32 border_type);
 extern void fv_dilate(fv_image_t *dst, fv_image_t *src,
             fv_conv_kernel_t *element, fv_s32 iterations);
 extern void fv_erode(fv_image_t *dst, fv_image_t *src, 
             fv_conv_kernel_t *element, fv_s32 iterations);
 extern void  fv_dilate_default(fv_mat_t *dst, fv_mat_t *src, 
              fv_mat_t *kernel);
+extern void _fv_morphology_ex(fv_mat_t *dst, fv_mat_t *src, fv_s32 op, 
+            fv_mat_t *kernel, fv_point_t anchor, fv_s32 iterations, 
+            fv_u32 border_type);
+extern void fv_morphology_ex(fv_image_t *dst, fv_image_t *src, 
+            fv_conv_kernel_t *element, fv_s32 operation, fv_s32 iterations);
 extern fv_s32 fv_cv_dilate(IplImage *cv_img, fv_bool image);
 extern fv_s32 fv_cv_erode(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_morphology_ex(IplImage *cv_img, fv_bool image);
 extern fv_conv_kernel_t *fv_create_structuring_element_ex(fv_s32 cols,
             fv_s32 rows, fv_s32 anchor_x, fv_s32 anchor_y,
             fv_s32 shape, fv_s32 *values);
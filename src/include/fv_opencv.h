@@ -11,5 +11,8 @@ extern fv_s32 fv_cv_detect_video(char *vd_file, fv_proc_func proc);
 extern fv_s32 fv_cv_detect_camera(char *vd_file, fv_proc_func proc);
 extern fv_s32 fv_cv_save_img(char *file_name, fv_mat_t *mat);
 extern void fv_cv_img_to_ipl(IplImage *cv_img, fv_image_t *img);
+extern fv_mat_t fv_cv_ipl_to_mat(IplImage *cv_img);
+extern fv_s32 fv_cv_img_diff(IplImage *a, IplImage *b, fv_s32 margin,
+            double tol, double *max_diff);
 
 #endif
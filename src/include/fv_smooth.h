@@ -18,22 +18,45 @@ typedef struct _fv_sum_row_filter_t {
 typedef struct _fv_sum_column_filter_t {
     fv_base_column_filter_t sc_base;
 #define sc_filter           sc_base.bc_filter
+#define sc_clone            sc_base.bc_clone
+#define sc_release          sc_base.bc_release
+#define sc_reset            sc_base.bc_reset
 #define sc_anchor           sc_base.bc_anchor
 #define sc_ksize            sc_base.bc_ksize
 #define sc_type             sc_base.bc_type
     fv_u32                  sc_nchannels;
     double                  *sc_sum;
+    fv_u32                  sc_sum_width;
     fv_u32                  sc_sum_count;
     double                  sc_scale;
 } fv_sum_column_filter_t;
 
 
+extern fv_filter_engine_t *fv_create_box_filter_engine(fv_mat_t *dst,
+                fv_mat_t *src, fv_size_t ksize, fv_point_t anchor, 
+                fv_bool normalize, fv_s32 border_type);
 extern void fv_box_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 ddepth,
                 fv_size_t ksize, fv_point_t anchor, 
                 fv_bool normalize, fv_s32 border_type);
+extern fv_mat_t *fv_get_gaussian_kernel(fv_s32 n, double sigma);
+extern void fv_gaussian_blur(fv_mat_t *dst, fv_mat_t *src, fv_size_t ksize,
+                double sigma_x, double sigma_y, fv_s32 border_type);
+extern void fv_gaussian_blur_iir(fv_mat_t *dst, fv_mat_t *src, 
+                double sigma_x, double sigma_y, fv_s32 border_type);
+extern void fv_median_blur(fv_mat_t *dst, fv_mat_t *src, fv_s32 ksize);
+extern void fv_bilateral_filter(fv_mat_t *dst, fv_mat_t *src, fv_s32 d,
+                double sigma_color, double sigma_space, fv_s32 border_type);
+extern void fv_bilateral_grid(fv_mat_t *dst, fv_mat_t *src,
+                double sigma_color, double sigma_space, fv_s32 border_type);
+extern void fv_guided_filter(fv_mat_t *dst, fv_mat_t *src, fv_mat_t *guide,
+                fv_s32 radius, double eps);
 extern void fv_smooth(fv_image_t *dstarr, fv_image_t *srcarr, 
             fv_u32 smooth_type, fv_s32 param1, fv_s32 param2, 
             double param3, double param4);
 extern fv_s32 fv_cv_smooth(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_gaussian(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_median(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_bilateral(IplImage *cv_img, fv_bool image);
+extern fv_s32 fv_cv_guided(IplImage *cv_img, fv_bool image);
 
 #endif
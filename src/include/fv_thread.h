@@ -0,0 +1,18 @@
+#ifndef __FV_THREAD_H__
+#define __FV_THREAD_H__
+
+#define FV_THREAD_MAX       64
+
+/*
+ * @index: job number in [0, njobs), every job is run exactly once
+ */
+typedef void (*fv_thread_job_func)(void *arg, fv_s32 index);
+
+extern void fv_set_num_threads(fv_s32 num);
+extern fv_s32 fv_get_num_threads(void);
+extern void fv_parallel_for(fv_s32 njobs, fv_thread_job_func func, void *arg);
+extern fv_s32 fv_get_num_bands(fv_s32 rows, fv_s32 min_rows);
+extern fv_s32 fv_parallel_bands(fv_s32 rows, fv_s32 min_rows,
+            fv_s32 *band_rows, fv_thread_job_func func, void *arg);
+
+#endif
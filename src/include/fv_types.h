@@ -255,6 +255,13 @@ typedef struct _fv_mat_t {
         fv_s32      mt_cols;
         fv_s32      mt_width;
     };
+
+    /* 
+     * ROI views: offset of the view in the whole matrix it was taken
+     * from and the size of that matrix, 0x0 for a whole matrix
+     */
+    fv_point_t  mt_roi_ofs;
+    fv_size_t   mt_whole;
 } fv_mat_t;
 
 #define FV_MAT_DEPTH(mat) ((mat)->mt_idepth)
@@ -279,6 +286,8 @@ fv_init_mat_header(fv_mat_t *arr, fv_s32 rows, fv_s32 cols,
     arr->mt_data.dt_ptr = data;
     arr->mt_refcount = NULL;
     arr->mt_hdr_refcount = 1;
+    arr->mt_roi_ofs.pt_x = arr->mt_roi_ofs.pt_y = 0;
+    arr->mt_whole.sz_width = arr->mt_whole.sz_height = 0;
 
     switch (arr->mt_idepth) {
         case FV_DEPTH_1U:
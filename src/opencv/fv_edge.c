@@ -5,6 +5,7 @@
 #include "fv_edge.h"
 #include "fv_debug.h"
 #include "fv_time.h"
+#include "fv_thread.h"
 
 #define FV_SOBEL_WIN_NAME   "sobel"
 #define FV_LAPLACE_WIN_NAME "laplace"
@@ -15,6 +16,7 @@
 #define FV_CANNY_K_SIZE     3
 #define FV_CANNY_THRESHOLD1 50
 #define FV_CANNY_THRESHOLD2 200
+#define FV_CANNY_MAX_THREADS    8
 
 static void 
 _fv_cv_sobel_mine(IplImage *cv_sobel, IplImage *gray, 
@@ -80,6 +82,62 @@ fv_cv_sobel(IplImage *cv_img, fv_bool image)
     return FV_OK;
 }
 
+/* 
+ * _fv_sobel() and _fv_scharr() of 8u into 16s against cvSobel(), for
+ * dx and dy of every aperture.
+ */
+fv_s32 
+fv_cv_sobel_8u16s(IplImage *cv_img, fv_bool image)
+{
+    IplImage        *gray;
+    IplImage        *sobel[2];
+    fv_mat_t        src;
+    fv_mat_t        dst;
+    double          max_diff;
+    fv_s32          ksize[] = {3, 5, CV_SCHARR};
+    fv_s32          ndiff;
+    fv_s32          dx;
+    fv_s32          i;
+
+    FV_ASSERT(image);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    sobel[0] = cvCreateImage(cvGetSize(cv_img), IPL_DEPTH_16S, 1);
+    sobel[1] = cvCreateImage(cvGetSize(cv_img), IPL_DEPTH_16S, 1);
+    FV_ASSERT(gray != NULL && sobel[0] != NULL && sobel[1] != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    src = fv_cv_ipl_to_mat(gray);
+    dst = fv_cv_ipl_to_mat(sobel[1]);
+    for (i = 0; i < sizeof(ksize)/sizeof(*ksize); i++) {
+        for (dx = 0; dx <= 1; dx++) {
+            fv_time_meter_set(0);
+            cvSobel(gray, sobel[0], dx, !dx, ksize[i]);
+            fv_time_meter_get(0, 0);
+
+            fv_time_meter_set(0);
+            if (ksize[i] == CV_SCHARR) {
+                _fv_scharr(&dst, &src, FV_16S, dx, !dx, 1, 0, 
+                        FV_BORDER_REPLICATE);
+            } else {
+                _fv_sobel(&dst, &src, FV_16S, dx, !dx, ksize[i], 1, 0, 
+                        FV_BORDER_REPLICATE);
+            }
+            fv_time_meter_get(0, 0);
+
+            ndiff = fv_cv_img_diff(sobel[0], sobel[1], 0, 0, &max_diff);
+            printf("ksize %d dx %d dy %d: %d differ, max %f\n", ksize[i],
+                    dx, !dx, ndiff, max_diff);
+        }
+    }
+
+    cvReleaseImage(&sobel[1]);
+    cvReleaseImage(&sobel[0]);
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}
+
 fv_s32 
 fv_cv_laplace(IplImage *cv_img, fv_bool image)
 {
@@ -128,6 +186,51 @@ fv_cv_laplace(IplImage *cv_img, fv_bool image)
     return FV_OK;
 }
 
+/* 
+ * fv_laplacian() of 8u into 16s against cvLaplace(), for every
+ * aperture up to 7.
+ */
+fv_s32 
+fv_cv_laplacian(IplImage *cv_img, fv_bool image)
+{
+    IplImage        *gray;
+    IplImage        *lap[2];
+    fv_mat_t        src;
+    fv_mat_t        dst;
+    double          max_diff;
+    fv_s32          ndiff;
+    fv_s32          ksize;
+
+    FV_ASSERT(image);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    lap[0] = cvCreateImage(cvGetSize(cv_img), IPL_DEPTH_16S, 1);
+    lap[1] = cvCreateImage(cvGetSize(cv_img), IPL_DEPTH_16S, 1);
+    FV_ASSERT(gray != NULL && lap[0] != NULL && lap[1] != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    src = fv_cv_ipl_to_mat(gray);
+    dst = fv_cv_ipl_to_mat(lap[1]);
+    for (ksize = 1; ksize <= 7; ksize += 2) {
+        fv_time_meter_set(0);
+        cvLaplace(gray, lap[0], ksize);
+        fv_time_meter_get(0, 0);
+
+        fv_time_meter_set(0);
+        fv_laplacian(&dst, &src, FV_16S, ksize, 1, 0, FV_BORDER_REPLICATE);
+        fv_time_meter_get(0, 0);
+
+        ndiff = fv_cv_img_diff(lap[0], lap[1], 0, 0, &max_diff);
+        printf("ksize %d: %d differ, max %f\n", ksize, ndiff, max_diff);
+    }
+
+    cvReleaseImage(&lap[1]);
+    cvReleaseImage(&lap[0]);
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}
+
 fv_s32 
 fv_cv_canny(IplImage *cv_img, fv_bool image)
 {
@@ -186,3 +289,78 @@ fv_cv_canny(IplImage *cv_img, fv_bool image)
 
     return FV_OK;
 }
+
+/* 
+ * fv_canny() with 1 to FV_CANNY_MAX_THREADS threads: every result
+ * against cvCanny() and against the one thread result.
+ */
+fv_s32 
+fv_cv_canny_threads(IplImage *cv_img, fv_bool image)
+{
+    char            *win_name = "canny_threads";
+    IplImage        *gray;
+    IplImage        *canny;
+    IplImage        *one;
+    IplImage        *cy;
+    fv_image_t      *img;
+    fv_image_t      *edge;
+    double          max_diff;
+    fv_s32          num_threads;
+    fv_s32          ndiff[2];
+    fv_s32          n;
+    fv_s32          c;
+
+    FV_ASSERT(image);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    canny = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    one = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    cy = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    FV_ASSERT(gray != NULL && canny != NULL && one != NULL && cy != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    fv_time_meter_set(0);
+    cvCanny(gray, canny, FV_CANNY_THRESHOLD1, FV_CANNY_THRESHOLD2, 
+            FV_CANNY_K_SIZE);
+    fv_time_meter_get(0, 0);
+
+    img = fv_convert_image(gray);
+    FV_ASSERT(img != NULL);
+    edge = fv_create_image(fv_get_size(img), img->ig_depth, 
+            img->ig_channels);
+    FV_ASSERT(edge != NULL);
+
+    num_threads = fv_get_num_threads();
+    for (n = 1; n <= FV_CANNY_MAX_THREADS; n <<= 1) {
+        fv_set_num_threads(n);
+        fv_time_meter_set(0);
+        fv_canny(edge, img, FV_CANNY_THRESHOLD1, FV_CANNY_THRESHOLD2,
+                FV_CANNY_K_SIZE);
+        fv_time_meter_get(0, 0);
+        fv_cv_img_to_ipl(n == 1 ? one : cy, edge);
+
+        ndiff[0] = fv_cv_img_diff(canny, n == 1 ? one : cy, 0, 0, 
+                &max_diff);
+        ndiff[1] = n == 1 ? 0 : fv_cv_img_diff(one, cy, 0, 0, &max_diff);
+        printf("%d threads: %d differ from OpenCV, %d from one thread\n", 
+                n, ndiff[0], ndiff[1]);
+    }
+    fv_set_num_threads(num_threads);
+
+    cvNamedWindow(win_name, 0);
+    cvShowImage(win_name, canny);
+    c = cvWaitKey(0);
+    cvShowImage(win_name, cy);
+    c = cvWaitKey(0);
+    printf("c = %d\n", c);
+    cvDestroyWindow(win_name);
+
+    fv_release_image(&edge);
+    fv_release_image(&img);
+    cvReleaseImage(&cy);
+    cvReleaseImage(&one);
+    cvReleaseImage(&canny);
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}
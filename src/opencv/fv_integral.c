@@ -0,0 +1,67 @@
+
+#include "fv_types.h"
+#include "fv_opencv.h"
+#include "fv_core.h"
+#include "fv_debug.h"
+#include "fv_time.h"
+#include "fv_integral.h"
+
+/* cvIntegral() and fv_integral() of the gray image, all three tables */
+fv_s32 
+fv_cv_integral(IplImage *cv_img, fv_bool image)
+{
+    IplImage        *gray;
+    IplImage        *sum[2];
+    IplImage        *sqsum[2];
+    IplImage        *tilted[2];
+    fv_mat_t        src;
+    fv_mat_t        _sum;
+    fv_mat_t        _sqsum;
+    fv_mat_t        _tilted;
+    CvSize          size;
+    double          max_diff[3];
+    fv_s32          ndiff[3];
+    fv_s32          i;
+
+    FV_ASSERT(image);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    FV_ASSERT(gray != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    size = cvSize(gray->width + 1, gray->height + 1);
+    for (i = 0; i < 2; i++) {
+        sum[i] = cvCreateImage(size, IPL_DEPTH_32S, 1);
+        sqsum[i] = cvCreateImage(size, IPL_DEPTH_64F, 1);
+        tilted[i] = cvCreateImage(size, IPL_DEPTH_32S, 1);
+        FV_ASSERT(sum[i] != NULL && sqsum[i] != NULL && tilted[i] != NULL);
+    }
+
+    fv_time_meter_set(FV_TIME_METER1);
+    cvIntegral(gray, sum[0], sqsum[0], tilted[0]);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    src = fv_cv_ipl_to_mat(gray);
+    _sum = fv_cv_ipl_to_mat(sum[1]);
+    _sqsum = fv_cv_ipl_to_mat(sqsum[1]);
+    _tilted = fv_cv_ipl_to_mat(tilted[1]);
+    fv_time_meter_set(FV_TIME_METER1);
+    fv_integral(&_sum, &_sqsum, &_tilted, &src);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    ndiff[0] = fv_cv_img_diff(sum[0], sum[1], 0, 0, &max_diff[0]);
+    ndiff[1] = fv_cv_img_diff(sqsum[0], sqsum[1], 0, 0, &max_diff[1]);
+    ndiff[2] = fv_cv_img_diff(tilted[0], tilted[1], 0, 0, &max_diff[2]);
+    printf("integral: sum %d differ (max %f), sqsum %d (max %f), "
+            "tilted %d (max %f)\n", ndiff[0], max_diff[0], ndiff[1], 
+            max_diff[1], ndiff[2], max_diff[2]);
+
+    for (i = 0; i < 2; i++) {
+        cvReleaseImage(&tilted[i]);
+        cvReleaseImage(&sqsum[i]);
+        cvReleaseImage(&sum[i]);
+    }
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}
@@ -114,3 +114,74 @@ fv_cv_min_max_loc(IplImage *cv_img, fv_bool image)
 {
     return _fv_cv_min_max_loc(cv_img, image);
 }
+
+#define FV_POLAR_MAG_TOL        0.01
+#define FV_POLAR_ANGLE_TOL      0.5
+
+/* 
+ * Polar coordinates of the Sobel gradients. The angles of OpenCV are
+ * good to about 0.3 degrees, a few near 0 come out as 360.
+ */
+fv_s32 
+fv_cv_cart_to_polar(IplImage *cv_img, fv_bool image)
+{
+    IplImage        *gray;
+    IplImage        *dx;
+    IplImage        *dy;
+    IplImage        *mag[2];
+    IplImage        *angle[2];
+    fv_mat_t        x;
+    fv_mat_t        y;
+    fv_mat_t        _mag;
+    fv_mat_t        _angle;
+    CvSize          size;
+    double          max_diff[2];
+    fv_s32          ndiff[2];
+    fv_s32          i;
+
+    FV_ASSERT(image);
+
+    size = cvGetSize(cv_img);
+    gray = cvCreateImage(size, cv_img->depth, 1);
+    dx = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    dy = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    FV_ASSERT(gray != NULL && dx != NULL && dy != NULL);
+    for (i = 0; i < 2; i++) {
+        mag[i] = cvCreateImage(size, IPL_DEPTH_32F, 1);
+        angle[i] = cvCreateImage(size, IPL_DEPTH_32F, 1);
+        FV_ASSERT(mag[i] != NULL && angle[i] != NULL);
+    }
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+    cvSobel(gray, dx, 1, 0, 3);
+    cvSobel(gray, dy, 0, 1, 3);
+
+    fv_time_meter_set(FV_TIME_METER1);
+    cvCartToPolar(dx, dy, mag[0], angle[0], 1);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    x = fv_cv_ipl_to_mat(dx);
+    y = fv_cv_ipl_to_mat(dy);
+    _mag = fv_cv_ipl_to_mat(mag[1]);
+    _angle = fv_cv_ipl_to_mat(angle[1]);
+    fv_time_meter_set(FV_TIME_METER1);
+    fv_cart_to_polar(&_mag, &_angle, &x, &y, 1);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    ndiff[0] = fv_cv_img_diff(mag[0], mag[1], 0, FV_POLAR_MAG_TOL, 
+            &max_diff[0]);
+    ndiff[1] = fv_cv_img_diff(angle[0], angle[1], 0, FV_POLAR_ANGLE_TOL, 
+            &max_diff[1]);
+    printf("cart_to_polar: magnitude %d differ by more than %f (max %f), "
+            "angle %d by more than %f (max %f)\n", ndiff[0], FV_POLAR_MAG_TOL,
+            max_diff[0], ndiff[1], FV_POLAR_ANGLE_TOL, max_diff[1]);
+
+    for (i = 0; i < 2; i++) {
+        cvReleaseImage(&angle[i]);
+        cvReleaseImage(&mag[i]);
+    }
+    cvReleaseImage(&dy);
+    cvReleaseImage(&dx);
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}
@@ -127,3 +127,83 @@ fv_cv_erode(IplImage *cv_img, fv_bool image)
     return _fv_cv_morph(cv_img, image, 0);
 }
 
+
+#define FV_MORPH_EX_WIN_NAME    "morphology_ex"
+#define FV_MORPH_EX_ELEM_SIZE   5
+
+/* 
+ * The compound operations on the gray image; the element is symmetric,
+ * the rows fv_convert_image() turns over do not change the result.
+ */
+fv_s32 
+fv_cv_morphology_ex(IplImage *cv_img, fv_bool image)
+{
+    IplConvKernel       *elem;
+    fv_conv_kernel_t    *kernel;
+    IplImage            *gray;
+    IplImage            *dst;
+    IplImage            *_dst;
+    IplImage            *temp;
+    fv_image_t          *_src;
+    fv_image_t          *mx;
+    double              max_diff;
+    fv_s32              ndiff;
+    fv_s32              op;
+    fv_s32              c;
+
+    FV_ASSERT(image);
+
+    elem = cvCreateStructuringElementEx(FV_MORPH_EX_ELEM_SIZE,
+                FV_MORPH_EX_ELEM_SIZE, FV_MORPH_EX_ELEM_SIZE/2,
+                FV_MORPH_EX_ELEM_SIZE/2, CV_SHAPE_ELLIPSE, NULL);
+    kernel = fv_create_structuring_element_ex(FV_MORPH_EX_ELEM_SIZE,
+                FV_MORPH_EX_ELEM_SIZE, FV_MORPH_EX_ELEM_SIZE/2,
+                FV_MORPH_EX_ELEM_SIZE/2, CV_SHAPE_ELLIPSE, NULL);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    dst = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    _dst = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    temp = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    FV_ASSERT(gray != NULL && dst != NULL && _dst != NULL && temp != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    _src = fv_convert_image(gray);
+    FV_ASSERT(_src != NULL);
+    mx = fv_create_image(fv_get_size(_src), _src->ig_depth, 
+            _src->ig_channels);
+    FV_ASSERT(mx != NULL);
+
+    cvNamedWindow(FV_MORPH_EX_WIN_NAME, 0);  
+    for (op = CV_MOP_OPEN; op <= CV_MOP_BLACKHAT; op++) {
+        fv_time_meter_set(FV_TIME_METER1);
+        cvMorphologyEx(gray, dst, temp, elem, op, FV_MORPH_ITERATIONS);
+        fv_time_meter_get(FV_TIME_METER1, 0);
+
+        fv_time_meter_set(FV_TIME_METER1);
+        fv_morphology_ex(mx, _src, kernel, op, FV_MORPH_ITERATIONS);
+        fv_time_meter_get(FV_TIME_METER1, 0);
+        fv_cv_img_to_ipl(_dst, mx);
+
+        ndiff = fv_cv_img_diff(dst, _dst, 0, 0, &max_diff);
+        printf("op %d: %d differ, max %f\n", op, ndiff, max_diff);
+
+        cvShowImage(FV_MORPH_EX_WIN_NAME, dst);  
+        c = cvWaitKey(0);  
+        cvShowImage(FV_MORPH_EX_WIN_NAME, _dst);  
+        c = cvWaitKey(0);  
+    }
+    printf("c = %d\n", c);
+    cvDestroyWindow(FV_MORPH_EX_WIN_NAME); 
+
+    fv_release_image(&mx);
+    fv_release_image(&_src);
+    cvReleaseImage(&temp);
+    cvReleaseImage(&_dst);
+    cvReleaseImage(&dst);
+    cvReleaseImage(&gray);
+
+    fv_release_structuring_element(&kernel);
+    cvReleaseStructuringElement(&elem);
+
+    return FV_OK;
+}
@@ -1,9 +1,11 @@
 #include <stdio.h>
+#include <math.h>
 
 #include "fv_types.h"
 #include "fv_opencv.h"
 #include "fv_log.h"
 #include "fv_debug.h"
+#include "fv_math.h"
 
 #define FV_KEY_ESC              27
 #define FV_KEY_ENTER            13
@@ -179,3 +181,95 @@ fv_cv_img_to_ipl(IplImage *cv_img, fv_image_t *img)
     }
 }
 
+static double
+fv_cv_img_get(IplImage *cv_img, fv_s32 y, fv_s32 x)
+{
+    char        *row = cv_img->imageData + y*cv_img->widthStep;
+
+    switch (cv_img->depth) {
+        case IPL_DEPTH_8U:
+            return ((fv_u8 *)row)[x];
+        case IPL_DEPTH_16U:
+            return ((fv_u16 *)row)[x];
+        case IPL_DEPTH_16S:
+            return ((fv_s16 *)row)[x];
+        case IPL_DEPTH_32S:
+            return ((fv_s32 *)row)[x];
+        case IPL_DEPTH_32F:
+            return ((float *)row)[x];
+        default:
+            return ((double *)row)[x];
+    }
+}
+
+/*
+ * Number of the elements of a and b more than tol apart, leaving out
+ * margin pixels at each side; max_diff gets the largest difference.
+ */
+fv_s32
+fv_cv_img_diff(IplImage *a, IplImage *b, fv_s32 margin, double tol,
+        double *max_diff)
+{
+    double      diff;
+    fv_s32      cn = a->nChannels;
+    fv_s32      ndiff = 0;
+    fv_s32      x;
+    fv_s32      y;
+
+    FV_ASSERT(a->width == b->width && a->height == b->height &&
+            a->depth == b->depth && cn == b->nChannels);
+
+    *max_diff = 0;
+    for (y = margin; y < a->height - margin; y++) {
+        for (x = margin*cn; x < (a->width - margin)*cn; x++) {
+            diff = fabs(fv_cv_img_get(a, y, x) - fv_cv_img_get(b, y, x));
+            *max_diff = fv_max(*max_diff, diff);
+            ndiff += diff > tol;
+        }
+    }
+
+    return ndiff;
+}
+
+/* A header on the pixels of cv_img, the rows in the same order */
+fv_mat_t
+fv_cv_ipl_to_mat(IplImage *cv_img)
+{
+    fv_mat_t    mat;
+    fv_u32      depth;
+    fv_u32      type;
+
+    switch (cv_img->depth) {
+        case IPL_DEPTH_8U:
+            depth = FV_8U;
+            type = FV_DEPTH_8U;
+            break;
+        case IPL_DEPTH_16U:
+            depth = FV_16U;
+            type = FV_DEPTH_16U;
+            break;
+        case IPL_DEPTH_16S:
+            depth = FV_16S;
+            type = FV_DEPTH_16S;
+            break;
+        case IPL_DEPTH_32S:
+            depth = FV_32S;
+            type = FV_DEPTH_32S;
+            break;
+        case IPL_DEPTH_32F:
+            depth = FV_32F;
+            type = FV_DEPTH_32F;
+            break;
+        default:
+            depth = FV_64F;
+            type = FV_DEPTH_64F;
+            break;
+    }
+
+    mat = fv_mat(cv_img->height, cv_img->width, 
+            FV_MAKETYPE(type, cv_img->nChannels), cv_img->imageData);
+    mat.mt_step = cv_img->widthStep;
+    mat.mt_depth = depth;
+
+    return mat;
+}
@@ -79,3 +79,209 @@ fv_cv_smooth(IplImage *cv_img, fv_bool image)
     return FV_OK;
 
 }
+
+/*
+ * cvSmooth() and fv_smooth() with the same parameters on cv_img: the
+ * number of elements more than tol apart is printed, then both
+ * results are shown.
+ */
+static fv_s32 
+_fv_cv_smooth_cmp(IplImage *cv_img, char *name, fv_u32 type, 
+        fv_s32 param1, fv_s32 param2, double param3, double param4, 
+        double tol)
+{
+    IplImage        *dst;
+    IplImage        *_dst;
+    fv_image_t      *img;
+    fv_image_t      *sm;
+    CvSize          size;
+    double          max_diff;
+    fv_s32          ndiff;
+    fv_s32          c;
+
+    size = cvGetSize(cv_img);
+    dst = cvCreateImage(size, cv_img->depth, cv_img->nChannels);
+    _dst = cvCreateImage(size, cv_img->depth, cv_img->nChannels);
+    FV_ASSERT(dst != NULL && _dst != NULL);
+
+    fv_time_meter_set(FV_TIME_METER1);
+    cvSmooth(cv_img, dst, type, param1, param2, param3, param4);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    img = fv_convert_image(cv_img);
+    FV_ASSERT(img != NULL);
+    sm = fv_create_image(fv_get_size(img), img->ig_depth, img->ig_channels);
+    FV_ASSERT(sm != NULL);
+
+    fv_time_meter_set(FV_TIME_METER1);
+    fv_smooth(sm, img, type, param1, param2, param3, param4);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+    fv_cv_img_to_ipl(_dst, sm);
+
+    ndiff = fv_cv_img_diff(dst, _dst, 0, tol, &max_diff);
+    printf("%s %d %d %f %f: %d differ by more than %f, max %f\n", name,
+            param1, param2, param3, param4, ndiff, tol, max_diff);
+
+    cvNamedWindow(name, 0);  
+    cvShowImage(name, dst);  
+    c = cvWaitKey(0);  
+    cvShowImage(name, _dst);  
+    c = cvWaitKey(0);  
+    printf("c = %d\n", c);
+    cvDestroyWindow(name); 
+
+    fv_release_image(&sm);
+    fv_release_image(&img);
+    cvReleaseImage(&_dst);
+    cvReleaseImage(&dst);
+
+    return FV_OK;
+}
+
+/* The 8u kernels are fixed point; sigma 4 sized from sigma is the IIR */
+fv_s32 
+fv_cv_gaussian(IplImage *cv_img, fv_bool image)
+{
+    FV_ASSERT(image);
+
+    _fv_cv_smooth_cmp(cv_img, "gaussian", CV_GAUSSIAN, 5, 5, 0, 0, 1);
+    _fv_cv_smooth_cmp(cv_img, "gaussian", CV_GAUSSIAN, 0, 0, 1.5, 0, 1);
+
+    return _fv_cv_smooth_cmp(cv_img, "gaussian", CV_GAUSSIAN, 0, 0, 4, 4, 
+            0.01*255 + 1);
+}
+
+fv_s32 
+fv_cv_median(IplImage *cv_img, fv_bool image)
+{
+    FV_ASSERT(image);
+
+    _fv_cv_smooth_cmp(cv_img, "median", CV_MEDIAN, 3, 0, 0, 0, 0);
+    _fv_cv_smooth_cmp(cv_img, "median", CV_MEDIAN, 5, 0, 0, 0, 0);
+
+    return _fv_cv_smooth_cmp(cv_img, "median", CV_MEDIAN, 9, 0, 0, 0, 0);
+}
+
+/* OpenCV filters directly for d 0 too, fv takes the grid */
+fv_s32 
+fv_cv_bilateral(IplImage *cv_img, fv_bool image)
+{
+    FV_ASSERT(image);
+
+    _fv_cv_smooth_cmp(cv_img, "bilateral", CV_BILATERAL, 5, 0, 30, 3, 1);
+
+    return _fv_cv_smooth_cmp(cv_img, "bilateral", CV_BILATERAL, 0, 0, 30, 
+            8, 3);
+}
+
+#define FV_GUIDED_NAME      "guided"
+#define FV_GUIDED_RADIUS    4
+#define FV_GUIDED_EPS       100
+
+/* He et al. on box means: cvSmooth(CV_BLUR) of 32f images */
+static void
+fv_cv_guided_filter(IplImage *dst, IplImage *src, fv_s32 r, double eps)
+{
+    IplImage        *p;
+    IplImage        *mean_p;
+    IplImage        *mean_pp;
+    IplImage        *a;
+    IplImage        *b;
+    CvSize          size;
+    fv_s32          ksize = 2*r + 1;
+
+    size = cvGetSize(src);
+    p = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    mean_p = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    mean_pp = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    a = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    b = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    FV_ASSERT(p != NULL && mean_p != NULL && mean_pp != NULL && 
+            a != NULL && b != NULL);
+
+    cvConvert(src, p);
+    cvSmooth(p, mean_p, CV_BLUR, ksize, ksize, 0, 0);
+    cvMul(p, p, a, 1);
+    cvSmooth(a, mean_pp, CV_BLUR, ksize, ksize, 0, 0);
+    /* a = var/(var + eps), b = (1 - a) mean */
+    cvMul(mean_p, mean_p, a, 1);
+    cvSub(mean_pp, a, mean_pp, NULL);
+    cvAddS(mean_pp, cvScalar(eps, 0, 0, 0), b, NULL);
+    cvDiv(mean_pp, b, a, 1);
+    cvMul(a, mean_p, b, 1);
+    cvSub(mean_p, b, b, NULL);
+    cvSmooth(a, mean_p, CV_BLUR, ksize, ksize, 0, 0);
+    cvSmooth(b, mean_pp, CV_BLUR, ksize, ksize, 0, 0);
+    cvMul(mean_p, p, a, 1);
+    cvAdd(a, mean_pp, a, NULL);
+    cvConvert(a, dst);
+
+    cvReleaseImage(&b);
+    cvReleaseImage(&a);
+    cvReleaseImage(&mean_pp);
+    cvReleaseImage(&mean_p);
+    cvReleaseImage(&p);
+}
+
+/* 
+ * OpenCV replicates the border, fv cuts the windows at the edges: the
+ * pixels farther than twice the radius from the edges are compared.
+ */
+fv_s32 
+fv_cv_guided(IplImage *cv_img, fv_bool image)
+{
+    IplImage        *gray;
+    IplImage        *dst;
+    IplImage        *_dst;
+    fv_image_t      *img;
+    fv_image_t      *gf;
+    fv_mat_t        src;
+    fv_mat_t        mat;
+    double          max_diff;
+    fv_s32          ndiff;
+    fv_s32          c;
+
+    FV_ASSERT(image);
+
+    gray = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    dst = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    _dst = cvCreateImage(cvGetSize(cv_img), cv_img->depth, 1);
+    FV_ASSERT(gray != NULL && dst != NULL && _dst != NULL);
+    cvCvtColor(cv_img, gray, CV_BGR2GRAY);
+
+    fv_time_meter_set(FV_TIME_METER1);
+    fv_cv_guided_filter(dst, gray, FV_GUIDED_RADIUS, FV_GUIDED_EPS);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+
+    img = fv_convert_image(gray);
+    FV_ASSERT(img != NULL);
+    gf = fv_create_image(fv_get_size(img), img->ig_depth, img->ig_channels);
+    FV_ASSERT(gf != NULL);
+    src = fv_image_roi_to_mat(img);
+    mat = fv_image_roi_to_mat(gf);
+
+    fv_time_meter_set(FV_TIME_METER1);
+    fv_guided_filter(&mat, &src, NULL, FV_GUIDED_RADIUS, FV_GUIDED_EPS);
+    fv_time_meter_get(FV_TIME_METER1, 0);
+    fv_cv_img_to_ipl(_dst, gf);
+
+    ndiff = fv_cv_img_diff(dst, _dst, 2*FV_GUIDED_RADIUS, 1, &max_diff);
+    printf("%s: %d differ by more than 1, max %f\n", FV_GUIDED_NAME, 
+            ndiff, max_diff);
+
+    cvNamedWindow(FV_GUIDED_NAME, 0);  
+    cvShowImage(FV_GUIDED_NAME, dst);  
+    c = cvWaitKey(0);  
+    cvShowImage(FV_GUIDED_NAME, _dst);  
+    c = cvWaitKey(0);  
+    printf("c = %d\n", c);
+    cvDestroyWindow(FV_GUIDED_NAME); 
+
+    fv_release_image(&gf);
+    fv_release_image(&img);
+    cvReleaseImage(&_dst);
+    cvReleaseImage(&dst);
+    cvReleaseImage(&gray);
+
+    return FV_OK;
+}